@@ -89,9 +89,27 @@
 #ifndef OT_PARAM_VLFPS
 #   define OT_PARAM_VLFPS               3                                   // Number of files that can be open simultaneously
 #endif
+#ifndef OT_PARAM_VLFDCHUNK
+#   define OT_PARAM_VLFDCHUNK           32                                  // Descriptors added at a time to the open-file table of an FS (VLFDTABLE)
+#endif
+#ifndef OT_PARAM_VLFDMAX
+#   define OT_PARAM_VLFDMAX             1024                                // Most files that can be open simultaneously on an FS (VLFDTABLE)
+#endif
 #ifndef OT_PARAM_VLACTIONS
 #   define OT_PARAM_VLACTIONS           16                                  // Number of file action applets that can be kept simultaneously
 #endif
+#ifndef OT_PARAM_VLCOWBLOCK
+#   define OT_PARAM_VLCOWBLOCK          256                                 // Copy-on-write block size of FS images (power of 2)
+#endif
+#ifndef OT_PARAM_VLTEMPLATES
+#   define OT_PARAM_VLTEMPLATES         8                                   // Number of FS image templates a MultiFS group can register
+#endif
+#ifndef OT_PARAM_VLHOTSET
+#   define OT_PARAM_VLHOTSET            0                                   // Max FS images kept hot in a MultiFS group with VLCOLD (0: no limit)
+#endif
+#ifndef OT_PARAM_VLPAGECACHE
+#   define OT_PARAM_VLPAGECACHE         4096                                // Blocks (of VLCOWBLOCK bytes) in the page cache of paged FS images
+#endif
 #ifndef OT_PARAM_BUFFER_SIZE
 #   define OT_PARAM_BUFFER_SIZE         (1024)                              // TX and RX application buffers
 #endif
@@ -118,6 +136,33 @@
 #ifndef OT_FEATURE_MULTIFS
 #   define OT_FEATURE_MULTIFS           DISABLED
 #endif
+#ifndef OT_FEATURE_VLTHREADS
+#   define OT_FEATURE_VLTHREADS         DISABLED                            // Per-thread active FS context (MultiFS only)
+#endif
+#ifndef OT_FEATURE_VLJUDY
+#   define OT_FEATURE_VLJUDY            ENABLED                             // Key-ordered MultiFS group table via Judy (else hash table only)
+#endif
+#ifndef OT_FEATURE_VLFILTER
+#   define OT_FEATURE_VLFILTER          DISABLED                            // Bloom filter for fast MultiFS lookup misses
+#endif
+#ifndef OT_FEATURE_VLSLAB
+#   define OT_FEATURE_VLSLAB            DISABLED                            // MultiFS group allocates FS images from a slab arena
+#endif
+#ifndef OT_FEATURE_VLHUGEPAGES
+#   define OT_FEATURE_VLHUGEPAGES       DISABLED                            // Slab arena uses 2MB huge pages, if available
+#endif
+#ifndef OT_FEATURE_VLCOW
+#   define OT_FEATURE_VLCOW             DISABLED                            // Copy-on-write FS images sharing the default data (MultiFS only)
+#endif
+#ifndef OT_FEATURE_VLCOLD
+#   define OT_FEATURE_VLCOLD            DISABLED                            // Idle FS images stored as a delta of their template (MultiFS only)
+#endif
+#ifndef OT_FEATURE_VLMMAP
+#   define OT_FEATURE_VLMMAP            DISABLED                            // FS images can be shared mappings of files (MultiFS only)
+#endif
+#ifndef OT_FEATURE_VLPAGED
+#   define OT_FEATURE_VLPAGED           DISABLED                            // FS images paged in from a file through a block cache (needs VLCOW)
+#endif
 #ifndef OT_FEATURE_VEELITE
 #   define OT_FEATURE_VEELITE           ENABLED                             // Veelite DASH7 File System
 #endif
@@ -127,6 +172,18 @@
 #ifndef OT_FEATURE_VLNEW
 #   define OT_FEATURE_VLNEW             DISABLED                             // File create/delete in Veelite
 #endif
+#ifndef OT_FEATURE_VLIDINDEX
+#   define OT_FEATURE_VLIDINDEX         DISABLED                            // Per-FS index of file IDs to header slots, for O(1) file lookup
+#endif
+#ifndef OT_FEATURE_VLFREEINDEX
+#   define OT_FEATURE_VLFREEINDEX       DISABLED                            // Per-FS index of free heap extents, for best-fit placement of new files
+#endif
+#ifndef OT_FEATURE_VLFDTABLE
+#   define OT_FEATURE_VLFDTABLE         DISABLED                            // Open-file table that grows past OT_PARAM_VLFPS, with a free list of descriptors
+#endif
+#ifndef OT_FEATURE_VLBULK
+#   define OT_FEATURE_VLBULK            DISABLED                            // Bulk copy of file data that is contiguous in memory, in vl_load/store/append
+#endif
 #ifndef OT_FEATURE_VLRESTORE
 #   define OT_FEATURE_VLRESTORE         ENABLED                             // File restore in Veelite
 #endif
@@ -99,6 +99,29 @@ void auth_deinit(void);
 
 
 
+/** @brief Returns the size of a key table, for use with auth_settable()
+  * @param None
+  * @retval ot_uint     Size in bytes of the key table
+  * @ingroup Authentication
+  */
+ot_uint auth_get_tablesize(void);
+
+
+
+/** @brief Selects the active key table
+  * @param table    (void*) key table, or NULL for the default table
+  * @retval None
+  * @ingroup Authentication
+  *
+  * The table must be auth_get_tablesize() bytes, and a new one must be zeroed
+  * before it is selected.  After selection, auth_init() will load the local
+  * keys into it.  Key tables are swapped along with the FS in MultiFS builds,
+  * so each FS keeps its expanded keys.
+  */
+void auth_settable(void* table);
+
+
+
 /** @brief Writes a 32 bit nonce to destination in memory, and advances nonce.
   * @param dst          (void*) destination in memory to write nonce
   * @param total_size   (ot_uint) total bytes to put to destination
@@ -75,6 +75,8 @@
 #   define OT_INLINE_H  inline
 #   define OT_WEAK      __attribute__((weak)) 
 #   define OT_PACKED    __attribute__((packed))
+#   define OT_THREADLOCAL   __thread
+#   define OT_PREFETCH(ADDR) __builtin_prefetch(ADDR)
 
 #elif (CC_SUPPORT == TI_C)
 #   ifdef __EABI__
@@ -82,11 +84,15 @@
 #       define OT_INLINE_H  inline
 #       define OT_WEAK
 #       define OT_PACKED
+#       define OT_THREADLOCAL
+#       define OT_PREFETCH(ADDR)
 #   else //COFFABI
 #       define OT_INLINE
 #       define OT_INLINE_H  __inline
 #       define OT_WEAK
 #       define OT_PACKED
+#       define OT_THREADLOCAL
+#       define OT_PREFETCH(ADDR)
 #   endif
 
 #elif (CC_SUPPORT == IAR_V5)
@@ -94,6 +100,8 @@
 #   define OT_INLINE_H  __inline
 #   define OT_WEAK
 #   define OT_PACKED
+#   define OT_THREADLOCAL
+#   define OT_PREFETCH(ADDR)
 
 #endif
 
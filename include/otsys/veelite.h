@@ -69,6 +69,9 @@ typedef struct {
     ot_u16      flags;
     vlread_fn   read;
     vlwrite_fn  write;
+#   if (OT_FEATURE(VLFDTABLE) == ENABLED)
+    ot_int      fd;
+#   endif
 } vlFILE;
 
 
@@ -149,6 +152,10 @@ typedef struct {
 #define VL_FLAG_MODDED      (1<<1)
 #define VL_FLAG_RESIZED     (1<<2)
 
+/// Set on a file that has given out a pointer via vl_span().  It is outside
+/// the low byte, so it is never taken as a file action flag.
+#define VL_FLAG_SPAN        (1<<8)
+
 
 
 #if (OT_FEATURE(VEELITE) == ENABLED)
@@ -157,15 +164,54 @@ typedef struct {
 // veelite functions
 
 /** @brief initializes the veelite subsystem.  Run after SRAM resets.
-  * @param handle       (void*) initialization handle.
+  * @param handle       (void*) runtime context to initialize, or NULL
   * @retval ot_u8       Returns zero on success, else an error code.
   * @ingroup Veelite
   *
-  * The input parameter "handle" is RFU.  NULL may be used.
+  * If handle is NULL, the active runtime context is initialized.  Otherwise,
+  * handle must point to vl_get_ctxsize() bytes of memory, which is selected
+  * as the active context (see vl_setctx()) and then initialized.
   */
 ot_u8 vl_init(void* handle);
 
 
+/** @brief Returns the size of a veelite runtime context
+  * @param None
+  * @retval ot_uint     Size in bytes of the context
+  * @ingroup Veelite
+  *
+  * The runtime context contains the open-file table, the registered file
+  * actions, and other state of veelite that is not stored in the FS image.
+  */
+ot_uint vl_get_ctxsize(void);
+
+
+/** @brief Selects the active veelite runtime context
+  * @param handle       (void*) runtime context, or NULL for the default one
+  * @retval None
+  * @ingroup Veelite
+  *
+  * The context is not modified, so files opened and actions added while it
+  * was last active are still in place.  Use vl_init() on new contexts.
+  */
+void vl_setctx(void* handle);
+
+
+/** @brief Frees the memory that a veelite runtime context has allocated
+  * @param handle       (void*) runtime context, or NULL for the active one
+  * @retval None
+  * @ingroup Veelite
+  *
+  * With OT_FEATURE_VLIDINDEX, a context allocates its file ID index when a
+  * file is first looked-up.  Call this before a context is freed.  The
+  * context can still be used afterwards, and the index is rebuilt.
+  *
+  * With OT_FEATURE_VLFDTABLE, the descriptors past OT_PARAM_VLFPS are freed
+  * too, so no file that has one may be open.
+  */
+void vl_freectx(void* handle);
+
+
 
 /** @brief Adds a File Action to a specified File
   * @param  block_id    (vlBLOCK) Block ID of file (GFB, ISFB, etc)
@@ -193,15 +239,110 @@ void vl_remove_action(vlBLOCK block_id, ot_u8 data_id);
 
 
 // Multi-FS functions
+
+/** @typedef vlFSREF
+  * Opaque reference to an FS entry in a MultiFS group.  It is valid from the
+  * time it is returned by vl_multifs_open() until the FS is deleted or the
+  * group is deinitialized.
+  */
+typedef struct vlfs_entry* vlFSREF;
+
+
+/** @typedef vlFSCURSOR
+  * Cursor for scanning a MultiFS group with vl_multifs_scan().  Set it up
+  * with vl_multifs_cursor().  Its members are private.
+  */
+typedef struct {
+    void*   handle;
+    ot_u8   key[8];
+    ot_u8   end[8];
+    size_t  pos;
+    ot_u32  gen;
+    ot_u16  part;
+    ot_u16  parts;
+    ot_u8   state;
+} vlFSCURSOR;
+
+
+/** @typedef vlFSSTATS
+  * Statistics of a MultiFS group, from vl_multifs_stats().  Sizes are in
+  * bytes.  The filter members are zero if the build has no lookup filter.
+  */
+typedef struct {
+    size_t  fs;             // Number of FS in the group
+    size_t  index_bytes;    // Read index (hash table)
+    size_t  entry_bytes;    // FS entries, and the runtime states that are allocated
+    size_t  filter_bytes;   // Lookup filter
+    float   filter_fpr;     // Lookup filter false-positive rate, 0 to 1
+    size_t  slab_bytes;     // Slab arena for FS images
+    size_t  slab_fs;        // Number of FS images allocated from the slab
+    size_t  cow_fs;         // Number of copy-on-write FS images
+    size_t  cow_bytes;      // Private memory of the copy-on-write FS images
+    size_t  cold_fs;        // Number of cold FS images
+    size_t  cold_bytes;     // Memory of the cold FS images
+    size_t  image_bytes;    // Size of all FS images, as full images
+    uint64_t switches;      // FS selected by vl_multifs_select() and others, in the group
+} vlFSSTATS;
+
+
+/** @typedef vlFSMAPENT
+  * Record of an FS image in a region given to vl_multifs_map().  offset is
+  * from the start of the region, and alloc is the size of the image.  flags
+  * is reserved, and must be zero.
+  */
+typedef struct {
+    uint64_t    uid;
+    uint64_t    offset;
+    ot_u32      alloc;
+    ot_u32      flags;
+} vlFSMAPENT;
+
 #if (OT_FEATURE(MULTIFS))
 // Functions primarily for use with Multi-FS features.
 ot_u8 vl_multifs_init(void** handle);
 
-ot_u8 vl_multifs_deinit(void* handle);
+/** @brief Deinitializes a MultiFS group
+  * @param handle       (void*) MultiFS group handle, or NULL for the default
+  * @param free_fn      (void (*)(void*)) Function to free the FS images, or NULL
+  * @retval ot_u8       Returns zero on success, else an error code.
+  * @ingroup Veelite
+  *
+  * Images allocated from the slab of the group are released with the slab.
+  * The others are freed with free_fn, unless it is NULL.
+  */
+ot_u8 vl_multifs_deinit(void* handle, void (*free_fn)(void*));
 
 ot_u8 vl_multifs_add(void* handle, void* newfsbase, const id_tmpl* fsid);
 
-ot_u8 vl_multifs_del(void* handle, const id_tmpl* fsid);
+/** @brief Adds a copy-on-write FS image to the MultiFS group
+  * @param handle       (void*) MultiFS group handle, or NULL for the default
+  * @param cow          (void*) COW image from vworm_cow_new() or vworm_lazy_new()
+  * @param fsid         (const id_tmpl*) UID of the FS
+  * @retval ot_u8       Returns zero on success, else an error code.
+  * @ingroup Veelite
+  *
+  * Same as vl_multifs_add(), except that the FS is selected with
+  * vworm_cow_init().  The image is freed with vworm_cow_free() by
+  * vl_multifs_del() and vl_multifs_deinit(), if they are given a free_fn.
+  * Requires OT_FEATURE_VLCOW.
+  */
+ot_u8 vl_multifs_addcow(void* handle, void* cow, const id_tmpl* fsid);
+
+/** @brief Deletes an FS from the MultiFS group
+  * @param handle       (void*) MultiFS group handle, or NULL for the default
+  * @param fsid         (const id_tmpl*) Filesystem ID to delete
+  * @param free_fn      (void (*)(void*)) Function to free the FS image, or NULL
+  * @retval ot_u8       Returns zero on success, 0x11 if FS is not in group.
+  * @ingroup Veelite
+  *
+  * With VLTHREADS, free_fn is called once no other thread can still be using
+  * the image, which may be during a later call that changes the group.  If
+  * there is no memory to keep the FS until then, 0x15 is returned and the FS
+  * stays in the group.  If
+  * the image is from the slab of the group, it is returned to the slab rather
+  * than given to free_fn.
+  */
+ot_u8 vl_multifs_del(void* handle, const id_tmpl* fsid, void (*free_fn)(void*));
 
 ot_u8 vl_multifs_activeid(void* obj, id_tmpl* fsid);
 
@@ -225,9 +366,234 @@ ot_u8 vl_multifs_activeid(void* obj, id_tmpl* fsid);
 ot_u8 vl_multifs_switch(void* handle, void** getfsbase, const id_tmpl* fsid);
 
 
+/** @brief Looks-up an FS in the MultiFS group and returns a reference to it.
+  * @param handle       (void*) MultiFS group handle, or NULL for the default
+  * @param ref          (vlFSREF*) Output reference to the FS entry
+  * @param fsid         (const id_tmpl*) Filesystem ID to look-up
+  * @retval ot_u8       Returns zero on success, 0x11 if FS is not in group.
+  * @ingroup Veelite
+  *
+  * The reference can be passed to vl_multifs_select() any number of times.
+  * Doing so avoids the table lookup that vl_multifs_switch() must do.
+  */
+ot_u8 vl_multifs_open(void* handle, vlFSREF* ref, const id_tmpl* fsid);
+
+/** @brief Looks-up many FS in the MultiFS group at once
+  * @param handle       (void*) MultiFS group handle, or NULL for the default
+  * @param uids         (const uint64_t*) Array of n UIDs to look-up
+  * @param n            (size_t) Number of UIDs
+  * @param refs         (vlFSREF*) Output array of n references, NULL if not found
+  * @param bases        (void**) Output array of n image bases, or NULL
+  * @retval ot_u8       Returns zero on success, else an error code.
+  * @ingroup Veelite
+  *
+  * The result is the same as vl_multifs_open() on each UID, but the lookups
+  * are overlapped with prefetching, so a large batch is much faster.  The
+  * active FS is not changed.
+  */
+ot_u8 vl_multifs_open_batch(void* handle, const uint64_t* uids, size_t n, vlFSREF* refs, void** bases);
+
+/** @brief Switches to the FS given by a reference from vl_multifs_open()
+  * @param ref          (vlFSREF) FS reference
+  * @param getfsbase    (void**) Output base of the FS image.  May be NULL.
+  * @param fsid         (id_tmpl*) Output ID of the FS.  May be NULL.
+  * @retval ot_u8       Returns zero on success, else an error code.
+  * @ingroup Veelite
+  */
+ot_u8 vl_multifs_select(vlFSREF ref, void** getfsbase, id_tmpl* fsid);
+
+
+/** @brief Releases the FS that is checked-out by the calling thread
+  * @param handle       (void*) MultiFS group handle, or NULL for the default
+  * @retval ot_u8       Returns zero on success, else an error code.
+  * @ingroup Veelite
+  *
+  * Afterwards, Veelite uses the default runtime context until an FS is
+  * checked-out again.  With VLTHREADS, a thread that keeps an FS checked-out
+  * holds back the freeing of deleted FS images, so threads that go idle for a
+  * long time should release.
+  */
+ot_u8 vl_multifs_release(void* handle);
+
+
 ot_u8 vl_multifs_start(void* handle, void** getfsbase, id_tmpl* fsid);
 ot_u8 vl_multifs_next(void* handle, void** getfsbase, id_tmpl* fsid);
 
+/** @brief Starts iterating over a range of FS IDs, switching to the first
+  * @param handle       (void*) MultiFS group handle, or NULL for the default
+  * @param getfsbase    (void**) Output base of the FS image
+  * @param fsid         (id_tmpl*) Output ID of the FS
+  * @param lo           (const ot_u8*) First ID of the range, 8 bytes
+  * @param hi           (const ot_u8*) Last ID of the range, 8 bytes
+  * @retval ot_u8       Returns zero on success, 0x11 if the range is empty.
+  * @ingroup Veelite
+  *
+  * IDs are ordered as byte strings, so all the IDs with a given prefix are in
+  * one range.  vl_multifs_next() continues the iteration until the end of the
+  * range.  With OT_FEATURE_VLJUDY, the iteration seeks directly to the start
+  * of the range; without it, the whole group is walked.
+  */
+ot_u8 vl_multifs_range(void* handle, void** getfsbase, id_tmpl* fsid, const ot_u8* lo, const ot_u8* hi);
+
+
+/** @brief Sets-up a cursor for scanning a MultiFS group, or a part of it
+  * @param handle       (void*) MultiFS group handle, or NULL for the default
+  * @param cur          (vlFSCURSOR*) Cursor to set-up
+  * @param part         (ot_uint) Partition to scan, 0 to parts-1
+  * @param parts        (ot_uint) Number of partitions, 1 to 256
+  * @retval ot_u8       Returns zero on success, else an error code.
+  * @ingroup Veelite
+  *
+  * The partitions are disjoint and together they cover the whole group, so
+  * each may be scanned by a different thread.  Use parts=1 for a full scan.
+  * With OT_FEATURE_VLJUDY, the partitions split the range of UIDs in the
+  * group when the cursor is set-up, so set-up the cursors of all partitions
+  * before the group is changed.
+  */
+ot_u8 vl_multifs_cursor(void* handle, vlFSCURSOR* cur, ot_uint part, ot_uint parts);
+
+/** @brief Returns the next FS in a scan, without switching to it
+  * @param cur          (vlFSCURSOR*) Cursor from vl_multifs_cursor()
+  * @param getfsbase    (void**) Output base of the FS image.  May be NULL.
+  * @param fsid         (id_tmpl*) Output ID of the FS.  May be NULL.
+  * @retval ot_u8       Returns zero on success, 0x11 at end of the scan.
+  * @ingroup Veelite
+  *
+  * Unlike vl_multifs_start() and vl_multifs_next(), the active FS is not
+  * changed.  FSes added or deleted during a scan may or may not be returned.
+  */
+ot_u8 vl_multifs_scan(vlFSCURSOR* cur, void** getfsbase, id_tmpl* fsid);
+
+
+/** @brief Allocates memory for an FS image of a MultiFS group
+  * @param handle       (void*) MultiFS group handle, or NULL for the default
+  * @param size         (size_t) Size of the image
+  * @retval void*       The image, or NULL if out of memory
+  * @ingroup Veelite
+  *
+  * With OT_FEATURE_VLSLAB, images of the size of the first one are allocated
+  * from the slab of the group, and others via malloc().  Without it, all are
+  * allocated via malloc().  Either way, the image is freed correctly by
+  * vl_multifs_del() and vl_multifs_deinit() if they are given free().
+  */
+void* vl_multifs_alloc(void* handle, size_t size);
+
+/** @brief Frees an FS image from vl_multifs_alloc() that is not in the group
+  * @param handle       (void*) MultiFS group handle, or NULL for the default
+  * @param base         (void*) The image
+  * @retval None
+  * @ingroup Veelite
+  */
+void vl_multifs_free(void* handle, void* base);
+
+
+/** @brief Registers an FS image as a template of a MultiFS group
+  * @param handle       (void*) MultiFS group handle, or NULL for the default
+  * @param image        (const void*) The image, which starts with its FS header
+  * @param size         (size_t) Size of the image, which must match its header
+  * @param id           (ot_u8*) Result Variable for the template ID
+  * @retval ot_u8       Returns zero on success, else an error code.
+  * @ingroup Veelite
+  *
+  * The image is copied.  Template IDs are from 1 to OT_PARAM_VLTEMPLATES, and
+  * the error is 0x15 when there is no room for another template.  Templates
+  * are freed by vl_multifs_deinit().
+  */
+ot_u8 vl_multifs_template_add(void* handle, const void* image, size_t size, ot_u8* id);
+
+/** @brief Returns a template image of a MultiFS group
+  * @param handle       (void*) MultiFS group handle, or NULL for the default
+  * @param id           (ot_u8) Template ID, or 0 for the default image
+  * @retval const void* The image, or NULL if there is no such template
+  * @ingroup Veelite
+  *
+  * The size of the image is vworm_fsalloc() of its header.
+  */
+const void* vl_multifs_template(void* handle, ot_u8 id);
+
+
+/** @brief Copies the image of an FS in a MultiFS group
+  * @param handle       (void*) MultiFS group handle, or NULL for the default
+  * @param fsid         (const id_tmpl*) UID of the FS
+  * @param dst          (void*) Destination, or NULL
+  * @param max          (ot_u32) Size of dst
+  * @retval ot_u32      Size of the image, or 0 if the FS is not in the group
+  * @ingroup Veelite
+  *
+  * The image is copied only if it fits in dst.  COW and cold images are
+  * copied as full images, so the copy is always a plain FS image.  Writes to
+  * the FS from other threads are not blocked, so the FS should be idle.
+  */
+ot_u32 vl_multifs_image(void* handle, const id_tmpl* fsid, void* dst, ot_u32 max);
+
+/** @brief Adds many FS images to a MultiFS group at once
+  * @param handle       (void*) MultiFS group handle, or NULL for the default
+  * @param bases        (void**) Array of n images, from vl_multifs_alloc()
+  * @param uids         (const uint64_t*) Array of n UIDs
+  * @param n            (size_t) Number of images
+  * @retval ot_u8       Returns zero on success, else the first error code.
+  * @ingroup Veelite
+  *
+  * The group is locked once for the batch, and nothing is selected: the
+  * runtime state of each FS is initialized when it is first selected.  Each
+  * image that is added is set to NULL in bases, so the ones that are left
+  * (e.g. with a UID that is already in the group, 0x12) still belong to the
+  * caller.
+  */
+ot_u8 vl_multifs_add_batch(void* handle, void** bases, const uint64_t* uids, size_t n);
+
+/** @brief Adds the FS images of a memory region to a MultiFS group
+  * @param handle       (void*) MultiFS group handle, or NULL for the default
+  * @param region       (void*) Region that contains the images
+  * @param size         (size_t) Size of the region
+  * @param region_free  (void (*)(void*, size_t)) Function to free the region
+  * @param ents         (const vlFSMAPENT*) Records of the images in the region
+  * @param n            (size_t) Number of records
+  * @retval ot_u8       Returns zero on success, else an error code.
+  * @ingroup Veelite
+  *
+  * The images are used in place.  The records are only checked against the
+  * size of the region, so that adding is fast, and the runtime state of each
+  * FS is initialized when it is first selected.  Unless the records are bad
+  * (255), the region belongs to the group on return, and vl_multifs_deinit()
+  * frees it with region_free.  If a UID is already in the group, the others
+  * are still added, and the error is 0x12.
+  */
+ot_u8 vl_multifs_map(void* handle, void* region, size_t size,
+                     void (*region_free)(void*, size_t), const vlFSMAPENT* ents, size_t n);
+
+
+/** @brief Sets the number of FS images a MultiFS group keeps hot
+  * @param handle       (void*) MultiFS group handle, or NULL for the default
+  * @param hot_max      (size_t) Max number of hot images, or 0 for no limit
+  * @retval ot_u8       Returns zero on success, else an error code.
+  * @ingroup Veelite
+  *
+  * Requires OT_FEATURE_VLCOLD.  Past hot_max, the least recently selected
+  * full images (approximately) are made cold: each is stored as a delta from
+  * the closest template, and its image is freed.  A cold image is rebuilt
+  * into a new allocation when its FS is selected, so the image pointer of an
+  * FS is only stable while it is checked-out, and scans and batch lookups
+  * return NULL for cold images.  Images in the group must be allocated by
+  * vl_multifs_alloc().  COW images are never made cold.  The default is
+  * OT_PARAM_VLHOTSET.
+  */
+ot_u8 vl_multifs_hotset(void* handle, size_t hot_max);
+
+
+/** @brief Gets statistics of a MultiFS group
+  * @param handle       (void*) MultiFS group handle, or NULL for the default
+  * @param stats        (vlFSSTATS*) Output statistics
+  * @retval ot_u8       Returns zero on success, else an error code.
+  * @ingroup Veelite
+  *
+  * The members are counters that the group keeps as it changes, so the time
+  * taken doesn't depend on the number of FS, and no FS image is read.  The
+  * false-positive rate of the filter is estimated from the number of bits
+  * that are set in it.
+  */
+ot_u8 vl_multifs_stats(void* handle, vlFSSTATS* stats);
+
 #endif
 
 
@@ -259,6 +625,45 @@ const vlFSHEADER* vl_get_fsheader(const id_tmpl* fsid);
 ot_u32 vl_get_fsalloc(const vlFSHEADER* fshdr);
 
 
+/** @typedef vlBLOCKSTATS
+  * Usage of a block (GFB, ISS, ISF) of an FS, from vl_fsstats().  Sizes are
+  * in bytes.  The free bytes of the heap are alloc - used, and they are
+  * fragmented if largest_gap is smaller than that.
+  */
+typedef struct {
+    ot_u32  alloc;          // Heap of the block
+    ot_u32  used;           // Heap allocated to files
+    ot_u32  length;         // Data in the files
+    ot_u32  largest_gap;    // Largest free extent of the heap
+    ot_u16  headers;        // File headers of the block
+    ot_u16  files;          // Files in the block
+} vlBLOCKSTATS;
+
+
+/** @typedef vlIMAGESTATS
+  * Usage of an FS image, from vl_fsstats().  Sizes are in bytes.
+  */
+typedef struct {
+    ot_u32          image_bytes;    // Whole image, as vl_get_fsalloc()
+    ot_u32          table_bytes;    // FS header and file header table
+    vlBLOCKSTATS    gfb;
+    vlBLOCKSTATS    iss;
+    vlBLOCKSTATS    isf;
+} vlIMAGESTATS;
+
+
+/** @brief  Gets the usage of the heaps of the active FS
+  * @param  stats       (vlIMAGESTATS*) Output statistics
+  * @retval ot_u8       Returns zero on success, else an error code.
+  * @ingroup Veelite
+  *
+  * Only the file headers are read, so the time taken is proportional to the
+  * number of them, and the file data is not touched.  A header with no base
+  * is an empty slot.
+  */
+ot_u8 vl_fsstats(vlIMAGESTATS* stats);
+
+
 // General File functions
 
 /** @brief  Returns an active file pointer when supplied an active file descriptor
@@ -267,6 +672,8 @@ ot_u32 vl_get_fsalloc(const vlFSHEADER* fshdr);
   * @ingroup Veelite
   *
   * Behavior is undefined if vl_get_fp() is supplied with an inactive fd.
+  * With OT_FEATURE_VLFDTABLE, NULL is returned for an fd that is not open in
+  * the table of the active context.
   */
 vlFILE* vl_get_fp(ot_int fd);
 
@@ -277,6 +684,14 @@ vlFILE* vl_get_fp(ot_int fd);
   * @ingroup Veelite
   *
   * Behavior is undefined if vl_get_fd() is supplied with an inactive fp.
+  *
+  * With OT_FEATURE_VLFDTABLE, the open-file table of a context is not limited
+  * to OT_PARAM_VLFPS files.  When its free descriptors run out, it grows by
+  * OT_PARAM_VLFDCHUNK descriptors, up to OT_PARAM_VLFDMAX.  The file pointer
+  * of a descriptor never moves, and the descriptor is kept in the vlFILE, so
+  * vl_get_fd() and vl_get_fp() are O(1), as are opening and closing a file.
+  * -1 is returned for an fp that is not open in the table of the active
+  * context.
   */
 ot_int  vl_get_fd(vlFILE* fp);
 
@@ -333,6 +748,29 @@ ot_u8   vl_new(vlFILE** fp_new, vlBLOCK block_id, ot_u8 data_id, ot_u8 mod, ot_u
 ot_u8   vl_delete(vlBLOCK block_id, ot_u8 data_id, const id_tmpl* user_id);
 
 
+
+/** @brief Compacts the heap of a block, so its free space is in one piece
+  * @param  block_id    (vlBLOCK) Block ID of the heap (GFB or ISF)
+  * @param  max_bytes   (ot_uint) Most bytes of file data to move, or 0 for all
+  * @retval ot_u8       Return code: 0 if compact, 1 if more to move, 255 on error
+  * @ingroup Veelite
+  *
+  * Files are moved down to the base of the heap, in the order of their data,
+  * and their headers and any open vlFILE of them are updated.  Files are moved
+  * whole, so a call with a budget moves at least one file, and it may exceed
+  * max_bytes by up to the size of one file.  Call it with a small budget
+  * between other work until it returns 0, to spread out the cost.  vl_new()
+  * compacts the heap by itself when there is no gap big enough for the file.
+  * A file that is open with a pointer from vl_span() is not moved, so the
+  * free space may stay in more than one piece until it is closed.
+  *
+  * Only the heaps where user files can be created are compacted: all of them
+  * with MultiFS, and the user part of them otherwise.  Returns 255 if VLNEW is
+  * disabled or the block is not GFB or ISF.
+  */
+ot_u8   vl_defrag(vlBLOCK block_id, ot_uint max_bytes);
+
+
 /** @brief  Returns a file header as the vaddr of the header
   * @param  header      (vaddr*) Output header vaddr
   * @param  block_id    (vlBLOCK) Block ID of file header to get
@@ -592,6 +1030,32 @@ ot_u8 vl_execute(vlFILE* fp, ot_uint input_size, vl_u8* input_stream);
 vl_u8* vl_memptr( vlFILE* fp );
 
 
+/** @brief  Gives a read-only pointer to a range of file data, without a copy
+  * @param  fp          (vlFILE*) file pointer of open file
+  * @param  offset      (ot_uint) byte offset of the range in the file
+  * @param  length      (ot_uint) number of bytes in the range
+  * @param  ptr         (const void**) returns the pointer, or NULL
+  * @retval (ot_u8)     0 on success, 1 if the range is not in one piece of
+  *                     memory, 255 if the range is not in the file data
+  * @ingroup Veelite
+  *
+  * When vl_span() returns 1, the data can still be read with vl_load() or
+  * vl_read().  Mirrored files, paged images and ranges that cross a block of
+  * a COW image are never spanned.
+  *
+  * The pointer is valid while all of these hold:
+  * - The file stays open.  vl_defrag(), and vl_new() when it compacts the
+  *   heap, leave the data of the file where it is until vl_close().
+  * - The FS stays selected.  With otfs, the thread must not select another
+  *   FS or call otfs_release(): an FS deleted with otfs_del() is freed only
+  *   once no thread has it checked-out, and with OT_FEATURE_VLCOLD an FS
+  *   that is not selected may be compacted.
+  * - The range is not written.  A write may copy a COW block, after which
+  *   the pointer still reads the old data.
+  */
+ot_u8 vl_span( vlFILE* fp, ot_uint offset, ot_uint length, const void** ptr );
+
+
 
 
 
@@ -619,6 +1083,10 @@ ot_u8 vl_erase(vlFILE* fp);
   * @param none
   * @retval (ot_u8) : Non-zero on failure
   * @ingroup Veelite
+  *
+  * With OT_FEATURE_VLFDTABLE, a file must be closed while the FS it was opened
+  * on is selected.  Otherwise, or if it is already closed, vl_close() returns
+  * 255 and the file stays open.
   */
 ot_u8 vl_close( vlFILE* fp );
 
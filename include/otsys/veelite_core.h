@@ -55,6 +55,21 @@ typedef enum {
 #define VL_ISFS_BLOCKID VL_ISS_BLOCKID
 
 
+/** @note Thread-local Veelite context:
+  * When OT_FEATURE_VLTHREADS is enabled (MultiFS builds only), the active FS
+  * pointer and the pointers to its runtime state (Veelite context and auth
+  * key table) are stored per-thread.  Each thread
+  * then has its own checked-out FS, and it may do Veelite I/O on it while
+  * other threads do the same on different filesystems.  Two threads must not
+  * write to the same FS at the same time.
+  */
+#if (OT_FEATURE(MULTIFS) && OT_FEATURE(VLTHREADS))
+#   define VL_TLS   OT_THREADLOCAL
+#else
+#   define VL_TLS
+#endif
+
+
 /** @typedef vl_blockheader
   * Header for a Veelite block: meant for internal use only.
   * It goes into the overhead section of the Veelite FS, via vlFSHEADER.
@@ -218,6 +233,17 @@ void vworm_fsheader_defload(vlFSHEADER* fs);
 
 ot_uint vworm_fsdata_defload(void* fs_base, const vlFSHEADER* fs);
 
+/** @brief Returns the default FS image, which is built on the first call
+  * @param none
+  * @retval const void*  The image (vworm_fsalloc() bytes), or NULL on error
+  * @ingroup Veelite
+  *
+  * MultiFS only.  The image starts with the default FS header, and it is the
+  * same data that vworm_fsdata_defload() loads, so a new image can be made
+  * with a single copy of it.  It is never freed.
+  */
+const void* vworm_fsdefault(void);
+
 
 
 /** @brief Return the maximum size (allocation) of the filesystem heap.
@@ -243,6 +269,152 @@ ot_u8 vworm_init(void* fs_base, const vlFSHEADER* fs);
 
 
 
+/** @note Copy-on-write images:
+  * With OT_FEATURE_VLCOW (MultiFS builds only), an FS image may be created
+  * as a copy-on-write image of the default data.  It is a descriptor that
+  * starts with a copy of the FS header, followed by a table of blocks of
+  * OT_PARAM_VLCOWBLOCK bytes.  All blocks are shared with one read-only golden
+  * image until they are first written, when they are copied.  So, unlike a
+  * normal image, the memory of a COW image is not the image data, and it may
+  * only be accessed through the vworm functions (or copied out with
+  * vworm_cow_copy()).  The FS header is kept in the descriptor, so
+  * vworm_get() of it is direct.  vworm_get() of any other part copies the COW
+  * image into one private image, since a direct pointer may span blocks.
+  *
+  * A lazy image is a COW image of any full image (e.g. a template), with no
+  * block table.  Its reads come from the full image, and its first write
+  * copies all of it into one private image.  The full image must not change
+  * or be freed while the lazy image exists.
+  */
+#if (OT_FEATURE(MULTIFS) && (OT_FEATURE(VLCOW) == ENABLED))
+
+/** @brief Creates a copy-on-write image of the default data
+  * @param fs           (const vlFSHEADER*) FS header, from vworm_fsheader_defload()
+  * @retval void*       COW image, or NULL on error
+  * @ingroup Veelite
+  */
+void* vworm_cow_new(const vlFSHEADER* fs);
+
+/** @brief Creates a lazy image of a full image
+  * @param image        (const void*) Full image, with its FS header first
+  * @retval void*       Lazy image, or NULL on error
+  * @ingroup Veelite
+  *
+  * The lazy image is a COW image, so it is used with the other vworm_cow
+  * functions.
+  */
+void* vworm_lazy_new(const void* image);
+
+/** @brief Frees a copy-on-write image, including its private blocks
+  * @param cow          (void*) COW image from vworm_cow_new()
+  * @retval None
+  * @ingroup Veelite
+  */
+void vworm_cow_free(void* cow);
+
+/** @brief Like vworm_init(), for a copy-on-write image
+  * @param cow          (void*) COW image from vworm_cow_new()
+  * @retval ot_u8       Non-zero on error
+  * @ingroup Veelite
+  */
+ot_u8 vworm_cow_init(void* cow);
+
+/** @brief Copies the data of a copy-on-write image into a normal image
+  * @param cow          (const void*) COW image from vworm_cow_new()
+  * @param dst          (void*) Destination, of vworm_fsalloc() bytes
+  * @retval ot_u32      Number of bytes copied
+  * @ingroup Veelite
+  */
+ot_u32 vworm_cow_copy(const void* cow, void* dst);
+
+/** @brief Returns the bytes of memory used privately by a copy-on-write image
+  * @param cow          (const void*) COW image from vworm_cow_new()
+  * @retval ot_u32      Bytes of descriptor and private blocks
+  * @ingroup Veelite
+  */
+ot_u32 vworm_cow_private(const void* cow);
+
+/** @brief Accounts the private memory of a copy-on-write image to a counter
+  * @param cow          (void*) COW image from vworm_cow_new()
+  * @param counter      (ot_u64*) Counter, or NULL to stop accounting
+  * @retval None
+  * @ingroup Veelite
+  *
+  * The private bytes are added to the counter, and it follows them as blocks
+  * are copied or freed.  They are subtracted from the previous counter, and
+  * from the counter when the image is freed.  It must not be called while a
+  * thread writes the image.
+  */
+void vworm_cow_account(void* cow, ot_u64* counter);
+
+
+/** @note Paged images:
+  * With OT_FEATURE_VLPAGED (which needs OT_FEATURE_VLCOW), an FS image may be
+  * paged in from a file, in blocks of OT_PARAM_VLCOWBLOCK bytes.  A paged
+  * image is a COW image whose blocks are read from the file when they are
+  * used, into one page cache of OT_PARAM_VLPAGECACHE blocks that all paged
+  * images share.  Dirty blocks are written back to the file when they are
+  * evicted, by vworm_save() when the image is selected, and when the image
+  * is freed with vworm_cow_free().  So the memory used is bounded by the
+  * cache, and not by the number of images.  vworm_get() returns NULL for any
+  * part of a paged image but its header, which is in the descriptor.
+  */
+#if (OT_FEATURE(VLPAGED) == ENABLED)
+
+/** @typedef vlPAGESTATS
+  * Counters of the page cache, from vworm_paged_stats()
+  */
+typedef struct {
+    ot_u64  hits;           // Accesses to blocks that were in the cache
+    ot_u64  misses;         // Blocks read from files
+    ot_u64  writebacks;     // Dirty blocks written to files
+    ot_u32  blocks;         // Blocks in the cache (0 until first used)
+    ot_u32  used;           // Blocks of the cache that hold a block of an image
+    ot_u32  block_size;     // Bytes per block
+} vlPAGESTATS;
+
+/** @brief Opens a file of FS images for paged images
+  * @param path         (const char*) Path of the file
+  * @retval void*       File, or NULL on error
+  * @ingroup Veelite
+  *
+  * Each paged image of the file has a reference to it, so the file is
+  * closed once vworm_paged_close() and vworm_cow_free() of all of them are
+  * done.
+  */
+void* vworm_paged_open(const char* path);
+
+/** @brief Drops the reference of vworm_paged_open() to a file
+  * @param file         (void*) File from vworm_paged_open()
+  * @retval None
+  * @ingroup Veelite
+  */
+void vworm_paged_close(void* file);
+
+/** @brief Creates a paged image of the FS image at an offset of a file
+  * @param file         (void*) File from vworm_paged_open()
+  * @param offset       (ot_u64) Offset of the image in the file
+  * @retval void*       Paged image, or NULL on error
+  * @ingroup Veelite
+  *
+  * Only the FS header is read here.  The paged image is a COW image, so it
+  * is used with the other vworm_cow functions.
+  */
+void* vworm_paged_new(void* file, ot_u64 offset);
+
+/** @brief Returns the counters of the page cache
+  * @param stats        (vlPAGESTATS*) Result Variable
+  * @retval None
+  * @ingroup Veelite
+  */
+void vworm_paged_stats(vlPAGESTATS* stats);
+
+#endif
+
+#endif
+
+
+
 /** @brief Saves the state of the vworm system
   * @param none
   * @retval ot_u8       Non-zero on memory fault
@@ -251,6 +423,13 @@ ot_u8 vworm_init(void* fs_base, const vlFSHEADER* fs);
   * This is sometimes implemented as an empty wrapper, depending on the way the
   * VWORM system saves its parameters.  Nonetheless, it should be run prior to
   * shutting down the system, power-cut off, etc.
+  *
+  * With OT_FEATURE_VLMMAP on POSIX, it syncs the pages of the selected image
+  * that were written with vworm_write() since the image was selected or last
+  * saved, and those of images that were selected before and written since the
+  * last save.  For an image that is a shared mapping of a file, those pages
+  * are then on the file.  Writes through pointers from vworm_get() are not
+  * tracked.
   */
 ot_u8 vworm_save( );
 
@@ -317,6 +496,25 @@ void* vworm_get(vaddr addr);
 
 
 
+/** @brief Returns a physical byte pointer to a range of VWORM, if contiguous
+  * @param addr : (vaddr) Virtual address of the start of the range
+  * @param span : (ot_uint) Number of bytes in the range
+  * @param write : (ot_bool) True if the range will be written via the pointer
+  * @retval void* : the physical pointer to the range, or NULL
+  * @ingroup Veelite
+  *
+  * Unlike vworm_get(), this never changes the layout of the image to make the
+  * range contiguous: it returns NULL when the range is not all in one piece
+  * of memory, and the caller must then use vworm_read() or vworm_write().  On
+  * POSIX, that is the case for ranges that cross a block of a COW image, for
+  * paged images and for the FS header of a COW image.  With write set to
+  * True, a shared COW block is copied first, and the range is marked dirty
+  * for vworm_save().  A span of 0 returns NULL.
+  */
+void* vworm_span(vaddr addr, ot_uint span, ot_bool write);
+
+
+
 /** @brief Debugging function that prints out the state of the block table
   * @param none
   * @retval none
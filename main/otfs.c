@@ -33,6 +33,23 @@
 // for malloc
 #include <stdlib.h>
 
+// for template files
+#include <stdio.h>
+
+// for snapshot files, and loading and saving groups
+#if (OT_FEATURE_MULTIFS == ENABLED)
+#   include <ctype.h>
+#   include <dirent.h>
+#   include <fcntl.h>
+#   include <limits.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#   if (OT_FEATURE_VLTHREADS == ENABLED)
+#       include <pthread.h>
+#   endif
+#endif
+
 
 
 
@@ -69,21 +86,7 @@ int otfs_deinit(void* handle, void (*free_fn)(void*)) {
         return -1;
     }
 
-    if (free_fn != NULL) {
-        otfs_t      fs;
-        uint64_t    uid = 0;
-        int         rc;
-        
-        rc = otfs_iterator_start(handle, &fs, (ot_u8*)&uid);
-        while (rc == 0) {
-            if (free_fn != NULL) {
-                free_fn(fs.base);
-            }
-            rc = otfs_iterator_next(handle, &fs, (ot_u8*)&uid);
-        }
-    }
-
-    return vl_multifs_deinit(handle);
+    return vl_multifs_deinit(handle, free_fn);
 #else
 
     return 0;
@@ -92,29 +95,108 @@ int otfs_deinit(void* handle, void (*free_fn)(void*)) {
 
 
 int otfs_load_defaults(void* handle, otfs_t* fs, size_t maxalloc) {
+#	if (OT_FEATURE_MULTIFS == ENABLED)
+    /// The default image is template 0, which is prebuilt
+    return otfs_load_template(handle, fs, 0, maxalloc);
+    
+#	else
     vlFSHEADER header;
     
     if (fs == NULL) {
         return -1;
     }
     
-    //Section between these comments could be refactored
     vworm_fsheader_defload(&header);
+    return vworm_fsdata_defload(fs->base, (const vlFSHEADER*)&header);
+#	endif
+}
+
+
+
+int otfs_load_template(void* handle, otfs_t* fs, int template_id, size_t maxalloc) {
+#if (OT_FEATURE_MULTIFS == ENABLED)
+    const void* image;
     
-#	if (OT_FEATURE_MULTIFS == ENABLED)
-    fs->alloc = vworm_fsalloc((const vlFSHEADER*)&header);
+    if ((fs == NULL) || (template_id < 0) || (template_id > 255)) {
+        return -1;
+    }
+    
+    image = vl_multifs_template(handle, (ot_u8)template_id);
+    if (image == NULL) {
+        return -1;
+    }
+    
+    fs->alloc = vworm_fsalloc((const vlFSHEADER*)image);
     if (fs->alloc >= maxalloc) {
         return -2;
     }
-    //End of refactorable section
     
-    fs->base = malloc(fs->alloc);
+    fs->base = vl_multifs_alloc(handle, fs->alloc);
     if (fs->base == NULL) {
         return -3;
     }
-#	endif
     
-    return vworm_fsdata_defload(fs->base, (const vlFSHEADER*)&header);
+    memcpy(fs->base, image, fs->alloc);
+    return (int)fs->alloc;
+#else
+    return (template_id == 0) ? otfs_load_defaults(handle, fs, maxalloc) : -1;
+#endif
+}
+
+
+
+int otfs_template_add(void* handle, const char* path) {
+#if (OT_FEATURE_MULTIFS == ENABLED)
+    FILE* f;
+    void* image = NULL;
+    long size;
+    ot_u8 id;
+    ot_u8 rc;
+    
+    if (path == NULL) {
+        return -1;
+    }
+    
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        return -1;
+    }
+    if ((fseek(f, 0, SEEK_END) == 0) && ((size = ftell(f)) > 0) && (fseek(f, 0, SEEK_SET) == 0)) {
+        image = malloc((size_t)size);
+        if ((image != NULL) && (fread(image, 1, (size_t)size, f) != (size_t)size)) {
+            free(image);
+            image = NULL;
+        }
+    }
+    fclose(f);
+    if (image == NULL) {
+        return -1;
+    }
+    
+    rc = vl_multifs_template_add(handle, image, (size_t)size, &id);
+    free(image);
+    if (rc == 255) {
+        return -2;
+    }
+    if (rc != 0) {
+        return -3;
+    }
+    return (int)id;
+#else
+    return -1;
+#endif
+}
+
+
+
+void otfs_free_image(void* handle, otfs_t* fs) {
+    if ((fs == NULL) || (fs->base == NULL)) {
+        return;
+    }
+#if (OT_FEATURE_MULTIFS == ENABLED)
+    vl_multifs_free(handle, fs->base);
+    fs->base = NULL;
+#endif
 }
 
 
@@ -142,11 +224,11 @@ int otfs_new(void* handle, const otfs_t* fs) {
     vworm_init(NULL, NULL);
 #endif
 
-    ///@note might be wise to put below features into otfs_setfs() (or a
-    ///      subroutine of such that takes a direct pointer).
+    ///@note The runtime state of the new FS (veelite context and key table)
+    ///      is kept in the group entry.  It is initialized once, here, and
+    ///      otfs_setfs() only needs to select it afterwards.
 
     // Initialize veelite for this context
-    ///@todo veelite will need context input
     vl_init(NULL);
 
     // Initialize auth_init for this FS context
@@ -158,6 +240,93 @@ int otfs_new(void* handle, const otfs_t* fs) {
 
 
 
+int otfs_new_cow(void* handle, otfs_t* fs) {
+#if ((OT_FEATURE_MULTIFS == ENABLED) && (OT_FEATURE_VLCOW == ENABLED))
+    vlFSHEADER header;
+    id_tmpl user_id;
+    void* cow;
+    int rc;
+
+    if ((handle == NULL) || (fs == NULL)) {
+        return -1;
+    }
+
+    vworm_fsheader_defload(&header);
+    cow = vworm_cow_new((const vlFSHEADER*)&header);
+    if (cow == NULL) {
+        return -3;
+    }
+
+    user_id.length  = 8;
+    user_id.value   = (ot_u8*)&fs->uid.u8[0];
+
+    rc = vl_multifs_addcow(handle, cow, (const id_tmpl*)&user_id);
+    if (rc != 0) {
+        vworm_cow_free(cow);
+        return -rc;
+    }
+
+    fs->base    = cow;
+    fs->alloc   = vl_get_fsalloc((vlFSHEADER*)cow);
+
+    // The COW image is already selected by vl_multifs_addcow()
+    vl_init(NULL);
+    auth_init();
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+
+
+
+int otfs_new_lazy(void* handle, otfs_t* fs, int template_id) {
+#if ((OT_FEATURE_MULTIFS == ENABLED) && (OT_FEATURE_VLCOW == ENABLED))
+    const void* image;
+    id_tmpl user_id;
+    void* lazy;
+    int rc;
+
+    if ((handle == NULL) || (fs == NULL) || (template_id < 0) || (template_id > 255)) {
+        return -1;
+    }
+
+    image = vl_multifs_template(handle, (ot_u8)template_id);
+    if (image == NULL) {
+        return -1;
+    }
+    lazy = vworm_lazy_new(image);
+    if (lazy == NULL) {
+        return -3;
+    }
+
+    user_id.length  = 8;
+    user_id.value   = (ot_u8*)&fs->uid.u8[0];
+
+    rc = vl_multifs_addcow(handle, lazy, (const id_tmpl*)&user_id);
+    if (rc != 0) {
+        vworm_cow_free(lazy);
+        return -rc;
+    }
+
+    fs->base    = lazy;
+    fs->alloc   = vl_get_fsalloc((vlFSHEADER*)lazy);
+
+    // The lazy image is already selected by vl_multifs_addcow()
+    vl_init(NULL);
+    auth_init();
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+
+
+
 int otfs_del(void* handle, const otfs_t* fs, void (*free_fn)(void*)) {
 #if (OT_FEATURE_MULTIFS == ENABLED)
     id_tmpl user_id;
@@ -169,12 +338,7 @@ int otfs_del(void* handle, const otfs_t* fs, void (*free_fn)(void*)) {
     
     user_id.length  = 8;
     user_id.value   = (ot_u8*)fs->uid.u8;
-    rc              = vl_multifs_del(handle, (const id_tmpl*)&user_id);
-    if (rc == 0) {
-        if ((free_fn != NULL) && (fs->base != NULL)) {
-            free_fn(fs->base);
-        }
-    }
+    rc              = vl_multifs_del(handle, (const id_tmpl*)&user_id, free_fn);
     
     return rc;
 #else
@@ -210,6 +374,100 @@ int otfs_setfs(void* handle, otfs_t* fs, const ot_u8* eui64_bytes) {
 
 
 
+int otfs_open(void* handle, otfs_handle_t* fsh, const ot_u8* eui64_bytes) {
+#if (OT_FEATURE_MULTIFS == ENABLED)
+    id_tmpl user_id;
+    
+    if ((handle == NULL) || (fsh == NULL)) {
+        return -1;
+    }
+    
+    user_id.length  = 8;
+    user_id.value   = (ot_u8*)eui64_bytes;
+    
+    return vl_multifs_open(handle, fsh, (const id_tmpl*)&user_id);
+#else
+	return 0;
+#endif
+}
+
+
+
+int otfs_select_handle(otfs_handle_t fsh, otfs_t* fs) {
+#if (OT_FEATURE_MULTIFS == ENABLED)
+    int rc;
+    uint64_t uid;
+    id_tmpl user_id;
+    void* fsbase;
+    
+    if (fsh == NULL) {
+        return -1;
+    }
+    
+    user_id.length  = 8;
+    user_id.value   = (ot_u8*)&uid;
+    
+    rc = vl_multifs_select(fsh, &fsbase, &user_id);
+    if (rc == 0) {
+        sub_loadfs(fs, fsbase, &user_id);
+    }
+    
+    return rc;
+#else
+	return 0;
+#endif
+}
+
+
+
+int otfs_lookup_batch(void* handle, const uint64_t* uids, size_t n, otfs_t* out) {
+#if (OT_FEATURE_MULTIFS == ENABLED)
+    otfs_handle_t refs[64];
+    void* bases[64];
+    size_t i, j, chunk;
+    int found = 0;
+    
+    if ((handle == NULL) || (uids == NULL) || (out == NULL)) {
+        return -1;
+    }
+    
+    for (i=0; i<n; i+=chunk) {
+        chunk = ((n-i) < 64) ? (n-i) : 64;
+        if (vl_multifs_open_batch(handle, &uids[i], chunk, refs, bases) != 0) {
+            return -1;
+        }
+        for (j=0; j<chunk; j++) {
+            out[i+j].uid.u64 = uids[i+j];
+            out[i+j].base    = bases[j];
+            out[i+j].alloc   = 0;
+            if (bases[j] != NULL) {
+                out[i+j].alloc = vl_get_fsalloc((vlFSHEADER*)bases[j]);
+                found++;
+            }
+        }
+    }
+    
+    return found;
+#else
+	return -1;
+#endif
+}
+
+
+
+int otfs_release(void* handle) {
+#if (OT_FEATURE_MULTIFS == ENABLED)
+    if (handle == NULL) {
+        return -1;
+    }
+    return vl_multifs_release(handle);
+#else
+	return 0;
+#endif
+}
+
+
+
 int otfs_activeuid(void* handle, ot_u8* eui64_bytes) {
 #if (OT_FEATURE_MULTIFS == ENABLED)
     id_tmpl user_id;
@@ -288,3 +546,1075 @@ int otfs_iterator_next(void* handle, otfs_t* fs, ot_u8* eui64_bytes) {
 }
 
 
+
+int otfs_iterator_range(void* handle, otfs_t* fs, ot_u8* eui64_bytes, const ot_u8* lo, const ot_u8* hi) {
+#if (OT_FEATURE_MULTIFS == ENABLED)
+    ot_u8 rc;
+    id_tmpl user_id;
+    void* fsbase;
+
+    if ((handle == NULL) || (lo == NULL) || (hi == NULL)) {
+        return -1;
+    }
+
+    user_id.length  = 0;
+    user_id.value   = eui64_bytes;
+
+    rc = vl_multifs_range(handle, &fsbase, &user_id, lo, hi);
+    if ((rc == 0) && (user_id.length == 8)) {
+        sub_loadfs(fs, fsbase, &user_id);
+        return 0;
+    }
+    
+    return 1;
+    
+#else
+	return 0;
+#endif
+}
+
+int otfs_iterator_prefix(void* handle, otfs_t* fs, ot_u8* eui64_bytes, const ot_u8* oui24) {
+    otfs_eui64_t lo;
+    otfs_eui64_t hi;
+    
+    if (oui24 == NULL) {
+        return -1;
+    }
+    
+    memcpy(lo.oui24, oui24, 3);
+    memcpy(hi.oui24, oui24, 3);
+    memset(lo.ext40, 0x00, 5);
+    memset(hi.ext40, 0xFF, 5);
+    
+    return otfs_iterator_range(handle, fs, eui64_bytes, (const ot_u8*)&lo, (const ot_u8*)&hi);
+}
+
+
+
+int otfs_scan_init(void* handle, otfs_scan_t* scan, unsigned int part, unsigned int parts) {
+#if (OT_FEATURE_MULTIFS == ENABLED)
+    if ((handle == NULL) || (scan == NULL)) {
+        return -1;
+    }
+    
+    return -(int)vl_multifs_cursor(handle, scan, part, parts);
+#else
+	return 0;
+#endif
+}
+
+
+int otfs_scan_next(otfs_scan_t* scan, otfs_t* fs) {
+#if (OT_FEATURE_MULTIFS == ENABLED)
+    ot_u8 rc;
+    uint64_t uid;
+    id_tmpl user_id;
+    void* fsbase;
+    
+    if (scan == NULL) {
+        return -1;
+    }
+    
+    user_id.length  = 0;
+    user_id.value   = (ot_u8*)&uid;
+    
+    rc = vl_multifs_scan(scan, &fsbase, &user_id);
+    if ((rc == 0) && (user_id.length == 8)) {
+        sub_loadfs(fs, fsbase, &user_id);
+        return 0;
+    }
+    
+    return 1;
+    
+#else
+	return 1;
+#endif
+}
+
+
+
+int otfs_stats(void* handle, otfs_stats_t* stats) {
+#if (OT_FEATURE_MULTIFS == ENABLED)
+    vlFSSTATS vlstats;
+    ot_u8 rc;
+    
+    if ((handle == NULL) || (stats == NULL)) {
+        return -1;
+    }
+    
+    rc = vl_multifs_stats(handle, &vlstats);
+    if (rc == 0) {
+        stats->fs           = vlstats.fs;
+        stats->table_bytes  = vlstats.index_bytes + vlstats.entry_bytes;
+        stats->filter_bytes = vlstats.filter_bytes;
+        stats->filter_fpr   = vlstats.filter_fpr;
+        stats->slab_bytes   = vlstats.slab_bytes;
+        stats->cow_fs       = vlstats.cow_fs;
+        stats->cow_bytes    = vlstats.cow_bytes;
+        stats->cold_fs      = vlstats.cold_fs;
+        stats->cold_bytes   = vlstats.cold_bytes;
+#       if ((OT_FEATURE_VLCOW == ENABLED) && (OT_FEATURE_VLPAGED == ENABLED))
+        {   vlPAGESTATS pstats;
+            vworm_paged_stats(&pstats);
+            stats->page_hits        = pstats.hits;
+            stats->page_misses      = pstats.misses;
+            stats->page_writebacks  = pstats.writebacks;
+            stats->page_bytes       = (size_t)pstats.blocks * pstats.block_size;
+        }
+#       else
+        stats->page_hits        = 0;
+        stats->page_misses      = 0;
+        stats->page_writebacks  = 0;
+        stats->page_bytes       = 0;
+#       endif
+        stats->image_bytes  = vlstats.image_bytes;
+        stats->switches     = vlstats.switches;
+    }
+    
+    return rc;
+#else
+	return -1;
+#endif
+}
+
+
+
+int otfs_fsstats(void* handle, const otfs_t* fs, otfs_fsstats_t* stats) {
+#if (OT_FEATURE_MULTIFS == ENABLED)
+    if ((handle == NULL) || (stats == NULL)) {
+        return -1;
+    }
+    if ((fs != NULL) && (otfs_setfs(handle, NULL, (const uint8_t*)&fs->uid.u8[0]) != 0)) {
+        return -2;
+    }
+    return (vl_fsstats(stats) == 0) ? 0 : -1;
+#else
+	return -1;
+#endif
+}
+
+
+
+int otfs_defrag(void* handle, const otfs_t* fs, size_t max_bytes) {
+#if ((OT_FEATURE_MULTIFS == ENABLED) && (OT_FEATURE_VLNEW == ENABLED))
+    ot_uint budget;
+    ot_u8   rc;
+
+    if (handle == NULL) {
+        return -1;
+    }
+    if ((fs != NULL) && (otfs_setfs(handle, NULL, (const uint8_t*)&fs->uid.u8[0]) != 0)) {
+        return -2;
+    }
+    budget  = (max_bytes > 0xFFFF) ? 0xFFFF : (ot_uint)max_bytes;
+    rc      = vl_defrag(VL_GFB_BLOCKID, budget);
+    if (rc == 0) {
+        rc  = vl_defrag(VL_ISF_BLOCKID, budget);
+    }
+    return (rc <= 1) ? (int)rc : -1;
+#else
+	return -1;
+#endif
+}
+
+
+
+int otfs_hotset(void* handle, size_t hot_max) {
+#if ((OT_FEATURE_MULTIFS == ENABLED) && (OT_FEATURE_VLCOLD == ENABLED))
+    if (handle == NULL) {
+        return -1;
+    }
+    return vl_multifs_hotset(handle, hot_max);
+#else
+    return -1;
+#endif
+}
+
+
+
+
+#if (OT_FEATURE_MULTIFS == ENABLED)
+#define SNAPSHOT_ALIGN      64
+#define SNAPSHOT_ROUND(X)   (((X) + (SNAPSHOT_ALIGN-1)) & ~(uint64_t)(SNAPSHOT_ALIGN-1))
+#define GROUP_BATCH         256
+#define GROUP_MAXTHREADS    64
+
+static const char snapshot_magic[8] = { 'O','T','F','S','S','N','A','P' };
+
+/// Job of the workers that load or save a group.  Each FS has a record, and
+/// the workers claim GROUP_BATCH records at a time.  With a directory, each
+/// FS is a file named by the hex of its UID bytes, else the records are the
+/// index of a snapshot file.
+typedef struct {
+    void*       handle;
+    const char* dir;
+    int         fd;
+    vlFSMAPENT* ents;
+    size_t      count;
+    size_t      next;
+    size_t      done;
+    ot_u32      alloc_max;
+    int         rc;
+} grpjob_t;
+
+
+/// The index is in the order of the UID bytes, like the group table, so it
+/// is added to the table in order.
+static int sub_snapshot_cmp(const void* a, const void* b) {
+    return memcmp(&((const vlFSMAPENT*)a)->uid, &((const vlFSMAPENT*)b)->uid, 8);
+}
+
+static ot_bool sub_snapshot_check(const otfs_snaphdr_t* hdr, size_t size) {
+    return (memcmp(hdr->magic, snapshot_magic, sizeof(hdr->magic)) == 0)
+        && (hdr->version == OTFS_SNAPSHOT_VERSION)
+        && (hdr->align == SNAPSHOT_ALIGN)
+        && (hdr->size == size)
+        && ((hdr->index_offset % SNAPSHOT_ALIGN) == 0)
+        && (hdr->index_offset <= size)
+        && (hdr->count <= ((size - hdr->index_offset) / sizeof(vlFSMAPENT)));
+}
+
+static void sub_snapshot_unmap(void* region, size_t size) {
+    munmap(region, size);
+}
+
+static void sub_job_error(grpjob_t* job, int rc) {
+    int none = 0;
+    __atomic_compare_exchange_n(&job->rc, &none, rc, False, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+static ot_bool sub_job_claim(grpjob_t* job, size_t* i, size_t* end) {
+    *i = __atomic_fetch_add(&job->next, GROUP_BATCH, __ATOMIC_RELAXED);
+    if (*i >= job->count) {
+        return False;
+    }
+    *end = ((job->count - *i) < GROUP_BATCH) ? job->count : (*i + GROUP_BATCH);
+    return True;
+}
+
+static void sub_job_path(const grpjob_t* job, uint64_t uid, const char* ext, char* path, size_t max) {
+    const ot_u8* b = (const ot_u8*)&uid;
+    snprintf(path, max, "%s/%02X%02X%02X%02X%02X%02X%02X%02X%s", job->dir,
+            b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7], ext);
+}
+
+static ot_bool sub_job_name(const char* name, uint64_t* uid) {
+    ot_u8* b = (ot_u8*)uid;
+    unsigned int v;
+
+    if (strlen(name) != 16) {
+        return False;
+    }
+    for (int i=0; i<8; i++) {
+        if ((isxdigit((int)name[2*i]) == 0) || (isxdigit((int)name[2*i+1]) == 0)
+        ||  (sscanf(&name[2*i], "%2x", &v) != 1)) {
+            return False;
+        }
+        b[i] = (ot_u8)v;
+    }
+    return (*uid != 0);
+}
+
+
+/// Maps a snapshot file as a new group.  A private mapping keeps writes in
+/// memory, and a shared mapping (OT_FEATURE_VLMMAP) writes them to the file.
+static int sub_snapshot_map(void** handle, const char* path, ot_bool shared) {
+    otfs_snaphdr_t* hdr;
+    struct stat st;
+    void* region;
+    size_t size;
+    int fd;
+    int rc;
+
+    if ((handle == NULL) || (path == NULL)) {
+        return -1;
+    }
+    fd = open(path, shared ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    if ((fstat(fd, &st) != 0) || (st.st_size < (off_t)sizeof(otfs_snaphdr_t))) {
+        close(fd);
+        return -2;
+    }
+    size    = (size_t)st.st_size;
+    region  = mmap(NULL, size, PROT_READ|PROT_WRITE, shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        return -3;
+    }
+
+    /// Only the header is checked here, and vl_multifs_map() checks that the
+    /// records are inside the file.  The images are not touched.
+    hdr = region;
+    if (sub_snapshot_check(hdr, size) == False) {
+        munmap(region, size);
+        return -2;
+    }
+
+    if (vl_multifs_init(handle) != 0) {
+        munmap(region, size);
+        return -3;
+    }
+    rc = vl_multifs_map(*handle, region, size, &sub_snapshot_unmap,
+                (const vlFSMAPENT*)((uint8_t*)region + hdr->index_offset), (size_t)hdr->count);
+    if (rc != 0) {
+        if (rc == 255) {
+            munmap(region, size);
+        }
+        vl_multifs_deinit(*handle, NULL);
+        *handle = NULL;
+        return ((rc == 255) || (rc == 0x12)) ? -2 : -3;
+    }
+    return 0;
+}
+
+#if ((OT_FEATURE_VLMMAP == ENABLED) || ((OT_FEATURE_VLCOW == ENABLED) && (OT_FEATURE_VLPAGED == ENABLED)))
+/// Opens the image file of a new FS.  A new or empty file gets the image of
+/// the template.  Else, the file has the image of an earlier run, and it is
+/// used as it is.  Returns the descriptor, or a negative error as for
+/// otfs_new_file().
+static int sub_image_file(void* handle, int template_id, const char* path, size_t* size) {
+    const void* image;
+    struct stat st;
+    int fd;
+
+    if ((template_id < 0) || (template_id > 255)) {
+        return -1;
+    }
+    fd = open(path, O_RDWR|O_CREAT, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -2;
+    }
+    *size = (size_t)st.st_size;
+    if (*size == 0) {
+        image = vl_multifs_template(handle, (ot_u8)template_id);
+        if (image == NULL) {
+            close(fd);
+            return -1;
+        }
+        *size = vworm_fsalloc((const vlFSHEADER*)image);
+        if (pwrite(fd, image, *size, 0) != (ssize_t)*size) {
+            if (ftruncate(fd, 0) != 0) {
+                *size = 0;
+            }
+            close(fd);
+            return -2;
+        }
+    }
+    if (*size < sizeof(vlFSHEADER)) {
+        close(fd);
+        return -2;
+    }
+    return fd;
+}
+#endif
+
+
+/// The calling thread is one of the workers.  Without VLTHREADS, the group
+/// can't be used from other threads, so it is the only one.
+static void sub_job_run(grpjob_t* job, void* (*worker)(void*), int nthreads) {
+#   if (OT_FEATURE_VLTHREADS == ENABLED)
+    pthread_t   threads[GROUP_MAXTHREADS];
+    int         started = 0;
+
+    if (nthreads > GROUP_MAXTHREADS) {
+        nthreads = GROUP_MAXTHREADS;
+    }
+    for (int i=1; i<nthreads; i++) {
+        if (pthread_create(&threads[started], NULL, worker, job) == 0) {
+            started++;
+        }
+    }
+    worker(job);
+    for (int i=0; i<started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+#   else
+    worker(job);
+#   endif
+}
+
+
+/// With a snapshot file, the images of a batch are contiguous in the file,
+/// so they are put together in the buffer and written at once.
+static void* sub_save_worker(void* arg) {
+    grpjob_t*   job = arg;
+    uint8_t*    buf;
+    uint8_t*    image;
+    size_t      buf_max;
+    char        path[PATH_MAX];
+    char        tmp[PATH_MAX];
+    id_tmpl     user_id;
+    size_t      i, end;
+
+    buf_max = (job->dir == NULL) ? (GROUP_BATCH * SNAPSHOT_ROUND(job->alloc_max)) : job->alloc_max;
+    buf     = malloc(buf_max);
+    if (buf == NULL) {
+        sub_job_error(job, -3);
+        return NULL;
+    }
+    user_id.length = 8;
+
+    while (sub_job_claim(job, &i, &end)) {
+        uint64_t    start = job->ents[i].offset;
+        size_t      span = 0;
+
+        for (; i<end; i++) {
+            vlFSMAPENT* ent = &job->ents[i];
+            ot_u32      size;
+
+            image = (job->dir == NULL) ? &buf[ent->offset - start] : buf;
+            span  = (size_t)(SNAPSHOT_ROUND(ent->offset + ent->alloc) - start);
+
+            /// An FS that was deleted or changed since the scan is left out.
+            /// In a snapshot file its slot in the batch is zeroed.
+            user_id.value   = (ot_u8*)&ent->uid;
+            size            = vl_multifs_image(job->handle, &user_id, image, job->alloc_max);
+            if (size != ent->alloc) {
+                if (job->dir == NULL) {
+                    memset(image, 0, SNAPSHOT_ROUND(ent->alloc));
+                }
+                ent->alloc = 0;
+                continue;
+            }
+            if (job->dir == NULL) {
+                memset(&image[size], 0, SNAPSHOT_ROUND(size) - size);
+            }
+            else {
+                int fd;
+                sub_job_path(job, ent->uid, ".tmp", tmp, sizeof(tmp));
+                sub_job_path(job, ent->uid, "", path, sizeof(path));
+                fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+                if ((fd < 0) || (write(fd, image, size) != (ssize_t)size)
+                ||  (close(fd) != 0) || (rename(tmp, path) != 0)) {
+                    if (fd >= 0) {
+                        unlink(tmp);
+                    }
+                    sub_job_error(job, -2);
+                }
+            }
+        }
+        if ((job->dir == NULL) && (pwrite(job->fd, buf, span, (off_t)start) != (ssize_t)span)) {
+            sub_job_error(job, -2);
+        }
+    }
+
+    free(buf);
+    return NULL;
+}
+
+
+/// Reads the image of a record.  With a snapshot file, the images of a batch
+/// are usually contiguous, so the batch is read at once into the buffer, and
+/// copied from there.
+static ot_u8* sub_load_image(grpjob_t* job, vlFSMAPENT* ent, const uint8_t* buf, uint64_t start, uint64_t span) {
+    char        path[PATH_MAX];
+    struct stat st;
+    ot_u8*      base = NULL;
+    ssize_t     got;
+    int         fd = job->fd;
+
+    if (job->dir != NULL) {
+        sub_job_path(job, ent->uid, "", path, sizeof(path));
+        fd = open(path, O_RDONLY);
+        if ((fd < 0) || (fstat(fd, &st) != 0) || (st.st_size > (off_t)UINT32_MAX)) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            sub_job_error(job, -2);
+            return NULL;
+        }
+        ent->alloc = (ot_u32)st.st_size;
+    }
+
+    /// The image must be exactly as big as its header says it is
+    if (ent->alloc < sizeof(vlFSHEADER)) {
+        got = -1;
+    }
+    else if ((base = vl_multifs_alloc(job->handle, ent->alloc)) == NULL) {
+        sub_job_error(job, -3);
+        got = -2;
+    }
+    else if ((buf != NULL) && (ent->offset >= start) && ((ent->offset + ent->alloc) <= (start + span))) {
+        memcpy(base, &buf[ent->offset - start], ent->alloc);
+        got = (ssize_t)ent->alloc;
+    }
+    else {
+        got = pread(fd, base, ent->alloc, (off_t)ent->offset);
+    }
+    if (job->dir != NULL) {
+        close(fd);
+    }
+    if (got == -2) {
+        return NULL;
+    }
+    if ((got != (ssize_t)ent->alloc) || (vworm_fsalloc((vlFSHEADER*)base) != ent->alloc)) {
+        if (got >= 0) {
+            vl_multifs_free(job->handle, base);
+        }
+        sub_job_error(job, -2);
+        return NULL;
+    }
+    return base;
+}
+
+
+static void* sub_load_worker(void* arg) {
+    grpjob_t*   job = arg;
+    void*       bases[GROUP_BATCH];
+    uint64_t    uids[GROUP_BATCH];
+    uint8_t*    buf = NULL;
+    size_t      buf_max = 0;
+    size_t      i, end, n, added;
+    ot_u8       rc;
+
+    if (job->dir == NULL) {
+        buf_max = GROUP_BATCH * SNAPSHOT_ROUND(job->alloc_max);
+        buf     = malloc(buf_max);
+    }
+
+    while (sub_job_claim(job, &i, &end)) {
+        uint64_t start = UINT64_MAX;
+        uint64_t span  = 0;
+
+        if (buf != NULL) {
+            uint64_t last = 0;
+            for (size_t k=i; k<end; k++) {
+                start   = (job->ents[k].offset < start) ? job->ents[k].offset : start;
+                last    = ((job->ents[k].offset + job->ents[k].alloc) > last) ?
+                            (job->ents[k].offset + job->ents[k].alloc) : last;
+            }
+            span = last - start;
+            if ((span > buf_max)
+            ||  (pread(job->fd, buf, (size_t)span, (off_t)start) != (ssize_t)span)) {
+                span = 0;
+            }
+        }
+
+        for (n=0; i<end; i++) {
+            bases[n] = sub_load_image(job, &job->ents[i], buf, start, span);
+            if (bases[n] != NULL) {
+                uids[n] = job->ents[i].uid;
+                n++;
+            }
+        }
+
+        /// The images that are left in bases were not added
+        rc = vl_multifs_add_batch(job->handle, bases, uids, n);
+        if (rc != 0) {
+            sub_job_error(job, (rc == 0x15) ? -3 : -2);
+        }
+        for (i=0, added=0; i<n; i++) {
+            if (bases[i] != NULL) {
+                vl_multifs_free(job->handle, bases[i]);
+            }
+            else {
+                added++;
+            }
+        }
+        __atomic_fetch_add(&job->done, added, __ATOMIC_RELAXED);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+
+/// Lists the FS of the group, in the order of their UID bytes
+static int sub_save_list(grpjob_t* job) {
+    vlFSCURSOR  cur;
+    size_t      ents_max = 0;
+    uint64_t    uid;
+    id_tmpl     user_id;
+    ot_bool     active;
+
+    user_id.length  = 8;
+    user_id.value   = (ot_u8*)&uid;
+    active          = (vl_multifs_activeid(job->handle, &user_id) == 0);
+    vl_multifs_cursor(job->handle, &cur, 0, 1);
+
+    while (vl_multifs_scan(&cur, NULL, &user_id) == 0) {
+        if (job->count == ents_max) {
+            vlFSMAPENT* grown;
+            ents_max    = (ents_max == 0) ? 1024 : (2 * ents_max);
+            grown       = realloc(job->ents, ents_max * sizeof(vlFSMAPENT));
+            if (grown == NULL) {
+                job->rc = -3;
+                break;
+            }
+            job->ents = grown;
+        }
+        memset(&job->ents[job->count], 0, sizeof(vlFSMAPENT));
+        job->ents[job->count].uid   = uid;
+        job->ents[job->count].alloc = vl_multifs_image(job->handle, &user_id, NULL, 0);
+        if (job->ents[job->count].alloc > job->alloc_max) {
+            job->alloc_max = job->ents[job->count].alloc;
+        }
+        job->count++;
+    }
+
+    /// The scan protects the images like a checked-out FS, so it is released
+    /// unless the caller has one checked-out.
+    if (active == False) {
+        vl_multifs_release(job->handle);
+    }
+    if (job->rc == 0) {
+        qsort(job->ents, job->count, sizeof(vlFSMAPENT), &sub_snapshot_cmp);
+    }
+    return job->rc;
+}
+
+
+static int sub_save_file(grpjob_t* job, const char* path, int nthreads) {
+    otfs_snaphdr_t  hdr;
+    char*           tmp;
+    uint64_t        offset;
+    size_t          i, n;
+
+    tmp = malloc(strlen(path) + 5);
+    if (tmp == NULL) {
+        return -3;
+    }
+    strcpy(tmp, path);
+    strcat(tmp, ".tmp");
+    job->fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (job->fd < 0) {
+        free(tmp);
+        return -2;
+    }
+
+    /// The images are at known offsets, so the workers write them in any
+    /// order.  Padding is left as holes, which read as zeros.
+    offset = SNAPSHOT_ROUND(sizeof(hdr));
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.data_offset = offset;
+    for (i=0; i<job->count; i++) {
+        job->ents[i].offset = offset;
+        offset = SNAPSHOT_ROUND(offset + job->ents[i].alloc);
+    }
+    if (job->count != 0) {
+        sub_job_run(job, &sub_save_worker, nthreads);
+    }
+
+    for (i=0, n=0; i<job->count; i++) {
+        if (job->ents[i].alloc != 0) {
+            job->ents[n++] = job->ents[i];
+        }
+    }
+    memcpy(hdr.magic, snapshot_magic, sizeof(hdr.magic));
+    hdr.version         = OTFS_SNAPSHOT_VERSION;
+    hdr.align           = SNAPSHOT_ALIGN;
+    hdr.count           = n;
+    hdr.index_offset    = offset;
+    hdr.size            = offset + (n * sizeof(vlFSMAPENT));
+
+    if ((job->rc == 0)
+    && ((pwrite(job->fd, job->ents, n * sizeof(vlFSMAPENT), (off_t)offset) != (ssize_t)(n * sizeof(vlFSMAPENT)))
+    ||  (pwrite(job->fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr))
+    ||  (fsync(job->fd) != 0))) {
+        job->rc = -2;
+    }
+    if ((close(job->fd) != 0) && (job->rc == 0)) {
+        job->rc = -2;
+    }
+    if ((job->rc == 0) && (rename(tmp, path) != 0)) {
+        job->rc = -2;
+    }
+    if (job->rc != 0) {
+        unlink(tmp);
+    }
+    free(tmp);
+    return job->rc;
+}
+
+
+static int sub_load_list(grpjob_t* job, const char* path) {
+    otfs_snaphdr_t  hdr;
+    struct stat     st;
+    size_t          bytes;
+
+    job->fd = open(path, O_RDONLY);
+    if (job->fd < 0) {
+        return -1;
+    }
+    if ((fstat(job->fd, &st) != 0)
+    ||  (pread(job->fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr))
+    ||  (sub_snapshot_check(&hdr, (size_t)st.st_size) == False)) {
+        return -2;
+    }
+    bytes       = (size_t)hdr.count * sizeof(vlFSMAPENT);
+    job->count  = (size_t)hdr.count;
+    job->ents   = malloc(bytes + 1);
+    if (job->ents == NULL) {
+        return -3;
+    }
+    if (pread(job->fd, job->ents, bytes, (off_t)hdr.index_offset) != (ssize_t)bytes) {
+        return -2;
+    }
+    for (size_t i=0; i<job->count; i++) {
+        if ((job->ents[i].offset > hdr.index_offset)
+        ||  (job->ents[i].alloc > (hdr.index_offset - job->ents[i].offset))) {
+            return -2;
+        }
+        if (job->ents[i].alloc > job->alloc_max) {
+            job->alloc_max = job->ents[i].alloc;
+        }
+    }
+    return 0;
+}
+
+
+static int sub_load_dir(grpjob_t* job) {
+    DIR*            d;
+    struct dirent*  de;
+    size_t          ents_max = 0;
+    uint64_t        uid;
+
+    d = opendir(job->dir);
+    if (d == NULL) {
+        return -1;
+    }
+    while ((de = readdir(d)) != NULL) {
+        if (sub_job_name(de->d_name, &uid) == False) {
+            continue;
+        }
+        if (job->count == ents_max) {
+            vlFSMAPENT* grown;
+            ents_max    = (ents_max == 0) ? 1024 : (2 * ents_max);
+            grown       = realloc(job->ents, ents_max * sizeof(vlFSMAPENT));
+            if (grown == NULL) {
+                closedir(d);
+                return -3;
+            }
+            job->ents = grown;
+        }
+        memset(&job->ents[job->count], 0, sizeof(vlFSMAPENT));
+        job->ents[job->count].uid = uid;
+        job->count++;
+    }
+    closedir(d);
+
+    /// Adding in the order of the UID bytes is fastest for the table
+    qsort(job->ents, job->count, sizeof(vlFSMAPENT), &sub_snapshot_cmp);
+    return 0;
+}
+#endif
+
+
+int otfs_save_group(void* handle, const char* path, int nthreads) {
+#if (OT_FEATURE_MULTIFS == ENABLED)
+    grpjob_t    job;
+    struct stat st;
+
+    if ((handle == NULL) || (path == NULL) || (nthreads < 1)) {
+        return -1;
+    }
+    memset(&job, 0, sizeof(job));
+    job.handle  = handle;
+    job.fd      = -1;
+    job.dir     = ((stat(path, &st) == 0) && S_ISDIR(st.st_mode)) ? path : NULL;
+
+    if (sub_save_list(&job) == 0) {
+        if (job.dir == NULL) {
+            sub_save_file(&job, path, nthreads);
+        }
+        else if (job.alloc_max != 0) {
+            sub_job_run(&job, &sub_save_worker, nthreads);
+        }
+    }
+    free(job.ents);
+    return job.rc;
+#else
+    return -1;
+#endif
+}
+
+
+
+int otfs_load_group(void* handle, const char* path, int nthreads) {
+#if (OT_FEATURE_MULTIFS == ENABLED)
+    grpjob_t    job;
+    struct stat st;
+    int         rc;
+
+    if ((handle == NULL) || (path == NULL) || (nthreads < 1)) {
+        return -1;
+    }
+    if (stat(path, &st) != 0) {
+        return -1;
+    }
+    memset(&job, 0, sizeof(job));
+    job.handle  = handle;
+    job.fd      = -1;
+
+    if (S_ISDIR(st.st_mode)) {
+        job.dir = path;
+        rc      = sub_load_dir(&job);
+    }
+    else {
+        rc      = sub_load_list(&job, path);
+    }
+    if (rc == 0) {
+        sub_job_run(&job, &sub_load_worker, nthreads);
+        rc = (job.rc != 0) ? job.rc : (int)job.done;
+    }
+    if (job.fd >= 0) {
+        close(job.fd);
+    }
+    free(job.ents);
+    return rc;
+#else
+    return -1;
+#endif
+}
+
+
+
+int otfs_snapshot_save(void* handle, const char* path) {
+#if (OT_FEATURE_MULTIFS == ENABLED)
+    grpjob_t job;
+
+    if ((handle == NULL) || (path == NULL)) {
+        return -1;
+    }
+    memset(&job, 0, sizeof(job));
+    job.handle  = handle;
+    job.fd      = -1;
+    if (sub_save_list(&job) == 0) {
+        sub_save_file(&job, path, 1);
+    }
+    free(job.ents);
+    return job.rc;
+#else
+    return -1;
+#endif
+}
+
+
+
+int otfs_snapshot_open(void** handle, const char* path) {
+#if (OT_FEATURE_MULTIFS == ENABLED)
+    return sub_snapshot_map(handle, path, False);
+#else
+    return -1;
+#endif
+}
+
+
+
+int otfs_snapshot_attach(void** handle, const char* path) {
+#if ((OT_FEATURE_MULTIFS == ENABLED) && (OT_FEATURE_VLMMAP == ENABLED))
+    return sub_snapshot_map(handle, path, True);
+#else
+    return -1;
+#endif
+}
+
+
+
+int otfs_new_file(void* handle, otfs_t* fs, int template_id, const char* path) {
+#if ((OT_FEATURE_MULTIFS == ENABLED) && (OT_FEATURE_VLMMAP == ENABLED))
+    otfs_handle_t ref;
+    vlFSMAPENT ent;
+    id_tmpl user_id;
+    void* region;
+    size_t size;
+    int fd;
+    int rc;
+
+    if ((handle == NULL) || (fs == NULL) || (path == NULL)) {
+        return -1;
+    }
+    user_id.length  = 8;
+    user_id.value   = (ot_u8*)&fs->uid.u8[0];
+    if ((fs->uid.u64 == 0) || (vl_multifs_open(handle, &ref, (const id_tmpl*)&user_id) == 0)) {
+        return -2;
+    }
+
+    fd = sub_image_file(handle, template_id, path, &size);
+    if (fd < 0) {
+        return fd;
+    }
+    region = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        return -3;
+    }
+
+    /// vl_multifs_map() checks that the image is inside the file
+    ent.uid     = fs->uid.u64;
+    ent.offset  = 0;
+    ent.alloc   = (((vlFSHEADER*)region)->ftab_alloc != 0) ? vworm_fsalloc((const vlFSHEADER*)region) : 0;
+    ent.flags   = 0;
+    rc = vl_multifs_map(handle, region, size, &sub_snapshot_unmap, &ent, 1);
+    if (rc != 0) {
+        if (rc == 255) {
+            munmap(region, size);
+        }
+        return ((rc == 255) || (rc == 0x12)) ? -2 : -3;
+    }
+
+    /// The runtime state of the FS is initialized when it is selected
+    return otfs_setfs(handle, fs, (const ot_u8*)&ent.uid);
+#else
+    return -1;
+#endif
+}
+
+
+
+int otfs_new_paged(void* handle, otfs_t* fs, int template_id, const char* path) {
+#if ((OT_FEATURE_MULTIFS == ENABLED) && (OT_FEATURE_VLCOW == ENABLED) && (OT_FEATURE_VLPAGED == ENABLED))
+    id_tmpl user_id;
+    void* file;
+    void* paged;
+    size_t size;
+    int fd;
+    int rc;
+
+    if ((handle == NULL) || (fs == NULL) || (path == NULL)) {
+        return -1;
+    }
+    fd = sub_image_file(handle, template_id, path, &size);
+    if (fd < 0) {
+        return fd;
+    }
+    close(fd);
+
+    file = vworm_paged_open(path);
+    if (file == NULL) {
+        return -1;
+    }
+    paged = vworm_paged_new(file, 0);
+    vworm_paged_close(file);
+    if (paged == NULL) {
+        return -2;
+    }
+    if (vl_get_fsalloc((vlFSHEADER*)paged) > size) {
+        vworm_cow_free(paged);
+        return -2;
+    }
+
+    user_id.length  = 8;
+    user_id.value   = (ot_u8*)&fs->uid.u8[0];
+    rc = vl_multifs_addcow(handle, paged, (const id_tmpl*)&user_id);
+    if (rc != 0) {
+        vworm_cow_free(paged);
+        return (rc == 0x12) ? -2 : -3;
+    }
+
+    fs->base    = paged;
+    fs->alloc   = vl_get_fsalloc((vlFSHEADER*)paged);
+
+    // The paged image is already selected by vl_multifs_addcow()
+    vl_init(NULL);
+    auth_init();
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+
+
+int otfs_snapshot_page(void** handle, const char* path) {
+#if ((OT_FEATURE_MULTIFS == ENABLED) && (OT_FEATURE_VLCOW == ENABLED) && (OT_FEATURE_VLPAGED == ENABLED))
+    otfs_snaphdr_t hdr;
+    vlFSMAPENT* ents = NULL;
+    struct stat st;
+    id_tmpl user_id;
+    void* group = NULL;
+    void* file = NULL;
+    void* paged;
+    size_t bytes;
+    int fd;
+    int rc = 0;
+
+    if ((handle == NULL) || (path == NULL)) {
+        return -1;
+    }
+
+    /// Only the header and the index are read here
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    if ((fstat(fd, &st) != 0) || (st.st_size < (off_t)sizeof(otfs_snaphdr_t))
+    || (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr))
+    || (sub_snapshot_check(&hdr, (size_t)st.st_size) == False)) {
+        rc = -2;
+    }
+    else {
+        bytes   = (size_t)hdr.count * sizeof(vlFSMAPENT);
+        ents    = malloc((bytes != 0) ? bytes : 1);
+        file    = vworm_paged_open(path);
+        if ((ents == NULL) || (file == NULL)) {
+            rc = -3;
+        }
+        else if (pread(fd, ents, bytes, (off_t)hdr.index_offset) != (ssize_t)bytes) {
+            rc = -2;
+        }
+    }
+    close(fd);
+
+    if ((rc == 0) && (vl_multifs_init(&group) != 0)) {
+        rc = -3;
+    }
+    for (uint64_t i=0; (rc == 0) && (i<hdr.count); i++) {
+        if ((ents[i].offset > (uint64_t)st.st_size) || (ents[i].alloc > ((uint64_t)st.st_size - ents[i].offset))) {
+            rc = -2;
+            break;
+        }
+        paged = vworm_paged_new(file, ents[i].offset);
+        if (paged == NULL) {
+            rc = -2;
+            break;
+        }
+        user_id.length  = 8;
+        user_id.value   = (ot_u8*)&ents[i].uid;
+        if (vl_get_fsalloc((vlFSHEADER*)paged) != ents[i].alloc) {
+            rc = -2;
+        }
+        else if ((rc = vl_multifs_addcow(group, paged, (const id_tmpl*)&user_id)) != 0) {
+            rc = (rc == 0x12) ? -2 : -3;
+        }
+        if (rc != 0) {
+            vworm_cow_free(paged);
+            break;
+        }
+        vl_init(NULL);
+        auth_init();
+    }
+
+    if (rc == 0) {
+        vl_multifs_release(group);
+    }
+    else if (group != NULL) {
+        vl_multifs_deinit(group, &free);
+        group = NULL;
+    }
+    *handle = group;
+    if (file != NULL) {
+        vworm_paged_close(file);
+    }
+    free(ents);
+    return rc;
+#else
+    return -1;
+#endif
+}
+
+
+
+int otfs_sync(void* handle) {
+    if (handle == NULL) {
+        return -1;
+    }
+    return (vworm_save() == 0) ? 0 : -2;
+}
@@ -22,7 +22,12 @@
   *
   * Only necessary for compiling as libotfs, and when linking to the library.
   *
-  * Libotfs is not thread-safe.
+  * Libotfs is not thread-safe, unless it is built with OT_FEATURE_VLTHREADS.
+  * In that case, lookups in the FS group table are lock-free, changes to it
+  * are serialized internally, and the active FS context (checked-out via
+  * otfs_setfs()) is per-thread.  Each thread can
+  * then do Veelite I/O on its own FS, concurrently with the others.  Two
+  * threads should not write to the same FS at the same time.
   *
   ******************************************************************************
   */
@@ -75,6 +80,74 @@ typedef struct {
 } otfs_t;
 
 
+/** @typedef otfs_handle_t
+  * Stable reference to an FS in an otfs group, returned by otfs_open().  It
+  * stays valid until the FS is deleted via otfs_del() or the group is
+  * deinitialized.
+  */
+typedef vlFSREF otfs_handle_t;
+
+
+/** @typedef otfs_scan_t
+  * Cursor for otfs_scan_init() and otfs_scan_next()
+  */
+typedef vlFSCURSOR otfs_scan_t;
+
+
+/** @typedef otfs_stats_t
+  * Statistics of an otfs group, from otfs_stats().  Sizes are in bytes.
+  */
+typedef struct {
+    size_t  fs;             // Number of FS in the group
+    size_t  table_bytes;    // Group table, including per-FS runtime state
+    size_t  filter_bytes;   // Lookup filter (0 if not built-in)
+    float   filter_fpr;     // Lookup filter false-positive rate, 0 to 1
+    size_t  slab_bytes;     // Slab arena for FS images (0 if not built-in)
+    size_t  cow_fs;         // Number of copy-on-write FS
+    size_t  cow_bytes;      // Private memory of the copy-on-write FS
+    size_t  cold_fs;        // Number of cold FS
+    size_t  cold_bytes;     // Memory of the cold FS
+    uint64_t page_hits;     // Page cache: accesses to cached blocks of paged FS
+    uint64_t page_misses;   // Page cache: blocks read from files
+    uint64_t page_writebacks; // Page cache: dirty blocks written to files
+    size_t  page_bytes;     // Page cache memory, shared by all groups (0 if not built-in)
+    size_t  image_bytes;    // Size of all FS images, as full images
+    uint64_t switches;      // FS selected (otfs_setfs() and others), in the group
+} otfs_stats_t;
+
+
+/** @typedef otfs_fsstats_t
+  * Usage of the heaps of an FS, from otfs_fsstats().  Sizes are in bytes.
+  * It has the image size, the size of the FS header and file header table,
+  * and for each block (gfb, iss, isf): the heap size, the heap allocated to
+  * files, the data in the files, the largest free extent of the heap, and
+  * the number of headers and of files.
+  */
+typedef vlIMAGESTATS otfs_fsstats_t;
+
+
+/** @typedef otfs_snaphdr_t
+  * Header of a group snapshot file, from otfs_snapshot_save().  The header is
+  * followed by the FS images, each at an offset that is a multiple of align,
+  * and then by count records of vlFSMAPENT at index_offset, in order of the
+  * bytes of the UID.
+  * The images are plain FS images, as on an embedded OpenTag device.  All
+  * values are in the byte order of the host.
+  */
+typedef struct {
+    char        magic[8];       // "OTFSSNAP"
+    uint32_t    version;        // OTFS_SNAPSHOT_VERSION
+    uint32_t    align;          // Alignment of the images and index
+    uint64_t    count;          // Number of FS
+    uint64_t    data_offset;    // Offset of the first image
+    uint64_t    index_offset;   // Offset of the index
+    uint64_t    size;           // Size of the file
+    uint8_t     reserved[16];
+} otfs_snaphdr_t;
+
+#define OTFS_SNAPSHOT_VERSION   1
+
+
 
 int otfs_init(void** handle);
 
@@ -84,10 +157,50 @@ int otfs_deinit(void* handle, void (*free_fn)(void*));
 /** @brief Load Application Defaults into an empty FS
   * @param fs   (otfs_t*) pointer to already allocated otfs_t variable to empty fs
   * @retval     (int) returns negative values on error, else size of filesystem in bytes (octets)
+  *
+  * The image memory is allocated by the group.  With OT_FEATURE_VLSLAB, it is
+  * from the slab arena of the group, so an image that is not added with
+  * otfs_new() must be freed with otfs_free_image(), not free().
   */
 int otfs_load_defaults(void* handle, otfs_t* fs, size_t maxalloc);
 
 
+/** @brief Load a template into an empty FS
+  * @param handle       (void*) otfs handle
+  * @param fs           (otfs_t*) pointer to already allocated otfs_t variable to empty fs
+  * @param template_id  (int) ID from otfs_template_add(), or 0 for the defaults
+  * @param maxalloc     (size_t) Error if the FS is at least this big
+  * @retval             (int) returns negative values on error, else size of filesystem in bytes (octets)
+  *
+  * Same as otfs_load_defaults(), which is the same as template 0.  The image
+  * is copied from the template in one step.
+  */
+int otfs_load_template(void* handle, otfs_t* fs, int template_id, size_t maxalloc);
+
+
+/** @brief Register a template FS image from a file
+  * @param handle   (void*) otfs handle
+  * @param path     (const char*) Path of the image file
+  * @retval         (int) returns the template ID (1 or more), else a negative error
+  *
+  * The file is a raw FS image, as it is at fs->base (fs->alloc bytes).  An
+  * image that doesn't match its own header is rejected with -2, and -3 means
+  * there is no room for another template (OT_PARAM_VLTEMPLATES) or memory.
+  * Templates are kept until otfs_deinit().
+  */
+int otfs_template_add(void* handle, const char* path);
+
+
+/** @brief Free the image of an FS that is not in the group
+  * @param handle   (void*) otfs handle
+  * @param fs       (otfs_t*) FS loaded by otfs_load_defaults()
+  * @retval None
+  *
+  * Images that are in the group are freed by otfs_del() and otfs_deinit().
+  */
+void otfs_free_image(void* handle, otfs_t* fs);
+
+
 /** @brief Create a new OTFS instance.
   * @param fs   (const otfs_t*) pointer to already allocated and non-empty otfs_t varable
   * @retval     (int) return zero on success, or non-zero on error
@@ -95,14 +208,90 @@ int otfs_load_defaults(void* handle, otfs_t* fs, size_t maxalloc);
   * The fs variable supplied as the parameter must be a non-empty fs.
   * Using otfs_defaults() before otfs_new() is one way to populate an
   * fs with default values.
+  *
+  * UID 0 is reserved, because it marks an empty slot of the group index, so
+  * it returns -255.  The other functions that add an FS reject it too, with
+  * their own error code.
   */
 int otfs_new(void* handle, const otfs_t* fs);
 
 
+/** @brief Create a new OTFS instance that shares the default data
+  * @param handle   (void*) otfs handle
+  * @param fs       (otfs_t*) FS with the uid set.  base and alloc are set here.
+  * @retval         (int) return zero on success, or non-zero on error
+  *
+  * Requires OT_FEATURE_VLCOW.  The FS is a copy-on-write image of the default
+  * data: it has the same content as an FS from otfs_load_defaults(), but the
+  * data is shared with all the other such FS until it is written.  fs->base
+  * is not the image data, so it must not be read or written directly.  It is
+  * freed by otfs_del() and otfs_deinit(), if they are given a free_fn.
+  */
+int otfs_new_cow(void* handle, otfs_t* fs);
+
+
+/** @brief Create a new OTFS instance that reads from a template until written
+  * @param handle       (void*) otfs handle
+  * @param fs           (otfs_t*) FS with the uid set.  base and alloc are set here.
+  * @param template_id  (int) Template ID from otfs_template_add(), or 0 for defaults
+  * @retval             (int) return zero on success, or non-zero on error
+  *
+  * Requires OT_FEATURE_VLCOW.  No image is allocated: the FS reads the data of
+  * the template, and its first write copies the template into a private image.
+  * As with otfs_new_cow(), fs->base must not be read or written directly, and
+  * it is freed by otfs_del() and otfs_deinit(), if they are given a free_fn.
+  * Returns -1 if template_id is not a template.
+  */
+int otfs_new_lazy(void* handle, otfs_t* fs, int template_id);
+
+
+/** @brief Create a new OTFS instance whose image is a file
+  * @param handle       (void*) otfs handle
+  * @param fs           (otfs_t*) FS with the uid set.  base and alloc are set here.
+  * @param template_id  (int) Template ID from otfs_template_add(), or 0 for defaults
+  * @param path         (const char*) Path of the image file
+  * @retval             (int) return zero on success, or negative on error
+  *
+  * Requires OT_FEATURE_VLMMAP.  The file is mapped shared, and the mapping is
+  * the image, so writes to the FS go to the file with no extra copy.  A new or
+  * empty file gets the image of the template.  Else, the image already in the
+  * file is used, so an FS can be opened again after the process restarts.
+  * Use otfs_sync() to make the writes durable.  The FS is selected, as with
+  * otfs_new(), and the file is unmapped by otfs_deinit().  Returns -1 if path
+  * can't be opened or template_id is not a template, -2 if the file isn't a
+  * valid image or the UID is already in the group, -3 if out of memory.
+  */
+int otfs_new_file(void* handle, otfs_t* fs, int template_id, const char* path);
+
+
+/** @brief Create a new OTFS instance whose image is paged in from a file
+  * @param handle       (void*) otfs handle
+  * @param fs           (otfs_t*) FS with the uid set.  base and alloc are set here.
+  * @param template_id  (int) Template ID from otfs_template_add(), or 0 for defaults
+  * @param path         (const char*) Path of the image file
+  * @retval             (int) return zero on success, or negative on error
+  *
+  * Requires OT_FEATURE_VLPAGED and OT_FEATURE_VLCOW.  The file is made or
+  * used as by otfs_new_file(), but it is read and written with pread() and
+  * pwrite(), in blocks that are kept in a page cache of OT_PARAM_VLPAGECACHE
+  * blocks.  So the memory of paged FS is bounded by the cache, which is
+  * shared by all of them.  As with otfs_new_cow(), fs->base must not be read
+  * or written directly, and it is freed by otfs_del() and otfs_deinit(), if
+  * they are given a free_fn, which writes back its dirty blocks.  otfs_sync()
+  * writes them back at once.  Returns as otfs_new_file().
+  */
+int otfs_new_paged(void* handle, otfs_t* fs, int template_id, const char* path);
+
+
 /** @brief Delete an OTFS instance.
   * @param fs       (const otfs_t*) pointer to already allocated and non-empty otfs_t varable
   * @param free_fn  (void (*)(void*)) Function to free FS subelements, or NULL
   * @retval         (int) return zero on success, or non-zero on error
+  *
+  * With OT_FEATURE_VLTHREADS, free_fn is deferred until no thread can still
+  * have the FS checked-out.  It may then be called from inside a later
+  * otfs_new() or otfs_del() on any thread, or from otfs_deinit().  If there
+  * is no memory to defer it, the FS is not deleted and 0x15 is returned.
   */
 int otfs_del(void* handle, const otfs_t* fs, void (*free_fn)(void*));
 
@@ -115,6 +304,53 @@ int otfs_del(void* handle, const otfs_t* fs, void (*free_fn)(void*));
   */
 int otfs_setfs(void* handle, otfs_t* fs, const ot_u8* eui64_bytes);
 
+/** @brief Get a stable handle to an FS, for use with otfs_select_handle()
+  * @param handle       (void*) otfs handle
+  * @param fsh          (otfs_handle_t*) Result Variable for FS handle
+  * @param eui64_bytes  (const ot_u8*) UID of the FS
+  * @retval             (int) return zero on success, or non-zero on error
+  *
+  * The lookup by UID is done once, here.  Afterwards, the FS can be selected
+  * through the handle without any lookup.
+  */
+int otfs_open(void* handle, otfs_handle_t* fsh, const ot_u8* eui64_bytes);
+
+
+/** @brief Select an FS to do operations on, via handle from otfs_open()
+  * @param fsh  (otfs_handle_t) FS handle
+  * @param fs   (otfs_t*) Result Variable for FS, or NULL if you don't want result
+  * @retval     (int) return zero on success, or non-zero on error
+  *
+  * This is equivalent to otfs_setfs(), but it is faster.
+  */
+int otfs_select_handle(otfs_handle_t fsh, otfs_t* fs);
+
+
+/** @brief Look-up many FS in the group at once
+  * @param handle   (void*) otfs handle
+  * @param uids     (const uint64_t*) Array of n UIDs, as in otfs_t.uid.u64
+  * @param n        (size_t) Number of UIDs
+  * @param out      (otfs_t*) Output array of n FS.  base is NULL if not found.
+  * @retval         (int) number of FS found, or negative on error
+  *
+  * The active FS is not changed.  The lookups are overlapped with memory
+  * prefetching, so this is much faster than otfs_setfs() on each UID.  The
+  * returned images stay valid as long as an image from otfs_setfs() would.
+  */
+int otfs_lookup_batch(void* handle, const uint64_t* uids, size_t n, otfs_t* out);
+
+
+/** @brief Release the FS that is checked-out by the calling thread
+  * @param handle (void*) otfs handle
+  * @retval     (int) return zero on success, or non-zero on error
+  *
+  * With OT_FEATURE_VLTHREADS, the FS images deleted by otfs_del() are freed
+  * only after every thread has checked-out another FS or released.  A thread
+  * that will be idle for a long time should call otfs_release().
+  */
+int otfs_release(void* handle);
+
+
 int otfs_activeuid(void* handle, ot_u8* eui64_bytes);
 
 
@@ -123,4 +359,217 @@ int otfs_iterator_start(void* handle, otfs_t* fs, ot_u8* eui64_bytes);
 int otfs_iterator_next(void* handle, otfs_t* fs, ot_u8* eui64_bytes);
 
 
+/** @brief Start iterating over the FS with IDs from lo to hi (inclusive)
+  * @param handle       (void*) otfs handle
+  * @param fs           (otfs_t*) Result Variable for the first FS in range
+  * @param eui64_bytes  (ot_u8*) Result Variable for its ID, 8 bytes
+  * @param lo           (const ot_u8*) First ID of the range, 8 bytes
+  * @param hi           (const ot_u8*) Last ID of the range, 8 bytes
+  * @retval             (int) return zero on success, or non-zero if none
+  *
+  * Like otfs_iterator_start(), but otfs_iterator_next() then stops at the end
+  * of the range.  IDs are ordered as byte strings, e.g. by OUI first.
+  */
+int otfs_iterator_range(void* handle, otfs_t* fs, ot_u8* eui64_bytes, const ot_u8* lo, const ot_u8* hi);
+
+
+/** @brief Start iterating over the FS with IDs having a given OUI
+  * @param handle       (void*) otfs handle
+  * @param fs           (otfs_t*) Result Variable for the first FS with the OUI
+  * @param eui64_bytes  (ot_u8*) Result Variable for its ID, 8 bytes
+  * @param oui24        (const ot_u8*) OUI, 3 bytes
+  * @retval             (int) return zero on success, or non-zero if none
+  *
+  * Same as otfs_iterator_range() over the IDs from oui24:0000000000 to
+  * oui24:FFFFFFFFFF.
+  */
+int otfs_iterator_prefix(void* handle, otfs_t* fs, ot_u8* eui64_bytes, const ot_u8* oui24);
+
+
+/** @brief Start a scan of the FS group, or a partition of it
+  * @param handle   (void*) otfs handle
+  * @param scan     (otfs_scan_t*) Scan cursor to initialize
+  * @param part     (unsigned int) Partition to scan, 0 to parts-1
+  * @param parts    (unsigned int) Number of partitions, 1 to 256
+  * @retval         (int) return zero on success, or non-zero on error
+  *
+  * Partitions are disjoint, so a group can be scanned by "parts" threads, each
+  * with its own partition.  Use part=0, parts=1 to scan the whole group.  With
+  * Judy, the partitions split the range of UIDs in the group at the time of
+  * the call, so start the scans of all partitions before changing the group.
+  */
+int otfs_scan_init(void* handle, otfs_scan_t* scan, unsigned int part, unsigned int parts);
+
+
+/** @brief Get the next FS in a scan
+  * @param scan     (otfs_scan_t*) Scan cursor from otfs_scan_init()
+  * @param fs       (otfs_t*) Result Variable for FS (uid, base, alloc)
+  * @retval         (int) return zero on success, 1 at the end, or negative on error
+  *
+  * Unlike otfs_iterator_next(), the active FS is not changed by scanning.
+  */
+int otfs_scan_next(otfs_scan_t* scan, otfs_t* fs);
+
+
+/** @brief Get statistics of the FS group
+  * @param handle   (void*) otfs handle
+  * @param stats    (otfs_stats_t*) Result Variable for statistics
+  * @retval         (int) return zero on success, or non-zero on error
+  *
+  * All members are of the group, except the page cache counters, which are of
+  * the cache shared by all groups.
+  */
+int otfs_stats(void* handle, otfs_stats_t* stats);
+
+
+/** @brief Get the usage of the heaps of an FS
+  * @param handle   (void*) otfs handle
+  * @param fs       (const otfs_t*) FS with the uid set, or NULL for the selected FS
+  * @param stats    (otfs_fsstats_t*) Result Variable for statistics
+  * @retval         (int) return zero on success, or non-zero on error
+  *
+  * If fs is not NULL, the FS is selected first, as by otfs_setfs().  Only
+  * the file headers are read, so this is cheap enough to poll.  The free
+  * bytes of a block are fragmented if its largest_gap is less than alloc -
+  * used.
+  */
+int otfs_fsstats(void* handle, const otfs_t* fs, otfs_fsstats_t* stats);
+
+
+/** @brief Compact the GFB and ISF heaps of an FS
+  * @param handle   (void*) otfs handle
+  * @param fs       (const otfs_t*) FS with the uid set, or NULL for the selected FS
+  * @param max_bytes (size_t) Most bytes of file data to move per block, 0 for all
+  * @retval         (int) 0 if compact, 1 if there is more to move, or negative on error
+  *
+  * If fs is not NULL, the FS is selected first, as by otfs_setfs().  It is
+  * vl_defrag() on the GFB, then on the ISF once the GFB is compact.  Call it
+  * with a budget until it returns 0, e.g. between messages, to compact a
+  * fragmented FS without a long pause.  Requires OT_FEATURE_VLNEW.
+  */
+int otfs_defrag(void* handle, const otfs_t* fs, size_t max_bytes);
+
+
+/** @brief Set the number of FS images that are kept hot
+  * @param handle   (void*) otfs handle
+  * @param hot_max  (size_t) Max number of hot images, or 0 for no limit
+  * @retval         (int) return zero on success, or non-zero on error
+  *
+  * Requires OT_FEATURE_VLCOLD.  The idle images past hot_max are stored as a
+  * compact delta from their template, and otfs_setfs() rebuilds them when
+  * they are selected.  So, fs->base from otfs_setfs() is only valid until
+  * another FS is selected, and the images in the group must be from
+  * otfs_load_defaults() or otfs_load_template().
+  */
+int otfs_hotset(void* handle, size_t hot_max);
+
+
+/** @brief Save all FS of a group, with a pool of threads
+  * @param handle   (void*) otfs handle
+  * @param path     (const char*) Snapshot file, or directory
+  * @param nthreads (int) Number of threads to use, including the caller
+  * @retval         (int) return zero on success, or negative on error
+  *
+  * If path is a directory, each FS is saved to a file in it, named by the 16
+  * hex digits of the UID bytes, which has the plain image.  Otherwise, path
+  * is a snapshot file, as from otfs_snapshot_save().  The images are copied
+  * and written by nthreads threads.  Without OT_FEATURE_VLTHREADS, only the
+  * calling thread is used.  The errors are as for otfs_snapshot_save().
+  */
+int otfs_save_group(void* handle, const char* path, int nthreads);
+
+
+/** @brief Load FS into a group, with a pool of threads
+  * @param handle   (void*) otfs handle
+  * @param path     (const char*) Snapshot file, or directory
+  * @param nthreads (int) Number of threads to use, including the caller
+  * @retval         (int) number of FS loaded, or negative on error
+  *
+  * Loads a snapshot file, or a directory from otfs_save_group(), into the
+  * group.  Unlike otfs_snapshot_open(), each image is read into memory from
+  * vl_multifs_alloc(), so the file is not used afterwards.  The images are
+  * read and checked by nthreads threads, and each thread adds them to the
+  * group in batches.  The runtime state of each FS is initialized when it is
+  * first selected.  Without OT_FEATURE_VLTHREADS, only the calling thread is
+  * used.  On error, the FS that were loaded stay in the group, and the return
+  * is -1 if path can't be opened, -2 if it has a bad image or a UID that is
+  * already in the group, or -3 if out of memory.
+  */
+int otfs_load_group(void* handle, const char* path, int nthreads);
+
+
+/** @brief Save all FS of a group to a snapshot file
+  * @param handle   (void*) otfs handle
+  * @param path     (const char*) Path of the snapshot file
+  * @retval         (int) return zero on success, or negative on error
+  *
+  * The file is written to path.tmp and renamed to path, so an old snapshot
+  * at path is replaced only by a complete new one.  COW and cold images are
+  * saved as full images.  The FS should be idle while they are saved.
+  * Returns -1 on a bad argument, -2 on an I/O error, -3 if out of memory.
+  */
+int otfs_snapshot_save(void* handle, const char* path);
+
+
+/** @brief Make a new group from a snapshot file
+  * @param handle   (void**) Result Variable for the new otfs handle
+  * @param path     (const char*) Path of the snapshot file
+  * @retval         (int) return zero on success, or negative on error
+  *
+  * The file is mapped privately, and the images are used where they are in
+  * the mapping, so the time to open a snapshot depends only on the size of
+  * its index.  Images are read from the file when they are first used, and
+  * writes to them are private: the file is not changed.  The group is freed
+  * with otfs_deinit() as usual, which unmaps the file.  Returns -1 if the
+  * file can't be opened, -2 if it isn't a valid snapshot, -3 if out of memory.
+  */
+int otfs_snapshot_open(void** handle, const char* path);
+
+
+/** @brief Make a new group from a snapshot file, which keeps its writes
+  * @param handle   (void**) Result Variable for the new otfs handle
+  * @param path     (const char*) Path of the snapshot file
+  * @retval         (int) return zero on success, or negative on error
+  *
+  * Requires OT_FEATURE_VLMMAP.  Same as otfs_snapshot_open(), but the file is
+  * mapped shared, so writes to the images go to the file, and the group can
+  * be attached again after the process restarts.  FS can't be added to the
+  * file this way: new FS are only in memory, unless otfs_snapshot_save()
+  * writes a new file.
+  */
+int otfs_snapshot_attach(void** handle, const char* path);
+
+
+/** @brief Make a new group from a snapshot file, paged in from the file
+  * @param handle   (void**) Result Variable for the new otfs handle
+  * @param path     (const char*) Path of the snapshot file
+  * @retval         (int) return zero on success, or negative on error
+  *
+  * Requires OT_FEATURE_VLPAGED and OT_FEATURE_VLCOW.  Each FS of the snapshot
+  * is a paged image, as from otfs_new_paged(), so the group may be bigger
+  * than memory.  Writes go back to the file.  The group must be freed with
+  * otfs_deinit() and a free_fn, so that the dirty blocks are written back.
+  * Returns as otfs_snapshot_open().
+  */
+int otfs_snapshot_page(void** handle, const char* path);
+
+
+/** @brief Sync the writes to the selected FS to its file
+  * @param handle   (void*) otfs handle
+  * @retval         (int) return zero on success, or negative on error
+  *
+  * With OT_FEATURE_VLMMAP, the pages of the selected image that were written
+  * since the FS was selected, or last synced, are written to the file of the
+  * image with msync().  The writes are already in the page cache, so another
+  * process or a later run sees them anyway, but they may be lost on a crash
+  * of the system until they are synced.  The written pages of an FS that was
+  * selected before are kept when another is selected, and are synced too.
+  * With OT_FEATURE_VLPAGED, if the
+  * selected FS is paged, its dirty blocks are written back to its file and
+  * synced.  This does nothing for images that are not from a file.  Returns
+  * -2 if the sync fails.
+  */
+int otfs_sync(void* handle);
+
+
 #endif
@@ -98,24 +98,37 @@ typedef struct OT_PACKED {
 #   undef   AUTH_NUM_ELEMENTS
 #   define  AUTH_NUM_ELEMENTS   3
 
-    static uint32_t dlls_nonce;
-    static ot_uint  dlls_size   = 0;
-
+    // The key tables follow the active FS, so they are kept together in a
+    // struct that can be swapped via auth_settable().  With VLTHREADS, the
+    // active table is per-thread just like the Veelite context.
+    typedef struct {
+        uint32_t    nonce;
+        ot_uint     size;
+        
 #   if (AUTH_NUM_ELEMENTS >= 0)
-    // Static allocation:
-    // First two elements are root and admin for the active device.
-    static authctx_t    dlls_ctx[AUTH_NUM_ELEMENTS];
-    static authinfo_t   dlls_info[AUTH_NUM_ELEMENTS];
+        // Static allocation:
+        // First two elements are root and admin for the active device.
+        authctx_t   ctx[AUTH_NUM_ELEMENTS];
+        authinfo_t  info[AUTH_NUM_ELEMENTS];
     
 #   elif (AUTH_NUM_ELEMENTS < 0)
-    // Dynamic Allocation:
-    // Is allocated at time of initialization.
-    // Must be at least 2 elements.
-    // Items will only be cleared during deinit/delete.
-    static authctx_t* dlls_ctx = NULL;
-    static authinfo_t* dlls_info = NULL;
+        // Dynamic Allocation:
+        // Is allocated at time of initialization.
+        // Must be at least 2 elements.
+        // Items will only be cleared during deinit/delete.
+        authctx_t*  ctx;
+        authinfo_t* info;
     
 #   endif
+    } authtab_t;
+
+    static authtab_t authtab_default;
+    static VL_TLS authtab_t* authtab = &authtab_default;
+
+#   define dlls_nonce   (authtab->nonce)
+#   define dlls_size    (authtab->size)
+#   define dlls_ctx     (authtab->ctx)
+#   define dlls_info    (authtab->info)
 
 #else
 #   undef   AUTH_NUM_ELEMENTS
@@ -293,6 +306,28 @@ void auth_deinit(void) {
 
 
 
+#ifndef EXTF_auth_get_tablesize
+ot_uint auth_get_tablesize(void) {
+#if (_SEC_ANY)
+    return sizeof(authtab_t);
+#else
+    return 0;
+#endif
+}
+#endif
+
+
+
+#ifndef EXTF_auth_settable
+void auth_settable(void* table) {
+#if (_SEC_ANY)
+    authtab = (table != NULL) ? (authtab_t*)table : &authtab_default;
+#endif
+}
+#endif
+
+
+
 #ifndef EXTF_auth_putnonce
 void auth_putnonce(void* dst, ot_uint total_size) {
 #if (_SEC_ANY)
@@ -39,6 +39,11 @@
 #include <otsys/veelite.h>
 #include <otsys/time.h>
 
+#if ((OT_FEATURE(VLIDINDEX) == ENABLED) || (OT_FEATURE(VLFREEINDEX) == ENABLED) \
+  || (OT_FEATURE(VLFDTABLE) == ENABLED))
+#   include <stdlib.h>
+#endif
+
 #if defined(__C2000__)
 #   define LSB16(_x)        (_x&0xFF)
 #   define MSB16(_x)        (_x>>8)
@@ -55,15 +60,137 @@
 
 
 
-// You can open a finite number of files simultaneously
-static vlFILE vlfile[OT_PARAM(VLFPS)];
+/** Veelite runtime context
+  * The open-file table, the registered vlactions and the FS header mirror are
+  * kept together, so they can be swapped as a unit.  With MultiFS, each FS in
+  * the group owns a context and vl_setctx() is used to switch between them.
+  * VL_TLS makes the active context per-thread, when VLTHREADS is enabled.
+  */
+#if (OT_FEATURE(VLIDINDEX) == ENABLED)
+/** File ID index
+  * For each of GFB (0) and ISF (1), slot[] has the header number of each file
+  * ID, or IDINDEX_NONE.  A block is indexed on its first lookup, and the index
+  * is for one image and one header table: it is rebuilt if either changes.
+  * Blocks with IDINDEX_NONE headers or more are not indexed.
+  */
+#define IDINDEX_NONE    0xFF
+#define IDINDEX_BLOCKS  2
+
+typedef struct {
+    const void* fs[IDINDEX_BLOCKS];
+    vaddr       header[IDINDEX_BLOCKS];
+    ot_u16      num[IDINDEX_BLOCKS];
+    ot_u8       slot[IDINDEX_BLOCKS][256];
+} vlidindex_t;
+#endif
+
+#if (OT_FEATURE(VLFREEINDEX) == ENABLED)
+/** Free space index
+  * For each of GFB (0) and ISF (1), the free extents of the heap, sorted by
+  * base and sorted by size (then base), so best-fit is a binary search.  Like
+  * the file ID index, a block is indexed when it is first needed, for one
+  * image, header table and heap, and vl_new() and vl_delete() keep it up to
+  * date.  A block can have no more than 256 files, so 257 extents.
+  */
+#define FREEINDEX_BLOCKS    2
+#define FREEINDEX_MAX       257
+
+typedef struct {
+    ot_u16  base;
+    ot_u16  size;
+} vlextent_t;
+
+typedef struct {
+    const void* fs;
+    vaddr       header;
+    ot_u16      num;
+    ot_u32      heap_base;
+    ot_u32      heap_end;
+    ot_int      count;
+    vlextent_t  by_base[FREEINDEX_MAX];
+    vlextent_t  by_size[FREEINDEX_MAX];
+} vlfreeblock_t;
+
+typedef struct {
+    vlfreeblock_t block[FREEINDEX_BLOCKS];
+} vlfreeindex_t;
+#endif
 
+#if (OT_FEATURE(VLFDTABLE) == ENABLED)
+/** Open-file table
+  * The first OT_PARAM_VLFPS descriptors are in the context.  When they are all
+  * open, the table grows by a chunk of OT_PARAM_VLFDCHUNK descriptors, up to
+  * OT_PARAM_VLFDMAX, and the chunks are kept until vl_freectx().  The free
+  * descriptors are in a list, in fdnext[] for those in the context and in
+  * next[] for those in a chunk, so a descriptor is taken and given back in
+  * O(1).  -1 ends the list.
+  */
+#define FDCHUNK         OT_PARAM(VLFDCHUNK)
+#define FDCHUNKS        ((OT_PARAM(VLFDMAX) - OT_PARAM(VLFPS) + FDCHUNK - 1) / FDCHUNK)
+
+typedef struct {
+    vlFILE  file[FDCHUNK];
+    ot_int  next[FDCHUNK];
+} vlfdchunk_t;
+
+typedef struct {
+    ot_int       chunks;
+    vlfdchunk_t* chunk[FDCHUNKS];
+} vlfdtable_t;
+#endif
 
-// If file actions are enabled, you can have a certain number of callbacks
-#if (OT_FEATURE(VLACTIONS))
-static ot_procv vlaction[OT_PARAM(VLACTIONS)];
-static ot_u8    vlaction_users[OT_PARAM(VLACTIONS)];
+typedef struct {
+    // You can open a finite number of files simultaneously
+    vlFILE      file[OT_PARAM(VLFPS)];
 
+    // With the growable file table, the free list and the chunks past file[]
+#   if (OT_FEATURE(VLFDTABLE) == ENABLED)
+    ot_int      fdfree;
+    ot_int      fdnext[OT_PARAM(VLFPS)];
+    vlfdtable_t* fdtable;
+#   endif
+    
+    // If file actions are enabled, you can have a certain number of callbacks
+#   if (OT_FEATURE(VLACTIONS))
+    ot_procv    action[OT_PARAM(VLACTIONS)];
+    ot_u8       action_users[OT_PARAM(VLACTIONS)];
+#   endif
+
+    // If creating new files is permitted, then we store a mirror of the filesystem header.
+#   if (OT_FEATURE(VLNEW) == ENABLED)
+    vlFSHEADER  fs;
+#   endif
+
+    // The file ID index is allocated on the first lookup
+#   if (OT_FEATURE(VLIDINDEX) == ENABLED)
+    vlidindex_t* idindex;
+#   endif
+
+    // The free space index is allocated on the first new file
+#   if (OT_FEATURE(VLFREEINDEX) == ENABLED)
+    vlfreeindex_t* freeindex;
+#   endif
+} vlctx_t;
+
+static vlctx_t vlctx_default;
+static VL_TLS vlctx_t* vlctx = &vlctx_default;
+
+#define vlfile          (vlctx->file)
+#define vlaction        (vlctx->action)
+#define vlaction_users  (vlctx->action_users)
+#define vlfs            (vlctx->fs)
+
+/// The open-file table, as descriptors 0 to FD_COUNT()-1
+#if (OT_FEATURE(VLFDTABLE) == ENABLED)
+#   define FD_CHUNK(FD)     (vlctx->fdtable->chunk[((FD) - OT_PARAM(VLFPS)) / FDCHUNK])
+#   define FD_INDEX(FD)     (((FD) - OT_PARAM(VLFPS)) % FDCHUNK)
+#   define FD_COUNT()       (OT_PARAM(VLFPS) + \
+                            ((vlctx->fdtable != NULL) ? (vlctx->fdtable->chunks * FDCHUNK) : 0))
+#   define FD_FILE(FD)      (((FD) < OT_PARAM(VLFPS)) ? &vlfile[FD] : &FD_CHUNK(FD)->file[FD_INDEX(FD)])
+#   define FD_NEXT(FD)      (*(((FD) < OT_PARAM(VLFPS)) ? &vlctx->fdnext[FD] : &FD_CHUNK(FD)->next[FD_INDEX(FD)]))
+#else
+#   define FD_COUNT()       OT_PARAM(VLFPS)
+#   define FD_FILE(FD)      (&vlfile[FD])
 #endif
 
 
@@ -80,14 +207,6 @@ static ot_u8    vlaction_users[OT_PARAM(VLACTIONS)];
 #define FP_ISMIRRORED(fp_VAL) (vworm_read((fp_VAL)->header + 8) != NULL_vaddr)
 
 
-// If creating new files is permitted, then we store a mirror of the filesystem header.
-#if (OT_FEATURE(VLNEW) == ENABLED)
-static vlFSHEADER vlfs;
-
-
-#endif
-
-
 
 
 /** @note Boundary Definitions
@@ -136,6 +255,7 @@ static vlFSHEADER vlfs;
 typedef ot_u8 (*sub_check)(ot_u8);
 typedef vaddr (*sub_vaddr)(ot_u8);
 typedef vlFILE* (*sub_new)(ot_u8, ot_u8, ot_u8);
+typedef ot_u8 (*sub_defrag)(ot_uint);
 
 
 /** VWORM Memory Allocation
@@ -158,6 +278,8 @@ static ot_u8 sub_gfb_delete_check(ot_u8 id);
 static ot_u8 sub_isf_delete_check(ot_u8 id);
 static vaddr sub_gfb_search(ot_u8 id);
 static vaddr sub_isf_search(ot_u8 id);
+static ot_u8 sub_gfb_defrag(ot_uint max_bytes);
+static ot_u8 sub_isf_defrag(ot_uint max_bytes);
 
 
 /** @brief Performs mirroring operations on ISF files
@@ -172,7 +294,11 @@ static ot_u8 sub_isf_mirror(ot_u8 direction);
 
 
 static vlFILE* sub_new_fp();
-static vlFILE* sub_new_file(vl_header_t* new_header, vaddr heap_base, vaddr heap_end, vaddr header_base, ot_int header_window );
+static void sub_free_fp(vlFILE* fp);
+#if (OT_FEATURE(VLFDTABLE) == ENABLED)
+static void sub_fdtable_reset(vlctx_t* ctx);
+#endif
+static vlFILE* sub_new_file(ot_u8 block, vl_header_t* new_header, vaddr heap_base, vaddr heap_end, vaddr header_base, ot_int header_window );
 static void sub_delete_file(vaddr del_header);
 static void sub_copy_header(vl_header_t* output_header, vaddr header);
 
@@ -208,34 +334,56 @@ static vaddr sub_find_empty_header(vaddr header, ot_int num_headers);
 
 
 /** @brief Searches for an amount of the empty space in the heap
-  * @param base : (vaddr*) physical pointer to the @c base @c file of a header
-  * @param alloc: (size_t) number of bytes needed to allocate
-  * @param header_size : (size_t) number of bytes in the given header type
+  * @param block : (ot_u8) 0 for GFB, 1 for ISF
+  * @param heap_base : (vaddr) base of the heap to search
+  * @param heap_end : (vaddr) end of the heap to search
+  * @param header : (vaddr) first header of the files in the heap
+  * @param new_alloc : (ot_uint) number of bytes needed to allocate
   * @param num_headers : (ot_int) number of headers to search through
   * @retval vaddr : virtual address of the spot in heap to put data.
   *                 returns @c NULL_vaddr @c if heap has no room
   *
-  * @c sub_find_empty_heap() @c runs in quadratic time based on the @c num_headers
-  * parameter.  Implementations on systems that are less memory constrained
-  * could be made faster.  @c sub_find_empty_heap() @c only runs when adding a ISF
-  * file, which may never even happen.
+  * The smallest gap that is big enough is used.  With VLFREEINDEX, the gaps
+  * are kept in the free space index, and the search is a binary search.
+  * Otherwise, the files are sorted by base, which takes linear time when the
+  * headers are already in the order of their data.
   */
-static vaddr sub_find_empty_heap(  vaddr heap_base, vaddr heap_end,
+static vaddr sub_find_empty_heap(  ot_u8 block, vaddr heap_base, vaddr heap_end,
                         vaddr header, ot_uint new_alloc, ot_int num_headers);
 
 
 
+/** @brief Returns the heap space of a deleted file to the free space index
+  * @param header : (vaddr) header of the file, before it is marked deleted
+  * @retval none
+  */
+static void sub_freeindex_put(vaddr header);
+
+
+
+/** @brief Drops the free space index of a block, after its files are moved
+  * @param header : (vaddr) first header of the block
+  * @retval none
+  */
+static void sub_freeindex_reset(vaddr header);
+
+
+
 /** @brief Defragments a given heap space
-  * @param base : (vaddr) base vaddr of the heap space to defragment
-  * @param size : (size_t) number of bytes in heap space
-  * @retval vaddr : Non-zero on failure
+  * @param header : (vaddr) first header of the files in the heap
+  * @param num_headers : (ot_int) number of headers
+  * @param heap_base : (vaddr) base of the heap to defragment
+  * @param heap_end : (vaddr) end of the heap to defragment
+  * @param max_bytes : (ot_uint) most bytes of data to move, 0 for no limit
+  * @retval ot_u8 : 0 if the heap is compact, 1 if there is more to move
   *
   * Run this function to clean out fragmented empty space in a heap.  For
-  * example, if @c sub_find_empty_heap() @c returns NULL_vaddr
-  *
-  * Not implemented at time being.
+  * example, if @c sub_find_empty_heap() @c returns NULL_vaddr.  The files
+  * are slid down to the base of the heap in the order of their data, one
+  * whole file at a time, so a call moves at least one file if there is a gap.
   */
-static ot_u8 sub_defragment_heap(vaddr base, ot_uint window);
+static ot_u8 sub_defragment_heap(vaddr header, ot_int num_headers,
+                                 vaddr heap_base, vaddr heap_end, ot_uint max_bytes);
 
 
 
@@ -251,6 +399,54 @@ static vaddr sub_header_search(vaddr header, ot_u8 search_id, ot_int num_headers
 
 
 
+/** @brief Searches for a header by ID, using the file ID index if enabled
+  * @param block : (ot_u8) 0 for GFB, 1 for ISF
+  * @param header : (vaddr) first header of the block
+  * @param search_id : (ot_u8) ID to search for
+  * @param num_headers : (ot_int) number of headers of the block
+  * @retval vaddr : header of the file, or NULL_vaddr if not found
+  */
+static vaddr sub_header_lookup(ot_u8 block, vaddr header, ot_u8 search_id, ot_int num_headers);
+
+
+
+/** @brief Updates the file ID index after a file is created or deleted
+  * @param block : (ot_u8) 0 for GFB, 1 for ISF
+  * @param id : (ot_u8) ID of the file
+  * @param header : (vaddr) header of the file, or NULL_vaddr if deleted
+  * @retval none
+  */
+static void sub_idindex_set(ot_u8 block, ot_u8 id, vaddr header);
+
+
+
+/** @brief Gets the usage of the heap of a block, from its headers
+  * @param stats : (vlBLOCKSTATS*) output statistics
+  * @param header : (vaddr) first header of the block
+  * @param num_headers : (ot_int) number of headers of the block
+  * @param heap_base : (ot_u32) base of the heap of the block
+  * @param heap_end : (ot_u32) end of the heap of the block
+  * @retval none
+  */
+static void sub_block_stats(vlBLOCKSTATS* stats, vaddr header, ot_int num_headers,
+                            ot_u32 heap_base, ot_u32 heap_end);
+
+
+
+/** @brief Gets the heap extents of the files of a block, sorted by base
+  * @param ext_base : (ot_u32*) output bases, room for 256
+  * @param ext_end : (ot_u32*) output ends, room for 256
+  * @param ext_header : (vaddr*) output headers, room for 256, or NULL
+  * @param header : (vaddr) first header of the block
+  * @param num_headers : (ot_int) number of headers of the block
+  * @param stats : (vlBLOCKSTATS*) file counts are added to it, or NULL
+  * @retval ot_int : number of extents
+  */
+static ot_int sub_block_extents(ot_u32* ext_base, ot_u32* ext_end, vaddr* ext_header,
+                                vaddr header, ot_int num_headers, vlBLOCKSTATS* stats);
+
+
+
 
 static ot_u8 sub_action(vlFILE* fp);
 
@@ -268,10 +464,69 @@ static ot_u8 sub_action(vlFILE* fp);
 #   include <otplatform.h>
 #endif
 
+#ifndef EXTF_vl_get_ctxsize
+OT_WEAK ot_uint vl_get_ctxsize(void) {
+    return sizeof(vlctx_t);
+}
+#endif
+
+
+#ifndef EXTF_vl_setctx
+OT_WEAK void vl_setctx(void* handle) {
+    vlctx = (handle != NULL) ? (vlctx_t*)handle : &vlctx_default;
+}
+#endif
+
+
+#ifndef EXTF_vl_freectx
+OT_WEAK void vl_freectx(void* handle) {
+    vlctx_t* ctx = (handle != NULL) ? (vlctx_t*)handle : vlctx;
+
+#   if (OT_FEATURE(VLIDINDEX) == ENABLED)
+    free(ctx->idindex);
+    ctx->idindex = NULL;
+#   endif
+#   if (OT_FEATURE(VLFREEINDEX) == ENABLED)
+    free(ctx->freeindex);
+    ctx->freeindex = NULL;
+#   endif
+#   if (OT_FEATURE(VLFDTABLE) == ENABLED)
+    if (ctx->fdtable != NULL) {
+        for (ot_int i=0; i<ctx->fdtable->chunks; i++) {
+            free(ctx->fdtable->chunk[i]);
+        }
+        free(ctx->fdtable);
+        ctx->fdtable = NULL;
+    }
+    sub_fdtable_reset(ctx);
+#   endif
+    (void)ctx;
+}
+#endif
+
+
 #ifndef EXTF_vl_init
 OT_WEAK ot_u8 vl_init(void* handle) {
     ot_int i;
 
+    /// A non-NULL handle is a context to select and initialize.  It may be
+    /// uninitialized memory, so it has no index to free.
+    if (handle != NULL) {
+        vl_setctx(handle);
+#       if (OT_FEATURE(VLIDINDEX) == ENABLED)
+        vlctx->idindex = NULL;
+#       endif
+#       if (OT_FEATURE(VLFREEINDEX) == ENABLED)
+        vlctx->freeindex = NULL;
+#       endif
+#       if (OT_FEATURE(VLFDTABLE) == ENABLED)
+        vlctx->fdtable = NULL;
+#       endif
+    }
+    else {
+        vl_freectx(NULL);
+    }
+
     /// Initialize vlactions, if enabled
 #   if (OT_FEATURE(VLACTIONS))
     memset(vlaction, 0, sizeof(vlaction));
@@ -287,6 +542,9 @@ OT_WEAK ot_u8 vl_init(void* handle) {
 //        vlfile[i].read     = NULL;
 //        vlfile[i].write    = NULL;
     }
+#   if (OT_FEATURE(VLFDTABLE) == ENABLED)
+    sub_fdtable_reset(vlctx);
+#   endif
 
     /// Initialize core
     /// @note This should be done already in platform_poweron()
@@ -415,22 +673,75 @@ OT_WEAK ot_u32 vl_get_fsalloc(const vlFSHEADER* fshdr) {
 
 
 
+#ifndef EXTF_vl_fsstats
+OT_WEAK ot_u8 vl_fsstats(vlIMAGESTATS* stats) {
+    vlFSHEADER  fshdr;
+    ot_u16      fshdr_u16[sizeof(vlFSHEADER)/2];
+    vaddr       header;
+    ot_u32      heap;
+
+    if (stats == NULL) {
+        return 255;
+    }
+
+    /// The FS header is read through vworm_read(), like the file headers, so
+    /// this works on any image the core has selected.
+    for (ot_int i=0; i<(sizeof(vlFSHEADER)/2); i++) {
+        fshdr_u16[i] = vworm_read(OVERHEAD_START_VADDR + (i*2));
+    }
+    memcpy(&fshdr, fshdr_u16, sizeof(vlFSHEADER));
+    stats->image_bytes  = vl_get_fsalloc(&fshdr);
+    stats->table_bytes  = fshdr.ftab_alloc;
+
+    /// Headers are in the order GFB, ISS, ISF, and so are the heaps
+    header  = GFB_Header_START;
+    heap    = OVERHEAD_START_VADDR + fshdr.ftab_alloc;
+    sub_block_stats(&stats->gfb, header, fshdr.gfb.files, heap, heap+fshdr.gfb.alloc);
+    header += fshdr.gfb.files * OCTETS_IN_vl_header_t;
+    heap   += fshdr.gfb.alloc;
+    sub_block_stats(&stats->iss, header, fshdr.iss.files, heap, heap+fshdr.iss.alloc);
+    header += fshdr.iss.files * OCTETS_IN_vl_header_t;
+    heap   += fshdr.iss.alloc;
+    sub_block_stats(&stats->isf, header, fshdr.isf.files, heap, heap+fshdr.isf.alloc);
+
+    return 0;
+}
+#endif
+
+
+
+
 // General File Functions
 #ifndef EXTF_vl_get_fp
 OT_WEAK vlFILE* vl_get_fp(ot_int fd) {
+#   if (OT_FEATURE(VLFDTABLE) == ENABLED)
+    if ((fd < 0) || (fd >= FD_COUNT()) || (FD_FILE(fd)->read == NULL)) {
+        return NULL;
+    }
+    return FD_FILE(fd);
+#   else
     return &vlfile[fd];
+#   endif
 }
 #endif
 
 
 #ifndef EXTF_vl_get_fd
 OT_WEAK ot_int vl_get_fd(vlFILE* fp) {
+#   if (OT_FEATURE(VLFDTABLE) == ENABLED)
+    if ((fp != NULL) && (fp->read != NULL) && (fp->fd >= 0) && (fp->fd < FD_COUNT())
+    &&  (FD_FILE(fp->fd) == fp)) {
+        return fp->fd;
+    }
+    return -1;
+#   else
     ot_uint fd;
 
     fd  = (ot_int)((vl_u8*)fp - (vl_u8*)vlfile);
     fd /= sizeof(vlFILE);
 
     return (fd < OT_PARAM(VLFPS)) ? (ot_int)fd : -1;
+#   endif
 }
 #endif
 
@@ -483,6 +794,7 @@ OT_WEAK ot_u8 vl_new(vlFILE** fp_new, vlBLOCK block_id, ot_u8 data_id, ot_u8 mod
     if (*fp_new == NULL) {
         return 0x06;
     }
+    sub_idindex_set(block_id >> 1, data_id, (*fp_new)->header);
     
     /// 4. Update the filesystem header, on successful file creation.
     {   vlBLOCKHEADER* block    = &vlfs.gfb;
@@ -554,6 +866,7 @@ OT_WEAK ot_u8 vl_delete(vlBLOCK block_id, ot_u8 data_id, const id_tmpl* user_id)
     
     /// 4. Delete the file, and update the fs header.
     sub_delete_file(header);
+    sub_idindex_set(block_id >> 1, data_id, NULL_vaddr);
     {   vlBLOCKHEADER* block    = &vlfs.gfb;
         block[block_id].files  -= 1;
     }
@@ -569,6 +882,29 @@ OT_WEAK ot_u8 vl_delete(vlBLOCK block_id, ot_u8 data_id, const id_tmpl* user_id)
 
 
 
+#ifndef EXTF_vl_defrag
+OT_WEAK ot_u8 vl_defrag(vlBLOCK block_id, ot_uint max_bytes) {
+#if (OT_FEATURE(VLNEW) == ENABLED)
+    sub_defrag defrag_fn;
+
+    block_id--;
+    switch (block_id) {
+        case 0: defrag_fn = &sub_gfb_defrag;    break;
+        case 2: defrag_fn = &sub_isf_defrag;    break;
+       default: return 255;
+    }
+
+    return defrag_fn(max_bytes);
+
+#else
+    return 255;
+
+#endif
+}
+#endif
+
+
+
 #ifndef EXTF_vl_getheader_vaddr
 OT_WEAK ot_u8 vl_getheader_vaddr(vaddr* header, vlBLOCK block_id, ot_u8 data_id, ot_u8 mod, const id_tmpl* user_id) {
 
@@ -824,6 +1160,53 @@ OT_WEAK vl_u8* vl_memptr( vlFILE* fp ) {
 
 
 
+#ifndef EXTF_vl_span
+OT_WEAK ot_u8 vl_span( vlFILE* fp, ot_uint offset, ot_uint length, const void** ptr ) {
+    const void* span = NULL;
+    ot_u8       retval = 255;
+
+    if ((ptr != NULL) && FP_ISVALID(fp) && (length != 0)
+    &&  (((ot_u32)offset + length) <= fp->length)) {
+        /// Mirrored files are copied back to VWORM on vl_close(), so only
+        /// the VWORM data of a file is given out
+        if (fp->read == &vworm_read) {
+            span = vworm_span((vaddr)(fp->start + offset), length, False);
+        }
+        if (span != NULL) {
+            fp->flags  |= VL_FLAG_SPAN;
+            retval      = 0;
+        }
+        else {
+            retval      = 1;
+        }
+    }
+    if (ptr != NULL) {
+        *ptr = span;
+    }
+    return retval;
+}
+#endif
+
+
+/// Bulk copy: a file that is not mirrored is in VWORM, and the driver may have
+/// the range of it in one piece of memory, which is then copied in one step.
+/// Otherwise, the data is copied 16 bits at a time via fp->read/write.
+#if ((OT_FEATURE(VLBULK) == ENABLED) && !defined(__C2000__))
+#   define VL_BULK  1
+#else
+#   define VL_BULK  0
+#endif
+
+#if (VL_BULK)
+static vl_u8* sub_bulk_ptr(vlFILE* fp, ot_uint offset, ot_uint length, ot_bool write) {
+    if (fp->read != &vworm_read) {
+        return NULL;
+    }
+    return (vl_u8*)vworm_span((vaddr)(fp->start + offset), length, write);
+}
+#endif
+
+
 #ifndef EXTF_vl_load
 OT_WEAK ot_uint vl_load( vlFILE* fp, ot_uint length, vl_u8* data ) {
     ot_uint     cursor;
@@ -831,6 +1214,14 @@ OT_WEAK ot_uint vl_load( vlFILE* fp, ot_uint length, vl_u8* data ) {
     if (length > fp->length) {
         length = fp->length;
     }
+#   if (VL_BULK)
+    {   vl_u8* src = sub_bulk_ptr(fp, 0, length, False);
+        if (src != NULL) {
+            ot_memcpy(data, src, length);
+            return length;
+        }
+    }
+#   endif
     cursor      = fp->start;        // guaranteed to be 16 bit aligned
     length      = cursor+length;
 
@@ -865,6 +1256,14 @@ OT_WEAK ot_u8 vl_store( vlFILE* fp, ot_uint length, vl_u8* data ) {
 
     fp->flags  |= (length != fp->length) ? (VL_FLAG_RESIZED|VL_FLAG_MODDED) : VL_FLAG_MODDED;
     fp->length  = length;
+#   if (VL_BULK)
+    {   vl_u8* dst = sub_bulk_ptr(fp, 0, length, True);
+        if (dst != NULL) {
+            ot_memcpy(dst, data, length);
+            return 0;
+        }
+    }
+#   endif
     cursor      = fp->start;
     length      = cursor+length;
 
@@ -891,12 +1290,34 @@ OT_WEAK ot_u8 vl_append( vlFILE* fp, ot_uint length, vl_u8* data ) {
 
     length = (fp->length+length);
     if (length <= fp->alloc) {
+#       if (VL_BULK)
+        vl_u8* dst = sub_bulk_ptr(fp, fp->length, length-fp->length, True);
+        if (dst != NULL) {
+            ot_memcpy(dst, data, length-fp->length);
+            fp->length  = length;
+            fp->flags  |= (VL_FLAG_RESIZED|VL_FLAG_MODDED);
+            return 0;
+        }
+#       endif
         cursor      = fp->start + fp->length;
         fp->length  = length;
         length     += cursor;
         fp->flags  |= (VL_FLAG_RESIZED|VL_FLAG_MODDED);
+        test        = 0;
+
+#       if !defined(__C2000__)
+        /// The last byte of a file of odd length shares its word with the
+        /// first byte appended, so it must be kept
+        if ((cursor & 1) && (cursor < length)) {
+            ot_uni16 scratch;
+            scratch.ushort      = fp->read(cursor);
+            scratch.ubyte[1]    = *data++;
+            test               |= fp->write(cursor, scratch.ushort);
+            cursor++;
+        }
+#       endif
 
-        for (test=0; cursor<length; cursor+=2) {
+        for (; cursor<length; cursor+=2) {
 #       if !defined(__C2000__)
             ot_uni16 scratch;
             scratch.ubyte[0]    = *data++;
@@ -934,6 +1355,14 @@ OT_WEAK ot_u8 vl_close( vlFILE* fp ) {
     ot_u8 retval = 0;
     ot_u32 epoch_s;
 
+    /// A file that is not open in the table of the active FS is left open, as
+    /// its descriptor could not be given back to the table it is from.
+#   if (OT_FEATURE(VLFDTABLE) == ENABLED)
+    if (vl_get_fd(fp) < 0) {
+        return 255;
+    }
+#   endif
+
     if (FP_ISVALID(fp)) {
 #       if MCU_CONFIG(DATAFLASH)
         if (FP_ISMIRRORED(fp)) {
@@ -988,6 +1417,7 @@ OT_WEAK ot_u8 vl_close( vlFILE* fp ) {
 #       endif
 
         // Kill file attributes
+        sub_free_fp(fp);
         fp->start   = 0;
         fp->length  = 0;
         //fp->header  = NULL_vaddr;
@@ -1135,7 +1565,7 @@ static vlFILE* sub_gfb_new(ot_u8 id, ot_u8 mod, ot_u8 null_arg) {
     new_header.mirror   = NULL_vaddr;
 
     // Find where to put the new data, and if heap is full
-    return sub_new_file(&new_header,
+    return sub_new_file(0, &new_header,
                         GFB_HEAP_USER_START,
                         GFB_HEAP_END,
                         GFB_Header_START_USER,
@@ -1174,7 +1604,7 @@ static vlFILE* sub_isf_new(ot_u8 id, ot_u8 mod, ot_u8 max_length ) {
     new_header.alloc &= ~1;
 
     // Find where to put the new data, and if heap is full
-    return sub_new_file(&new_header,
+    return sub_new_file(1, &new_header,
                         ISF_HEAP_USER_START,
                         ISF_HEAP_END,
                         ISF_Header_START_USER,
@@ -1209,8 +1639,30 @@ static ot_u8 sub_isf_delete_check(ot_u8 id) {
 
 
 
+static ot_u8 sub_gfb_defrag(ot_uint max_bytes) {
+#if ((OT_FEATURE(VLNEW) == ENABLED) && ((GFB_HEAP_BYTES > 0) && (GFB_NUM_USER_FILES > 0)))
+    return sub_defragment_heap( GFB_Header_START_USER, GFB_NUM_USER_FILES,
+                                GFB_HEAP_USER_START, GFB_HEAP_END, max_bytes );
+#else
+    return 0;
+#endif
+}
+
+
+
+static ot_u8 sub_isf_defrag(ot_uint max_bytes) {
+#if ((OT_FEATURE(VLNEW) == ENABLED) && (ISF_NUM_USER_FILES > 0))
+    return sub_defragment_heap( ISF_Header_START_USER, ISF_NUM_USER_FILES,
+                                ISF_HEAP_USER_START, ISF_HEAP_END, max_bytes );
+#else
+    return 0;
+#endif
+}
+
+
+
 static vaddr sub_gfb_search(ot_u8 id) {
-    return sub_header_search( GFB_Header_START, id, GFB_NUM_USER_FILES );
+    return sub_header_lookup(0, GFB_Header_START, id, GFB_NUM_USER_FILES);
 }
 
 
@@ -1219,7 +1671,7 @@ static vaddr sub_isf_search(ot_u8 id) {
 #   if (OT_FEATURE(VLNEW) == ENABLED)
     // Check IDs added by the user during runtime
     if ( (id >= (ISF_NUM_M1_FILES+ISF_NUM_M2_FILES)) && (id < (256-ISF_NUM_EXT_FILES)) ) {
-        return sub_header_search(ISF_Header_START_USER, id, ISF_NUM_USER_FILES);
+        return sub_header_lookup(1, ISF_Header_START_USER, id, ISF_NUM_USER_FILES);
     }
 #   endif
 
@@ -1295,17 +1747,17 @@ static ot_u8 sub_isf_mirror(ot_u8 direction) {
 #else
 
 
+/// The header table of a block has a fixed number of headers (files in the
+/// block header), and a new file goes into the header of a deleted one.
 static vlFILE* sub_gfb_new(ot_u8 id, ot_u8 mod, ot_u8 null_arg) {
 #   if (OT_FEATURE(VLNEW) == ENABLED)
     vl_header_t new_header;
     ot_uni16    idmod;
     vlFSHEADER* fshdr;
-    ot_int      num_files;
     
-    fshdr       = vworm_get(OVERHEAD_START_VADDR);
-    num_files   = fshdr->gfb.files - fshdr->gfb.used;
+    fshdr = vworm_get(OVERHEAD_START_VADDR);
     
-    if (num_files > 0) {
+    if (fshdr->gfb.files > 0) {
         idmod.ubyte[0]  = id;
         idmod.ubyte[1]  = mod;
 
@@ -1316,11 +1768,11 @@ static vlFILE* sub_gfb_new(ot_u8 id, ot_u8 mod, ot_u8 null_arg) {
         new_header.mirror   = NULL_vaddr;
 
         // Find where to put the new data, and if heap is full
-        return sub_new_file(&new_header,
+        return sub_new_file(0, &new_header,
                             fshdr->ftab_alloc,
                             fshdr->ftab_alloc+fshdr->gfb.alloc,
-                            GFB_Header_START + ((fshdr->gfb.used)*sizeof(vl_header_t)),
-                            num_files   );
+                            GFB_Header_START,
+                            fshdr->gfb.files );
     }
 #   endif
     
@@ -1334,12 +1786,10 @@ static vlFILE* sub_isf_new(ot_u8 id, ot_u8 mod, ot_u8 max_length ) {
     vl_header_t new_header;
     ot_uni16    idmod;
     vlFSHEADER* fshdr;
-    ot_int      num_files;
     
-    fshdr       = vworm_get(OVERHEAD_START_VADDR);
-    num_files   = fshdr->isf.files - fshdr->isf.used
+    fshdr = vworm_get(OVERHEAD_START_VADDR);
     
-    if (num_files > 0) {
+    if (fshdr->isf.files > 0) {
         idmod.ubyte[0]  = id;
         idmod.ubyte[1]  = mod;
 
@@ -1354,11 +1804,11 @@ static vlFILE* sub_isf_new(ot_u8 id, ot_u8 mod, ot_u8 max_length ) {
         new_header.alloc &= ~1;
 
         // Find where to put the new data, and if heap is full
-        return sub_new_file(&new_header,
+        return sub_new_file(1, &new_header,
                             fshdr->ftab_alloc + fshdr->gfb.alloc + fshdr->iss.alloc,
                             fshdr->ftab_alloc + fshdr->gfb.alloc + fshdr->iss.alloc + fshdr->isf.alloc,
-                            GFB_Header_START + ((fshdr->gfb.files+fshdr->iss.files+fshdr->isf.used)*sizeof(vl_header_t)),
-                            num_files );
+                            GFB_Header_START + ((fshdr->gfb.files+fshdr->iss.files)*sizeof(vl_header_t)),
+                            fshdr->isf.files );
     }
 #   endif
     
@@ -1366,10 +1816,35 @@ static vlFILE* sub_isf_new(ot_u8 id, ot_u8 mod, ot_u8 max_length ) {
 }
 
 
+#if (OT_FEATURE(VLNEW) == ENABLED)
+/// A block of a runtime-defined FS has the stock files if its header is the
+/// same as in the default FS header, and then the number of files in it is
+/// the stock file count.  Otherwise the block has no stock files.
+static ot_u16 sub_stock_files(ot_u8 block_id) {
+    vlFSHEADER      stock;
+    vlFSHEADER*     fshdr;
+    vlBLOCKHEADER*  have;
+    vlBLOCKHEADER*  want;
+
+    fshdr   = vworm_get(OVERHEAD_START_VADDR);
+    vworm_fsheader_defload(&stock);
+    have    = &(&fshdr->gfb)[block_id];
+    want    = &(&stock.gfb)[block_id];
+
+    if ((have->alloc != want->alloc) || (have->used != want->used) || (have->files != want->files)) {
+        return 0;
+    }
+    return want->files;
+}
+#endif
+
+
+/// The stock files are kept from deletion, as GFB_NUM_STOCK_FILES and the M1,
+/// M2 and EXT counts do without MultiFS.  The search that follows the check
+/// finds if the file exists.
 static ot_u8 sub_gfb_delete_check(ot_u8 id) {
 #   if (OT_FEATURE(VLNEW) == ENABLED)
-    vlFSHEADER* fshdr = vworm_get(OVERHEAD_START_VADDR);
-    return ( id > fshdr->gfb.used );
+    return ( id >= sub_stock_files(0) );
 #   endif
 
     return 0;
@@ -1378,43 +1853,54 @@ static ot_u8 sub_gfb_delete_check(ot_u8 id) {
 
 static ot_u8 sub_isf_delete_check(ot_u8 id) {
 #   if (OT_FEATURE(VLNEW) == ENABLED)
-    ot_uni16        idmod;
-    vlFSHEADER*     fshdr;
-    vl_header_t*    isfhdr;
-    ot_int          i;
-    
-    fshdr   = vworm_get(OVERHEAD_START_VADDR);
-    isfhdr  = (void*)fshdr + sizeof(vlFSHEADER) + ((fshdr->gfb.files+fshdr->iss.files)*sizeof(vl_header_t));
-    i       = fshdr->isf.used-1;
-    
-    while (i >= 0) {
-        idmod.ushort = isfhdr[i].idmod;
-        if (idmod.ubyte[0] == id) {
-            break;
-        }
-        i--;
-    }
-    
-    return (i >= 0);
-    
-#   else
+    ot_u16 stock = sub_stock_files(2);
+    return ((stock == 0) || ((id >= stock) && (id < (256-ISF_NUM_EXT_FILES))));
+#   endif
 
     return 0;
+}
+
+
+static ot_u8 sub_gfb_defrag(ot_uint max_bytes) {
+#   if (OT_FEATURE(VLNEW) == ENABLED)
+    vlFSHEADER* fshdr = vworm_get(OVERHEAD_START_VADDR);
+    return sub_defragment_heap( GFB_Header_START,
+                                fshdr->gfb.files,
+                                fshdr->ftab_alloc,
+                                fshdr->ftab_alloc + fshdr->gfb.alloc,
+                                max_bytes );
 #   endif
+
+    return 0;
+}
+
+
+static ot_u8 sub_isf_defrag(ot_uint max_bytes) {
+#   if (OT_FEATURE(VLNEW) == ENABLED)
+    vlFSHEADER* fshdr = vworm_get(OVERHEAD_START_VADDR);
+    return sub_defragment_heap( GFB_Header_START + ((fshdr->gfb.files+fshdr->iss.files)*sizeof(vl_header_t)),
+                                fshdr->isf.files,
+                                fshdr->ftab_alloc + fshdr->gfb.alloc + fshdr->iss.alloc,
+                                fshdr->ftab_alloc + fshdr->gfb.alloc + fshdr->iss.alloc + fshdr->isf.alloc,
+                                max_bytes );
+#   endif
+
+    return 0;
 }
 
 
 static vaddr sub_gfb_search(ot_u8 id) {
     vlFSHEADER* fshdr;
     fshdr = vworm_get(OVERHEAD_START_VADDR);
-    return sub_header_search( GFB_Header_START, id, fshdr->gfb.files );
+    return sub_header_lookup(0, GFB_Header_START, id, fshdr->gfb.files);
 }
 
 
 static vaddr sub_isf_search(ot_u8 id) {
     vlFSHEADER* fshdr;
     fshdr = vworm_get(OVERHEAD_START_VADDR);
-    return sub_header_search(   GFB_Header_START+((fshdr->gfb.files+fshdr->iss.files)*sizeof(vl_header_t)), 
+    return sub_header_lookup(   1,
+                                GFB_Header_START+((fshdr->gfb.files+fshdr->iss.files)*sizeof(vl_header_t)), 
                                 id, 
                                 fshdr->isf.files);
 }
@@ -1488,23 +1974,98 @@ static ot_u8 sub_isf_mirror(ot_u8 direction) {
 /// Generic Subroutines
 ///@note All these are MULTIFS SAFE
 
+#if (OT_FEATURE(VLFDTABLE) == ENABLED)
+/// Links the free descriptors of the context into the free list.  Those in
+/// chunks are linked when the chunk is added.
+static void sub_fdtable_reset(vlctx_t* ctx) {
+    ctx->fdfree = -1;
+    for (ot_int fd=OT_PARAM(VLFPS)-1; fd>=0; fd--) {
+        if (ctx->file[fd].read == NULL) {
+            ctx->fdnext[fd] = ctx->fdfree;
+            ctx->fdfree     = fd;
+        }
+    }
+}
+
+
+/// Adds a chunk of descriptors to the table of the active context, and puts
+/// them in the free list.  Returns non-zero if the table is full or if there
+/// is no memory.  The descriptors of the last chunk from OT_PARAM_VLFDMAX on
+/// are never put in the list.
+static ot_u8 sub_fdtable_grow(void) {
+    vlfdtable_t* table = vlctx->fdtable;
+    vlfdchunk_t* chunk;
+    ot_int       fd;
+    ot_int       n;
+
+    if (table == NULL) {
+        table = calloc(1, sizeof(vlfdtable_t));
+        if (table == NULL) {
+            return 1;
+        }
+        vlctx->fdtable = table;
+    }
+    if (table->chunks >= FDCHUNKS) {
+        return 1;
+    }
+    chunk = calloc(1, sizeof(vlfdchunk_t));
+    if (chunk == NULL) {
+        return 1;
+    }
+
+    fd  = OT_PARAM(VLFPS) + (table->chunks * FDCHUNK);
+    n   = OT_PARAM(VLFDMAX) - fd;
+    n   = (n < FDCHUNK) ? n : FDCHUNK;
+    for (ot_int i=0; i<FDCHUNK; i++) {
+        chunk->file[i].header   = NULL_vaddr;
+        chunk->next[i]          = (i < (n-1)) ? (fd + i + 1) : vlctx->fdfree;
+    }
+    table->chunk[table->chunks++]   = chunk;
+    vlctx->fdfree                   = fd;
+    return 0;
+}
+#endif
+
+
 static vlFILE* sub_new_fp() {
-#if (OT_PARAM(VLFPS) < 8)
+#if (OT_FEATURE(VLFDTABLE) == ENABLED)
+    vlFILE* fp;
+    ot_int  fd;
+
+    if ((vlctx->fdfree < 0) && (sub_fdtable_grow() != 0)) {
+        return NULL;
+    }
+    fd              = vlctx->fdfree;
+    vlctx->fdfree   = FD_NEXT(fd);
+    fp              = FD_FILE(fd);
+    fp->fd          = fd;
+    return fp;
+
+#else
     ot_int fd;
 
     for (fd=0; fd<OT_PARAM(VLFPS); fd++) {
         if (vlfile[fd].read == NULL)
             return &vlfile[fd];
     }
-#else
-        ///@todo do a binary search
+    return NULL;
 #endif
+}
 
-    return NULL;
+
+/// Gives the descriptor of a file that is being closed back to the free list.
+/// vl_close() only closes files that are open in the active table.
+static void sub_free_fp(vlFILE* fp) {
+#if (OT_FEATURE(VLFDTABLE) == ENABLED)
+    FD_NEXT(fp->fd) = vlctx->fdfree;
+    vlctx->fdfree   = fp->fd;
+#else
+    (void)fp;
+#endif
 }
 
 
-static vlFILE* sub_new_file(vl_header_t* new_header, vaddr heap_base, vaddr heap_end, vaddr header_base, ot_int header_window ) {
+static vlFILE* sub_new_file(ot_u8 block, vl_header_t* new_header, vaddr heap_base, vaddr heap_end, vaddr header_base, ot_int header_window ) {
 #if (OT_FEATURE(VLNEW) == ENABLED)
     //vlFILE* fp;
     //vaddr   new_base    = 0;
@@ -1516,11 +2077,23 @@ static vlFILE* sub_new_file(vl_header_t* new_header, vaddr heap_base, vaddr heap
         return NULL;
 
     // Find where to put the new data, and if heap is full
-    new_header->base = sub_find_empty_heap( heap_base,
+    new_header->base = sub_find_empty_heap( block,
+                                            heap_base,
                                             heap_end,
                                             header_base,
                                             (ot_uint)new_header->alloc,
                                             header_window );
+
+    // If there is no gap big enough, compact the heap and try again
+    if (new_header->base == NULL_vaddr) {
+        sub_defragment_heap(header_base, header_window, heap_base, heap_end, 0);
+        new_header->base = sub_find_empty_heap( block,
+                                                heap_base,
+                                                heap_end,
+                                                header_base,
+                                                (ot_uint)new_header->alloc,
+                                                header_window );
+    }
     if (new_header->base == NULL_vaddr)
         return NULL;
 
@@ -1542,6 +2115,7 @@ static void sub_delete_file(vaddr del_header) {
 
     header_alloc    = (ot_u16)vworm_read(del_header+2);
     header_base     = (vaddr)vworm_read(del_header+6);
+    sub_freeindex_put(del_header);
 
     // Wipe the old data and mark header as deleted
     vworm_wipeblock(header_base, header_alloc);
@@ -1555,14 +2129,16 @@ static void sub_delete_file(vaddr del_header) {
 static vaddr sub_header_search(vaddr header, ot_u8 search_id, ot_int num_headers) {
 
     // Quick check to see if Header is at the indexed location.
+    // A deleted header keeps its ID, so the base is checked as below.
 #   if (OT_FEATURE(MULTIFS) == ENABLED)
     ot_uni16 idmod;
-    const vl_header_t* hdr = vworm_get(header);
     
     if (search_id < num_headers) {
-        idmod.ushort = hdr[search_id].idmod;
-        if (idmod.ubyte[0] == search_id) {
-            return header + (search_id * sizeof(vl_header_t));
+        vaddr quick     = header + (search_id * sizeof(vl_header_t));
+        ot_u16 base     = vworm_read(quick + 6);
+        idmod.ushort    = vworm_read(quick + 4);
+        if ((idmod.ubyte[0] == search_id) && (base != 0) && (base != 0xFFFF)) {
+            return quick;
         }
     }
 #   endif
@@ -1594,6 +2170,185 @@ static vaddr sub_header_search(vaddr header, ot_u8 search_id, ot_int num_headers
 }
 
 
+#if (OT_FEATURE(VLIDINDEX) == ENABLED)
+/// Returns the ID of a header, or -1 if the header has no file, with the same
+/// test as sub_header_search().
+static ot_int sub_header_id(vaddr header) {
+    ot_u16 base     = vworm_read(header + 6);
+    ot_u16 idmod    = vworm_read(header + 4);
+
+    if ((base == 0) || (base == 0xFFFF)) {
+        return -1;
+    }
+#   if !defined(__C2000__)
+    {   ot_uni16 id;
+        id.ushort = idmod;
+        return id.ubyte[0];
+    }
+#   else
+    return BYTE0(idmod);
+#   endif
+}
+
+
+static void sub_idindex_build(vlidindex_t* index, ot_u8 block, vaddr header, ot_int num_headers) {
+    ot_int i;
+    ot_int id;
+
+    /// Going backwards, the first header of an ID is the one that is kept,
+    /// as with sub_header_search().
+    memset(index->slot[block], IDINDEX_NONE, 256);
+    for (i=num_headers-1; i>=0; i--) {
+        id = sub_header_id(header + (i * OCTETS_IN_vl_header_t));
+        if (id >= 0) {
+            index->slot[block][id] = (ot_u8)i;
+        }
+    }
+    index->header[block]    = header;
+    index->num[block]       = (ot_u16)num_headers;
+}
+#endif
+
+
+static vaddr sub_header_lookup(ot_u8 block, vaddr header, ot_u8 search_id, ot_int num_headers) {
+#if (OT_FEATURE(VLIDINDEX) == ENABLED)
+    vlidindex_t*    index;
+    const void*     fs;
+    vaddr           found;
+    ot_u8           slot;
+
+    if ((num_headers <= 0) || (num_headers >= IDINDEX_NONE)) {
+        return sub_header_search(header, search_id, num_headers);
+    }
+
+    index = vlctx->idindex;
+    if (index == NULL) {
+        index = calloc(1, sizeof(vlidindex_t));
+        if (index == NULL) {
+            return sub_header_search(header, search_id, num_headers);
+        }
+        vlctx->idindex = index;
+    }
+
+    fs = vworm_get(OVERHEAD_START_VADDR);
+    if ((index->fs[block] != fs) || (index->header[block] != header)
+    ||  (index->num[block] != num_headers)) {
+        sub_idindex_build(index, block, header, num_headers);
+        index->fs[block] = fs;
+    }
+
+    slot = index->slot[block][search_id];
+    if (slot == IDINDEX_NONE) {
+        return NULL_vaddr;
+    }
+
+    /// A hit is checked, because the headers can be changed underneath the
+    /// index (e.g. by restore or by a load of the image).  If it is stale,
+    /// the block is re-indexed on the next lookup.
+    found = header + (slot * OCTETS_IN_vl_header_t);
+    if (sub_header_id(found) == search_id) {
+        return found;
+    }
+    index->fs[block] = NULL;
+#endif
+
+    return sub_header_search(header, search_id, num_headers);
+}
+
+
+static void sub_idindex_set(ot_u8 block, ot_u8 id, vaddr header) {
+#if (OT_FEATURE(VLIDINDEX) == ENABLED)
+    vlidindex_t* index = vlctx->idindex;
+
+    if ((index == NULL) || (index->fs[block] == NULL)) {
+        return;
+    }
+    if (index->fs[block] != vworm_get(OVERHEAD_START_VADDR)) {
+        index->fs[block] = NULL;
+    }
+    else if (header == NULL_vaddr) {
+        index->slot[block][id] = IDINDEX_NONE;
+    }
+    else if ((header < index->header[block])
+         ||  (header >= (index->header[block] + (index->num[block] * OCTETS_IN_vl_header_t)))) {
+        index->fs[block] = NULL;
+    }
+    else {
+        index->slot[block][id] = (ot_u8)((header - index->header[block]) / OCTETS_IN_vl_header_t);
+    }
+#endif
+}
+
+
+static void sub_block_stats(vlBLOCKSTATS* stats, vaddr header, ot_int num_headers,
+                            ot_u32 heap_base, ot_u32 heap_end) {
+    ot_u32  ext_base[256];
+    ot_u32  ext_end[256];
+    ot_u32  cursor;
+    ot_int  n;
+
+    memset(stats, 0, sizeof(vlBLOCKSTATS));
+    stats->alloc    = (ot_u32)(heap_end - heap_base);
+    stats->headers  = (ot_u16)num_headers;
+    n               = sub_block_extents(ext_base, ext_end, NULL, header, num_headers, stats);
+
+    /// The gaps are between the extents, and at the ends of the heap
+    cursor = heap_base;
+    for (ot_int i=0; i<n; i++) {
+        ot_u32 gap_end = (ext_base[i] < heap_end) ? ext_base[i] : heap_end;
+        if ((gap_end > cursor) && ((ot_u32)(gap_end - cursor) > stats->largest_gap)) {
+            stats->largest_gap = (ot_u32)(gap_end - cursor);
+        }
+        if (ext_end[i] > cursor) {
+            cursor = ext_end[i];
+        }
+    }
+    if ((heap_end > cursor) && ((ot_u32)(heap_end - cursor) > stats->largest_gap)) {
+        stats->largest_gap = (ot_u32)(heap_end - cursor);
+    }
+}
+
+
+static ot_int sub_block_extents(ot_u32* ext_base, ot_u32* ext_end, vaddr* ext_header,
+                                vaddr header, ot_int num_headers, vlBLOCKSTATS* stats) {
+    /// File IDs are 8 bits, so a block can't have more than 256 files.  The
+    /// extents are sorted by base with insertion sort, because headers are
+    /// mostly in the order of their data already.
+    ot_int n = 0;
+
+    for (; num_headers>0; num_headers--, header+=OCTETS_IN_vl_header_t) {
+        vaddr   base    = vworm_read(header + 6);
+        ot_u16  alloc   = vworm_read(header + 2);
+        ot_int  i;
+
+        if ((base == 0) || (base == NULL_vaddr) || (n >= 256)) {
+            continue;
+        }
+        if (stats != NULL) {
+            stats->files++;
+            stats->used    += alloc;
+            stats->length  += vworm_read(header + 0);
+        }
+
+        for (i=n; (i>0) && (ext_base[i-1] > base); i--) {
+            ext_base[i] = ext_base[i-1];
+            ext_end[i]  = ext_end[i-1];
+            if (ext_header != NULL) {
+                ext_header[i] = ext_header[i-1];
+            }
+        }
+        ext_base[i] = base;
+        ext_end[i]  = base + alloc;
+        if (ext_header != NULL) {
+            ext_header[i] = header;
+        }
+        n++;
+    }
+
+    return n;
+}
+
+
 static void sub_copy_header(vl_header_t* output_header, vaddr header ) {
     ot_int i;
     ot_int copy_length  = (OCTETS_IN_vl_header_t / 2);
@@ -1631,54 +2386,278 @@ static vaddr sub_find_empty_header(vaddr header, ot_int num_headers) {
 }
 
 
-static vaddr sub_find_empty_heap(  vaddr heap_base, vaddr heap_end,
-                        vaddr header, ot_uint new_alloc, ot_int num_headers) {
-#if (OT_FEATURE(VLNEW) == ENABLED)
-    //Search all header combinations to find:
-    // - pairs of adjacent files in the heap
-    // - gaps between these pairs
-    // - the smallest gap that is big enough.
-    vaddr   loop1           = header;
-    vaddr   loop1_base;
-    ot_uint loop1_alloc;
-    vaddr   loop2;
-    vaddr   loop2_base;
+#if (OT_FEATURE(VLFREEINDEX) == ENABLED)
+/// Position of the first extent in by_size that is not before (size, base),
+/// where by_size has count extents
+static ot_int sub_freeindex_bysize(vlfreeblock_t* blk, ot_int count, ot_u16 size, ot_u16 base) {
+    ot_int lo = 0;
+    ot_int hi = count;
 
-    ot_int  i;
-    ot_int  j;
-    ot_int  gap;
-    ot_int  closest_gap     = (ot_int)(heap_end - heap_base);
-    ot_int  bestfit_alloc   = (ot_int)(32767);
-    vaddr   bestfit_base    = NULL_vaddr;
+    while (lo < hi) {
+        ot_int mid = (lo + hi) >> 1;
+        if ((blk->by_size[mid].size < size)
+        || ((blk->by_size[mid].size == size) && (blk->by_size[mid].base < base))) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+
+/// Position of the first extent in by_base that is not before base
+static ot_int sub_freeindex_bybase(vlfreeblock_t* blk, ot_u16 base) {
+    ot_int lo = 0;
+    ot_int hi = blk->count;
 
-    for (i=0; i<num_headers; i++, loop1+=OCTETS_IN_vl_header_t ) {
-        loop1_alloc = vworm_read(loop1 + 2);                                    // load alloc (max) from header
-        loop1_base  = vworm_read(loop1 + 6);                                    // load base from header
+    while (lo < hi) {
+        ot_int mid = (lo + hi) >> 1;
+        if (blk->by_base[mid].base < base) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
 
-        if ( loop1_base != NULL_vaddr ) {                                       // skip if header is deleted, or empty
-            heap_base   = (vaddr)(loop1_base + loop1_alloc);
-            loop2       = header;
 
-            for (j=0; j<num_headers; j++, loop2+=OCTETS_IN_vl_header_t ) {
-                loop2_base  = vworm_read(loop2 + 6);
+/// Removes an extent from by_size, which has count extents
+static void sub_freeindex_unsize(vlfreeblock_t* blk, ot_int count, const vlextent_t* ext) {
+    ot_int i = sub_freeindex_bysize(blk, count, ext->size, ext->base);
+    memmove(&blk->by_size[i], &blk->by_size[i+1], (count-i-1) * sizeof(vlextent_t));
+}
 
-                if ( (loop2_base != NULL_vaddr) && (loop2_base > heap_base) ) { // if header is valid ...
-                    gap = (ot_int)(loop2_base - heap_base);                     // calc gap between the two files
 
-                    if (gap < closest_gap) {                                    // The closest gap ...
-                        closest_gap = gap;                                      // will be between two adjacent ...
-                    }                                                           // files in the heap.
-                }
+/// Inserts an extent in by_size, which has count extents and room for one more
+static void sub_freeindex_size(vlfreeblock_t* blk, ot_int count, const vlextent_t* ext) {
+    ot_int i = sub_freeindex_bysize(blk, count, ext->size, ext->base);
+    memmove(&blk->by_size[i+1], &blk->by_size[i], (count-i) * sizeof(vlextent_t));
+    blk->by_size[i] = *ext;
+}
+
+
+static int sub_extent_cmp(const void* a, const void* b) {
+    const vlextent_t* ea = a;
+    const vlextent_t* eb = b;
+    if (ea->size != eb->size) {
+        return (ea->size < eb->size) ? -1 : 1;
+    }
+    return (ea->base < eb->base) ? -1 : (ea->base > eb->base);
+}
+
+
+/// Gets the free space index of a block, and builds it from the headers if
+/// it isn't for this image, header table and heap.
+static vlfreeblock_t* sub_freeindex_get(ot_u8 block, vaddr header, ot_int num_headers,
+                                        ot_u32 heap_base, ot_u32 heap_end) {
+    vlfreeblock_t*  blk;
+    const void*     fs;
+    ot_u32          ext_base[256];
+    ot_u32          ext_end[256];
+    ot_u32          cursor;
+    ot_int          n;
+
+    if ((num_headers > 256) || (heap_end > NULL_vaddr) || (heap_base > heap_end)) {
+        return NULL;
+    }
+    if (vlctx->freeindex == NULL) {
+        vlctx->freeindex = calloc(1, sizeof(vlfreeindex_t));
+        if (vlctx->freeindex == NULL) {
+            return NULL;
+        }
+    }
+
+    blk = &vlctx->freeindex->block[block];
+    fs  = vworm_get(OVERHEAD_START_VADDR);
+    if ((blk->fs == fs) && (blk->header == header) && (blk->num == num_headers)
+    &&  (blk->heap_base == heap_base) && (blk->heap_end == heap_end)) {
+        return blk;
+    }
+
+    /// The free extents are the gaps between the files, and at the ends of
+    /// the heap, in the same way as sub_block_stats().
+    n           = sub_block_extents(ext_base, ext_end, NULL, header, num_headers, NULL);
+    blk->count  = 0;
+    cursor      = heap_base;
+    for (ot_int i=0; i<=n; i++) {
+        ot_u32 gap_end = (i < n) ? ext_base[i] : heap_end;
+        gap_end = (gap_end < heap_end) ? gap_end : heap_end;
+        if (gap_end > cursor) {
+            blk->by_base[blk->count].base = (ot_u16)cursor;
+            blk->by_base[blk->count].size = (ot_u16)(gap_end - cursor);
+            blk->count++;
+        }
+        if ((i < n) && (ext_end[i] > cursor)) {
+            cursor = ext_end[i];
+        }
+    }
+    memcpy(blk->by_size, blk->by_base, blk->count * sizeof(vlextent_t));
+    qsort(blk->by_size, blk->count, sizeof(vlextent_t), &sub_extent_cmp);
+
+    blk->fs         = fs;
+    blk->header     = header;
+    blk->num        = (ot_u16)num_headers;
+    blk->heap_base  = heap_base;
+    blk->heap_end   = heap_end;
+    return blk;
+}
+
+
+/// Takes the best-fit extent, and puts back what is left of it.  The size is
+/// taken as 32 bits, since ot_uint may be wider than the 16-bit extents.
+static vaddr sub_freeindex_take(vlfreeblock_t* blk, ot_u32 new_alloc) {
+    vlextent_t  ext;
+    ot_int      i;
+
+    if (new_alloc > 0xFFFF) {
+        return NULL_vaddr;
+    }
+    i = sub_freeindex_bysize(blk, blk->count, (ot_u16)new_alloc, 0);
+    if (i >= blk->count) {
+        return NULL_vaddr;
+    }
+    ext = blk->by_size[i];
+    sub_freeindex_unsize(blk, blk->count, &ext);
+
+    i = sub_freeindex_bybase(blk, ext.base);
+    if (ext.size == new_alloc) {
+        memmove(&blk->by_base[i], &blk->by_base[i+1], (blk->count-i-1) * sizeof(vlextent_t));
+        blk->count--;
+    }
+    else {
+        blk->by_base[i].base += new_alloc;
+        blk->by_base[i].size -= new_alloc;
+        sub_freeindex_size(blk, blk->count-1, &blk->by_base[i]);
+    }
+    return ext.base;
+}
+#endif
+
+
+static void sub_freeindex_reset(vaddr header) {
+#if (OT_FEATURE(VLFREEINDEX) == ENABLED)
+    if (vlctx->freeindex != NULL) {
+        for (ot_int b=0; b<FREEINDEX_BLOCKS; b++) {
+            if (vlctx->freeindex->block[b].header == header) {
+                vlctx->freeindex->block[b].fs = NULL;
             }
         }
-        
-        // If the gap between loop1 and next file is big enough for the data we need ...
-        // and is smaller than other big-enough gaps then it is the gap we will write into.
-        if ((closest_gap >= new_alloc) && (closest_gap < bestfit_alloc))  {
-            bestfit_alloc   = closest_gap;
-            bestfit_base    = heap_base;
+    }
+#endif
+}
+
+
+static void sub_freeindex_put(vaddr header) {
+#if (OT_FEATURE(VLFREEINDEX) == ENABLED)
+    vlfreeblock_t*  blk;
+    vlextent_t*     prev;
+    vlextent_t*     next;
+    vlextent_t      ext;
+    ot_u32          end;
+    ot_int          b, i;
+
+    if (vlctx->freeindex == NULL) {
+        return;
+    }
+
+    /// The block is the one with the header in its header table
+    for (b=0; b<FREEINDEX_BLOCKS; b++) {
+        blk = &vlctx->freeindex->block[b];
+        if ((blk->fs != NULL) && (header >= blk->header)
+        &&  (header < (blk->header + (blk->num * OCTETS_IN_vl_header_t)))) {
+            break;
+        }
+    }
+    if (b == FREEINDEX_BLOCKS) {
+        return;
+    }
+    if (blk->fs != vworm_get(OVERHEAD_START_VADDR)) {
+        blk->fs = NULL;
+        return;
+    }
+
+    ext.base    = vworm_read(header + 6);
+    ext.size    = vworm_read(header + 2);
+    end         = (ot_u32)ext.base + ext.size;
+    if ((ext.base == 0) || (ext.base == NULL_vaddr) || (ext.size == 0)) {
+        return;
+    }
+    if ((ext.base < blk->heap_base) || (end > blk->heap_end)) {
+        blk->fs = NULL;
+        return;
+    }
+
+    /// Merge with the free extents on each side, if they touch it
+    i       = sub_freeindex_bybase(blk, ext.base);
+    prev    = (i > 0) ? &blk->by_base[i-1] : NULL;
+    next    = (i < blk->count) ? &blk->by_base[i] : NULL;
+    if ((prev != NULL) && (((ot_u32)prev->base + prev->size) > ext.base)) {
+        blk->fs = NULL;         // overlaps free space: the index is stale
+        return;
+    }
+    if ((next != NULL) && (next->base < end)) {
+        blk->fs = NULL;
+        return;
+    }
+    if ((next != NULL) && (next->base == end)) {
+        sub_freeindex_unsize(blk, blk->count, next);
+        ext.size += next->size;
+        memmove(next, next+1, (blk->count-i-1) * sizeof(vlextent_t));
+        blk->count--;
+    }
+    if ((prev != NULL) && (((ot_u32)prev->base + prev->size) == ext.base)) {
+        sub_freeindex_unsize(blk, blk->count, prev);
+        prev->size += ext.size;
+        sub_freeindex_size(blk, blk->count-1, prev);
+    }
+    else {
+        memmove(&blk->by_base[i+1], &blk->by_base[i], (blk->count-i) * sizeof(vlextent_t));
+        blk->by_base[i] = ext;
+        sub_freeindex_size(blk, blk->count, &ext);
+        blk->count++;
+    }
+#endif
+}
+
+
+static vaddr sub_find_empty_heap(  ot_u8 block, vaddr heap_base, vaddr heap_end,
+                        vaddr header, ot_uint new_alloc, ot_int num_headers) {
+#if (OT_FEATURE(VLNEW) == ENABLED)
+    ot_u32  ext_base[256];
+    ot_u32  ext_end[256];
+    ot_u32  cursor;
+    ot_u32  bestfit_alloc   = ~0;
+    vaddr   bestfit_base    = NULL_vaddr;
+    ot_int  n;
+
+#   if (OT_FEATURE(VLFREEINDEX) == ENABLED)
+    {   vlfreeblock_t* blk;
+        blk = sub_freeindex_get(block, header, num_headers, heap_base, heap_end);
+        if (blk != NULL) {
+            return sub_freeindex_take(blk, (ot_u32)new_alloc);
         }
+    }
+#   endif
 
+    /// Without the index, the gaps are found from the files sorted by base,
+    /// and the smallest gap that is big enough is the one to write into.
+    n       = sub_block_extents(ext_base, ext_end, NULL, header, num_headers, NULL);
+    cursor  = heap_base;
+    for (ot_int i=0; i<=n; i++) {
+        ot_u32 gap_end = (i < n) ? ext_base[i] : heap_end;
+        gap_end = (gap_end < heap_end) ? gap_end : heap_end;
+        if ((gap_end > cursor) && ((gap_end - cursor) >= new_alloc)
+        &&  ((gap_end - cursor) < bestfit_alloc)) {
+            bestfit_alloc   = gap_end - cursor;
+            bestfit_base    = (vaddr)cursor;
+        }
+        if ((i < n) && (ext_end[i] > cursor)) {
+            cursor = ext_end[i];
+        }
     }
 
     return bestfit_base;
@@ -1690,9 +2669,86 @@ static vaddr sub_find_empty_heap(  vaddr heap_base, vaddr heap_end,
 
 
 
-//Save sub_defragment_heap for a rainy day
-static ot_u8 sub_defragment_heap(vaddr base, ot_uint window) {
-    return ~0;
+#if (OT_FEATURE(VLNEW) == ENABLED)
+static ot_bool sub_header_spanned(vaddr header) {
+    for (ot_int j=0; j<FD_COUNT(); j++) {
+        vlFILE* fp = FD_FILE(j);
+        if ((fp->read != NULL) && (fp->header == header) && (fp->flags & VL_FLAG_SPAN)) {
+            return True;
+        }
+    }
+    return False;
+}
+#endif
+
+static ot_u8 sub_defragment_heap(vaddr header, ot_int num_headers,
+                                 vaddr heap_base, vaddr heap_end, ot_uint max_bytes) {
+#if (OT_FEATURE(VLNEW) == ENABLED)
+    ot_u32  ext_base[256];
+    ot_u32  ext_end[256];
+    vaddr   ext_header[256];
+    ot_u32  cursor;
+    ot_u32  moved = 0;
+    ot_int  n;
+
+    n       = sub_block_extents(ext_base, ext_end, ext_header, header, num_headers, NULL);
+    cursor  = heap_base;
+
+    for (ot_int i=0; i<n; i++) {
+        ot_u32  span;
+        ot_u32  j;
+
+        /// Files that are before the heap, that overlap the one before, or
+        /// that are open with a span from vl_span() are left where they are.
+        if ((ext_base[i] <= cursor) || (ext_end[i] > heap_end)
+        ||  sub_header_spanned(ext_header[i])) {
+            cursor = (ext_end[i] > cursor) ? ext_end[i] : cursor;
+            continue;
+        }
+
+        /// Only the data up to the length of the file is moved, and the
+        /// budget is checked per file, so a file is never half-moved.  The
+        /// header length is written on vl_close(), so an open file may have
+        /// more data than it says: the length of its vlFILE is used too.
+        span = vworm_read(ext_header[i] + 0);
+        for (j=0; j<(ot_u32)FD_COUNT(); j++) {
+            vlFILE* fp = FD_FILE(j);
+            if ((fp->read != NULL) && (fp->header == ext_header[i])
+            &&  (fp->start == ext_base[i]) && (fp->length > span)) {
+                span = fp->length;
+            }
+        }
+        span = (span + 1) & ~1;
+        span = (span < (ext_end[i] - ext_base[i])) ? span : (ext_end[i] - ext_base[i]);
+        if ((max_bytes != 0) && (moved != 0) && ((moved + span) > max_bytes)) {
+            sub_freeindex_reset(header);
+            return 1;
+        }
+
+        /// The data moves down, so copying upwards is safe if it overlaps
+        for (j=0; j<span; j+=2) {
+            vworm_write((vaddr)(cursor + j), vworm_read((vaddr)(ext_base[i] + j)));
+        }
+        vworm_write(ext_header[i] + 6, (ot_u16)cursor);
+        moved += span;
+
+        /// Open files of the header that read from the heap follow it
+        for (j=0; j<(ot_u32)FD_COUNT(); j++) {
+            vlFILE* fp = FD_FILE(j);
+            if ((fp->read != NULL) && (fp->header == ext_header[i])
+            &&  (fp->start == ext_base[i]) && !FP_ISMIRRORED(fp)) {
+                fp->start = (vaddr)cursor;
+            }
+        }
+
+        cursor += ext_end[i] - ext_base[i];
+    }
+
+    sub_freeindex_reset(header);
+    return 0;
+#else
+    return 0;
+#endif
 }
 
 
@@ -24,6 +24,30 @@
   * Veelite MultiFS is used to clone multiple filesystems on a single device.
   * The MultiFS feature is intended for Gateways that are proxying endpoints.
   *
+  * A group has two tables.  The Judy array holds the FS entries in key order,
+  * and it is used for adding, deleting and iterating.  The read index is an
+  * open-addressing hash table on the 64 bit UID, and it is used for lookups.
+  * Lookups in the index don't take any lock.  All changes to the group are
+  * serialized by the group mutex.
+  *
+  * If OT_FEATURE_VLJUDY is disabled, the Judy array is not used, and the read
+  * index is the only table.  Iteration is then in index order, not key order.
+  *
+  * If OT_FEATURE_VLFILTER is enabled, the read index has a blocked Bloom
+  * filter in front of it, so most lookups of UIDs that are not in the group
+  * are rejected after reading one cache line of the filter.
+  *
+  * If OT_FEATURE_VLSLAB is enabled, the group has a slab arena for FS images
+  * of one size, which is set by the first image allocated from it.  The
+  * arena is mapped in chunks of 2MB (huge pages with OT_FEATURE_VLHUGEPAGES),
+  * and it is released all at once when the group is deinitialized.
+  *
+  * With VLTHREADS, memory that is removed from the group (FS entries, images
+  * and old indexes) is not freed right away.  It is retired with the current
+  * epoch, and it is freed once every thread has passed through a later epoch.
+  * A thread enters the current epoch when it checks-out an FS, so it keeps
+  * the FS it has checked-out safe until it checks-out another.
+  *
   ******************************************************************************
   */
 
@@ -37,184 +61,2404 @@
 #include <otsys/veelite.h>
 #include <otlib/memcpy.h>
 
+#include <stdlib.h>
+#include <string.h>
+
+#if (OT_FEATURE(VLTHREADS) == ENABLED)
+#   include <pthread.h>
+#endif
+
+#if (OT_FEATURE(VLSLAB) == ENABLED)
+#   include <sys/mman.h>
+#endif
+
 // Veelite init function
 #if (CC_SUPPORT == SIM_GCC)
 #   include <otplatform.h>
 #endif
 
-///@todo have option to use a hash table (maybe uthash) instead of Judy.
 // For implementation using Judy datatype via libjudy (part of hbuilder pkg)
 // Intended for larger-scale POSIX system
-#include <judy.h>
-#define JUDYKEYS_PER_UID    ((8+JUDY_key_size-1)/JUDY_key_size)
+#if (OT_FEATURE(VLJUDY) == ENABLED)
+#   include <judy.h>
+#   define JUDYKEYS_PER_UID ((8+JUDY_key_size-1)/JUDY_key_size)
+#endif
 
 
-static void* fstab = NULL;     // Judy-based FS Table
+/// Each FS in the table has an entry, and the Judy value is a pointer to it.
+/// The entry is never moved once it is allocated, so it can be given to the
+/// caller as a stable reference (vlFSREF) that bypasses the table lookup.
+///
+/// The entry also owns the runtime state of its FS: the Veelite context,
+/// followed by the auth key table.  They are allocated together with the
+/// entry, so that switching FS only needs to swap the pointers.  Entries of
+/// mapped images have no state (vlctx is NULL) until the FS is first
+/// selected, and then it is allocated on its own.  "group" is the group that
+/// has the entry, and "alloc" is the size of the image, for the stats.  With
+/// VLCOW, the image may be a copy-on-write image, which is selected with
+/// vworm_cow_init().  With VLCOLD, base is NULL while the image is cold.  Hot
+/// full images are on a circular list of the group (hot_prev, hot_next), and
+/// "ref" is their CLOCK bit, which is set each time the FS is selected.
+struct vlfs_entry {
+    uint64_t    uid;
+    void*       base;
+    void*       vlctx;
+    void*       group;
+#   if (OT_FEATURE(VLCOLD) == ENABLED)
+    void*       cold;
+    struct vlfs_entry* hot_prev;
+    struct vlfs_entry* hot_next;
+    ot_u8       ref;
+#   endif
+#   if (OT_FEATURE(VLCOW) == ENABLED)
+    ot_u8       cow;
+#   endif
+    ot_u32      alloc;
+};
 
+#define ENTRY_ALIGN(SIZE)   (((SIZE) + 15) & ~(size_t)15)
+#define STATE_SIZE()        (ENTRY_ALIGN(vl_get_ctxsize()) + auth_get_tablesize())
+#define STATE_AUTHTAB(CTX)  ((auth_get_tablesize() != 0) ? (ot_u8*)(CTX) + ENTRY_ALIGN(vl_get_ctxsize()) : NULL)
 
 
+/// Read index: the slots are in buckets of one cache line, so a lookup will
+/// usually touch one line.  The UIDs of a bucket come first, so they can be
+/// compared without loading the entry pointers.  Probing is linear, bucket by
+/// bucket, and slots of a bucket are filled in order.
+///
+/// UID 0 marks an empty slot.  A deleted FS leaves its UID in the slot with a
+/// NULL entry, so a UID only ever has one slot in an index, and a reader that
+/// finds the UID or an empty slot can stop there.  "used" counts all slots
+/// with a UID, and the index is rebuilt when it reaches 3/4 of the slots.
+#define BUCKET_SLOTS        4
+#define BUCKET_BYTES        64
+#define INDEX_MINBUCKETS    16
 
+typedef struct {
+    uint64_t            uid[BUCKET_SLOTS];
+    struct vlfs_entry*  entry[BUCKET_SLOTS];
+} vlbucket_t;
 
-ot_u8 vl_multifs_init(void** new_handle) {
-    void* obj;
-    obj = judy_open(4*JUDYKEYS_PER_UID, JUDYKEYS_PER_UID);
-    
-    if (new_handle != NULL) {
-        *new_handle = obj;
+typedef struct {
+    size_t      mask;       // number of buckets - 1
+    size_t      used;
+    size_t      live;
+    vlbucket_t* bucket;
+#   if (OT_FEATURE(VLFILTER) == ENABLED)
+    size_t      fmask;      // number of filter blocks - 1
+    size_t      fbits;      // number of filter bits set
+    uint64_t*   filter;
+#   endif
+} vlindex_t;
+
+#define INDEX_SLOTS(INDEX)  (((INDEX)->mask + 1) * BUCKET_SLOTS)
+#define SLOT_UID(INDEX, POS)    ((INDEX)->bucket[(POS)/BUCKET_SLOTS].uid[(POS)%BUCKET_SLOTS])
+#define SLOT_ENTRY(INDEX, POS)  ((INDEX)->bucket[(POS)/BUCKET_SLOTS].entry[(POS)%BUCKET_SLOTS])
+
+
+/// Filter: a blocked Bloom filter with 8 bits per slot of the index.  A UID
+/// selects one block of a cache line (8 words), and sets one bit in each word
+/// of it.  The filter is part of the index, so it is rebuilt with the index.
+/// Deleting an FS doesn't clear its bits, but its UID keeps its slot until the
+/// next rebuild, so deletes don't make the filter less precise than adds do.
+#if (OT_FEATURE(VLFILTER) == ENABLED)
+#   define FILTER_WORDS         8
+#   define FILTER_BITS_PER_SLOT 8
+#   define FILTER_BLOCKS(INDEX) (((INDEX)->mask + 1) * BUCKET_SLOTS * FILTER_BITS_PER_SLOT / (64*FILTER_WORDS))
+#endif
+
+
+/// Memory removed from a group, waiting to be freed
+typedef struct vllimbo {
+    struct vllimbo* next;
+    uint64_t        epoch;
+    void*           obj;
+    void            (*obj_free)(void*);
+    void*           base;
+    void            (*base_free)(void*);
+} vllimbo_t;
+
+
+/// Region of images added by vl_multifs_map().  The group owns the region,
+/// but the images in it are never freed on their own.
+typedef struct vlmap {
+    struct vlmap*   next;
+    ot_u8*          region;
+    size_t          size;
+    void            (*region_free)(void*, size_t);
+} vlmap_t;
+
+
+/// Slab arena: images are in slots of equal size, and each slot starts with a
+/// header of one cache line, so the images are cache-aligned too.  The chunk
+/// bases are kept sorted, so the slab can tell its own images by address.
+/// The slab has its own lock, because images are allocated without the group
+/// lock.  The group lock, if held, is always taken first.
+#if (OT_FEATURE(VLSLAB) == ENABLED)
+#   define SLAB_CHUNK       (2*1024*1024)
+#   define SLAB_HEADER      64
+
+typedef struct vlslab {
+    size_t      image;          // image size, 0 until the first allocation
+    size_t      slot;           // SLAB_HEADER + image, rounded to SLAB_HEADER
+    size_t      chunk_bytes;
+    size_t      chunks;
+    size_t      chunk_max;
+    ot_u8**     chunk;
+    ot_u8*      next;           // unused part of the newest chunk
+    ot_u8*      end;
+    void*       free;           // list of freed images
+    size_t      live;
+#   if (OT_FEATURE(VLTHREADS) == ENABLED)
+    pthread_mutex_t mutex;
+#   endif
+} vlslab_t;
+
+typedef struct {
+    vlslab_t*   slab;
+    void*       next_free;
+} vlslabhdr_t;
+
+#   define SLAB_HDR(BASE)   ((vlslabhdr_t*)((ot_u8*)(BASE) - SLAB_HEADER))
+#endif
+
+
+/// The limbo list is in order of retirement, so the oldest items are at the
+/// head, and reclaiming stops at the first item that is still in use.
+/// Templates are FS images registered at runtime.  They are never removed
+/// before the group is deinitialized, so they are read without the lock.
+/// "generation" counts rebuilds of the index, which reorder it.  "iter" is
+/// the position of the switching iterator, without Judy.  The iterator only
+/// returns keys from iter_lo to iter_hi, inclusive.  With VLCOLD, "hot" is
+/// the number of full images that are not cold, and "hand" is the CLOCK hand
+/// on the list of them.  "maps" are the regions from vl_multifs_map(), which
+/// are only added to while the group is in use.  The counters from
+/// "entries" to "switches" are for vl_multifs_stats(), so that it doesn't
+/// visit the FS.  "states" counts the runtime states that are allocated, and
+/// "cow_bytes" is kept by the vworm COW images.  They and "switches" are
+/// written without the lock.
+typedef struct {
+#   if (OT_FEATURE(VLJUDY) == ENABLED)
+    void*       judy;
+#   else
+    size_t      iter;
+#   endif
+    ot_u8       iter_lo[8];
+    ot_u8       iter_hi[8];
+    vlindex_t*  index;
+    ot_u32      generation;
+    vllimbo_t*  limbo;
+    vllimbo_t*  limbo_tail;
+    void*       tmpl[OT_PARAM(VLTEMPLATES)];
+    vlmap_t*    maps;
+    size_t      entries;
+    size_t      states;
+    size_t      image_bytes;
+    size_t      cow_fs;
+    ot_u64      cow_bytes;
+    size_t      cold_fs;
+    size_t      cold_bytes;
+    uint64_t    switches;
+#   if (OT_FEATURE(VLCOLD) == ENABLED)
+    size_t      hot;
+    size_t      hot_max;
+    struct vlfs_entry* hand;
+#   endif
+#   if (OT_FEATURE(VLSLAB) == ENABLED)
+    vlslab_t    slab;
+#   endif
+#   if (OT_FEATURE(VLTHREADS) == ENABLED)
+    pthread_mutex_t mutex;
+#   endif
+} vlgroup_t;
+
+
+static vlgroup_t* fstab = NULL;     // Default FS Table
+
+// UID and entry of the FS that is checked-out (per-thread when VLTHREADS is
+// enabled).  A UID may be in more than one group, so deletes compare entries.
+static VL_TLS uint64_t active_uid = 0;
+static VL_TLS struct vlfs_entry* active_entry = NULL;
+
+
+
+
+/// Judy is not safe for concurrent access, not even for lookups (the cursor
+/// is stored inside the array).  With VLTHREADS, all Judy operations, all
+/// changes to the read index and all iteration are serialized by the group
+/// mutex.  The Veelite
+/// context switch itself is done outside of the lock, because that context is
+/// thread-local.
+#if (OT_FEATURE(VLTHREADS) == ENABLED)
+#   define FSTAB_LOCK(GROUP)    pthread_mutex_lock(&(GROUP)->mutex)
+#   define FSTAB_UNLOCK(GROUP)  pthread_mutex_unlock(&(GROUP)->mutex)
+
+/// Each thread that uses a group registers a reader record.  Its epoch is 0
+/// when the thread has nothing checked-out.  Records are never freed: when a
+/// thread exits, its record is released and can be taken by a new thread.
+/// With VLCOLD, "entry" is the FS the thread has checked-out, which must not
+/// be made cold.
+typedef struct vlreader {
+    struct vlreader*    next;
+    uint64_t            epoch;
+    int                 inuse;
+#   if (OT_FEATURE(VLCOLD) == ENABLED)
+    struct vlfs_entry*  entry;
+#   endif
+} vlreader_t;
+
+static uint64_t         global_epoch = 1;
+static vlreader_t*      readers = NULL;
+static VL_TLS vlreader_t* reader = NULL;
+static pthread_key_t    reader_key;
+static pthread_once_t   reader_once = PTHREAD_ONCE_INIT;
+
+static void sub_reader_exit(void* arg) {
+    vlreader_t* rec = arg;
+#   if (OT_FEATURE(VLCOLD) == ENABLED)
+    __atomic_store_n(&rec->entry, NULL, __ATOMIC_RELEASE);
+#   endif
+    __atomic_store_n(&rec->epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&rec->inuse, 0, __ATOMIC_RELEASE);
+}
+
+static void sub_reader_keyinit(void) {
+    pthread_key_create(&reader_key, &sub_reader_exit);
+}
+
+static vlreader_t* sub_reader(void) {
+    vlreader_t* rec;
+    int unused;
+
+    if (reader != NULL) {
+        return reader;
     }
-    else {
-        fstab = obj;
+
+    for (rec=__atomic_load_n(&readers, __ATOMIC_ACQUIRE); rec!=NULL; rec=rec->next) {
+        unused = 0;
+        if (__atomic_compare_exchange_n(&rec->inuse, &unused, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (rec == NULL) {
+        rec = calloc(1, sizeof(vlreader_t));
+        if (rec == NULL) {
+            return NULL;
+        }
+        rec->inuse  = 1;
+        rec->next   = __atomic_load_n(&readers, __ATOMIC_ACQUIRE);
+        while (!__atomic_compare_exchange_n(&readers, &rec->next, rec, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    }
+
+    pthread_once(&reader_once, &sub_reader_keyinit);
+    pthread_setspecific(reader_key, rec);
+    reader = rec;
+    return rec;
+}
+
+/// Entering the current epoch releases anything the thread held before.  The
+/// store must be visible before the thread reads the index, hence the fence.
+static ot_u8 sub_epoch_enter(void) {
+    vlreader_t* rec = sub_reader();
+    if (rec == NULL) {
+        return 0x15;
     }
-    
+    __atomic_store_n(&rec->epoch, __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST), __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
     return 0;
 }
 
+/// Holding keeps an older epoch if there is one, since it protects more.
+static ot_u8 sub_epoch_hold(void) {
+    if ((reader != NULL) && (__atomic_load_n(&reader->epoch, __ATOMIC_RELAXED) != 0)) {
+        return 0;
+    }
+    return sub_epoch_enter();
+}
 
-ot_u8 vl_multifs_deinit(void* handle) {
-    void* obj;
-    obj = (handle != NULL) ? handle : fstab;
-    judy_close(obj);
-    return 0;
+static void sub_epoch_leave(void) {
+    if (reader != NULL) {
+        __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+    }
 }
 
+static uint64_t sub_epoch_oldest(void) {
+    vlreader_t* rec;
+    uint64_t oldest = UINT64_MAX;
+    uint64_t epoch;
 
-ot_u8 vl_multifs_add(void* handle, void* newfsbase, const id_tmpl* fsid) {
-    void* obj;
-    MCU_TYPE_UINT* new_value;
-    
-//    {   uint64_t test;
-//        memcpy(&test, fsid->value, 8);
-//        printf("--> UID = %016llX (length=%i)\n", test, fsid->length);
-//        printf("--> Value = %016llX\n", (uint64_t)newfsbase);
-//        printf("--> handle = %016llX\n", (uint64_t)handle);
-//    }
-  
-    obj         = (handle != NULL) ? handle : fstab;
-    new_value   = judy_cell(obj, fsid->value, fsid->length);
+    for (rec=__atomic_load_n(&readers, __ATOMIC_ACQUIRE); rec!=NULL; rec=rec->next) {
+        epoch = __atomic_load_n(&rec->epoch, __ATOMIC_SEQ_CST);
+        if ((epoch != 0) && (epoch < oldest)) {
+            oldest = epoch;
+        }
+    }
+    return oldest;
+}
 
-    /// Error on case when out of memory.
-    /// 0x05 Veelite error is: "Cannot create file: Supplied length (in header) 
-    /// is beyond file limits."  The variant for MultiFS is 0x15.
-    if (new_value == NULL) {
-        return 0x15;
+#else
+#   define FSTAB_LOCK(GROUP)    do { } while(0)
+#   define FSTAB_UNLOCK(GROUP)  do { } while(0)
+#   define sub_epoch_enter()    0
+#   define sub_epoch_hold()     0
+#   define sub_epoch_leave()    do { } while(0)
+#endif
+
+
+/// With VLCOLD, each thread publishes the FS it checks-out before it reads
+/// whether the image is hot, and the group clears the image pointer before it
+/// reads whether any thread has the FS.  So, one of the two always sees the
+/// other, and a checked-out FS is never made cold.
+#if (OT_FEATURE(VLCOLD) == ENABLED)
+#   if (OT_FEATURE(VLTHREADS) == ENABLED)
+static void sub_hazard_set(struct vlfs_entry* entry) {
+    if (reader != NULL) {
+        __atomic_store_n(&reader->entry, entry, __ATOMIC_SEQ_CST);
     }
+}
 
-    /// Error on case when FSID already exists.
-    /// 0x02 Veelite error is: "Cannot create file: File ID already exists."
-    /// The variant for MultiFS is 0x12.
-    if (*new_value != 0) {
-        return 0x12;
+static ot_bool sub_hazard_test(struct vlfs_entry* entry) {
+    vlreader_t* rec;
+
+    for (rec=__atomic_load_n(&readers, __ATOMIC_ACQUIRE); rec!=NULL; rec=rec->next) {
+        if (__atomic_load_n(&rec->entry, __ATOMIC_SEQ_CST) == entry) {
+            return True;
+        }
     }
- 
-    /// Finally attach the newfs after errors are handled.  It is important to
-    /// have the new_value data type be an integer type that is as big as the 
-    /// pointer type on the platform.
-    //printf("--> Judy Value = %016llX\n", (MCU_TYPE_UINT)newfsbase);
-    *new_value = (MCU_TYPE_UINT)newfsbase;
-  
-    return 0;
+    return False;
 }
 
+#   else
+static struct vlfs_entry* hazard = NULL;
+#   define sub_hazard_set(ENTRY)    do { hazard = (ENTRY); } while(0)
+#   define sub_hazard_test(ENTRY)   (ot_bool)(hazard == (ENTRY))
+#   endif
+#endif
 
-ot_u8 vl_multifs_del(void* handle, const id_tmpl* fsid) {
-    void* obj;
-    MCU_TYPE_UINT* val;
-    ot_u8 rc;
-    
-    obj = (handle != NULL) ? handle : fstab;
-    val = judy_slot(obj, fsid->value, fsid->length);
-    
-    if (val != NULL) {
-        judy_del(obj);
-        rc = 0;
+
+
+
+static vlgroup_t* sub_group(void* handle) {
+    return (handle != NULL) ? (vlgroup_t*)handle : fstab;
+}
+
+
+static uint64_t sub_uid(const id_tmpl* fsid) {
+    uint64_t uid = 0;
+    ot_memcpy(&uid, fsid->value, (fsid->length < 8) ? fsid->length : 8);
+    return uid;
+}
+
+
+/// Without state, the entry is allocated alone, for vl_multifs_map().
+static struct vlfs_entry* sub_alloc_entry(vlgroup_t* group, void* base, uint64_t uid, ot_u8 cow, ot_bool state) {
+    struct vlfs_entry* entry;
+    size_t ctx_offset;
+
+    ctx_offset  = ENTRY_ALIGN(sizeof(struct vlfs_entry));
+    entry       = calloc(1, ctx_offset + (state ? STATE_SIZE() : 0));
+
+    if (entry != NULL) {
+        entry->uid      = uid;
+        entry->base     = base;
+        entry->vlctx    = state ? (ot_u8*)entry + ctx_offset : NULL;
+        entry->group    = group;
+#       if (OT_FEATURE(VLCOW) == ENABLED)
+        entry->cow      = cow;
+#       endif
+        group->entries++;
+        if (state) {
+            __atomic_fetch_add(&group->states, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return entry;
+}
+
+
+static void sub_free_entry(void* obj) {
+    struct vlfs_entry* entry = obj;
+    vlgroup_t* group = entry->group;
+    size_t ctx_offset = ENTRY_ALIGN(sizeof(struct vlfs_entry));
+
+    group->entries--;
+    if (entry->vlctx != NULL) {
+        __atomic_fetch_sub(&group->states, 1, __ATOMIC_RELAXED);
+    }
+
+#   if (OT_FEATURE(VLCOLD) == ENABLED)
+    free(entry->cold);
+#   endif
+    if (entry->vlctx != NULL) {
+        vl_freectx(entry->vlctx);
+    }
+    /// Wipe the state, because the auth table contains expanded keys.
+    if (entry->vlctx == ((ot_u8*)entry + ctx_offset)) {
+        memset(entry, 0, ctx_offset + STATE_SIZE());
     }
     else {
-        /// Error on case when FSID cannot be found.
-        /// 0x01 Veelite error is: "Cannot access file: File ID does not exist"
-        rc = 0x11;
+        if (entry->vlctx != NULL) {
+            memset(entry->vlctx, 0, STATE_SIZE());
+            free(entry->vlctx);
+        }
+        memset(entry, 0, ctx_offset);
     }
+    free(entry);
+}
 
-    return rc;
+
+/// Allocates and initializes the runtime state of an FS that has none, after
+/// its image is selected.  Threads may race to do it, and the first one to
+/// publish its state wins.
+static void* sub_state_init(struct vlfs_entry* entry) {
+    void* ctx = NULL;
+    void* state;
+
+    state = calloc(1, STATE_SIZE());
+    if (state == NULL) {
+        return NULL;
+    }
+    vl_setctx(state);
+    auth_settable(STATE_AUTHTAB(state));
+    vl_init(NULL);
+    auth_init();
+
+    if (__atomic_compare_exchange_n(&entry->vlctx, &ctx, state, False,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) == False) {
+        vl_freectx(state);
+        memset(state, 0, STATE_SIZE());
+        free(state);
+        state = ctx;
+    }
+    else {
+        __atomic_fetch_add(&((vlgroup_t*)entry->group)->states, 1, __ATOMIC_RELAXED);
+    }
+    return state;
+}
+
+
+/// If the calling thread has a deleted FS checked-out, it falls back to the
+/// default runtime state.
+static void sub_release_ctx(void) {
+    active_uid      = 0;
+    active_entry    = NULL;
+#   if (OT_FEATURE(VLCOLD) == ENABLED)
+    sub_hazard_set(NULL);
+#   endif
+    vl_setctx(NULL);
+    auth_settable(NULL);
+    sub_epoch_leave();
 }
 
 
 
 
-ot_u8 vl_multifs_switch(void* handle, void** getfsbase, const id_tmpl* fsid) {
-    void* obj;
-    MCU_TYPE_UINT* val;
-    ot_u8 rc = 255;
-    
-    obj = (handle != NULL) ? handle : fstab;
-    val = judy_slot(obj, fsid->value, fsid->length);
-    
-    //{   uint64_t test;
-    //    ot_memcpy(&test, fsid->value, 8);
-    //    printf("--> fsid->length = %d, fsid->value = %016llX\n", fsid->length, test);
-    //    printf("--> Value = %016llX\n", (MCU_TYPE_UINT)val);
-    //}
-    
-    if (val == NULL) {
-        rc = 0x11;
+/** Retirement of removed memory <BR>
+  * ========================================================================<BR>
+  * Must be called with the group locked.
+  */
+static void sub_dispose(vllimbo_t* item) {
+    if ((item->base_free != NULL) && (item->base != NULL)) {
+        item->base_free(item->base);
     }
-    else if (getfsbase != NULL) {
-        *getfsbase = (void*)*val;
-        //printf("--> Judy Value = %016llX\n", (MCU_TYPE_UINT)*getfsbase);
-        
-        /// Now, switch the context internally so that Veelite interface works with
-        /// the new FS.
-        vworm_init(*getfsbase, NULL);
-        vl_init(NULL);
-        rc = 0;
+    if ((item->obj_free != NULL) && (item->obj != NULL)) {
+        item->obj_free(item->obj);
     }
-    
-    return rc;
 }
 
 
+static void sub_reclaim(vlgroup_t* group, ot_bool all) {
+#   if (OT_FEATURE(VLTHREADS) == ENABLED)
+    vllimbo_t*  item;
+    uint64_t    oldest;
 
-ot_u8 vl_multifs_activeid(void* obj, id_tmpl* fsid) {
-    judy_key((Judy*)obj, fsid->value, JUDYKEYS_PER_UID);
-    return (*(uint64_t*)fsid->value != 0) ? 0 : 255;
+    if (group->limbo == NULL) {
+        return;
+    }
+    oldest = all ? UINT64_MAX : sub_epoch_oldest();
+    while ((group->limbo != NULL) && (group->limbo->epoch < oldest)) {
+        item            = group->limbo;
+        group->limbo    = item->next;
+        sub_dispose(item);
+        free(item);
+    }
+    if (group->limbo == NULL) {
+        group->limbo_tail = NULL;
+    }
+#   endif
 }
 
 
-static ot_u8 sub_pullfs(void* obj, MCU_TYPE_UINT* val, void** getfsbase, id_tmpl* fsid) {
-    ot_u8 rc = 255;
+/// The limbo item is allocated by the caller before it changes anything, so
+/// that running out of memory fails the change.  Waiting for the readers
+/// instead is not possible with the group locked.  Without VLTHREADS, items
+/// are disposed of at once, so one static item does.
+#if (OT_FEATURE(VLTHREADS) == ENABLED)
+#   define sub_limbo_new()      ((vllimbo_t*)malloc(sizeof(vllimbo_t)))
+#   define sub_limbo_free(ITEM) free(ITEM)
+#else
+static vllimbo_t limbo_item;
+#   define sub_limbo_new()      (&limbo_item)
+#   define sub_limbo_free(ITEM) do { } while(0)
+#endif
 
-    if (val == NULL) {
-        rc = 0x11;
+static void sub_retire(vlgroup_t* group, vllimbo_t* item, void* obj, void (*obj_free)(void*),
+                        void* base, void (*base_free)(void*)) {
+    item->obj       = obj;
+    item->obj_free  = obj_free;
+    item->base      = base;
+    item->base_free = base_free;
+
+#   if (OT_FEATURE(VLTHREADS) == ENABLED)
+    item->epoch     = __atomic_fetch_add(&global_epoch, 1, __ATOMIC_SEQ_CST);
+    item->next      = NULL;
+    if (group->limbo_tail != NULL) {
+        group->limbo_tail->next = item;
     }
-    else if (fsid != NULL) {
-        judy_key((Judy*)obj, fsid->value, JUDYKEYS_PER_UID);
-        if ((getfsbase != NULL) && (*(uint64_t*)fsid->value != 0)) {
-            fsid->length = 8;
-            *getfsbase = (void*)*val;
-            vworm_init(*getfsbase, NULL);
-            vl_init(NULL);
-            rc = 0;
+    else {
+        group->limbo = item;
+    }
+    group->limbo_tail = item;
+    sub_reclaim(group, False);
+#   else
+    sub_dispose(item);
+#   endif
+}
+
+
+
+
+/** Slab arena <BR>
+  * ========================================================================<BR>
+  */
+#if (OT_FEATURE(VLSLAB) == ENABLED)
+#   if (OT_FEATURE(VLTHREADS) == ENABLED)
+#       define SLAB_LOCK(SLAB)      pthread_mutex_lock(&(SLAB)->mutex)
+#       define SLAB_UNLOCK(SLAB)    pthread_mutex_unlock(&(SLAB)->mutex)
+#   else
+#       define SLAB_LOCK(SLAB)      do { } while(0)
+#       define SLAB_UNLOCK(SLAB)    do { } while(0)
+#   endif
+
+/// Huge pages are tried first, if enabled.  Otherwise, or if there are none
+/// reserved, the chunk is mapped normally and transparent huge pages are
+/// requested for it.
+static void* sub_slab_map(size_t bytes) {
+    void* chunk = MAP_FAILED;
+
+#   if ((OT_FEATURE(VLHUGEPAGES) == ENABLED) && defined(MAP_HUGETLB))
+    chunk = mmap(NULL, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+#   endif
+    if (chunk == MAP_FAILED) {
+        chunk = mmap(NULL, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (chunk == MAP_FAILED) {
+            return NULL;
         }
+#       if ((OT_FEATURE(VLHUGEPAGES) == ENABLED) && defined(MADV_HUGEPAGE))
+        madvise(chunk, bytes, MADV_HUGEPAGE);
+#       endif
     }
-    return rc;
+    return chunk;
 }
 
-ot_u8 vl_multifs_start(void* handle, void** getfsbase, id_tmpl* fsid) {
-    uint64_t null_id= 0;
-    void* obj;
-    MCU_TYPE_UINT* val;
-    
-    obj = (handle != NULL) ? handle : fstab;
-    val = judy_strt( (Judy*)obj, (const unsigned char*)&null_id, 0 /*JUDYKEYS_PER_UID*/);
-    return sub_pullfs(obj, val, getfsbase, fsid);
+
+/// Adds a chunk, keeping the chunk list sorted.  Must be called with the slab
+/// locked.
+static ot_u8 sub_slab_grow(vlslab_t* slab) {
+    ot_u8*  chunk;
+    size_t  i;
+
+    if (slab->chunks == slab->chunk_max) {
+        size_t  max     = (slab->chunk_max != 0) ? (2 * slab->chunk_max) : 16;
+        ot_u8** list    = realloc(slab->chunk, max * sizeof(ot_u8*));
+        if (list == NULL) {
+            return 0x15;
+        }
+        slab->chunk     = list;
+        slab->chunk_max = max;
+    }
+
+    chunk = sub_slab_map(slab->chunk_bytes);
+    if (chunk == NULL) {
+        return 0x15;
+    }
+    for (i=slab->chunks; (i > 0) && (slab->chunk[i-1] > chunk); i--) {
+        slab->chunk[i] = slab->chunk[i-1];
+    }
+    slab->chunk[i]  = chunk;
+    slab->chunks++;
+    slab->next      = chunk;
+    slab->end       = chunk + ((slab->chunk_bytes / slab->slot) * slab->slot);
+    return 0;
 }
 
-ot_u8 vl_multifs_next(void* handle, void** getfsbase, id_tmpl* fsid) {
-    void* obj;
-    MCU_TYPE_UINT* val;
-    
-    obj = (handle != NULL) ? handle : fstab;
-    val = judy_nxt((Judy*)obj);
-    return sub_pullfs(obj, val, getfsbase, fsid);
+
+static void* sub_slab_alloc(vlslab_t* slab, size_t size) {
+    ot_u8* slot = NULL;
+    void*  base = NULL;
+
+    SLAB_LOCK(slab);
+    if (slab->image == 0) {
+        slab->image         = size;
+        slab->slot          = (SLAB_HEADER + size + SLAB_HEADER - 1) & ~(size_t)(SLAB_HEADER - 1);
+        slab->chunk_bytes   = (slab->slot + SLAB_CHUNK - 1) & ~(size_t)(SLAB_CHUNK - 1);
+    }
+
+    if (size == slab->image) {
+        if (slab->free != NULL) {
+            base        = slab->free;
+            slab->free  = SLAB_HDR(base)->next_free;
+        }
+        else {
+            if (slab->next == slab->end) {
+                sub_slab_grow(slab);
+            }
+            if (slab->next != slab->end) {
+                slot        = slab->next;
+                slab->next += slab->slot;
+                base        = slot + SLAB_HEADER;
+                SLAB_HDR(base)->slab = slab;
+            }
+        }
+        if (base != NULL) {
+            slab->live++;
+        }
+    }
+    SLAB_UNLOCK(slab);
+
+    return base;
+}
+
+
+static void sub_slab_free(void* base) {
+    vlslab_t* slab = SLAB_HDR(base)->slab;
+
+    SLAB_LOCK(slab);
+    SLAB_HDR(base)->next_free   = slab->free;
+    slab->free                  = base;
+    slab->live--;
+    SLAB_UNLOCK(slab);
+}
+
+
+/// Binary search for the chunk at or below the address.
+static ot_bool sub_slab_owns(vlslab_t* slab, const void* base) {
+    const ot_u8* addr = base;
+    size_t lo, hi, mid;
+    ot_bool owns = False;
+
+    SLAB_LOCK(slab);
+    lo = 0;
+    hi = slab->chunks;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (slab->chunk[mid] <= addr)   lo = mid + 1;
+        else                            hi = mid;
+    }
+    if (lo > 0) {
+        owns = (ot_bool)(addr < (slab->chunk[lo-1] + slab->chunk_bytes));
+    }
+    SLAB_UNLOCK(slab);
+
+    return owns;
+}
+
+
+static void sub_slab_release(vlslab_t* slab) {
+    size_t i;
+    for (i=0; i<slab->chunks; i++) {
+        munmap(slab->chunk[i], slab->chunk_bytes);
+    }
+    free(slab->chunk);
+}
+
+#endif
+
+
+/// Images from the slab are returned to it, if the caller would free them.
+/// Mapped images are not freed.  Other images are freed with the caller's
+/// function.
+typedef void (*vlfree_t)(void*);
+
+static vlfree_t sub_image_free(vlgroup_t* group, void* base, vlfree_t free_fn) {
+    vlmap_t* map;
+
+    /// Mapped images are freed with their region
+    for (map = __atomic_load_n(&group->maps, __ATOMIC_ACQUIRE); map != NULL; map = map->next) {
+        if (((ot_u8*)base >= map->region) && ((ot_u8*)base < (map->region + map->size))) {
+            return NULL;
+        }
+    }
+#   if (OT_FEATURE(VLSLAB) == ENABLED)
+    if ((free_fn != NULL) && (base != NULL) && sub_slab_owns(&group->slab, base)) {
+        return &sub_slab_free;
+    }
+#   endif
+    return free_fn;
+}
+
+
+/// COW images are descriptors made by vworm_cow_new(), so they are always freed
+/// with vworm_cow_free(), if the caller would free them.
+static vlfree_t sub_entry_free(vlgroup_t* group, struct vlfs_entry* entry, vlfree_t free_fn) {
+#   if (OT_FEATURE(VLCOW) == ENABLED)
+    if ((free_fn != NULL) && (entry->cow != 0)) {
+        return &vworm_cow_free;
+    }
+#   endif
+    return sub_image_free(group, entry->base, free_fn);
+}
+
+
+
+
+/** Read index <BR>
+  * ========================================================================<BR>
+  * sub_index_get() is lock-free.  The others must be called with the group
+  * locked.
+  */
+static inline uint64_t sub_hash(uint64_t uid) {
+    uid ^= uid >> 33;
+    uid *= 0xff51afd7ed558ccdULL;
+    uid ^= uid >> 33;
+    uid *= 0xc4ceb9fe1a85ec53ULL;
+    uid ^= uid >> 33;
+    return uid;
+}
+
+
+#if (OT_FEATURE(VLFILTER) == ENABLED)
+/// The bits of a block are from the low half of the hash, and the block is
+/// from the high half.  The multipliers are odd constants, one per word.
+static const uint32_t filter_salt[FILTER_WORDS] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+#define FILTER_BIT(HASH, I) ((uint64_t)1 << (((uint32_t)(HASH) * filter_salt[I]) >> 26))
+
+static inline uint64_t* sub_filter_block(vlindex_t* index, uint64_t hash) {
+    return &index->filter[((size_t)(hash >> 32) & index->fmask) * FILTER_WORDS];
+}
+
+static void sub_filter_add(vlindex_t* index, uint64_t hash) {
+    uint64_t* block = sub_filter_block(index, hash);
+    uint64_t bit;
+    int i;
+    for (i=0; i<FILTER_WORDS; i++) {
+        bit = FILTER_BIT(hash, i);
+        if ((__atomic_fetch_or(&block[i], bit, __ATOMIC_RELEASE) & bit) == 0) {
+            index->fbits++;
+        }
+    }
+}
+
+static ot_bool sub_filter_test(vlindex_t* index, uint64_t hash) {
+    uint64_t* block = sub_filter_block(index, hash);
+    int i;
+    for (i=0; i<FILTER_WORDS; i++) {
+        if ((__atomic_load_n(&block[i], __ATOMIC_RELAXED) & FILTER_BIT(hash, i)) == 0) {
+            return False;
+        }
+    }
+    return True;
+}
+
+/// Chance that a UID not in the group passes the filter: it would need one
+/// set bit in each word of its block, and the fraction of bits set is taken
+/// to be the same in all words.
+static float sub_filter_fpr(vlindex_t* index) {
+    double  f = (double)index->fbits / (double)(FILTER_BLOCKS(index) * FILTER_WORDS * 64);
+    double  p = 1.;
+    int     i;
+
+    for (i=0; i<FILTER_WORDS; i++) {
+        p *= f;
+    }
+    return (float)p;
+}
+
+#else
+#   define sub_filter_add(INDEX, HASH)      do { } while(0)
+#   define sub_filter_test(INDEX, HASH)     True
+#endif
+
+
+static struct vlfs_entry* sub_index_probe(vlindex_t* index, uint64_t uid, uint64_t hash) {
+    vlbucket_t* bucket;
+    uint64_t    key;
+    size_t      b;
+    int         j;
+
+    if (sub_filter_test(index, hash) == False) {
+        return NULL;
+    }
+
+    b = (size_t)hash & index->mask;
+    while (1) {
+        bucket = &index->bucket[b];
+        for (j=0; j<BUCKET_SLOTS; j++) {
+            key = __atomic_load_n(&bucket->uid[j], __ATOMIC_ACQUIRE);
+            if (key == uid) {
+                return __atomic_load_n(&bucket->entry[j], __ATOMIC_ACQUIRE);
+            }
+            if (key == 0) {
+                return NULL;
+            }
+        }
+        b = (b + 1) & index->mask;
+    }
+}
+
+
+static struct vlfs_entry* sub_index_get(vlgroup_t* group, uint64_t uid) {
+    vlindex_t* index = __atomic_load_n(&group->index, __ATOMIC_ACQUIRE);
+    return sub_index_probe(index, uid, sub_hash(uid));
+}
+
+
+/// Prefetches the memory that sub_index_probe() will read first.
+static inline void sub_index_prefetch(vlindex_t* index, uint64_t hash) {
+#   if (OT_FEATURE(VLFILTER) == ENABLED)
+    OT_PREFETCH(sub_filter_block(index, hash));
+#   endif
+    OT_PREFETCH(&index->bucket[(size_t)hash & index->mask]);
+}
+
+
+/// Returns the slot position of the UID, or of the empty slot where it would
+/// be inserted.
+static size_t sub_index_find(vlindex_t* index, uint64_t uid) {
+    size_t  b;
+    int     j;
+
+    b = (size_t)sub_hash(uid) & index->mask;
+    while (1) {
+        for (j=0; j<BUCKET_SLOTS; j++) {
+            if ((index->bucket[b].uid[j] == uid) || (index->bucket[b].uid[j] == 0)) {
+                return (b * BUCKET_SLOTS) + j;
+            }
+        }
+        b = (b + 1) & index->mask;
+    }
+}
+
+
+static void sub_index_free(void* obj) {
+    vlindex_t* index = obj;
+#   if (OT_FEATURE(VLFILTER) == ENABLED)
+    free(index->filter);
+#   endif
+    free(index->bucket);
+    free(index);
+}
+
+
+static vlindex_t* sub_index_alloc(size_t live) {
+    vlindex_t*  index;
+    void*       bucket;
+    size_t      buckets = INDEX_MINBUCKETS;
+
+    /// Sized for half load, so it can grow for a while before a rebuild
+    while ((buckets * BUCKET_SLOTS) < (2 * (live + 1))) {
+        buckets <<= 1;
+    }
+    index = calloc(1, sizeof(vlindex_t));
+    if (index == NULL) {
+        return NULL;
+    }
+    if (posix_memalign(&bucket, BUCKET_BYTES, buckets * sizeof(vlbucket_t)) != 0) {
+        free(index);
+        return NULL;
+    }
+    memset(bucket, 0, buckets * sizeof(vlbucket_t));
+    index->bucket   = bucket;
+    index->mask     = buckets - 1;
+
+#   if (OT_FEATURE(VLFILTER) == ENABLED)
+    index->fmask = FILTER_BLOCKS(index) - 1;
+    if (posix_memalign(&bucket, BUCKET_BYTES, FILTER_BLOCKS(index) * FILTER_WORDS * 8) != 0) {
+        free(index->bucket);
+        free(index);
+        return NULL;
+    }
+    memset(bucket, 0, FILTER_BLOCKS(index) * FILTER_WORDS * 8);
+    index->filter = bucket;
+#   endif
+
+    return index;
+}
+
+
+/// The new index is filled before it is published, so plain stores are OK.
+/// It is sized for extra more FS than are in the group now.
+static ot_u8 sub_index_rebuild(vlgroup_t* group, size_t extra) {
+    vlindex_t* old = group->index;
+    vlindex_t* index;
+    vllimbo_t* item;
+    size_t i, j;
+
+    index = sub_index_alloc(old->live + extra);
+    if (index == NULL) {
+        return 0x15;
+    }
+    item = sub_limbo_new();
+    if (item == NULL) {
+        sub_index_free(index);
+        return 0x15;
+    }
+    for (i=0; i<INDEX_SLOTS(old); i++) {
+        if (SLOT_ENTRY(old, i) != NULL) {
+            j = sub_index_find(index, SLOT_UID(old, i));
+            SLOT_UID(index, j)      = SLOT_UID(old, i);
+            SLOT_ENTRY(index, j)    = SLOT_ENTRY(old, i);
+            sub_filter_add(index, sub_hash(SLOT_UID(old, i)));
+            index->used++;
+        }
+    }
+    index->live = old->live;
+
+    __atomic_store_n(&group->index, index, __ATOMIC_RELEASE);
+    group->generation++;
+    sub_retire(group, item, old, &sub_index_free, NULL, NULL);
+    return 0;
+}
+
+
+/// Sets the entry for a UID.  A NULL entry deletes it.
+static ot_u8 sub_index_put(vlgroup_t* group, uint64_t uid, struct vlfs_entry* entry) {
+    vlindex_t* index = group->index;
+    size_t i;
+
+    if ((entry != NULL) && (4 * (index->used + 1) > 3 * INDEX_SLOTS(index))) {
+        if (sub_index_rebuild(group, 0) != 0) {
+            return 0x15;
+        }
+        index = group->index;
+    }
+
+    i = sub_index_find(index, uid);
+    if (SLOT_UID(index, i) == 0) {
+        if (entry == NULL) {
+            return 0x11;
+        }
+        sub_filter_add(index, sub_hash(uid));
+        __atomic_store_n(&SLOT_ENTRY(index, i), entry, __ATOMIC_RELEASE);
+        __atomic_store_n(&SLOT_UID(index, i), uid, __ATOMIC_RELEASE);
+        index->used++;
+    }
+    else {
+        __atomic_store_n(&SLOT_ENTRY(index, i), entry, __ATOMIC_RELEASE);
+    }
+
+    if (entry != NULL)  index->live++;
+    else                index->live--;
+
+    return 0;
+}
+
+
+/// Returns the first position at or after pos that has an FS, or the end.
+/// With Judy, iterating and scanning go through the Judy table instead.
+#if (OT_FEATURE(VLJUDY) != ENABLED)
+static size_t sub_index_seek(vlindex_t* index, size_t pos, size_t end) {
+    while ((pos < end) && (SLOT_ENTRY(index, pos) == NULL)) {
+        pos++;
+    }
+    return pos;
+}
+#endif
+
+
+
+
+
+/** Cold storage <BR>
+  * ========================================================================<BR>
+  * With VLCOLD, an idle full image is made cold: it is stored as the runs of
+  * bytes where it differs from the template that is closest to it, and the
+  * image is freed.  Selecting the FS rebuilds the image (thaws it).  When a
+  * group has more than hot_max hot images, they are made cold in CLOCK order,
+  * which approximates LRU without taking the lock on each select.  Must be
+  * called with the group locked, except for sub_cold_pin().
+  */
+#if (OT_FEATURE(VLCOLD) == ENABLED)
+
+/// Each run is a skip from the end of the previous run, a length, and the
+/// bytes.  Differences closer than COLD_GAP bytes are put in the same run,
+/// because a new run costs 4 bytes.
+#define COLD_GAP    4
+#define COLD_MAXRUN 0xFFFF
+
+typedef struct {
+    ot_u32      alloc;
+    ot_u32      size;
+    ot_u8       tmpl;
+    ot_u8       data[];
+} vlcold_t;
+
+
+static size_t sub_cold_run(ot_u8* out, size_t size, size_t skip, size_t len, const ot_u8* src) {
+    if (out != NULL) {
+        ot_u16 hdr[2] = { (ot_u16)skip, (ot_u16)len };
+        memcpy(&out[size], hdr, 4);
+        memcpy(&out[size+4], src, len);
+    }
+    return size + 4 + len;
+}
+
+
+/// Writes the runs of the image into out, if it is not NULL, and returns
+/// their size in bytes.
+static size_t sub_cold_delta(const ot_u8* image, const ot_u8* tmpl, size_t alloc, ot_u8* out) {
+    size_t size = 0;
+    size_t last = 0;
+    size_t start, end, len;
+    size_t i = 0;
+
+    while (i < alloc) {
+        if (image[i] == tmpl[i]) {
+            i++;
+            continue;
+        }
+        start   = i;
+        end     = i + 1;
+        for (i=end; (i < alloc) && ((i - end) < COLD_GAP); i++) {
+            if (image[i] != tmpl[i]) {
+                end = i + 1;
+            }
+        }
+        for (; (start - last) > COLD_MAXRUN; last += COLD_MAXRUN) {
+            size = sub_cold_run(out, size, COLD_MAXRUN, 0, image);
+        }
+        for (; start < end; start += len) {
+            len     = ((end - start) > COLD_MAXRUN) ? COLD_MAXRUN : (end - start);
+            size    = sub_cold_run(out, size, start - last, len, &image[start]);
+            last    = start + len;
+        }
+    }
+    return size;
+}
+
+
+static void sub_cold_undelta(ot_u8* image, const vlcold_t* cold) {
+    const ot_u8* run = cold->data;
+    const ot_u8* end = cold->data + cold->size;
+    size_t pos = 0;
+    ot_u16 hdr[2];
+
+    while (run < end) {
+        memcpy(hdr, run, 4);
+        pos += hdr[0];
+        memcpy(&image[pos], run+4, hdr[1]);
+        pos += hdr[1];
+        run += 4 + hdr[1];
+    }
+}
+
+
+/// A hot image is put on the list just behind the hand, so it is the last
+/// one the hand gets to.  COW images are small already, so they are never
+/// put on the list.
+static void sub_cold_link(vlgroup_t* group, struct vlfs_entry* entry) {
+    struct vlfs_entry* hand = group->hand;
+
+    if (hand == NULL) {
+        entry->hot_prev = entry;
+        entry->hot_next = entry;
+        group->hand     = entry;
+    }
+    else {
+        entry->hot_next = hand;
+        entry->hot_prev = hand->hot_prev;
+        hand->hot_prev->hot_next = entry;
+        hand->hot_prev  = entry;
+    }
+    group->hot++;
+}
+
+
+static void sub_cold_unlink(vlgroup_t* group, struct vlfs_entry* entry) {
+    if (entry->hot_next == entry) {
+        group->hand = NULL;
+    }
+    else {
+        entry->hot_prev->hot_next = entry->hot_next;
+        entry->hot_next->hot_prev = entry->hot_prev;
+        if (group->hand == entry) {
+            group->hand = entry->hot_next;
+        }
+    }
+    entry->hot_prev = NULL;
+    entry->hot_next = NULL;
+    group->hot--;
+}
+
+
+/// Makes an image cold, unless it is checked-out or it would not be smaller.
+static ot_u8 sub_cold_freeze(vlgroup_t* group, struct vlfs_entry* entry) {
+    const ot_u8* tmpl;
+    vlcold_t*   cold;
+    ot_u8*      base = entry->base;
+    vllimbo_t*  item;
+    size_t      alloc, size;
+    size_t      best = SIZE_MAX;
+    ot_u8       best_id = 0;
+
+    alloc = vworm_fsalloc((const vlFSHEADER*)base);
+    for (ot_u8 id=0; id<=OT_PARAM(VLTEMPLATES); id++) {
+        tmpl = vl_multifs_template(group, id);
+        if ((tmpl != NULL) && (vworm_fsalloc((const vlFSHEADER*)tmpl) == alloc)) {
+            size = sub_cold_delta(base, tmpl, alloc, NULL);
+            if (size < best) {
+                best    = size;
+                best_id = id;
+            }
+        }
+    }
+    if ((best + sizeof(vlcold_t)) >= alloc) {
+        return 1;
+    }
+
+    __atomic_store_n(&entry->base, NULL, __ATOMIC_SEQ_CST);
+    if (sub_hazard_test(entry)) {
+        __atomic_store_n(&entry->base, base, __ATOMIC_RELEASE);
+        return 1;
+    }
+
+    /// No thread can write the image now, so the delta is final.
+    item = sub_limbo_new();
+    cold = (item != NULL) ? malloc(sizeof(vlcold_t) + best) : NULL;
+    if (cold == NULL) {
+        if (item != NULL) {
+            sub_limbo_free(item);
+        }
+        __atomic_store_n(&entry->base, base, __ATOMIC_RELEASE);
+        return 0x15;
+    }
+    cold->alloc = (ot_u32)alloc;
+    cold->size  = (ot_u32)best;
+    cold->tmpl  = best_id;
+    sub_cold_delta(base, vl_multifs_template(group, best_id), alloc, cold->data);
+    entry->cold = cold;
+    sub_cold_unlink(group, entry);
+    group->cold_fs++;
+    group->cold_bytes += sizeof(vlcold_t) + best;
+
+    /// A thread may still be reading the image through a stale pointer, e.g.
+    /// from vl_multifs_open_batch(), so it is retired rather than freed.
+    sub_retire(group, item, NULL, NULL, base, sub_image_free(group, base, &free));
+    return 0;
+}
+
+
+/// Advances the CLOCK hand until the group has no more than hot_max hot
+/// images.  An image that was selected since the hand last passed gets a
+/// second chance, so each image is passed at most twice.  keep is never made
+/// cold.
+static void sub_cold_balance(vlgroup_t* group, struct vlfs_entry* keep) {
+    struct vlfs_entry* entry;
+    size_t limit = 2 * group->hot;
+
+    if (group->hot_max == 0) {
+        return;
+    }
+    for (size_t n=0; (group->hot > group->hot_max) && (n < limit); n++) {
+        entry       = group->hand;
+        group->hand = entry->hot_next;
+        if (entry == keep) {
+            continue;
+        }
+        if (__atomic_load_n(&entry->ref, __ATOMIC_RELAXED) != 0) {
+            __atomic_store_n(&entry->ref, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        sub_cold_freeze(group, entry);
+    }
+}
+
+
+/// Rebuilds a cold image, from a new allocation.
+static ot_u8 sub_cold_thaw(vlgroup_t* group, struct vlfs_entry* entry) {
+    vlcold_t*   cold = entry->cold;
+    ot_u8*      base;
+
+    if (entry->base != NULL) {
+        return 0;
+    }
+    if ((cold == NULL) || (sub_index_get(group, entry->uid) != entry)) {
+        return 0x11;
+    }
+    base = vl_multifs_alloc(group, cold->alloc);
+    if (base == NULL) {
+        return 0x15;
+    }
+    memcpy(base, vl_multifs_template(group, cold->tmpl), cold->alloc);
+    sub_cold_undelta(base, cold);
+    entry->cold = NULL;
+    group->cold_fs--;
+    group->cold_bytes -= sizeof(vlcold_t) + cold->size;
+    free(cold);
+
+    __atomic_store_n(&entry->base, base, __ATOMIC_RELEASE);
+    sub_cold_link(group, entry);
+    sub_cold_balance(group, entry);
+    return 0;
+}
+
+
+/// Called without the lock, when an FS is selected: the image is thawed if it
+/// is cold.  The image is returned through base, because entry->base can be
+/// NULL for a moment while another thread tries to make it cold.
+static ot_u8 sub_cold_pin(struct vlfs_entry* entry, void** base) {
+    vlgroup_t* group;
+    ot_u8 rc;
+
+    sub_hazard_set(entry);
+    if (__atomic_load_n(&entry->ref, __ATOMIC_RELAXED) == 0) {
+        __atomic_store_n(&entry->ref, 1, __ATOMIC_RELAXED);
+    }
+    *base = __atomic_load_n(&entry->base, __ATOMIC_SEQ_CST);
+    if (*base != NULL) {
+        return 0;
+    }
+
+    group = entry->group;
+    FSTAB_LOCK(group);
+    rc      = sub_cold_thaw(group, entry);
+    *base   = entry->base;
+    FSTAB_UNLOCK(group);
+    if (rc != 0) {
+        sub_hazard_set(NULL);
+    }
+    return rc;
+}
+
+#endif
+
+
+
+
+ot_u8 vl_multifs_init(void** new_handle) {
+    vlgroup_t* group;
+
+    /// The default image is built here, so new FS don't wait for it
+    if (vworm_fsdefault() == NULL) {
+        return 0x15;
+    }
+    group = calloc(1, sizeof(vlgroup_t));
+    if (group == NULL) {
+        return 0x15;
+    }
+    group->index = sub_index_alloc(0);
+    if (group->index == NULL) {
+        free(group);
+        return 0x15;
+    }
+#   if (OT_FEATURE(VLJUDY) == ENABLED)
+    group->judy = judy_open(4*JUDYKEYS_PER_UID, JUDYKEYS_PER_UID);
+    if (group->judy == NULL) {
+        sub_index_free(group->index);
+        free(group);
+        return 0x15;
+    }
+#   endif
+#   if (OT_FEATURE(VLCOLD) == ENABLED)
+    group->hot_max = OT_PARAM(VLHOTSET);
+#   endif
+#   if (OT_FEATURE(VLTHREADS) == ENABLED)
+    pthread_mutex_init(&group->mutex, NULL);
+#       if (OT_FEATURE(VLSLAB) == ENABLED)
+        pthread_mutex_init(&group->slab.mutex, NULL);
+#       endif
+#   endif
+
+    if (new_handle != NULL) {
+        *new_handle = group;
+    }
+    else {
+        fstab = group;
+    }
+
+    return 0;
+}
+
+
+ot_u8 vl_multifs_deinit(void* handle, void (*free_fn)(void*)) {
+    vlgroup_t* group;
+    struct vlfs_entry* entry;
+    ot_bool active = False;
+    size_t i;
+
+    group = sub_group(handle);
+    if (group == NULL) {
+        return 255;
+    }
+
+    /// The caller must ensure that no other thread is using the group.  The
+    /// images from the slab are released with it, below, so only the others
+    /// need to be freed one by one.  COW images are freed with their own
+    /// function, which also writes back paged images.
+    FSTAB_LOCK(group);
+    for (i=0; i<INDEX_SLOTS(group->index); i++) {
+        entry = SLOT_ENTRY(group->index, i);
+        if (entry != NULL) {
+            vlfree_t entry_free = NULL;
+            active |= (entry == active_entry);
+            if ((free_fn != NULL) && (entry->base != NULL)) {
+                entry_free = sub_entry_free(group, entry, free_fn);
+            }
+#           if (OT_FEATURE(VLSLAB) == ENABLED)
+            if (entry_free == &sub_slab_free) {
+                entry_free = NULL;
+            }
+#           endif
+#           if (OT_FEATURE(VLCOW) == ENABLED)
+            if (entry->cow != 0) {
+                vworm_cow_account(entry->base, NULL);
+            }
+#           endif
+            if (entry_free != NULL) {
+                entry_free(entry->base);
+            }
+            sub_free_entry(entry);
+        }
+    }
+#   if (OT_FEATURE(VLJUDY) == ENABLED)
+    judy_close(group->judy);
+#   endif
+    sub_reclaim(group, True);
+    sub_index_free(group->index);
+    for (i=0; i<OT_PARAM(VLTEMPLATES); i++) {
+        free(group->tmpl[i]);
+    }
+    while (group->maps != NULL) {
+        vlmap_t* map = group->maps;
+        group->maps  = map->next;
+        if (map->region_free != NULL) {
+            map->region_free(map->region, map->size);
+        }
+        free(map);
+    }
+#   if (OT_FEATURE(VLSLAB) == ENABLED)
+    sub_slab_release(&group->slab);
+#   endif
+    FSTAB_UNLOCK(group);
+
+#   if (OT_FEATURE(VLTHREADS) == ENABLED)
+    pthread_mutex_destroy(&group->mutex);
+#       if (OT_FEATURE(VLSLAB) == ENABLED)
+        pthread_mutex_destroy(&group->slab.mutex);
+#       endif
+#   endif
+    if (group == fstab) {
+        fstab = NULL;
+    }
+    free(group);
+
+    /// The FS checked-out by this thread may be from another group
+    if (active) {
+        sub_release_ctx();
+    }
+
+    return 0;
+}
+
+
+static ot_u8 sub_add(void* handle, void* newfsbase, const id_tmpl* fsid, ot_u8 cow) {
+    vlgroup_t* group;
+    struct vlfs_entry* entry = NULL;
+    uint64_t uid;
+    ot_u32 alloc;
+    ot_u8 rc;
+#   if (OT_FEATURE(VLJUDY) == ENABLED)
+    MCU_TYPE_UINT* new_value;
+#   endif
+
+    group = sub_group(handle);
+    uid   = sub_uid(fsid);
+
+    /// UID 0 is reserved: it marks an empty slot in the read index.  It is
+    /// documented with otfs_new().
+    if ((group == NULL) || (uid == 0)) {
+        return 255;
+    }
+
+    /// This thread will have the new FS checked-out
+    if (sub_epoch_enter() != 0) {
+        return 0x15;
+    }
+    alloc = (newfsbase != NULL) ? vworm_fsalloc((const vlFSHEADER*)newfsbase) : 0;
+
+    FSTAB_LOCK(group);
+#   if (OT_FEATURE(VLJUDY) == ENABLED)
+    new_value = judy_cell(group->judy, fsid->value, fsid->length);
+
+    /// Error on case when out of memory.
+    /// 0x05 Veelite error is: "Cannot create file: Supplied length (in header)
+    /// is beyond file limits."  The variant for MultiFS is 0x15.
+    if (new_value == NULL) {
+        rc = 0x15;
+    }
+
+    /// Error on case when FSID already exists.
+    /// 0x02 Veelite error is: "Cannot create file: File ID already exists."
+    /// The variant for MultiFS is 0x12.
+    else if (*new_value != 0) {
+        rc = 0x12;
+    }
+
+    /// Out of memory on the entry allocation: the empty cell must be removed.
+    else if ((entry = sub_alloc_entry(group, newfsbase, uid, cow, True)) == NULL) {
+        judy_del(group->judy);
+        rc = 0x15;
+    }
+
+    else if (sub_index_put(group, uid, entry) != 0) {
+        judy_del(group->judy);
+        sub_free_entry(entry);
+        rc = 0x15;
+    }
+
+    /// Finally attach the newfs after errors are handled.  It is important to
+    /// have the new_value data type be an integer type that is as big as the
+    /// pointer type on the platform.
+    else {
+        *new_value  = (MCU_TYPE_UINT)entry;
+        rc          = 0;
+    }
+
+#   else
+    /// Same errors as above, from the read index alone
+    if (sub_index_get(group, uid) != NULL) {
+        rc = 0x12;
+    }
+    else if ((entry = sub_alloc_entry(group, newfsbase, uid, cow, True)) == NULL) {
+        rc = 0x15;
+    }
+    else if (sub_index_put(group, uid, entry) != 0) {
+        sub_free_entry(entry);
+        rc = 0x15;
+    }
+    else {
+        rc = 0;
+    }
+#   endif
+
+    /// A COW image keeps the count of its private memory in the group
+    if (rc == 0) {
+        entry->alloc        = alloc;
+        group->image_bytes += alloc;
+#       if (OT_FEATURE(VLCOW) == ENABLED)
+        if (cow != 0) {
+            group->cow_fs++;
+            vworm_cow_account(newfsbase, &group->cow_bytes);
+        }
+#       endif
+    }
+
+    /// The new FS is about to be checked-out, so it is not made cold here.
+#   if (OT_FEATURE(VLCOLD) == ENABLED)
+    if (rc == 0) {
+        entry->ref      = 1;
+        if (cow == 0) {
+            sub_cold_link(group, entry);
+            sub_cold_balance(group, entry);
+        }
+    }
+#   endif
+    FSTAB_UNLOCK(group);
+
+    /// The new FS is checked-out, but its runtime state is not initialized.
+    /// The caller must do vl_init() and auth_init() after vl_multifs_add().
+    if (rc == 0) {
+        vl_multifs_select(entry, NULL, NULL);
+    }
+
+    return rc;
+}
+
+
+ot_u8 vl_multifs_add(void* handle, void* newfsbase, const id_tmpl* fsid) {
+    return sub_add(handle, newfsbase, fsid, 0);
+}
+
+
+#if (OT_FEATURE(VLCOW) == ENABLED)
+ot_u8 vl_multifs_addcow(void* handle, void* cow, const id_tmpl* fsid) {
+    if (cow == NULL) {
+        return 255;
+    }
+    return sub_add(handle, cow, fsid, 1);
+}
+#endif
+
+
+ot_u8 vl_multifs_del(void* handle, const id_tmpl* fsid, void (*free_fn)(void*)) {
+    vlgroup_t* group;
+    struct vlfs_entry* entry;
+    vllimbo_t* item;
+    vlfree_t entry_free;
+    uint64_t uid;
+    ot_u8 rc;
+#   if (OT_FEATURE(VLJUDY) == ENABLED)
+    MCU_TYPE_UINT* val;
+#   endif
+
+    group = sub_group(handle);
+    if (group == NULL) {
+        return 255;
+    }
+    uid = sub_uid(fsid);
+
+    /// Out of memory for retiring the FS: it is not deleted
+    item = sub_limbo_new();
+    if (item == NULL) {
+        return 0x15;
+    }
+
+    FSTAB_LOCK(group);
+#   if (OT_FEATURE(VLJUDY) == ENABLED)
+    val     = judy_slot(group->judy, fsid->value, fsid->length);
+    entry   = (val != NULL) ? (struct vlfs_entry*)*val : NULL;
+    if (entry != NULL) {
+        judy_del(group->judy);
+    }
+#   else
+    entry   = sub_index_get(group, uid);
+#   endif
+
+    if (entry != NULL) {
+        sub_index_put(group, uid, NULL);
+        if (active_entry == entry) {
+            sub_release_ctx();
+        }
+#       if (OT_FEATURE(VLCOLD) == ENABLED)
+        if (entry->hot_next != NULL) {
+            sub_cold_unlink(group, entry);
+        }
+        if (entry->cold != NULL) {
+            group->cold_fs--;
+            group->cold_bytes -= sizeof(vlcold_t) + ((vlcold_t*)entry->cold)->size;
+        }
+#       endif
+        group->image_bytes -= entry->alloc;
+        entry_free = sub_entry_free(group, entry, free_fn);
+
+        /// A COW image that is not freed here is the caller's from now on
+#       if (OT_FEATURE(VLCOW) == ENABLED)
+        if (entry->cow != 0) {
+            group->cow_fs--;
+            if (entry_free != &vworm_cow_free) {
+                vworm_cow_account(entry->base, NULL);
+            }
+        }
+#       endif
+        sub_retire(group, item, entry, &sub_free_entry, entry->base, entry_free);
+        rc = 0;
+    }
+    else {
+        /// Error on case when FSID cannot be found.
+        /// 0x01 Veelite error is: "Cannot access file: File ID does not exist"
+        sub_limbo_free(item);
+        rc = 0x11;
+    }
+    FSTAB_UNLOCK(group);
+
+    return rc;
+}
+
+
+
+ot_u8 vl_multifs_open(void* handle, vlFSREF* ref, const id_tmpl* fsid) {
+    vlgroup_t* group;
+    struct vlfs_entry* entry;
+    ot_u8 rc;
+
+    group = sub_group(handle);
+    if (group == NULL) {
+        return 255;
+    }
+
+    /// Lock-free lookup.  Entering the epoch first protects the entry from
+    /// being freed until this thread checks-out another FS.
+    rc = sub_epoch_enter();
+    if (rc == 0) {
+        entry = sub_index_get(group, sub_uid(fsid));
+        if (entry == NULL) {
+            rc = 0x11;
+        }
+        else {
+            *ref = entry;
+        }
+    }
+
+    return rc;
+}
+
+
+/// Batch lookups are pipelined in three stages, each BATCH_AHEAD lookups
+/// ahead of the next: prefetch the bucket, probe it and prefetch the entry,
+/// then read the entry and prefetch the image header.  So the memory latency
+/// of each stage is hidden behind the work on other UIDs.
+#define BATCH_AHEAD     8
+#define BATCH_RING      32
+
+ot_u8 vl_multifs_open_batch(void* handle, const uint64_t* uids, size_t n, vlFSREF* refs, void** bases) {
+    vlgroup_t*  group;
+    vlindex_t*  index;
+    uint64_t    hash[BATCH_RING];
+    size_t      i;
+    ot_u8       rc;
+
+    group = sub_group(handle);
+    if ((group == NULL) || (uids == NULL) || (refs == NULL)) {
+        return 255;
+    }
+
+    rc = sub_epoch_enter();
+    if (rc != 0) {
+        return rc;
+    }
+
+    /// The index is loaded once, so the whole batch is resolved on the same
+    /// index.  The epoch keeps it from being freed.
+    index = __atomic_load_n(&group->index, __ATOMIC_ACQUIRE);
+
+    for (i=0; i<(n+(2*BATCH_AHEAD)); i++) {
+        if (i < n) {
+            hash[i % BATCH_RING] = sub_hash(uids[i]);
+            sub_index_prefetch(index, hash[i % BATCH_RING]);
+        }
+        if ((i >= BATCH_AHEAD) && ((i-BATCH_AHEAD) < n)) {
+            size_t k    = i - BATCH_AHEAD;
+            refs[k]     = sub_index_probe(index, uids[k], hash[k % BATCH_RING]);
+            if (refs[k] != NULL) {
+                OT_PREFETCH(refs[k]);
+            }
+        }
+        if (i >= (2*BATCH_AHEAD)) {
+            size_t k = i - (2*BATCH_AHEAD);
+            if (refs[k] != NULL) {
+                OT_PREFETCH(refs[k]->base);
+            }
+            if (bases != NULL) {
+                bases[k] = (refs[k] != NULL) ? refs[k]->base : NULL;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+static ot_u8 sub_select(vlFSREF ref, void** getfsbase, id_tmpl* fsid) {
+    void* base;
+    void* ctx;
+
+#   if (OT_FEATURE(VLCOLD) == ENABLED)
+    ot_u8 rc = sub_cold_pin(ref, &base);
+    if (rc != 0) {
+        return rc;
+    }
+#   else
+    base = ref->base;
+#   endif
+
+    /// The entry is dereferenced directly, so the table isn't touched.  The
+    /// runtime state of the FS is kept in the entry, so it is only selected.
+    active_uid      = ref->uid;
+    active_entry    = ref;
+#   if (OT_FEATURE(VLCOW) == ENABLED)
+    if (ref->cow != 0) {
+        vworm_cow_init(base);
+    }
+    else
+#   endif
+    vworm_init(base, NULL);
+
+    ctx = __atomic_load_n(&ref->vlctx, __ATOMIC_ACQUIRE);
+    if (ctx == NULL) {
+        ctx = sub_state_init(ref);
+        if (ctx == NULL) {
+            sub_release_ctx();
+            return 0x15;
+        }
+    }
+    vl_setctx(ctx);
+    auth_settable(STATE_AUTHTAB(ctx));
+    __atomic_fetch_add(&((vlgroup_t*)ref->group)->switches, 1, __ATOMIC_RELAXED);
+
+    if (getfsbase != NULL) {
+        *getfsbase = base;
+    }
+    if (fsid != NULL) {
+        fsid->length = 8;
+        ot_memcpy(fsid->value, &ref->uid, 8);
+    }
+
+    return 0;
+}
+
+
+ot_u8 vl_multifs_select(vlFSREF ref, void** getfsbase, id_tmpl* fsid) {
+    if (ref == NULL) {
+        return 0x11;
+    }
+    if (sub_epoch_enter() != 0) {
+        return 0x15;
+    }
+    return sub_select(ref, getfsbase, fsid);
+}
+
+
+ot_u8 vl_multifs_switch(void* handle, void** getfsbase, const id_tmpl* fsid) {
+    vlFSREF ref;
+    ot_u8 rc;
+
+    rc = vl_multifs_open(handle, &ref, fsid);
+    if ((rc == 0) && (getfsbase != NULL)) {
+        rc = sub_select(ref, getfsbase, NULL);
+    }
+
+    return rc;
+}
+
+
+
+ot_u8 vl_multifs_release(void* handle) {
+    sub_release_ctx();
+    return 0;
+}
+
+
+
+ot_u8 vl_multifs_activeid(void* obj, id_tmpl* fsid) {
+    ot_memcpy(fsid->value, &active_uid, 8);
+    return (active_uid != 0) ? 0 : 255;
+}
+
+
+/// sub_pullfs() must be called with the table locked.  It releases the lock
+/// before doing the Veelite context switch.
+static ot_u8 sub_pullfs(vlgroup_t* group, struct vlfs_entry* ref, void** getfsbase, id_tmpl* fsid) {
+    if (ref == NULL) {
+        FSTAB_UNLOCK(group);
+        return 0x11;
+    }
+    if ((fsid == NULL) || (getfsbase == NULL) || (ref->uid == 0)) {
+        FSTAB_UNLOCK(group);
+        return 255;
+    }
+    if (sub_epoch_enter() != 0) {
+        FSTAB_UNLOCK(group);
+        return 0x15;
+    }
+    FSTAB_UNLOCK(group);
+
+    return sub_select(ref, getfsbase, fsid);
+}
+
+
+/// Keys are compared as byte strings, which is the order of Judy.
+#if (OT_FEATURE(VLJUDY) != ENABLED)
+static ot_bool sub_inrange(vlgroup_t* group, struct vlfs_entry* entry) {
+    return (ot_bool)((memcmp(&entry->uid, group->iter_lo, 8) >= 0)
+                  && (memcmp(&entry->uid, group->iter_hi, 8) <= 0));
+}
+#endif
+
+
+/// With Judy, the iterator seeks to the first key of the range, and it stops
+/// at the first key past the end.  Without Judy, the iterator keeps its
+/// position in the group, and it skips the keys outside of the range.
+static struct vlfs_entry* sub_iterate(vlgroup_t* group, ot_bool start) {
+#   if (OT_FEATURE(VLJUDY) == ENABLED)
+    MCU_TYPE_UINT* val;
+    struct vlfs_entry* entry;
+
+    if (start) {
+        val = judy_strt( (Judy*)group->judy, group->iter_lo, 8);
+    }
+    else {
+        val = judy_nxt((Judy*)group->judy);
+    }
+    if (val == NULL) {
+        return NULL;
+    }
+    entry = (struct vlfs_entry*)*val;
+    return (memcmp(&entry->uid, group->iter_hi, 8) <= 0) ? entry : NULL;
+
+#   else
+    size_t end = INDEX_SLOTS(group->index);
+    size_t pos = start ? 0 : group->iter+1;
+
+    while (1) {
+        pos = sub_index_seek(group->index, pos, end);
+        if (pos >= end) {
+            group->iter = end;
+            return NULL;
+        }
+        if (sub_inrange(group, SLOT_ENTRY(group->index, pos))) {
+            group->iter = pos;
+            return SLOT_ENTRY(group->index, pos);
+        }
+        pos++;
+    }
+
+#   endif
+}
+
+ot_u8 vl_multifs_start(void* handle, void** getfsbase, id_tmpl* fsid) {
+    vlgroup_t* group;
+
+    group = sub_group(handle);
+    if (group == NULL) {
+        return 255;
+    }
+
+    FSTAB_LOCK(group);
+    memset(group->iter_lo, 0x00, 8);
+    memset(group->iter_hi, 0xFF, 8);
+    return sub_pullfs(group, sub_iterate(group, True), getfsbase, fsid);
+}
+
+ot_u8 vl_multifs_range(void* handle, void** getfsbase, id_tmpl* fsid, const ot_u8* lo, const ot_u8* hi) {
+    vlgroup_t* group;
+
+    group = sub_group(handle);
+    if ((group == NULL) || (lo == NULL) || (hi == NULL)) {
+        return 255;
+    }
+
+    FSTAB_LOCK(group);
+    memcpy(group->iter_lo, lo, 8);
+    memcpy(group->iter_hi, hi, 8);
+    return sub_pullfs(group, sub_iterate(group, True), getfsbase, fsid);
+}
+
+ot_u8 vl_multifs_next(void* handle, void** getfsbase, id_tmpl* fsid) {
+    vlgroup_t* group;
+
+    group = sub_group(handle);
+    if (group == NULL) {
+        return 255;
+    }
+
+    FSTAB_LOCK(group);
+    return sub_pullfs(group, sub_iterate(group, False), getfsbase, fsid);
+}
+
+
+
+
+/// Scanning with a cursor doesn't change the active FS.  The iterator state
+/// of the table is shared by all its users, so each step seeks from the last
+/// position the scan cursor returned.
+///
+/// With Judy, keys are byte strings, so they sort as big-endian numbers.  The
+/// range from the lowest to the highest key in the table when the cursor is
+/// set-up is split evenly, so K partitions are K disjoint, contiguous parts of
+/// the table even when all the UIDs have the same first bytes.  The first and
+/// last partitions are open-ended, for FSes added later.  Without Judy, a
+/// partition is a range of slots in the read index.  If the index is rebuilt
+/// during a scan, the scan continues from the slot of the last UID in the new
+/// index, so it may return some FS twice or miss some.
+#if (OT_FEATURE(VLJUDY) == ENABLED)
+static uint64_t sub_key_get(const ot_u8* key) {
+    uint64_t value = 0;
+
+    for (int i=0; i<8; i++) {
+        value = (value << 8) | key[i];
+    }
+    return value;
+}
+
+
+static void sub_key_put(ot_u8* key, uint64_t value) {
+    for (int i=7; i>=0; i--) {
+        key[i]  = (ot_u8)value;
+        value >>= 8;
+    }
+}
+
+
+/// Must be called with the group locked.
+static void sub_scan_bounds(vlgroup_t* group, vlFSCURSOR* cur) {
+    MCU_TYPE_UINT* val;
+    uint64_t lo, hi, span;
+
+    val = judy_strt((Judy*)group->judy, cur->key, 8);
+    lo  = (val != NULL) ? sub_key_get((ot_u8*)&((struct vlfs_entry*)*val)->uid) : 0;
+    val = judy_end((Judy*)group->judy);
+    hi  = (val != NULL) ? sub_key_get((ot_u8*)&((struct vlfs_entry*)*val)->uid) : 0;
+    span = hi - lo;
+
+    /// Partition K starts at lo + span*K/parts, without overflow
+#   define PART_START(K)    (lo + ((span / cur->parts) * (K)) + (((span % cur->parts) * (K)) / cur->parts))
+    sub_key_put(cur->key, (cur->part == 0) ? 0 : PART_START(cur->part));
+    sub_key_put(cur->end, PART_START(cur->part + 1));
+#   undef PART_START
+}
+#endif
+
+
+ot_u8 vl_multifs_cursor(void* handle, vlFSCURSOR* cur, ot_uint part, ot_uint parts) {
+    if ((cur == NULL) || (parts == 0) || (parts > 256) || (part >= parts)) {
+        return 255;
+    }
+
+    ot_memset(cur->key, 0, sizeof(cur->key));
+    ot_memset(cur->end, 0, sizeof(cur->end));
+    cur->handle = handle;
+    cur->part   = (ot_u16)part;
+    cur->parts  = (ot_u16)parts;
+    cur->pos    = 0;
+    cur->gen    = 0;
+    cur->state  = 0;
+#   if (OT_FEATURE(VLJUDY) == ENABLED)
+    {   vlgroup_t* group = sub_group(handle);
+        if (group == NULL) {
+            return 255;
+        }
+        FSTAB_LOCK(group);
+        sub_scan_bounds(group, cur);
+        FSTAB_UNLOCK(group);
+    }
+#   endif
+    return 0;
+}
+
+
+/// Must be called with the group locked.  Returns the next FS of the scan.
+static struct vlfs_entry* sub_scan_next(vlgroup_t* group, vlFSCURSOR* cur) {
+#   if (OT_FEATURE(VLJUDY) == ENABLED)
+    MCU_TYPE_UINT* val;
+    struct vlfs_entry* entry;
+
+    val = judy_strt((Judy*)group->judy, cur->key, 8);
+
+    /// After the first step, the key in the cursor has already been returned
+    if ((val != NULL) && (cur->state != 0)) {
+        entry = (struct vlfs_entry*)*val;
+        if (memcmp(&entry->uid, cur->key, 8) == 0) {
+            val = judy_nxt((Judy*)group->judy);
+        }
+    }
+    if (val == NULL) {
+        return NULL;
+    }
+    entry = (struct vlfs_entry*)*val;
+    if ((cur->part != (cur->parts-1)) && (memcmp(&entry->uid, cur->end, 8) >= 0)) {
+        return NULL;
+    }
+
+    /// Prefetch the following FS, which the caller will likely access right
+    /// after this one.
+    val = judy_nxt((Judy*)group->judy);
+    if (val != NULL) {
+        OT_PREFETCH((void*)*val);
+        OT_PREFETCH(((struct vlfs_entry*)*val)->base);
+    }
+    return entry;
+
+#   else
+    vlindex_t* index = group->index;
+    size_t slots = INDEX_SLOTS(index);
+    size_t end   = ((cur->part + 1) * slots) / cur->parts;
+    size_t pos;
+
+    if (cur->state == 0) {
+        pos = (cur->part * slots) / cur->parts;
+    }
+    else if (cur->gen == group->generation) {
+        pos = cur->pos + 1;
+    }
+    else {
+        uint64_t uid;
+        ot_memcpy(&uid, cur->key, 8);
+        pos = sub_index_find(index, uid) + 1;
+    }
+
+    pos = sub_index_seek(index, pos, end);
+    if (pos >= end) {
+        return NULL;
+    }
+    cur->pos = pos;
+    cur->gen = group->generation;
+
+    /// Prefetch the following FS, which the caller will likely access right
+    /// after this one.
+    {   size_t next = sub_index_seek(index, pos+1, end);
+        if (next < end) {
+            OT_PREFETCH(SLOT_ENTRY(index, next));
+            OT_PREFETCH(SLOT_ENTRY(index, next)->base);
+        }
+    }
+    return SLOT_ENTRY(index, pos);
+
+#   endif
+}
+
+
+ot_u8 vl_multifs_scan(vlFSCURSOR* cur, void** getfsbase, id_tmpl* fsid) {
+    vlgroup_t* group;
+    struct vlfs_entry* entry;
+
+    if ((cur == NULL) || (cur->state > 1)) {
+        return 0x11;
+    }
+    group = sub_group(cur->handle);
+    if (group == NULL) {
+        return 255;
+    }
+
+    /// The images returned by the scan are protected like a checked-out FS.
+    if (sub_epoch_hold() != 0) {
+        return 0x15;
+    }
+
+    FSTAB_LOCK(group);
+    entry = sub_scan_next(group, cur);
+    if (entry != NULL) {
+        ot_memcpy(cur->key, &entry->uid, 8);
+        if (getfsbase != NULL) {
+            *getfsbase = entry->base;
+        }
+        if (fsid != NULL) {
+            fsid->length = 8;
+            ot_memcpy(fsid->value, &entry->uid, 8);
+        }
+    }
+    FSTAB_UNLOCK(group);
+
+    cur->state = (entry != NULL) ? 1 : 2;
+    return (entry != NULL) ? 0 : 0x11;
+}
+
+
+
+
+void* vl_multifs_alloc(void* handle, size_t size) {
+#   if (OT_FEATURE(VLSLAB) == ENABLED)
+    vlgroup_t*  group;
+    void*       base;
+
+    group = sub_group(handle);
+    if (group != NULL) {
+        base = sub_slab_alloc(&group->slab, size);
+        if (base != NULL) {
+            return base;
+        }
+    }
+#   endif
+
+    return malloc(size);
+}
+
+
+void vl_multifs_free(void* handle, void* base) {
+    vlgroup_t* group = sub_group(handle);
+
+    if ((group != NULL) && (base != NULL)) {
+        sub_image_free(group, base, &free)(base);
+    }
+}
+
+
+
+
+ot_u8 vl_multifs_template_add(void* handle, const void* image, size_t size, ot_u8* id) {
+    vlgroup_t* group;
+    vlFSHEADER header;
+    void* copy;
+    ot_u8 rc = 0x15;
+
+    group = sub_group(handle);
+    if ((group == NULL) || (image == NULL) || (size < sizeof(vlFSHEADER))) {
+        return 255;
+    }
+
+    /// The image must be exactly as big as its header says it is
+    ot_memcpy(&header, (void*)image, sizeof(vlFSHEADER));
+    if ((header.ftab_alloc == 0) || (vworm_fsalloc(&header) != size)) {
+        return 255;
+    }
+    if (posix_memalign(&copy, 64, (size + 3) & ~(size_t)3) != 0) {
+        return 0x15;
+    }
+    memcpy(copy, image, size);
+
+    FSTAB_LOCK(group);
+    for (ot_u8 i=0; i<OT_PARAM(VLTEMPLATES); i++) {
+        if (group->tmpl[i] == NULL) {
+            __atomic_store_n(&group->tmpl[i], copy, __ATOMIC_RELEASE);
+            if (id != NULL) {
+                *id = i + 1;
+            }
+            rc = 0;
+            break;
+        }
+    }
+    FSTAB_UNLOCK(group);
+
+    if (rc != 0) {
+        free(copy);
+    }
+    return rc;
+}
+
+
+const void* vl_multifs_template(void* handle, ot_u8 id) {
+    vlgroup_t* group;
+
+    if (id == 0) {
+        return vworm_fsdefault();
+    }
+    group = sub_group(handle);
+    if ((group == NULL) || (id > OT_PARAM(VLTEMPLATES))) {
+        return NULL;
+    }
+    return __atomic_load_n(&group->tmpl[id-1], __ATOMIC_ACQUIRE);
+}
+
+
+ot_u32 vl_multifs_image(void* handle, const id_tmpl* fsid, void* dst, ot_u32 max) {
+    vlgroup_t* group;
+    struct vlfs_entry* entry;
+    ot_u32 size = 0;
+
+    group = sub_group(handle);
+    if ((group == NULL) || (fsid == NULL)) {
+        return 0;
+    }
+
+    /// With the lock held, the image can't be freed, made cold or thawed.
+    FSTAB_LOCK(group);
+    entry = sub_index_get(group, sub_uid(fsid));
+    if (entry == NULL) {
+        size = 0;
+    }
+#   if (OT_FEATURE(VLCOLD) == ENABLED)
+    else if (entry->base == NULL) {
+        vlcold_t* cold = entry->cold;
+        size = cold->alloc;
+        if ((dst != NULL) && (size <= max)) {
+            memcpy(dst, vl_multifs_template(group, cold->tmpl), size);
+            sub_cold_undelta(dst, cold);
+        }
+    }
+#   endif
+#   if (OT_FEATURE(VLCOW) == ENABLED)
+    else if (entry->cow != 0) {
+        size = vworm_fsalloc((const vlFSHEADER*)entry->base);
+        if ((dst != NULL) && (size <= max)) {
+            vworm_cow_copy(entry->base, dst);
+        }
+    }
+#   endif
+    else {
+        size = vworm_fsalloc((const vlFSHEADER*)entry->base);
+        if ((dst != NULL) && (size <= max)) {
+            memcpy(dst, entry->base, size);
+        }
+    }
+    FSTAB_UNLOCK(group);
+
+    return size;
+}
+
+
+/// Adds an FS without runtime state, for the bulk adds.  Must be called with
+/// the group locked.  With VLCOLD, a hot image is put on the hot list.
+static ot_u8 sub_insert(vlgroup_t* group, uint64_t uid, void* base, ot_u32 alloc, ot_bool hot) {
+    struct vlfs_entry* entry;
+#   if (OT_FEATURE(VLJUDY) == ENABLED)
+    MCU_TYPE_UINT* new_value;
+
+    new_value = judy_cell(group->judy, (ot_u8*)&uid, 8);
+    if (new_value == NULL) {
+        return 0x15;
+    }
+    if (*new_value != 0) {
+        return 0x12;
+    }
+#   else
+    if (sub_index_get(group, uid) != NULL) {
+        return 0x12;
+    }
+#   endif
+
+    entry = sub_alloc_entry(group, base, uid, 0, False);
+    if ((entry == NULL) || (sub_index_put(group, uid, entry) != 0)) {
+#       if (OT_FEATURE(VLJUDY) == ENABLED)
+        judy_del(group->judy);
+#       endif
+        if (entry != NULL) {
+            sub_free_entry(entry);
+        }
+        return 0x15;
+    }
+#   if (OT_FEATURE(VLJUDY) == ENABLED)
+    *new_value = (MCU_TYPE_UINT)entry;
+#   endif
+    entry->alloc        = alloc;
+    group->image_bytes += alloc;
+#   if (OT_FEATURE(VLCOLD) == ENABLED)
+    if (hot) {
+        sub_cold_link(group, entry);
+    }
+#   endif
+    return 0;
+}
+
+
+/// The index is grown once for all of the new FS
+static ot_u8 sub_index_reserve(vlgroup_t* group, size_t n) {
+    if (4 * (group->index->used + n) > 3 * INDEX_SLOTS(group->index)) {
+        return sub_index_rebuild(group, n);
+    }
+    return 0;
+}
+
+
+ot_u8 vl_multifs_add_batch(void* handle, void** bases, const uint64_t* uids, size_t n) {
+    vlgroup_t* group;
+    size_t i;
+    ot_u8 rc;
+    ot_u8 err = 0;
+
+    group = sub_group(handle);
+    if ((group == NULL) || ((n != 0) && ((bases == NULL) || (uids == NULL)))) {
+        return 255;
+    }
+
+    FSTAB_LOCK(group);
+    if (sub_index_reserve(group, n) != 0) {
+        err = 0x15;
+    }
+    for (i=0; (i<n) && (err != 0x15); i++) {
+        rc = ((uids[i] == 0) || (bases[i] == NULL)) ? 255 : sub_insert(group, uids[i], bases[i],
+                                        vworm_fsalloc((const vlFSHEADER*)bases[i]), True);
+        if (rc == 0) {
+            bases[i] = NULL;
+        }
+        else if ((err == 0) || (rc == 0x15)) {
+            err = rc;
+        }
+    }
+#   if (OT_FEATURE(VLCOLD) == ENABLED)
+    sub_cold_balance(group, NULL);
+#   endif
+    FSTAB_UNLOCK(group);
+
+    return err;
+}
+
+
+ot_u8 vl_multifs_map(void* handle, void* region, size_t size,
+                     void (*region_free)(void*, size_t), const vlFSMAPENT* ents, size_t n) {
+    vlgroup_t* group;
+    vlmap_t* map;
+    size_t i;
+    ot_u8 rc = 0;
+    ot_u8 err = 0;
+
+    group = sub_group(handle);
+    if ((group == NULL) || (region == NULL) || ((n != 0) && (ents == NULL))) {
+        return 255;
+    }
+    for (i=0; i<n; i++) {
+        if ((ents[i].uid == 0) || (ents[i].alloc < sizeof(vlFSHEADER))
+        || (ents[i].offset > size) || (ents[i].alloc > (size - ents[i].offset))) {
+            return 255;
+        }
+    }
+    map = malloc(sizeof(vlmap_t));
+    if (map == NULL) {
+        return 0x15;
+    }
+    map->region         = region;
+    map->size           = size;
+    map->region_free    = region_free;
+
+    FSTAB_LOCK(group);
+    map->next = group->maps;
+    __atomic_store_n(&group->maps, map, __ATOMIC_RELEASE);
+
+    if (sub_index_reserve(group, n) != 0) {
+        err = 0x15;
+    }
+
+    /// Mapped images are not put on the hot list, so that adding them
+    /// doesn't touch them.  Their pages are only private once written.
+    for (i=0; (i<n) && (err != 0x15); i++) {
+        rc = sub_insert(group, ents[i].uid, (ot_u8*)region + ents[i].offset, ents[i].alloc, False);
+        if ((rc != 0) && ((err == 0) || (rc == 0x15))) {
+            err = rc;
+        }
+    }
+    FSTAB_UNLOCK(group);
+
+    return err;
+}
+
+
+#if (OT_FEATURE(VLCOLD) == ENABLED)
+ot_u8 vl_multifs_hotset(void* handle, size_t hot_max) {
+    vlgroup_t* group = sub_group(handle);
+
+    if (group == NULL) {
+        return 255;
+    }
+    FSTAB_LOCK(group);
+    group->hot_max = hot_max;
+    sub_cold_balance(group, NULL);
+    FSTAB_UNLOCK(group);
+    return 0;
+}
+#endif
+
+
+ot_u8 vl_multifs_stats(void* handle, vlFSSTATS* stats) {
+    vlgroup_t* group;
+    vlindex_t* index;
+
+    group = sub_group(handle);
+    if ((group == NULL) || (stats == NULL)) {
+        return 255;
+    }
+
+    FSTAB_LOCK(group);
+    index               = group->index;
+    stats->fs           = index->live;
+    stats->index_bytes  = sizeof(vlindex_t) + ((index->mask + 1) * sizeof(vlbucket_t));
+    stats->entry_bytes  = (group->entries * ENTRY_ALIGN(sizeof(struct vlfs_entry)))
+                        + (__atomic_load_n(&group->states, __ATOMIC_RELAXED) * STATE_SIZE());
+#   if (OT_FEATURE(VLFILTER) == ENABLED)
+    stats->filter_bytes = FILTER_BLOCKS(index) * FILTER_WORDS * 8;
+    stats->filter_fpr   = sub_filter_fpr(index);
+#   else
+    stats->filter_bytes = 0;
+    stats->filter_fpr   = 0.;
+#   endif
+#   if (OT_FEATURE(VLSLAB) == ENABLED)
+    SLAB_LOCK(&group->slab);
+    stats->slab_bytes   = group->slab.chunks * group->slab.chunk_bytes;
+    stats->slab_fs      = group->slab.live;
+    SLAB_UNLOCK(&group->slab);
+#   else
+    stats->slab_bytes   = 0;
+    stats->slab_fs      = 0;
+#   endif
+    stats->cow_fs       = group->cow_fs;
+    stats->cow_bytes    = (size_t)__atomic_load_n(&group->cow_bytes, __ATOMIC_RELAXED);
+    stats->cold_fs      = group->cold_fs;
+    stats->cold_bytes   = group->cold_bytes;
+    stats->image_bytes  = group->image_bytes;
+    FSTAB_UNLOCK(group);
+    stats->switches     = __atomic_load_n(&group->switches, __ATOMIC_RELAXED);
+
+    return 0;
 }
 
 
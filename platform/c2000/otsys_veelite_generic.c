@@ -282,6 +282,13 @@ void* vworm_get(vaddr addr) {
 }
 #endif
 
+#ifndef EXTF_vworm_span
+void* vworm_span(vaddr addr, ot_uint span, ot_bool write) {
+    /// C2000 has 16bit byte, so the file data is never a byte array
+    return NULL;
+}
+#endif
+
 #ifndef EXTF_vworm_wipeblock
 ot_u8 vworm_wipeblock(vaddr addr, ot_uint wipe_span) {
     return 0;
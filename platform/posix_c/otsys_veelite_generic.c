@@ -38,12 +38,35 @@
 #include <otlib/logger.h>
 #include <otlib/memcpy.h>
 
+#include <stdlib.h>
+#include <string.h>
+
+#if (OT_FEATURE(MULTIFS) && (OT_FEATURE(VLMMAP) == ENABLED))
+#   include <sys/mman.h>
+#   include <errno.h>
+#   if (OT_FEATURE(VLTHREADS) == ENABLED)
+#       include <pthread.h>
+#   endif
+#endif
+
+#define VW_PAGED    (OT_FEATURE(MULTIFS) && (OT_FEATURE(VLCOW) == ENABLED) && (OT_FEATURE(VLPAGED) == ENABLED))
+
+#if (OT_FEATURE(MULTIFS) && ((OT_FEATURE(VLMMAP) == ENABLED) || VW_PAGED))
+#   include <unistd.h>
+#endif
+#if (VW_PAGED)
+#   include <fcntl.h>
+#   if (OT_FEATURE(VLTHREADS) == ENABLED)
+#       include <pthread.h>
+#   endif
+#endif
+
 
 /// Patch: If Multi-FS is enabled, fsram location and size is defined through
 /// vworm_init(), dynamically, selected via vworm_select(), and assigned to 
-/// this context while used.
+/// this context while used.  With VLTHREADS, each thread has its own context.
 #if (OT_FEATURE(MULTIFS))
-    static ot_u32* fsram;
+    static VL_TLS ot_u32* fsram;
 #else
     static ot_u32 fsram[FLASH_FS_ALLOC/4];
 #endif
@@ -51,6 +74,157 @@
 #define FSRAM ((ot_u16*)fsram)
 
 
+/// The golden image is the default image, built once from the stock data.
+/// New images are copied from it in one step, and COW images share it.  It is
+/// never written or freed.  Its data is padded to a whole number of COW
+/// blocks, so that blocks are always copied whole.
+#if (OT_FEATURE(MULTIFS))
+#   if (OT_FEATURE(VLCOW) == ENABLED)
+#       define COW_BLOCK    OT_PARAM(VLCOWBLOCK)
+#   else
+#       define COW_BLOCK    4
+#   endif
+
+    typedef struct {
+        ot_u32      alloc;
+        ot_u32      blocks;
+        ot_u8       data[];
+    } vwgolden_t;
+
+    static vwgolden_t* golden;
+#endif
+
+
+/// Copy-on-write images: fscow is the image selected via vworm_cow_init(),
+/// or NULL when a normal image is selected.  The header of a COW image is
+/// always in its descriptor, so vworm_get() can return a pointer to it
+/// without copying the image.  src is the shared data: the golden image, or
+/// a template for lazy images.  Lazy images have no block table (blocks is
+/// 0), so their first write copies the whole image.  Paged images have a
+/// file instead of src, at offset fofs.  "priv" is the memory the image has
+/// of its own: descriptor, block table and private blocks.  Changes to it are
+/// also made to the counter at "account", if there is one.
+#if (OT_FEATURE(MULTIFS) && (OT_FEATURE(VLCOW) == ENABLED))
+
+#   if (VW_PAGED)
+    typedef struct {
+        int         fd;
+        ot_u32      refs;
+    } vwfile_t;
+#   endif
+
+    typedef struct {
+        vlFSHEADER  header;
+        ot_u32      alloc;
+        ot_u32      blocks;
+        const ot_u8* src;
+        ot_u8*      flat;
+        ot_u32      priv;
+        ot_u64*     account;
+#   if (VW_PAGED)
+        vwfile_t*   file;
+        ot_u64      fofs;
+        ot_bool     hdirty;
+#   endif
+        ot_u8*      block[];
+    } vwcow_t;
+
+    static VL_TLS vwcow_t* fscow;
+#endif
+
+
+/// File-backed images: an image may be a shared mapping of a file, so writes
+/// go straight to the page cache.  The bytes written to the selected image
+/// since it was selected, or since the last vworm_save(), are in the range
+/// [fsdirty_lo, fsdirty_hi), and vworm_save() syncs only the pages of that
+/// range.  The range is empty when fsdirty_lo >= fsdirty_hi.  For an image in
+/// ordinary memory, the sync does nothing.
+///
+/// When another image is selected, the range of the one before is kept in
+/// fspending[], which is shared by all threads, and vworm_save() syncs those
+/// ranges too.  Ranges that touch are merged, and the list is synced when it
+/// is full, so it is bounded in a process that never calls vworm_save().
+#if (OT_FEATURE(MULTIFS) && (OT_FEATURE(VLMMAP) == ENABLED))
+    static VL_TLS ot_u32 fsdirty_lo;
+    static VL_TLS ot_u32 fsdirty_hi;
+
+#   define PENDING_MAX      256
+
+    typedef struct {
+        uintptr_t   lo;
+        uintptr_t   hi;
+    } vwrange_t;
+
+    static vwrange_t fspending[PENDING_MAX];
+    static ot_u32    fspending_num;
+
+#   if (OT_FEATURE(VLTHREADS) == ENABLED)
+    static pthread_mutex_t fspending_mutex = PTHREAD_MUTEX_INITIALIZER;
+#       define PENDING_LOCK()   pthread_mutex_lock(&fspending_mutex)
+#       define PENDING_UNLOCK() pthread_mutex_unlock(&fspending_mutex)
+#   else
+#       define PENDING_LOCK()   do { } while(0)
+#       define PENDING_UNLOCK() do { } while(0)
+#   endif
+
+    static void sub_dirty_park(void);
+
+#   define DIRTY_PARK()     sub_dirty_park()
+#   define DIRTY_CLEAR()    do { fsdirty_lo = ~0; fsdirty_hi = 0; } while (0)
+#   define DIRTY_SPAN(OFS, LEN) do { \
+                                if ((OFS) < fsdirty_lo)         fsdirty_lo = (OFS); \
+                                if ((OFS)+(LEN) > fsdirty_hi)   fsdirty_hi = (OFS)+(LEN); \
+                            } while (0)
+#   define DIRTY_MARK(OFS)  DIRTY_SPAN(OFS, 2)
+#else
+#   define DIRTY_PARK()     do { } while (0)
+#   define DIRTY_CLEAR()    do { } while (0)
+#   define DIRTY_SPAN(OFS, LEN) do { } while (0)
+#   define DIRTY_MARK(OFS)  do { } while (0)
+#endif
+
+
+/// Paged images: a COW image whose blocks are in a file, rather than in
+/// memory.  The blocks in memory are in one page cache, which is shared by
+/// all paged images and has OT_PARAM_VLPAGECACHE blocks, so the memory used
+/// doesn't depend on the number or size of the images.  The block table of a
+/// paged image points to its blocks that are in the cache.  Blocks are
+/// evicted with the CLOCK algorithm, and dirty blocks are written back to
+/// the file when they are evicted, or by vworm_save().  With VLTHREADS, the
+/// cache has one lock, which is held for each access to a paged image.
+#if (VW_PAGED)
+    typedef struct {
+        vwcow_t*    owner;
+        ot_u32      index;
+        ot_u8       ref;
+        ot_u8       dirty;
+    } vwslot_t;
+
+    typedef struct {
+        ot_u8*      data;
+        vwslot_t*   slot;
+        ot_u32      hand;
+        ot_u32      used;
+        ot_u64      hits;
+        ot_u64      misses;
+        ot_u64      writebacks;
+    } vwcache_t;
+
+    static vwcache_t pcache;
+
+#   define PAGE_SLOT(DATA)  (&pcache.slot[((DATA) - pcache.data) / COW_BLOCK])
+
+#   if (OT_FEATURE(VLTHREADS) == ENABLED)
+    static pthread_mutex_t pcache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#       define PAGE_LOCK()      pthread_mutex_lock(&pcache_mutex)
+#       define PAGE_UNLOCK()    pthread_mutex_unlock(&pcache_mutex)
+#   else
+#       define PAGE_LOCK()      do { } while(0)
+#       define PAGE_UNLOCK()    do { } while(0)
+#   endif
+#endif
+
+
 /// Set Bus Error (code 7) on physical flash access faults (X2table errors).
 /// Vector to Access Violation ISR (CC430 Specific)
 #if defined(VLX2_DEBUG_ON)
@@ -179,6 +353,42 @@ ot_uint vworm_fsdata_defload(void* fs_base, const vlFSHEADER* fs) {
 
 
 
+#if (OT_FEATURE(MULTIFS))
+static vwgolden_t* sub_golden(void) {
+    vwgolden_t* gold;
+    vwgolden_t* expected = NULL;
+    vlFSHEADER  header;
+    ot_u32      blocks;
+
+    gold = __atomic_load_n(&golden, __ATOMIC_ACQUIRE);
+    if (gold != NULL) {
+        return gold;
+    }
+
+    /// If two threads build it at once, one copy is dropped.
+    vworm_fsheader_defload(&header);
+    blocks  = (vworm_fsalloc(&header) + COW_BLOCK - 1) / COW_BLOCK;
+    gold    = calloc(1, sizeof(vwgolden_t) + (blocks * COW_BLOCK));
+    if (gold != NULL) {
+        gold->alloc     = vworm_fsalloc(&header);
+        gold->blocks    = blocks;
+        vworm_fsdata_defload(gold->data, &header);
+        if (__atomic_compare_exchange_n(&golden, &expected, gold, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) == 0) {
+            free(gold);
+            gold = expected;
+        }
+    }
+    return gold;
+}
+
+
+const void* vworm_fsdefault(void) {
+    vwgolden_t* gold = sub_golden();
+    return (gold != NULL) ? gold->data : NULL;
+}
+#endif
+
+
 #ifndef EXTF_vworm_init
 ot_u8 vworm_init(void* fs_base, const vlFSHEADER* fs) {
 /// If MultiFS is not used, all the arguments can be NULL.
@@ -197,7 +407,13 @@ ot_u8 vworm_init(void* fs_base, const vlFSHEADER* fs) {
         vworm_fsdata_defload(fs_base, fs);
     }
 
+    if ((ot_u32*)fs_base != fsram) {
+        DIRTY_PARK();
+    }
     fsram = (ot_u32*)fs_base;
+#   if (OT_FEATURE(VLCOW) == ENABLED)
+    fscow = NULL;
+#   endif
     
     /// No MultiFS
 #   else
@@ -216,16 +432,598 @@ ot_u8 vworm_init(void* fs_base, const vlFSHEADER* fs) {
 }
 #endif
 
+#if (OT_FEATURE(MULTIFS) && (OT_FEATURE(VLCOW) == ENABLED))
+
+static ot_u8* sub_cow_flatten(void);
+
+/// Adds to the private memory of a COW image.  The counter it is accounted to
+/// is only changed by vworm_cow_account() while no thread writes the image.
+static void sub_cow_charge(vwcow_t* cow, ot_s32 bytes) {
+    ot_u64* account = __atomic_load_n(&cow->account, __ATOMIC_ACQUIRE);
+
+    __atomic_fetch_add(&cow->priv, (ot_u32)bytes, __ATOMIC_RELAXED);
+    if (account != NULL) {
+        __atomic_fetch_add(account, (ot_u64)(ot_s64)bytes, __ATOMIC_RELAXED);
+    }
+}
+
+/// Returns the address of an offset in the selected COW image.  The first
+/// write to a block that is still shared copies it from the shared data, and
+/// the first write to a lazy image copies all of it.  NULL is returned if the
+/// offset is outside the image, or if the copy cannot be allocated.
+static ot_u8* sub_cow_ptr(ot_u32 offset, ot_bool write) {
+    vwcow_t*    cow = fscow;
+    ot_u8*      flat;
+    ot_u32      i;
+
+    if (offset < sizeof(vlFSHEADER)) {
+        return (ot_u8*)&cow->header + offset;
+    }
+    if (offset >= cow->alloc) {
+        return NULL;
+    }
+    if (write == False) {
+        i = offset / COW_BLOCK;
+        return ((cow->blocks == 0) || (cow->block[i] == NULL)) ?
+                (ot_u8*)&cow->src[offset] : &cow->block[i][offset & (COW_BLOCK-1)];
+    }
+    if (cow->blocks == 0) {
+        flat = sub_cow_flatten();
+        return (flat != NULL) ? &flat[offset] : NULL;
+    }
+
+    i = offset / COW_BLOCK;
+    if (cow->block[i] == NULL) {
+        cow->block[i] = malloc(COW_BLOCK);
+        if (cow->block[i] == NULL) {
+            return NULL;
+        }
+        memcpy(cow->block[i], &cow->src[i * COW_BLOCK], COW_BLOCK);
+        sub_cow_charge(cow, COW_BLOCK);
+    }
+    return &cow->block[i][offset & (COW_BLOCK-1)];
+}
+
+
+/// A direct pointer into the image may span blocks, so the selected COW image
+/// is copied into one private image, which is selected instead of it.
+static ot_u8* sub_cow_flatten(void) {
+    vwcow_t*    cow = fscow;
+    ot_u8*      flat;
+    ot_s32      bytes;
+
+    flat = malloc((cow->alloc + 3) & ~3);
+    if (flat != NULL) {
+        vworm_cow_copy(cow, flat);
+        bytes = (ot_s32)cow->alloc;
+        for (ot_u32 i=0; i<cow->blocks; i++) {
+            bytes -= (cow->block[i] != NULL) ? COW_BLOCK : 0;
+            free(cow->block[i]);
+            cow->block[i] = NULL;
+        }
+        sub_cow_charge(cow, bytes);
+        cow->flat   = flat;
+        fsram       = (ot_u32*)flat;
+        fscow       = NULL;
+    }
+    return flat;
+}
+
+
+#if (VW_PAGED)
+
+/// Writes back a dirty block of the cache.  The FS header is kept in the
+/// descriptor, so it is put into block 0 first.
+static ot_bool sub_page_writeback(vwslot_t* slot, ot_u8* data) {
+    vwcow_t*    cow = slot->owner;
+    ot_u32      offset;
+    ot_u32      span;
+
+    offset  = slot->index * COW_BLOCK;
+    span    = ((cow->alloc - offset) < COW_BLOCK) ? (cow->alloc - offset) : COW_BLOCK;
+    if (slot->index == 0) {
+        memcpy(data, &cow->header, sizeof(vlFSHEADER));
+    }
+    if (pwrite(cow->file->fd, data, span, (off_t)(cow->fofs + offset)) != (ssize_t)span) {
+        return False;
+    }
+    if (slot->index == 0) {
+        cow->hdirty = False;
+    }
+    slot->dirty = 0;
+    pcache.writebacks++;
+    return True;
+}
+
+
+/// Returns block i of a paged image, from the cache, or read into it.  The
+/// CLOCK hand gives a block that was used since it last passed another pass,
+/// and it skips blocks that can't be written back.  NULL is returned if no
+/// block can be evicted, or if the block can't be read.  The lock is held.
+static ot_u8* sub_page_block(vwcow_t* cow, ot_u32 i) {
+    vwslot_t*   slot = NULL;
+    ot_u8*      data = NULL;
+    ot_u32      offset;
+    ot_u32      span;
+    ot_u32      k;
+
+    if (cow->block[i] != NULL) {
+        PAGE_SLOT(cow->block[i])->ref = 1;
+        pcache.hits++;
+        return cow->block[i];
+    }
+    if (pcache.data == NULL) {
+        pcache.data = malloc((size_t)OT_PARAM(VLPAGECACHE) * COW_BLOCK);
+        pcache.slot = calloc(OT_PARAM(VLPAGECACHE), sizeof(vwslot_t));
+        if ((pcache.data == NULL) || (pcache.slot == NULL)) {
+            free(pcache.data);
+            free(pcache.slot);
+            pcache.data = NULL;
+            pcache.slot = NULL;
+            return NULL;
+        }
+    }
+
+    for (ot_u32 n=0; n<(2*OT_PARAM(VLPAGECACHE)); n++) {
+        k           = pcache.hand;
+        pcache.hand = (k + 1) % OT_PARAM(VLPAGECACHE);
+        if (pcache.slot[k].owner == NULL) {
+            slot = &pcache.slot[k];
+            break;
+        }
+        if (pcache.slot[k].ref != 0) {
+            pcache.slot[k].ref = 0;
+            continue;
+        }
+        if ((pcache.slot[k].dirty != 0)
+        && (sub_page_writeback(&pcache.slot[k], &pcache.data[k * COW_BLOCK]) == False)) {
+            continue;
+        }
+        slot = &pcache.slot[k];
+        slot->owner->block[slot->index] = NULL;
+        sub_cow_charge(slot->owner, -COW_BLOCK);
+        slot->owner = NULL;
+        pcache.used--;
+        break;
+    }
+    if (slot == NULL) {
+        return NULL;
+    }
+
+    data    = &pcache.data[k * COW_BLOCK];
+    offset  = i * COW_BLOCK;
+    span    = ((cow->alloc - offset) < COW_BLOCK) ? (cow->alloc - offset) : COW_BLOCK;
+    if (pread(cow->file->fd, data, span, (off_t)(cow->fofs + offset)) != (ssize_t)span) {
+        return NULL;
+    }
+    slot->owner     = cow;
+    slot->index     = i;
+    slot->ref       = 1;
+    slot->dirty     = 0;
+    cow->block[i]   = data;
+    sub_cow_charge(cow, COW_BLOCK);
+    pcache.used++;
+    pcache.misses++;
+    return data;
+}
+
+
+/// Reads or writes 16 bits at an offset of the selected paged image
+static ot_u8 sub_page_rw(ot_u32 offset, ot_u16* data, ot_bool write) {
+    vwcow_t*    cow = fscow;
+    ot_u8*      block;
+    ot_u16*     ptr;
+    ot_u8       rc = 0;
+
+    if (offset >= cow->alloc) {
+        return 1;
+    }
+    PAGE_LOCK();
+    if (offset < sizeof(vlFSHEADER)) {
+        ptr = (ot_u16*)((ot_u8*)&cow->header + offset);
+        cow->hdirty |= write;
+    }
+    else if ((block = sub_page_block(cow, offset / COW_BLOCK)) != NULL) {
+        ptr = (ot_u16*)&block[offset & (COW_BLOCK-1)];
+        PAGE_SLOT(block)->dirty |= write;
+    }
+    else {
+        ptr = NULL;
+        rc  = 1;
+    }
+    if (ptr != NULL) {
+        if (write)  *ptr  = *data;
+        else        *data = *ptr;
+    }
+    PAGE_UNLOCK();
+    return rc;
+}
+
+
+/// Writes back the dirty blocks of a paged image, and its header if it was
+/// written while block 0 was not dirty in the cache.  The lock is held.
+static ot_u8 sub_page_flush(vwcow_t* cow) {
+    ot_u8 rc = 0;
+
+    for (ot_u32 i=0; i<cow->blocks; i++) {
+        if ((cow->block[i] != NULL) && (PAGE_SLOT(cow->block[i])->dirty != 0)) {
+            rc |= (sub_page_writeback(PAGE_SLOT(cow->block[i]), cow->block[i]) == False);
+        }
+    }
+    if (cow->hdirty) {
+        if (pwrite(cow->file->fd, &cow->header, sizeof(vlFSHEADER), (off_t)cow->fofs) != (ssize_t)sizeof(vlFSHEADER)) {
+            rc |= 1;
+        }
+        else {
+            cow->hdirty = False;
+        }
+    }
+    return rc;
+}
+
+
+/// Drops a reference to a file.  The lock is held.
+static void sub_page_unref(vwfile_t* file) {
+    if (--file->refs == 0) {
+        close(file->fd);
+        free(file);
+    }
+}
+
+
+void* vworm_paged_open(const char* path) {
+    vwfile_t* file;
+
+    if (path == NULL) {
+        return NULL;
+    }
+    file = malloc(sizeof(vwfile_t));
+    if (file != NULL) {
+        file->fd    = open(path, O_RDWR);
+        file->refs  = 1;
+        if (file->fd < 0) {
+            free(file);
+            file = NULL;
+        }
+    }
+    return file;
+}
+
+
+void vworm_paged_close(void* file) {
+    if (file != NULL) {
+        PAGE_LOCK();
+        sub_page_unref(file);
+        PAGE_UNLOCK();
+    }
+}
+
+
+void* vworm_paged_new(void* file, ot_u64 offset) {
+    vwfile_t*   f = file;
+    vwcow_t*    paged;
+    vlFSHEADER  header;
+    ot_u32      alloc;
+    ot_u32      blocks;
+
+    if (f == NULL) {
+        return NULL;
+    }
+    if ((pread(f->fd, &header, sizeof(vlFSHEADER), (off_t)offset) != (ssize_t)sizeof(vlFSHEADER))
+    || (header.ftab_alloc == 0)) {
+        return NULL;
+    }
+    alloc = vworm_fsalloc(&header);
+    if (alloc < sizeof(vlFSHEADER)) {
+        return NULL;
+    }
+
+    blocks  = (alloc + COW_BLOCK - 1) / COW_BLOCK;
+    paged   = calloc(1, sizeof(vwcow_t) + (blocks * sizeof(ot_u8*)));
+    if (paged != NULL) {
+        memcpy(&paged->header, &header, sizeof(vlFSHEADER));
+        paged->alloc    = alloc;
+        paged->blocks   = blocks;
+        paged->priv     = sizeof(vwcow_t) + (blocks * sizeof(ot_u8*));
+        paged->file     = f;
+        paged->fofs     = offset;
+        PAGE_LOCK();
+        f->refs++;
+        PAGE_UNLOCK();
+    }
+    return paged;
+}
+
+
+void vworm_paged_stats(vlPAGESTATS* stats) {
+    if (stats != NULL) {
+        PAGE_LOCK();
+        stats->hits         = pcache.hits;
+        stats->misses       = pcache.misses;
+        stats->writebacks   = pcache.writebacks;
+        stats->blocks       = (pcache.data != NULL) ? OT_PARAM(VLPAGECACHE) : 0;
+        stats->used         = pcache.used;
+        stats->block_size   = COW_BLOCK;
+        PAGE_UNLOCK();
+    }
+}
+
+#endif
+
+
+void* vworm_cow_new(const vlFSHEADER* fs) {
+    vwgolden_t* gold;
+    vwcow_t*    cow;
+
+    if (fs == NULL) {
+        return NULL;
+    }
+
+    /// Only an image with the stock layout can share the stock data.
+    gold = sub_golden();
+    if ((gold == NULL) || (vworm_fsalloc(fs) != gold->alloc)
+    || (memcmp(fs, gold->data, sizeof(vlFSHEADER)) != 0)) {
+        return NULL;
+    }
+
+    cow = calloc(1, sizeof(vwcow_t) + (gold->blocks * sizeof(ot_u8*)));
+    if (cow != NULL) {
+        memcpy(&cow->header, fs, sizeof(vlFSHEADER));
+        cow->alloc  = gold->alloc;
+        cow->blocks = gold->blocks;
+        cow->priv   = sizeof(vwcow_t) + (gold->blocks * sizeof(ot_u8*));
+        cow->src    = gold->data;
+    }
+    return cow;
+}
+
+
+void* vworm_lazy_new(const void* image) {
+    vwcow_t* lazy;
+
+    if (image == NULL) {
+        return NULL;
+    }
+
+    lazy = calloc(1, sizeof(vwcow_t));
+    if (lazy != NULL) {
+        memcpy(&lazy->header, image, sizeof(vlFSHEADER));
+        lazy->alloc = vworm_fsalloc(&lazy->header);
+        lazy->priv  = sizeof(vwcow_t);
+        lazy->src   = image;
+    }
+    return lazy;
+}
+
+
+void vworm_cow_free(void* cow) {
+    vwcow_t* image = cow;
+
+    if (image == NULL) {
+        return;
+    }
+    vworm_cow_account(image, NULL);
+#   if (VW_PAGED)
+    /// The blocks of a paged image are in the cache, which keeps them
+    if (image->file != NULL) {
+        PAGE_LOCK();
+        sub_page_flush(image);
+        for (ot_u32 i=0; i<image->blocks; i++) {
+            if (image->block[i] != NULL) {
+                PAGE_SLOT(image->block[i])->owner = NULL;
+                pcache.used--;
+            }
+        }
+        sub_page_unref(image->file);
+        PAGE_UNLOCK();
+        free(image);
+        return;
+    }
+#   endif
+    for (ot_u32 i=0; i<image->blocks; i++) {
+        free(image->block[i]);
+    }
+    free(image->flat);
+    free(image);
+}
+
+
+ot_u8 vworm_cow_init(void* cow) {
+    vwcow_t* image = cow;
+
+    if (image == NULL) {
+        return 1;
+    }
+    if (image->flat != NULL) {
+        fsram = (ot_u32*)image->flat;
+        fscow = NULL;
+    }
+    else {
+        fsram = NULL;
+        fscow = image;
+    }
+    DIRTY_PARK();
+    return 0;
+}
+
+
+ot_u32 vworm_cow_copy(const void* cow, void* dst) {
+    const vwcow_t*  image = cow;
+    ot_u8*          data = dst;
+    ot_u32          offset;
+    ot_u32          span;
+
+    if ((image == NULL) || (dst == NULL)) {
+        return 0;
+    }
+    if (image->flat != NULL) {
+        memcpy(dst, image->flat, image->alloc);
+        return image->alloc;
+    }
+#   if (VW_PAGED)
+    if (image->file != NULL) {
+        ot_u32 copied = image->alloc;
+        PAGE_LOCK();
+        for (ot_u32 i=0; (i<image->blocks) && (copied != 0); i++) {
+            offset  = i * COW_BLOCK;
+            span    = ((image->alloc - offset) < COW_BLOCK) ? (image->alloc - offset) : COW_BLOCK;
+            if (image->block[i] != NULL) {
+                memcpy(&data[offset], image->block[i], span);
+            }
+            else if (pread(image->file->fd, &data[offset], span, (off_t)(image->fofs + offset)) != (ssize_t)span) {
+                copied = 0;
+            }
+        }
+        PAGE_UNLOCK();
+        memcpy(data, &image->header, sizeof(vlFSHEADER));
+        return copied;
+    }
+#   endif
+    if (image->blocks == 0) {
+        memcpy(dst, image->src, image->alloc);
+    }
+
+    for (ot_u32 i=0; i<image->blocks; i++) {
+        offset  = i * COW_BLOCK;
+        span    = ((image->alloc - offset) < COW_BLOCK) ? (image->alloc - offset) : COW_BLOCK;
+        memcpy(&data[offset], (image->block[i] != NULL) ? image->block[i] : &image->src[offset], span);
+    }
+    memcpy(data, &image->header, sizeof(vlFSHEADER));
+    return image->alloc;
+}
+
+
+ot_u32 vworm_cow_private(const void* cow) {
+    const vwcow_t* image = cow;
+    return (image != NULL) ? __atomic_load_n(&image->priv, __ATOMIC_RELAXED) : 0;
+}
+
+
+/// The blocks of paged images are attached and evicted with the cache locked,
+/// so the cache lock keeps them from changing while the counter is changed.
+void vworm_cow_account(void* cow, ot_u64* counter) {
+    vwcow_t*    image = cow;
+    ot_u64*     old;
+    ot_u32      priv;
+
+    if (image == NULL) {
+        return;
+    }
+#   if (VW_PAGED)
+    PAGE_LOCK();
+#   endif
+    old     = image->account;
+    priv    = __atomic_load_n(&image->priv, __ATOMIC_RELAXED);
+    if (old != NULL) {
+        __atomic_fetch_sub(old, priv, __ATOMIC_RELAXED);
+    }
+    if (counter != NULL) {
+        __atomic_fetch_add(counter, priv, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&image->account, counter, __ATOMIC_RELEASE);
+#   if (VW_PAGED)
+    PAGE_UNLOCK();
+#   endif
+}
+
+#endif
+
+
 #ifndef EXTF_vworm_print_table
 void vworm_print_table() {
 }
 #endif
 
+#if (OT_FEATURE(MULTIFS) && (OT_FEATURE(VLMMAP) == ENABLED))
+/// Syncs the pages of a range.  The image of a range that was kept may have
+/// been unmapped since, which is not an error.
+static ot_u8 sub_range_sync(uintptr_t lo, uintptr_t hi) {
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+
+    lo &= ~(page-1);
+    if ((msync((void*)lo, hi - lo, MS_SYNC) != 0) && (errno != ENOMEM)) {
+        return 1;
+    }
+    return 0;
+}
+
+
+/// Syncs the kept ranges.  The caller must hold the lock.
+static ot_u8 sub_pending_sync(void) {
+    ot_u8 rc = 0;
+
+    for (ot_u32 i=0; i<fspending_num; i++) {
+        rc |= sub_range_sync(fspending[i].lo, fspending[i].hi);
+    }
+    fspending_num = 0;
+    return rc;
+}
+
+
+/// Keeps the dirty range of the image that is being deselected, and clears
+/// it.  The range is merged into a kept one that it touches, if any.
+static void sub_dirty_park(void) {
+    uintptr_t   lo;
+    uintptr_t   hi;
+    ot_u32      i;
+
+    if ((fsram != NULL) && (fsdirty_lo < fsdirty_hi)) {
+        lo = (uintptr_t)fsram + fsdirty_lo;
+        hi = (uintptr_t)fsram + fsdirty_hi;
+
+        PENDING_LOCK();
+        for (i=0; i<fspending_num; i++) {
+            if ((lo <= fspending[i].hi) && (hi >= fspending[i].lo)) {
+                fspending[i].lo = (lo < fspending[i].lo) ? lo : fspending[i].lo;
+                fspending[i].hi = (hi > fspending[i].hi) ? hi : fspending[i].hi;
+                break;
+            }
+        }
+        if (i == fspending_num) {
+            if (fspending_num == PENDING_MAX) {
+                sub_pending_sync();
+            }
+            fspending[fspending_num].lo = lo;
+            fspending[fspending_num].hi = hi;
+            fspending_num++;
+        }
+        PENDING_UNLOCK();
+    }
+    DIRTY_CLEAR();
+}
+#endif
+
+
 #ifndef EXTF_vworm_save
 ot_u8 vworm_save( ) {
-/// @note This does nothing for pure STDC implementation, which is entirely 
-///       RAM based.  For Microcontroller variant, this can save the file table
-///       to nonvolatile memory.
+/// @note Without OT_FEATURE_VLMMAP or OT_FEATURE_VLPAGED, this does nothing
+///       for pure STDC implementation, which is entirely RAM based.  For
+///       Microcontroller variant, this can save the file table to
+///       nonvolatile memory.
+#   if (VW_PAGED)
+    if ((fscow != NULL) && (fscow->file != NULL)) {
+        ot_u8 rc;
+        PAGE_LOCK();
+        rc = sub_page_flush(fscow);
+        PAGE_UNLOCK();
+        return (rc != 0) || (fdatasync(fscow->file->fd) != 0);
+    }
+#   endif
+#   if (OT_FEATURE(MULTIFS) && (OT_FEATURE(VLMMAP) == ENABLED))
+    ot_u8 rc;
+
+    PENDING_LOCK();
+    rc = sub_pending_sync();
+    PENDING_UNLOCK();
+
+    if ((fsram != NULL) && (fsdirty_lo < fsdirty_hi)) {
+        if (sub_range_sync((uintptr_t)fsram + fsdirty_lo, (uintptr_t)fsram + fsdirty_hi) != 0) {
+            return 1;
+        }
+        DIRTY_CLEAR();
+    }
+    return rc;
+#   endif
     return 0;
 }
 #endif
@@ -235,6 +1033,19 @@ ot_u16 vworm_read(vaddr addr) {
     ot_u16* data;
     addr   -= VWORM_BASE_VADDR;
     addr   &= ~1;
+#   if (OT_FEATURE(MULTIFS) && (OT_FEATURE(VLCOW) == ENABLED))
+    if (fscow != NULL) {
+#       if (VW_PAGED)
+        if (fscow->file != NULL) {
+            ot_u16 value = 0;
+            sub_page_rw(addr, &value, False);
+            return value;
+        }
+#       endif
+        data = (ot_u16*)sub_cow_ptr(addr, False);
+        return (data != NULL) ? *data : 0;
+    }
+#   endif
     data    = (ot_u16*)((ot_u8*)fsram + addr);
     return *data;
 }
@@ -245,8 +1056,24 @@ ot_u8 vworm_write(vaddr addr, ot_u16 data) {
     ot_u16* aptr;
     addr   -= VWORM_BASE_VADDR;
     addr   &= ~1;
+#   if (OT_FEATURE(MULTIFS) && (OT_FEATURE(VLCOW) == ENABLED))
+    if (fscow != NULL) {
+#       if (VW_PAGED)
+        if (fscow->file != NULL) {
+            return sub_page_rw(addr, &data, True);
+        }
+#       endif
+        aptr = (ot_u16*)sub_cow_ptr(addr, True);
+        if (aptr == NULL) {
+            return 1;
+        }
+        *aptr = data;
+        return 0;
+    }
+#   endif
     aptr    = (ot_u16*)((ot_u8*)fsram + addr);
     *aptr   = data;
+    DIRTY_MARK(addr);
     return 0;
 }
 #endif
@@ -272,10 +1099,60 @@ ot_u8 vworm_mark_physical(ot_u16* addr, ot_u16 value) {
 #ifndef EXTF_vworm_get
 void* vworm_get(vaddr addr) {
     addr -= VWORM_BASE_VADDR;
+#   if (OT_FEATURE(MULTIFS) && (OT_FEATURE(VLCOW) == ENABLED))
+    if (fscow != NULL) {
+        if ((ot_u32)addr < sizeof(vlFSHEADER)) {
+            return (ot_u8*)&fscow->header + addr;
+        }
+#       if (VW_PAGED)
+        /// A paged image is never all in memory
+        if (fscow->file != NULL) {
+            return NULL;
+        }
+#       endif
+        if (sub_cow_flatten() == NULL) {
+            return NULL;
+        }
+    }
+#   endif
     return (void*)((ot_u8*)fsram + addr);
 }
 #endif
 
+#ifndef EXTF_vworm_span
+void* vworm_span(vaddr addr, ot_uint span, ot_bool write) {
+    ot_u32 offset = (ot_u32)(addr - VWORM_BASE_VADDR);
+
+    if (span == 0) {
+        return NULL;
+    }
+#   if (OT_FEATURE(MULTIFS) && (OT_FEATURE(VLCOW) == ENABLED))
+    if (fscow != NULL) {
+        ot_u32 last = offset + span - 1;
+#       if (VW_PAGED)
+        if (fscow->file != NULL) {
+            return NULL;
+        }
+#       endif
+        /// The header of a COW image is apart from its data.  A lazy image
+        /// has no blocks: its data is all in one piece, before and after the
+        /// first write copies it.
+        if ((offset < sizeof(vlFSHEADER)) || (last >= fscow->alloc)) {
+            return NULL;
+        }
+        if ((fscow->blocks != 0) && ((offset / COW_BLOCK) != (last / COW_BLOCK))) {
+            return NULL;
+        }
+        return sub_cow_ptr(offset, write);
+    }
+#   endif
+    if (write) {
+        DIRTY_SPAN(offset, span);
+    }
+    return (void*)((ot_u8*)fsram + offset);
+}
+#endif
+
 #ifndef EXTF_vworm_wipeblock
 ot_u8 vworm_wipeblock(vaddr addr, ot_uint wipe_span) {
     return 0;
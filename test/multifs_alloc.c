@@ -0,0 +1,259 @@
+/* Copyright 2017 JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+/**
+  * @file       /test/multifs_alloc.c
+  * @author     JP Norair (jpnorair@indigresso.com)
+  * @version    R100
+  * @date       17 October 2026
+  * @brief      Test of file creation and deletion
+  *
+  * Builds an image with an empty ISF block of many headers, and creates and
+  * deletes files of random sizes on a group of them.  The data of every file
+  * is checked before it is deleted and at the end, and the heap extents of
+  * the files must not overlap.  The time of vl_new() is measured: build with
+  * OT_FEATURE_VLFREEINDEX enabled to use the free space index, and without
+  * it to compare with the search of the headers.
+  *
+  * The library must be built with OT_FEATURE_VLNEW.
+  *
+  ******************************************************************************
+  */
+
+
+#include <otfs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+#define KYEL  "\x1B[33m"
+
+// Default parameters
+#define DEF_NUM_FS          100
+#define DEF_OPS             5000
+#define DEF_HEADERS         240
+#define DEF_HEAP            8192
+#define DEF_MAXFILE         128
+
+
+static uint64_t sub_uid(uint64_t i) {
+    return i + 1;
+}
+
+
+static double sub_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+
+/// An image with no GFB or ISS, and an ISF block of empty headers
+static void* sub_image(size_t* alloc) {
+    vlFSHEADER  fshdr;
+    vl_header_t hdr;
+    uint8_t*    image;
+    size_t      ftab;
+
+    ftab    = (sizeof(vlFSHEADER) + (DEF_HEADERS * sizeof(vl_header_t)) + 3) & ~3;
+    *alloc  = ftab + DEF_HEAP;
+    image   = calloc(1, *alloc);
+    if (image == NULL) {
+        return NULL;
+    }
+
+    memset(&fshdr, 0, sizeof(fshdr));
+    fshdr.ftab_alloc    = (ot_u16)ftab;
+    fshdr.isf.alloc     = DEF_HEAP;
+    fshdr.isf.files     = DEF_HEADERS;
+    memcpy(image, &fshdr, sizeof(fshdr));
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.idmod   = 0xFFFF;
+    hdr.base    = NULL_vaddr;
+    hdr.mirror  = NULL_vaddr;
+    for (int i=0; i<DEF_HEADERS; i++) {
+        memcpy(image + sizeof(vlFSHEADER) + (i * sizeof(vl_header_t)), &hdr, sizeof(hdr));
+    }
+    return image;
+}
+
+
+static int sub_data_check(ot_u8 id, ot_uint size) {
+    vlFILE* fp;
+    uint8_t data[DEF_MAXFILE];
+    int     errors = 0;
+
+    fp = ISF_open_su(id);
+    if (fp == NULL) {
+        return 1;
+    }
+    errors += (vl_load(fp, size, data) != size);
+    for (ot_uint i=0; i<size; i++) {
+        errors += (data[i] != (uint8_t)(id ^ i));
+    }
+    vl_close(fp);
+    return (errors != 0);
+}
+
+
+/// The files of the image must not overlap or leave the heap
+static int sub_overlap_check(const uint8_t* image) {
+    const vlFSHEADER*   fshdr = (const vlFSHEADER*)image;
+    vl_header_t         hdr;
+    uint32_t            heap_base, heap_end;
+    uint8_t             used[DEF_HEAP];
+    int                 errors = 0;
+
+    heap_base   = fshdr->ftab_alloc;
+    heap_end    = heap_base + fshdr->isf.alloc;
+    memset(used, 0, sizeof(used));
+    for (int i=0; i<fshdr->isf.files; i++) {
+        memcpy(&hdr, image + sizeof(vlFSHEADER) + (i * sizeof(vl_header_t)), sizeof(hdr));
+        if ((hdr.base == 0) || (hdr.base == NULL_vaddr)) {
+            continue;
+        }
+        if ((hdr.base < heap_base) || ((hdr.base + hdr.alloc) > heap_end)) {
+            errors++;
+            continue;
+        }
+        for (int j=0; j<hdr.alloc; j++) {
+            errors += (used[hdr.base - heap_base + j]++ != 0);
+        }
+    }
+    return errors;
+}
+
+
+
+int main(int argc, char** argv) {
+    void*       group;
+    otfs_t      fs;
+    size_t      alloc;
+    uint16_t    size[256];
+    uint8_t     data[DEF_MAXFILE];
+    uint64_t    uid;
+    uint64_t    creates = 0;
+    uint64_t    deletes = 0;
+    uint64_t    full = 0;
+    double      new_time = 0.;
+    int         num_fs;
+    int         errors = 0;
+
+    num_fs = (argc > 1) ? atoi(argv[1]) : DEF_NUM_FS;
+    if (num_fs <= 0) {
+        num_fs = DEF_NUM_FS;
+    }
+
+    printf("MultiFS file creation test\n");
+    printf("===============================================================================\n");
+    printf("Name of app in use with libotfs: %s\n", LIBOTFS_APP_NAME);
+    printf("Free space index:                %s\n", (OT_FEATURE(VLFREEINDEX) == ENABLED) ? "on" : "off");
+    printf("Filesystems:                     %d\n", num_fs);
+    printf("Headers, heap:                   %d, %d bytes\n\n", DEF_HEADERS, DEF_HEAP);
+
+#   if (OT_FEATURE(VLNEW) != ENABLED)
+    printf("%sNote: libotfs built without OT_FEATURE_VLNEW, nothing to test%s\n", KYEL, KNRM);
+    printf("\nErrors: %s%d%s\n", KGRN, 0, KNRM);
+    return 0;
+#   endif
+
+    if (otfs_init(&group) != 0) {
+        fprintf(stderr, "%sError: could not init group (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+        return -1;
+    }
+    for (int i=0; i<num_fs; i++) {
+        fs.uid.u64  = sub_uid(i);
+        fs.base     = sub_image(&alloc);
+        fs.alloc    = alloc;
+        if ((fs.base == NULL) || (otfs_new(group, &fs) != 0)) {
+            fprintf(stderr, "%sError: could not add FS (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+            return -1;
+        }
+    }
+    otfs_release(group);
+
+    // Random IDs on each FS: a file is deleted if it exists, else it is
+    // created 3 times out of 4
+    srand(1);
+    for (int i=0; i<num_fs; i++) {
+        uid = sub_uid(i);
+        errors += (otfs_setfs(group, &fs, (ot_u8*)&uid) != 0);
+        memset(size, 0, sizeof(size));
+
+        for (int n=0; n<DEF_OPS; n++) {
+            ot_u8   id = (ot_u8)(rand() % DEF_HEADERS);
+            vlFILE* fp;
+            double  start;
+            ot_u8   rc;
+
+            if (size[id] != 0) {
+                errors += sub_data_check(id, size[id]);
+                errors += (vl_delete(VL_ISF_BLOCKID, id, NULL) != 0);
+                errors += (ISF_open_su(id) != NULL);
+                size[id] = 0;
+                deletes++;
+                continue;
+            }
+            if ((rand() & 3) == 0) {
+                continue;
+            }
+
+            size[id] = 2 + (rand() % (DEF_MAXFILE - 1));
+            start    = sub_now();
+            rc       = vl_new(&fp, VL_ISF_BLOCKID, id, b00110110, size[id], NULL);
+            new_time+= sub_now() - start;
+            if (rc == 0x06) {
+                size[id] = 0;
+                full++;
+                continue;
+            }
+            if (rc != 0) {
+                errors++;
+                size[id] = 0;
+                continue;
+            }
+            for (ot_uint j=0; j<size[id]; j++) {
+                data[j] = (uint8_t)(id ^ j);
+            }
+            errors += (vl_store(fp, size[id], data) != 0);
+            vl_close(fp);
+            creates++;
+        }
+
+        for (int id=0; id<256; id++) {
+            if (size[id] != 0) {
+                errors += sub_data_check((ot_u8)id, size[id]);
+            }
+        }
+        errors += sub_overlap_check(fs.base);
+    }
+    otfs_release(group);
+
+    printf("Creates:               %llu\n", (unsigned long long)creates);
+    printf("Deletes:               %llu\n", (unsigned long long)deletes);
+    printf("Heap full:             %llu\n", (unsigned long long)full);
+    printf("vl_new():              %.1f ns/call\n", 1e9 * new_time / (double)(creates + full + 1));
+
+    otfs_deinit(group, &free);
+
+    printf("\nErrors: %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+    return (errors != 0);
+}
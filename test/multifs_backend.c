@@ -0,0 +1,232 @@
+/* Copyright 2017 JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+/**
+  * @file       /test/multifs_backend.c
+  * @author     JP Norair (jpnorair@indigresso.com)
+  * @version    R100
+  * @date       17 October 2026
+  * @brief      Benchmark of the MultiFS group table backend
+  *
+  * Measures insert, lookup, miss and iterate throughput of a MultiFS group at
+  * 10k, 100k and 1M filesystems, and the same operations on a bare Judy array
+  * keyed the way MultiFS used to key it.  A miss is a lookup of a UID that is
+  * not in the group.
+  *
+  * The group backend is selected when libotfs is built: with OT_FEATURE_VLJUDY
+  * the group keeps a Judy array and the hash index, without it only the hash
+  * index.  Build both ways to compare them.  With OT_FEATURE_VLFILTER, misses
+  * are mostly rejected by the lookup filter, and its memory cost and false-
+  * positive rate are shown from the group statistics.  The images are not
+  * used, so all the filesystems share one dummy image.
+  *
+  * The largest group size can be given as the first argument.
+  *
+  ******************************************************************************
+  */
+
+
+#include <otfs.h>
+#include <judy.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+
+// Default parameters
+#define DEF_MAX_FS          1000000
+#define DEF_LOOKUPS         2000000
+
+#define JUDYKEYS_PER_UID    ((8+JUDY_key_size-1)/JUDY_key_size)
+
+
+static uint64_t dummy_image[64];
+
+
+
+/// UIDs are scrambled so that neither backend sees them in key order.  The
+/// function is a bijection, so they are unique, and 0 is never used.
+static uint64_t sub_uid(uint64_t i) {
+    uint64_t z = (i + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z = z ^ (z >> 31);
+    return (z != 0) ? z : 1;
+}
+
+
+static double sub_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+
+static void sub_report(const char* name, int num_fs, double ins, double look, double miss, double iter) {
+    printf("%-10s %-9d %-14.0f %-14.0f %-14.0f %-14.0f\n", name, num_fs, ins, look, miss, iter);
+}
+
+
+static int sub_bench_judy(int num_fs, int lookups) {
+    void*       judy;
+    JudySlot*   val;
+    uint64_t    uid;
+    uint64_t    null_id = 0;
+    int         errors = 0;
+    int         count;
+    double      start, ins, look, miss, iter;
+
+    judy = judy_open(4*JUDYKEYS_PER_UID, JUDYKEYS_PER_UID);
+    if (judy == NULL) {
+        return 1;
+    }
+
+    start = sub_now();
+    for (int i=0; i<num_fs; i++) {
+        uid = sub_uid(i);
+        val = judy_cell(judy, (const unsigned char*)&uid, 8);
+        if (val == NULL) {
+            errors++;
+            continue;
+        }
+        *val = (JudySlot)(i+1);
+    }
+    ins = (double)num_fs / (sub_now() - start);
+
+    start = sub_now();
+    for (int i=0; i<lookups; i++) {
+        int j = (int)(((uint64_t)i * 7919) % num_fs);
+        uid = sub_uid(j);
+        val = judy_slot(judy, (const unsigned char*)&uid, 8);
+        errors += ((val == NULL) || (*val != (JudySlot)(j+1)));
+    }
+    look = (double)lookups / (sub_now() - start);
+
+    start = sub_now();
+    for (int i=0; i<lookups; i++) {
+        uid = sub_uid(num_fs + i);
+        errors += (judy_slot(judy, (const unsigned char*)&uid, 8) != NULL);
+    }
+    miss = (double)lookups / (sub_now() - start);
+
+    start = sub_now();
+    count = 0;
+    val = judy_strt(judy, (const unsigned char*)&null_id, 0);
+    while (val != NULL) {
+        count++;
+        val = judy_nxt(judy);
+    }
+    iter = (double)count / (sub_now() - start);
+    errors += (count != num_fs);
+
+    judy_close(judy);
+    sub_report("judy", num_fs, ins, look, miss, iter);
+    return errors;
+}
+
+
+static int sub_bench_group(int num_fs, int lookups) {
+    void*       group;
+    vlFSREF     ref;
+    vlFSCURSOR  cur;
+    vlFSSTATS   stats;
+    id_tmpl     fsid;
+    uint64_t    uid;
+    int         errors = 0;
+    int         count;
+    double      start, ins, look, miss, iter;
+
+    if (vl_multifs_init(&group) != 0) {
+        return 1;
+    }
+    fsid.length = 8;
+    fsid.value  = (ot_u8*)&uid;
+
+    start = sub_now();
+    for (int i=0; i<num_fs; i++) {
+        uid = sub_uid(i);
+        errors += (vl_multifs_add(group, dummy_image, &fsid) != 0);
+    }
+    ins = (double)num_fs / (sub_now() - start);
+
+    start = sub_now();
+    for (int i=0; i<lookups; i++) {
+        int j = (int)(((uint64_t)i * 7919) % num_fs);
+        uid = sub_uid(j);
+        errors += (vl_multifs_open(group, &ref, &fsid) != 0);
+    }
+    look = (double)lookups / (sub_now() - start);
+
+    start = sub_now();
+    for (int i=0; i<lookups; i++) {
+        uid = sub_uid(num_fs + i);
+        errors += (vl_multifs_open(group, &ref, &fsid) != 0x11);
+    }
+    miss = (double)lookups / (sub_now() - start);
+
+    start = sub_now();
+    count = 0;
+    vl_multifs_cursor(group, &cur, 0, 1);
+    while (vl_multifs_scan(&cur, NULL, NULL) == 0) {
+        count++;
+    }
+    iter = (double)count / (sub_now() - start);
+    errors += (count != num_fs);
+
+    errors += (vl_multifs_stats(group, &stats) != 0) || (stats.fs != (size_t)num_fs);
+
+    vl_multifs_deinit(group, NULL);
+    sub_report("group", num_fs, ins, look, miss, iter);
+    if (stats.filter_bytes != 0) {
+        printf("  filter: %zu bytes, %.2f bits/FS, false-positive rate %.4f\n",
+                stats.filter_bytes, (8. * stats.filter_bytes) / (double)num_fs, stats.filter_fpr);
+    }
+    return errors;
+}
+
+
+
+int main(int argc, char** argv) {
+    int max_fs;
+    int errors = 0;
+
+    max_fs = (argc > 1) ? atoi(argv[1]) : DEF_MAX_FS;
+    if (max_fs < 10000) {
+        max_fs = DEF_MAX_FS;
+    }
+
+    printf("MultiFS group backend benchmark\n");
+    printf("===============================================================================\n");
+    printf("Name of app in use with libotfs: %s\n", LIBOTFS_APP_NAME);
+    printf("Group backend:                   %s\n",
+            (OT_FEATURE(VLJUDY) == ENABLED) ? "Judy + hash index" : "hash index");
+    printf("Lookup filter:                   %s\n",
+            (OT_FEATURE(VLFILTER) == ENABLED) ? "yes" : "no");
+    printf("Lookups per size:                %d\n\n", DEF_LOOKUPS);
+
+    printf("Table      FS        Insert/s       Lookup/s       Miss/s         Iterate/s\n");
+    for (int n=10000; n<=max_fs; n*=10) {
+        errors += sub_bench_judy(n, DEF_LOOKUPS);
+        errors += sub_bench_group(n, DEF_LOOKUPS);
+    }
+
+    printf("\nErrors: %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+    return (errors != 0);
+}
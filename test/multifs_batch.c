@@ -0,0 +1,185 @@
+/* Copyright 2017 JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+/**
+  * @file       /test/multifs_batch.c
+  * @author     JP Norair (jpnorair@indigresso.com)
+  * @version    R100
+  * @date       17 October 2026
+  * @brief      Benchmark of batched MultiFS lookups
+  *
+  * Resolves bursts of UIDs to FS images, as a gateway does for a burst of
+  * received frames.  Some of the UIDs are not in the group.  Each burst is
+  * resolved two ways:
+  * - otfs_setfs() on each UID
+  * - otfs_lookup_batch() on the whole burst
+  *
+  * The results of the two are compared, and the rate of each is reported.
+  *
+  ******************************************************************************
+  */
+
+
+#include <otfs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+
+// Default parameters
+#define DEF_NUM_FS          100000
+#define DEF_BURST           256
+#define DEF_BURSTS          4000
+#define DEF_MISS_PERCENT    10
+#define DEF_FS_ALLOC        2048
+
+
+static uint64_t sub_uid(uint64_t i) {
+    uint64_t z = (i + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z = z ^ (z >> 31);
+    return (z != 0) ? z : 1;
+}
+
+
+static double sub_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+
+static uint32_t sub_rand(uint32_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+
+
+int main(int argc, char** argv) {
+    void*       group;
+    uint64_t*   uids;
+    otfs_t*     single;
+    otfs_t*     batch;
+    int         num_fs;
+    int         burst;
+    int         errors = 0;
+    int         found = 0;
+    int         rc;
+    uint32_t    seed = 0x2545F491;
+    double      start, t_single, t_batch;
+
+    num_fs  = (argc > 1) ? atoi(argv[1]) : DEF_NUM_FS;
+    burst   = (argc > 2) ? atoi(argv[2]) : DEF_BURST;
+    if (num_fs < 1) {
+        num_fs = DEF_NUM_FS;
+    }
+    if (burst < 1) {
+        burst = DEF_BURST;
+    }
+
+    printf("MultiFS batched lookup benchmark\n");
+    printf("===============================================================================\n");
+    printf("Name of app in use with libotfs: %s\n", LIBOTFS_APP_NAME);
+    printf("Filesystems:                     %d\n", num_fs);
+    printf("UIDs per burst:                  %d\n", burst);
+    printf("Bursts:                          %d\n", DEF_BURSTS);
+    printf("UIDs not in group:               %d%%\n\n", DEF_MISS_PERCENT);
+
+    uids    = calloc(burst, sizeof(uint64_t));
+    single  = calloc(burst, sizeof(otfs_t));
+    batch   = calloc(burst, sizeof(otfs_t));
+    if ((uids == NULL) || (single == NULL) || (batch == NULL)) {
+        fprintf(stderr, "%sError: out of memory%s\n", KRED, KNRM);
+        return -1;
+    }
+
+    rc = otfs_init(&group);
+    if (rc != 0) {
+        fprintf(stderr, "%sError: otfs_init() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-2, KNRM);
+        return -1;
+    }
+    for (int i=0; i<num_fs; i++) {
+        otfs_t fs;
+        fs.uid.u64 = sub_uid(i);
+        rc = otfs_load_defaults(group, &fs, DEF_FS_ALLOC);
+        if (rc < 0) {
+            fprintf(stderr, "%sError: otfs_load_defaults() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-2, KNRM);
+            return -1;
+        }
+        rc = otfs_new(group, &fs);
+        if (rc != 0) {
+            fprintf(stderr, "%sError: otfs_new() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-2, KNRM);
+            return -1;
+        }
+    }
+
+    t_single    = 0.;
+    t_batch     = 0.;
+    for (int b=0; b<DEF_BURSTS; b++) {
+        for (int i=0; i<burst; i++) {
+            uint32_t r = sub_rand(&seed);
+            uids[i] = ((r % 100) < DEF_MISS_PERCENT) ? sub_uid(num_fs + r) : sub_uid(r % num_fs);
+        }
+
+        start = sub_now();
+        for (int i=0; i<burst; i++) {
+            if (otfs_setfs(group, &single[i], (ot_u8*)&uids[i]) != 0) {
+                single[i].base = NULL;
+            }
+        }
+        t_single += sub_now() - start;
+
+        start = sub_now();
+        rc = otfs_lookup_batch(group, uids, burst, batch);
+        t_batch += sub_now() - start;
+
+        if (rc < 0) {
+            errors++;
+            continue;
+        }
+        found += rc;
+        for (int i=0; i<burst; i++) {
+            if ((batch[i].uid.u64 != uids[i]) || (batch[i].base != single[i].base)) {
+                errors++;
+            }
+            else if ((batch[i].base != NULL) && (batch[i].alloc != single[i].alloc)) {
+                errors++;
+            }
+        }
+    }
+
+    printf("Method                 Lookups/s      Speedup\n");
+    printf("%-22s %-14.0f %.2f\n", "otfs_setfs", ((double)DEF_BURSTS * burst) / t_single, 1.);
+    printf("%-22s %-14.0f %.2f\n", "otfs_lookup_batch", ((double)DEF_BURSTS * burst) / t_batch, t_single/t_batch);
+    printf("\nFound: %.1f%%\n", (100. * found) / ((double)DEF_BURSTS * burst));
+    printf("Result errors: %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+
+    otfs_deinit(group, &free);
+    free(uids);
+    free(single);
+    free(batch);
+    printf("FS group deallocated\n");
+
+    return (errors != 0);
+}
@@ -0,0 +1,298 @@
+/* Copyright 2017 JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+/**
+  * @file       /test/multifs_cold.c
+  * @author     JP Norair (jpnorair@indigresso.com)
+  * @version    R100
+  * @date       17 October 2026
+  * @brief      Test of cold storage of FS images
+  *
+  * Provisions one group with a limited hot set and one group without, and
+  * writes the UID of each FS into its ISF 0x11.  Half of the filesystems are
+  * from the default image and half from a template, so both are used as the
+  * base of the cold images.  The resident memory of the two groups is
+  * compared, and then every FS of the limited group is checked, which thaws
+  * it.  With VLTHREADS, threads then write and check disjoint sets of FS,
+  * while the images are made cold and thawed under them.
+  *
+  * The library must be built with OT_FEATURE_VLCOLD.
+  *
+  ******************************************************************************
+  */
+
+
+#include <otfs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+#define KYEL  "\x1B[33m"
+
+// Default parameters
+#define DEF_NUM_FS          100000
+#define DEF_HOT_FS          1000
+#define DEF_THREADS         4
+#define DEF_OPS_PER_THREAD  100000
+#define DEF_FS_ALLOC        2048
+#define DEF_TEST_FILE       0x11
+#define DEF_TMPL_FILE       0x0B
+
+
+typedef struct {
+    void*       group;
+    int         index;
+    int         num_fs;
+    int         errors;
+} worker_t;
+
+
+static const uint8_t test_data[8] = { 0xDE, 0xC0, 0xDE, 0x01, 0x02, 0x03, 0x04, 0x05 };
+
+
+static uint64_t sub_uid(uint64_t i) {
+    return i + 1;
+}
+
+
+static double sub_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+
+/// Resident set size in MB, from /proc (0 if it is not available)
+static double sub_rss(void) {
+    FILE* f;
+    long pages = 0;
+
+    f = fopen("/proc/self/statm", "r");
+    if (f != NULL) {
+        if (fscanf(f, "%*ld %ld", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(f);
+    }
+    return ((double)pages * (double)sysconf(_SC_PAGESIZE)) / (1024. * 1024.);
+}
+
+
+static int sub_rw(ot_u8 id, uint8_t* data, int write) {
+    vlFILE* fp;
+    fp = ISF_open_su(id);
+    if (fp == NULL) {
+        return -1;
+    }
+    if (write) {
+        vl_store(fp, 8, data);
+    }
+    else {
+        memset(data, 0, 8);
+        vl_load(fp, 8, data);
+    }
+    vl_close(fp);
+    return 0;
+}
+
+
+/// The template has test_data in ISF 0x0B
+static int sub_template(void* group) {
+    otfs_t  fs;
+    ot_u8   id;
+    ot_u8   rc;
+
+    if (otfs_load_defaults(group, &fs, DEF_FS_ALLOC) < 0) {
+        return -1;
+    }
+    fs.uid.u64 = ~0ULL;
+    if (otfs_new(group, &fs) != 0) {
+        otfs_free_image(group, &fs);
+        return -1;
+    }
+    sub_rw(DEF_TMPL_FILE, (uint8_t*)test_data, 1);
+    rc = vl_multifs_template_add(group, fs.base, fs.alloc, &id);
+    otfs_del(group, &fs, &free);
+    return (rc == 0) ? (int)id : -1;
+}
+
+
+static int sub_provision(void** group, int num_fs, size_t hot_fs) {
+    double  rss0, start, mb;
+    int     tmpl;
+
+    rss0 = sub_rss();
+    if (otfs_init(group) != 0) {
+        return -1;
+    }
+    if ((hot_fs != 0) && (otfs_hotset(*group, hot_fs) != 0)) {
+        return -1;
+    }
+    tmpl = sub_template(*group);
+    if (tmpl <= 0) {
+        return -1;
+    }
+
+    start = sub_now();
+    for (int i=0; i<num_fs; i++) {
+        otfs_t fs;
+        uint64_t uid = sub_uid(i);
+
+        fs.uid.u64 = uid;
+        if (otfs_load_template(*group, &fs, (i & 1) ? tmpl : 0, DEF_FS_ALLOC) < 0) {
+            return -1;
+        }
+        if (otfs_new(*group, &fs) != 0) {
+            otfs_free_image(*group, &fs);
+            return -1;
+        }
+        if (sub_rw(DEF_TEST_FILE, (uint8_t*)&uid, 1) != 0) {
+            return -1;
+        }
+    }
+
+    mb = sub_rss() - rss0;
+    printf("%-10zu %-10.3f %-10.1f %.0f\n", hot_fs, sub_now() - start, mb,
+            (mb * 1024. * 1024.) / (double)num_fs);
+    return 0;
+}
+
+
+/// Each thread has the filesystems with i % threads == index.  It writes a
+/// new value into each one and reads it back, over and over.
+static void* sub_worker(void* arg) {
+    worker_t* w = arg;
+    uint8_t data[8];
+    uint64_t value;
+
+    for (int n=0; n<DEF_OPS_PER_THREAD; n++) {
+        int i = w->index + (int)(((uint64_t)n * 7919) % (uint64_t)(w->num_fs / DEF_THREADS)) * DEF_THREADS;
+        uint64_t uid = sub_uid(i);
+
+        if (otfs_setfs(w->group, NULL, (ot_u8*)&uid) != 0) {
+            w->errors++;
+            continue;
+        }
+        value = uid ^ ((uint64_t)n << 40);
+        sub_rw(DEF_TEST_FILE, (uint8_t*)&value, 1);
+        if ((sub_rw(DEF_TEST_FILE, data, 0) != 0) || (memcmp(data, &value, 8) != 0)) {
+            w->errors++;
+        }
+    }
+    otfs_release(w->group);
+    return NULL;
+}
+
+
+
+int main(int argc, char** argv) {
+    void*           full;
+    void*           group;
+    otfs_stats_t    stats;
+    uint8_t         data[8];
+    int             num_fs;
+    int             errors = 0;
+    double          start;
+
+    num_fs = (argc > 1) ? atoi(argv[1]) : DEF_NUM_FS;
+    if (num_fs < (2*DEF_HOT_FS)) {
+        num_fs = DEF_NUM_FS;
+    }
+
+    printf("MultiFS cold storage test\n");
+    printf("===============================================================================\n");
+    printf("Name of app in use with libotfs: %s\n", LIBOTFS_APP_NAME);
+    printf("Filesystems:                     %d\n", num_fs);
+    printf("Hot filesystems:                 %d\n\n", DEF_HOT_FS);
+
+#   if (OT_FEATURE(VLCOLD) != ENABLED)
+    printf("%sNote: libotfs built without OT_FEATURE_VLCOLD, nothing to test%s\n", KYEL, KNRM);
+    return 0;
+#   endif
+
+    printf("Hot set    Time (s)   RSS (MB)   Bytes/FS\n");
+    if (sub_provision(&group, num_fs, DEF_HOT_FS) != 0) {
+        fprintf(stderr, "%sError: could not add FS with a hot set (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+        return -1;
+    }
+    if (sub_provision(&full, num_fs, 0) != 0) {
+        fprintf(stderr, "%sError: could not add FS (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+        return -1;
+    }
+    otfs_release(full);
+    otfs_deinit(full, &free);
+
+    if (otfs_stats(group, &stats) == 0) {
+        errors += (stats.cold_fs < (size_t)(num_fs - DEF_HOT_FS));
+        printf("\nCold FS:               %zu (%.0f bytes/FS)\n", stats.cold_fs,
+                (stats.cold_fs != 0) ? (double)stats.cold_bytes / (double)stats.cold_fs : 0.);
+    }
+
+    // Check every filesystem, which thaws each one
+    start = sub_now();
+    for (int i=0; i<num_fs; i++) {
+        uint64_t uid = sub_uid(i);
+
+        if (otfs_setfs(group, NULL, (ot_u8*)&uid) != 0) {
+            errors++;
+            continue;
+        }
+        errors += (sub_rw(DEF_TEST_FILE, data, 0) != 0) || (memcmp(data, &uid, 8) != 0);
+        if (i & 1) {
+            errors += (sub_rw(DEF_TMPL_FILE, data, 0) != 0) || (memcmp(data, test_data, 8) != 0);
+        }
+    }
+    printf("Thawed:                %.0f FS/s\n", (double)num_fs / (sub_now() - start));
+
+    if (otfs_stats(group, &stats) == 0) {
+        errors += (stats.cold_fs < (size_t)(num_fs - DEF_HOT_FS));
+    }
+
+#   if (OT_FEATURE(VLTHREADS) == ENABLED)
+    {   pthread_t   threads[DEF_THREADS];
+        worker_t    workers[DEF_THREADS];
+
+        otfs_release(group);
+        otfs_hotset(group, DEF_THREADS * 4);
+        start = sub_now();
+        for (int t=0; t<DEF_THREADS; t++) {
+            workers[t].group    = group;
+            workers[t].index    = t;
+            workers[t].num_fs   = (num_fs < 4096) ? num_fs : 4096;
+            workers[t].errors   = 0;
+            pthread_create(&threads[t], NULL, &sub_worker, &workers[t]);
+        }
+        for (int t=0; t<DEF_THREADS; t++) {
+            pthread_join(threads[t], NULL);
+            errors += workers[t].errors;
+        }
+        printf("Threads:               %d, %.0f ops/s\n", DEF_THREADS,
+                (double)(DEF_THREADS * DEF_OPS_PER_THREAD) / (sub_now() - start));
+    }
+#   endif
+
+    otfs_release(group);
+    otfs_deinit(group, &free);
+
+    printf("\nErrors: %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+    return (errors != 0);
+}
@@ -0,0 +1,301 @@
+/* Copyright 2017 JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+/**
+  * @file       /test/multifs_defrag.c
+  * @author     JP Norair (jpnorair@indigresso.com)
+  * @version    R100
+  * @date       17 October 2026
+  * @brief      Test of heap defragmentation
+  *
+  * Fills the ISF heap of each FS with files, and deletes every other one, so
+  * the free space is in gaps that are too small for a bigger file.  Half of
+  * the FS are then compacted with otfs_defrag() and a small budget, with one
+  * file kept open, and the other half by vl_new() of the bigger file, which
+  * compacts the heap by itself.  The data of all files is checked, and the
+  * time of the budgeted and of the full calls is measured.  Last, a file that
+  * is open and written, but not yet closed, must keep its data when moved.
+  *
+  * The library must be built with OT_FEATURE_VLNEW.
+  *
+  ******************************************************************************
+  */
+
+
+#include <otfs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+#define KYEL  "\x1B[33m"
+
+// Default parameters
+#define DEF_NUM_FS          200
+#define DEF_HEADERS         64
+#define DEF_HEAP            4096
+#define DEF_FILES           32
+#define DEF_FILE_BYTES      126
+#define DEF_BIG_BYTES       250
+#define DEF_BIG_FILE        (DEF_FILES + 1)
+#define DEF_OPEN_FILE       (DEF_FILES - 1)
+#define DEF_BUDGET          256
+
+
+static uint64_t sub_uid(uint64_t i) {
+    return i + 1;
+}
+
+
+static double sub_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+
+/// An image with no GFB or ISS, and an ISF block of empty headers
+static void* sub_image(size_t* alloc) {
+    vlFSHEADER  fshdr;
+    vl_header_t hdr;
+    uint8_t*    image;
+    size_t      ftab;
+
+    ftab    = (sizeof(vlFSHEADER) + (DEF_HEADERS * sizeof(vl_header_t)) + 3) & ~3;
+    *alloc  = ftab + DEF_HEAP;
+    image   = calloc(1, *alloc);
+    if (image == NULL) {
+        return NULL;
+    }
+
+    memset(&fshdr, 0, sizeof(fshdr));
+    fshdr.ftab_alloc    = (ot_u16)ftab;
+    fshdr.isf.alloc     = DEF_HEAP;
+    fshdr.isf.files     = DEF_HEADERS;
+    memcpy(image, &fshdr, sizeof(fshdr));
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.idmod   = 0xFFFF;
+    hdr.base    = NULL_vaddr;
+    hdr.mirror  = NULL_vaddr;
+    for (int i=0; i<DEF_HEADERS; i++) {
+        memcpy(image + sizeof(vlFSHEADER) + (i * sizeof(vl_header_t)), &hdr, sizeof(hdr));
+    }
+    return image;
+}
+
+
+static int sub_create(ot_u8 id, ot_uint size) {
+    vlFILE* fp;
+    uint8_t data[DEF_BIG_BYTES];
+
+    if (vl_new(&fp, VL_ISF_BLOCKID, id, b00110110, size, NULL) != 0) {
+        return 1;
+    }
+    for (ot_uint i=0; i<size; i++) {
+        data[i] = (uint8_t)(id ^ i);
+    }
+    vl_store(fp, size, data);
+    vl_close(fp);
+    return 0;
+}
+
+
+static int sub_data_check(vlFILE* fp, ot_u8 id, ot_uint size) {
+    uint8_t data[DEF_BIG_BYTES];
+    int     errors = 0;
+
+    if (fp == NULL) {
+        return 1;
+    }
+    errors += (vl_load(fp, size, data) != size);
+    for (ot_uint i=0; i<size; i++) {
+        errors += (data[i] != (uint8_t)(id ^ i));
+    }
+    return (errors != 0);
+}
+
+
+static int sub_file_check(ot_u8 id, ot_uint size) {
+    vlFILE* fp = ISF_open_su(id);
+    int     errors;
+
+    errors = sub_data_check(fp, id, size);
+    vl_close(fp);
+    return errors;
+}
+
+
+
+int main(int argc, char** argv) {
+    void*           group;
+    otfs_t          fs;
+    otfs_fsstats_t  st;
+    size_t          alloc;
+    uint64_t        uid;
+    uint64_t        calls = 0;
+    double          call_max = 0.;
+    double          call_total = 0.;
+    double          full_total = 0.;
+    double          new_total = 0.;
+    int             num_fs;
+    int             errors = 0;
+
+    num_fs = (argc > 1) ? atoi(argv[1]) : DEF_NUM_FS;
+    if (num_fs <= 1) {
+        num_fs = DEF_NUM_FS;
+    }
+
+    printf("MultiFS heap defragmentation test\n");
+    printf("===============================================================================\n");
+    printf("Name of app in use with libotfs: %s\n", LIBOTFS_APP_NAME);
+    printf("Filesystems:                     %d\n", num_fs);
+    printf("Heap, files:                     %d bytes, %d x %d bytes\n\n", DEF_HEAP, DEF_FILES, DEF_FILE_BYTES);
+
+#   if (OT_FEATURE(VLNEW) != ENABLED)
+    printf("%sNote: libotfs built without OT_FEATURE_VLNEW, nothing to test%s\n", KYEL, KNRM);
+    printf("\nErrors: %s%d%s\n", KGRN, 0, KNRM);
+    return 0;
+#   endif
+
+    if (otfs_init(&group) != 0) {
+        fprintf(stderr, "%sError: could not init group (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+        return -1;
+    }
+    for (int i=0; i<num_fs; i++) {
+        fs.uid.u64  = sub_uid(i);
+        fs.base     = sub_image(&alloc);
+        fs.alloc    = alloc;
+        if ((fs.base == NULL) || (otfs_new(group, &fs) != 0)) {
+            fprintf(stderr, "%sError: could not add FS (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+            return -1;
+        }
+    }
+    otfs_release(group);
+
+    // Fill each heap, then delete every other file: the gaps are too small
+    for (int i=0; i<num_fs; i++) {
+        uid = sub_uid(i);
+        errors += (otfs_setfs(group, NULL, (ot_u8*)&uid) != 0);
+        for (int id=0; id<DEF_FILES; id++) {
+            errors += sub_create((ot_u8)id, DEF_FILE_BYTES);
+        }
+        for (int id=0; id<DEF_FILES; id+=2) {
+            errors += (vl_delete(VL_ISF_BLOCKID, (ot_u8)id, NULL) != 0);
+        }
+        errors += (otfs_fsstats(group, NULL, &st) != 0);
+        errors += (st.isf.largest_gap >= DEF_BIG_BYTES);
+    }
+    otfs_release(group);
+    printf("Largest gap:           %u of %u free bytes\n", st.isf.largest_gap, st.isf.alloc - st.isf.used);
+
+    // Even FS: budgeted compaction, with a file open that must follow its data
+    for (int i=0; i<num_fs; i+=2) {
+        vlFILE* fp;
+        int     rc;
+
+        uid = sub_uid(i);
+        otfs_setfs(group, NULL, (ot_u8*)&uid);
+        fp = ISF_open_su(DEF_OPEN_FILE);
+        do {
+            double start = sub_now();
+            double call;
+            rc          = otfs_defrag(group, NULL, DEF_BUDGET);
+            call        = sub_now() - start;
+            call_total += call;
+            call_max    = (call > call_max) ? call : call_max;
+            calls++;
+        } while (rc == 1);
+        errors += (rc != 0);
+        errors += sub_data_check(fp, DEF_OPEN_FILE, DEF_FILE_BYTES);
+        vl_close(fp);
+
+        otfs_fsstats(group, NULL, &st);
+        errors += (st.isf.largest_gap != (st.isf.alloc - st.isf.used));
+        errors += sub_create(DEF_BIG_FILE, DEF_BIG_BYTES);
+    }
+
+    // Odd FS: vl_new() compacts the heap when it has no gap big enough
+    for (int i=1; i<num_fs; i+=2) {
+        double start;
+
+        uid = sub_uid(i);
+        otfs_setfs(group, NULL, (ot_u8*)&uid);
+        start       = sub_now();
+        errors     += sub_create(DEF_BIG_FILE, DEF_BIG_BYTES);
+        new_total  += sub_now() - start;
+    }
+
+    // Fragment again, and compact each FS in one call
+    for (int i=0; i<num_fs; i++) {
+        double start;
+
+        uid = sub_uid(i);
+        otfs_setfs(group, NULL, (ot_u8*)&uid);
+        for (int id=1; id<DEF_FILES; id+=4) {
+            errors += (vl_delete(VL_ISF_BLOCKID, (ot_u8)id, NULL) != 0);
+        }
+        start       = sub_now();
+        errors     += (otfs_defrag(group, NULL, 0) != 0);
+        full_total += sub_now() - start;
+
+        for (int id=0; id<DEF_FILES; id++) {
+            if (((id & 1) != 0) && ((id & 3) != 1)) {
+                errors += sub_file_check((ot_u8)id, DEF_FILE_BYTES);
+            }
+        }
+        errors += sub_file_check(DEF_BIG_FILE, DEF_BIG_BYTES);
+    }
+    otfs_release(group);
+
+    // A file that is open and written has a length of 0 in its header until
+    // it is closed, and all of its data must still move
+    {   vlFILE* fp;
+        uint8_t data[DEF_FILE_BYTES];
+        ot_u8   id = DEF_BIG_FILE + 1;
+
+        uid = sub_uid(0);
+        otfs_setfs(group, NULL, (ot_u8*)&uid);
+        errors += (vl_new(&fp, VL_ISF_BLOCKID, id, b00110110, DEF_FILE_BYTES, NULL) != 0);
+        for (ot_uint i=0; i<DEF_FILE_BYTES; i++) {
+            data[i] = (uint8_t)(id ^ i);
+        }
+        errors += (vl_store(fp, DEF_FILE_BYTES, data) != 0);
+        errors += (vl_delete(VL_ISF_BLOCKID, 3, NULL) != 0);
+        errors += (vl_defrag(VL_ISF_BLOCKID, 0) != 0);
+        errors += sub_data_check(fp, id, DEF_FILE_BYTES);
+        vl_close(fp);
+        errors += sub_file_check(id, DEF_FILE_BYTES);
+        otfs_release(group);
+    }
+
+    printf("Budgeted calls:        %llu, %.2f us average, %.2f us max\n",
+            (unsigned long long)calls, 1e6 * call_total / calls, 1e6 * call_max);
+    printf("Full compaction:       %.2f us per FS\n", 1e6 * full_total / num_fs);
+    printf("vl_new() with compaction: %.2f us\n", 1e6 * new_total / (num_fs / 2));
+
+    // Bad inputs
+    errors += (otfs_defrag(NULL, NULL, 0) == 0);
+    errors += (vl_defrag(VL_ISS_BLOCKID, 0) != 255);
+
+    otfs_deinit(group, &free);
+
+    printf("\nErrors: %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+    return (errors != 0);
+}
@@ -0,0 +1,227 @@
+/* Copyright 2017 JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+/**
+  * @file       /test/multifs_fd.c
+  * @author     JP Norair (jpnorair@indigresso.com)
+  * @version    R100
+  * @date       17 October 2026
+  * @brief      Test of the open-file table
+  *
+  * Opens as many files as the open-file table takes on each FS of a group,
+  * and keeps them open while the other FS are used.  The number of files
+  * that open must be OT_PARAM_VLFPS, or OT_PARAM_VLFDMAX when libotfs is built
+  * with OT_FEATURE_VLFDTABLE.  vl_get_fd() and vl_get_fp() must map each file
+  * to its own descriptor, and the files must still read their data.  A file
+  * must not close while another FS is selected.  Then the files are closed in
+  * a random order and opened again, and the time of an open and close is
+  * measured with the table full.
+  *
+  ******************************************************************************
+  */
+
+
+#include <otfs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+
+// Default parameters
+#define DEF_NUM_FS          16
+#define DEF_FS_ALLOC        2048
+#define DEF_TEST_FILE       0x11
+#define DEF_OPENS           2000
+#define DEF_CYCLES          100000
+
+#if (OT_FEATURE(VLFDTABLE) == ENABLED)
+#   define DEF_MAXFILES     OT_PARAM(VLFDMAX)
+#else
+#   define DEF_MAXFILES     OT_PARAM(VLFPS)
+#endif
+
+
+static uint64_t sub_uid(uint64_t i) {
+    return i + 1;
+}
+
+
+static double sub_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+
+/// Opens the test file until the table is full, and checks the descriptors
+static int sub_open_all(vlFILE** files, uint8_t* used, int* count) {
+    int errors = 0;
+
+    memset(used, 0, DEF_OPENS);
+    for (*count=0; *count<DEF_OPENS; (*count)++) {
+        ot_int fd;
+
+        files[*count] = ISF_open_su(DEF_TEST_FILE);
+        if (files[*count] == NULL) {
+            break;
+        }
+        fd      = vl_get_fd(files[*count]);
+        errors += (fd < 0) || (fd >= DEF_OPENS) || (vl_get_fp(fd) != files[*count]);
+        if ((fd >= 0) && (fd < DEF_OPENS)) {
+            errors += (used[fd]++ != 0);
+        }
+    }
+    return errors;
+}
+
+
+/// A file checks if it reads the same data as the first file of the FS
+static int sub_read_check(vlFILE** files, int count) {
+    uint8_t data0[64];
+    uint8_t data[64];
+    ot_uint length;
+    int     errors = 0;
+
+    length = vl_load(files[0], sizeof(data0), data0);
+    for (int i=0; i<count; i+=1+(count/32)) {
+        errors += (vl_load(files[i], sizeof(data), data) != length);
+        errors += (memcmp(data, data0, length) != 0);
+    }
+    return errors;
+}
+
+
+
+int main(int argc, char** argv) {
+    void*       group;
+    otfs_t      fs;
+    vlFILE**    files;
+    uint8_t     used[DEF_OPENS];
+    uint64_t    uid;
+    int*        count;
+    int         num_fs;
+    int         errors = 0;
+    double      start;
+
+    num_fs = (argc > 1) ? atoi(argv[1]) : DEF_NUM_FS;
+    if ((num_fs <= 0) || (num_fs > DEF_NUM_FS)) {
+        num_fs = DEF_NUM_FS;
+    }
+
+    printf("MultiFS open-file table test\n");
+    printf("===============================================================================\n");
+    printf("Name of app in use with libotfs: %s\n", LIBOTFS_APP_NAME);
+    printf("Growable file table:             %s\n", (OT_FEATURE(VLFDTABLE) == ENABLED) ? "on" : "off");
+    printf("Filesystems:                     %d\n", num_fs);
+    printf("Most open files per FS:          %d\n\n", DEF_MAXFILES);
+
+    files = calloc((size_t)num_fs * DEF_OPENS, sizeof(vlFILE*));
+    count = calloc(num_fs, sizeof(int));
+    if ((files == NULL) || (count == NULL) || (otfs_init(&group) != 0)) {
+        fprintf(stderr, "%sError: could not init group (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+        return -1;
+    }
+    for (int i=0; i<num_fs; i++) {
+        fs.uid.u64 = sub_uid(i);
+        if ((otfs_load_defaults(group, &fs, DEF_FS_ALLOC) < 0) || (otfs_new(group, &fs) != 0)) {
+            fprintf(stderr, "%sError: could not add FS (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+            return -1;
+        }
+    }
+    otfs_release(group);
+
+    // Fill the table of each FS, while the files of the others stay open
+    start = sub_now();
+    for (int i=0; i<num_fs; i++) {
+        uid = sub_uid(i);
+        errors += (otfs_setfs(group, NULL, (ot_u8*)&uid) != 0);
+        errors += sub_open_all(&files[i * DEF_OPENS], used, &count[i]);
+        errors += (count[i] != ((DEF_MAXFILES < DEF_OPENS) ? DEF_MAXFILES : DEF_OPENS));
+    }
+    printf("Opened:                %d files per FS, %.1f ns/open\n", count[0],
+            1e9 * (sub_now() - start) / ((double)num_fs * count[0]));
+
+    // The files of each FS still read its data, and close in a random order
+    srand(1);
+    for (int i=0; i<num_fs; i++) {
+        vlFILE** f = &files[i * DEF_OPENS];
+
+        // A file is not closed while another FS is selected
+#       if (OT_FEATURE(VLFDTABLE) == ENABLED)
+        if (num_fs > 1) {
+            errors += (vl_close(f[0]) != 255);
+        }
+#       endif
+
+        uid = sub_uid(i);
+        otfs_setfs(group, NULL, (ot_u8*)&uid);
+        errors += sub_read_check(f, count[i]);
+        for (int n=count[i]-1; n>0; n--) {
+            int     j   = rand() % (n + 1);
+            vlFILE* fp  = f[j];
+            f[j]        = f[n];
+            f[n]        = fp;
+        }
+        for (int n=0; n<count[i]; n++) {
+            errors += (vl_close(f[n]) != 0);
+        }
+#       if (OT_FEATURE(VLFDTABLE) == ENABLED)
+        errors += (vl_get_fd(f[0]) >= 0);
+        errors += (vl_get_fp(-1) != NULL) || (vl_get_fp(DEF_MAXFILES) != NULL);
+#       endif
+    }
+
+    // All the descriptors are free again, and the table does not grow
+    for (int i=0; i<num_fs; i++) {
+        vlFILE** f = &files[i * DEF_OPENS];
+        int      n;
+
+        uid = sub_uid(i);
+        otfs_setfs(group, NULL, (ot_u8*)&uid);
+        errors += sub_open_all(f, used, &n);
+        errors += (n != count[i]);
+        errors += sub_read_check(f, n);
+
+        // Open and close with the table full, but for one descriptor
+        if (i == 0) {
+            errors += (vl_close(f[n/2]) != 0);
+            start = sub_now();
+            for (int c=0; c<DEF_CYCLES; c++) {
+                vlFILE* fp = ISF_open_su(DEF_TEST_FILE);
+                errors += (fp == NULL);
+                vl_close(fp);
+            }
+            printf("Open and close:        %.1f ns with %d files open\n",
+                    1e9 * (sub_now() - start) / DEF_CYCLES, n - 1);
+            f[n/2] = ISF_open_su(DEF_TEST_FILE);
+        }
+        for (int c=0; c<n; c++) {
+            vl_close(f[c]);
+        }
+    }
+    otfs_release(group);
+
+    otfs_deinit(group, &free);
+    free(files);
+    free(count);
+
+    printf("\nErrors: %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+    return (errors != 0);
+}
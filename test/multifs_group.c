@@ -0,0 +1,245 @@
+/* Copyright 2017 JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+/**
+  * @file       /test/multifs_group.c
+  * @author     JP Norair (jpnorair@indigresso.com)
+  * @version    R100
+  * @date       17 October 2026
+  * @brief      Test of parallel group load and save
+  *
+  * Provisions a group and writes the UID of each FS into its ISF 0x11.  The
+  * group is saved to a snapshot file and loaded into new groups with 1 to
+  * DEF_THREADS threads, and the rate of each is measured.  Every FS of the
+  * loaded groups must have its UID in ISF 0x11, and the default data
+  * elsewhere.  Then a small group is saved to and loaded from a directory,
+  * and bad inputs are checked.
+  *
+  ******************************************************************************
+  */
+
+
+#include <otfs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+
+// Default parameters
+#define DEF_NUM_FS          100000
+#define DEF_DIR_FS          1000
+#define DEF_THREADS         4
+#define DEF_FS_ALLOC        2048
+#define DEF_TEST_FILE       0x11
+#define DEF_CHECK_FILE      0x01
+
+
+static uint8_t def_check[8];
+
+
+static uint64_t sub_uid(uint64_t i) {
+    return i + 1;
+}
+
+
+static double sub_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+
+static int sub_rw(ot_u8 id, uint8_t* data, int write) {
+    vlFILE* fp;
+    fp = ISF_open_su(id);
+    if (fp == NULL) {
+        return -1;
+    }
+    if (write) {
+        vl_store(fp, 8, data);
+    }
+    else {
+        memset(data, 0, 8);
+        vl_load(fp, 8, data);
+    }
+    vl_close(fp);
+    return 0;
+}
+
+
+static int sub_provision(void** group, int num_fs) {
+    if (otfs_init(group) != 0) {
+        return -1;
+    }
+    for (int i=0; i<num_fs; i++) {
+        otfs_t fs;
+        uint64_t uid = sub_uid(i);
+
+        fs.uid.u64 = uid;
+        if ((otfs_load_defaults(*group, &fs, DEF_FS_ALLOC) < 0) || (otfs_new(*group, &fs) != 0)) {
+            return -1;
+        }
+        sub_rw(DEF_TEST_FILE, (uint8_t*)&uid, 1);
+    }
+    sub_rw(DEF_CHECK_FILE, def_check, 0);
+    otfs_release(*group);
+    return 0;
+}
+
+
+static int sub_verify(void* group, int num_fs) {
+    uint8_t data[8];
+    int errors = 0;
+
+    for (int i=0; i<num_fs; i++) {
+        uint64_t uid = sub_uid(i);
+        if (otfs_setfs(group, NULL, (ot_u8*)&uid) != 0) {
+            errors++;
+            continue;
+        }
+        errors += (sub_rw(DEF_TEST_FILE, data, 0) != 0) || (memcmp(data, &uid, 8) != 0);
+        errors += (sub_rw(DEF_CHECK_FILE, data, 0) != 0) || (memcmp(data, def_check, 8) != 0);
+    }
+    otfs_release(group);
+    return errors;
+}
+
+
+static void sub_rmdir(const char* dir) {
+    DIR* d;
+    struct dirent* de;
+    char path[256];
+
+    d = opendir(dir);
+    if (d != NULL) {
+        while ((de = readdir(d)) != NULL) {
+            if (de->d_name[0] != '.') {
+                snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+                unlink(path);
+            }
+        }
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+
+
+int main(int argc, char** argv) {
+    void*       group;
+    void*       loaded;
+    char        path[] = "/tmp/otfs_group_XXXXXX";
+    char        dir[] = "/tmp/otfs_groupdir_XXXXXX";
+    double      start, t_save1 = 0., t_load1 = 0.;
+    int         num_fs;
+    int         errors = 0;
+    int         fd;
+    int         rc;
+
+    num_fs = (argc > 1) ? atoi(argv[1]) : DEF_NUM_FS;
+    if (num_fs < (2*DEF_DIR_FS)) {
+        num_fs = DEF_NUM_FS;
+    }
+
+    printf("MultiFS parallel group load/save test\n");
+    printf("===============================================================================\n");
+    printf("Name of app in use with libotfs: %s\n", LIBOTFS_APP_NAME);
+    printf("Filesystems:                     %d\n\n", num_fs);
+
+    if (sub_provision(&group, num_fs) != 0) {
+        fprintf(stderr, "%sError: could not add FS (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+        return -1;
+    }
+    fd = mkstemp(path);
+    if ((fd < 0) || (mkdtemp(dir) == NULL)) {
+        fprintf(stderr, "%sError: could not make a temporary file%s\n", KRED, KNRM);
+        return -1;
+    }
+    close(fd);
+
+    printf("Threads   Save (FS/s)    Load (FS/s)    Speedup (save, load)\n");
+    for (int t=1; t<=DEF_THREADS; t*=2) {
+        double t_save, t_load;
+
+        start   = sub_now();
+        rc      = otfs_save_group(group, path, t);
+        t_save  = sub_now() - start;
+        if (rc != 0) {
+            fprintf(stderr, "%sError: otfs_save_group() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-3, KNRM);
+            errors++;
+            break;
+        }
+
+        if (otfs_init(&loaded) != 0) {
+            errors++;
+            break;
+        }
+        start   = sub_now();
+        rc      = otfs_load_group(loaded, path, t);
+        t_load  = sub_now() - start;
+        errors += (rc != num_fs);
+        errors += sub_verify(loaded, num_fs);
+        if (t == 1) {
+            t_save1 = t_save;
+            t_load1 = t_load;
+        }
+
+        printf("%-9d %-14.0f %-14.0f %.2f, %.2f\n", t, num_fs / t_save, num_fs / t_load,
+                t_save1 / t_save, t_load1 / t_load);
+
+        // Loading it again must fail, since the UIDs are in the group
+        if (t == 1) {
+            errors += (otfs_load_group(loaded, path, 2) != -2);
+        }
+        otfs_deinit(loaded, &free);
+    }
+
+    // A small group saved as a directory of image files, and loaded back
+    {   void* part;
+
+        errors += (sub_provision(&part, DEF_DIR_FS) != 0);
+        errors += (otfs_save_group(part, dir, DEF_THREADS) != 0);
+        otfs_deinit(part, &free);
+
+        errors += (otfs_init(&part) != 0);
+        rc = otfs_load_group(part, dir, DEF_THREADS);
+        errors += (rc != DEF_DIR_FS);
+        errors += sub_verify(part, DEF_DIR_FS);
+        otfs_deinit(part, &free);
+        printf("\nDirectory:             %d FS saved and loaded\n", rc);
+    }
+
+    // Bad inputs
+    errors += (otfs_load_group(group, "/nonexistent/otfs_group", 2) != -1);
+    errors += (otfs_save_group(group, path, 0) != -1);
+    errors += (truncate(path, 100) != 0);
+    errors += (otfs_init(&loaded) != 0);
+    errors += (otfs_load_group(loaded, path, 2) != -2);
+    otfs_deinit(loaded, &free);
+
+    unlink(path);
+    sub_rmdir(dir);
+    otfs_deinit(group, &free);
+
+    printf("\nErrors: %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+    return (errors != 0);
+}
@@ -0,0 +1,220 @@
+/* Copyright 2017 JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+/**
+  * @file       /test/multifs_index.c
+  * @author     JP Norair (jpnorair@indigresso.com)
+  * @version    R100
+  * @date       17 October 2026
+  * @brief      Test of file lookup by ID
+  *
+  * Provisions a group, and opens every ISF ID on each FS.  The IDs that open
+  * are checked against the headers in the image, and the rate of opens is
+  * measured.  Build with OT_FEATURE_VLIDINDEX enabled to use the file ID
+  * index, and without it to compare with the header scan.  With VLNEW, a
+  * file is also created and deleted, and the lookup must follow, and a stock
+  * file must not be deleted.
+  *
+  ******************************************************************************
+  */
+
+
+#include <otfs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+
+// Default parameters
+#define DEF_NUM_FS          1000
+#define DEF_FS_ALLOC        2048
+#define DEF_PASSES          100
+
+
+static uint64_t sub_uid(uint64_t i) {
+    return i + 1;
+}
+
+
+static double sub_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+
+/// Finds the ISF files from the headers in the image, without veelite
+static void sub_isf_map(const void* base, uint8_t* map) {
+    const vlFSHEADER*   fshdr = base;
+    const vl_header_t*  hdr;
+    vl_header_t         h;
+
+    memset(map, 0, 256);
+    hdr = (const vl_header_t*)((const uint8_t*)base + sizeof(vlFSHEADER))
+        + fshdr->gfb.files + fshdr->iss.files;
+    for (int i=0; i<fshdr->isf.files; i++) {
+        memcpy(&h, &hdr[i], sizeof(h));
+        if ((h.base != 0) && (h.base != 0xFFFF)) {
+            map[h.idmod & 0xFF] = 1;
+        }
+    }
+}
+
+
+static int sub_isf_check(const uint8_t* map) {
+    vlFILE* fp;
+    int     errors = 0;
+
+    for (int id=0; id<256; id++) {
+        fp = ISF_open_su((ot_u8)id);
+        errors += ((fp != NULL) != (map[id] != 0));
+        if (fp != NULL) {
+            vl_close(fp);
+        }
+    }
+    return errors;
+}
+
+
+
+int main(int argc, char** argv) {
+    void*       group;
+    otfs_t*     fs;
+    uint8_t     map[256];
+    uint64_t    uid;
+    uint64_t    opens = 0;
+    uint64_t    misses = 0;
+    double      start, elapsed;
+    int         num_fs;
+    int         files = 0;
+    int         errors = 0;
+
+    num_fs = (argc > 1) ? atoi(argv[1]) : DEF_NUM_FS;
+    if (num_fs <= 0) {
+        num_fs = DEF_NUM_FS;
+    }
+
+    printf("MultiFS file lookup test\n");
+    printf("===============================================================================\n");
+    printf("Name of app in use with libotfs: %s\n", LIBOTFS_APP_NAME);
+    printf("File ID index:                   %s\n", (OT_FEATURE(VLIDINDEX) == ENABLED) ? "on" : "off");
+    printf("Filesystems:                     %d\n\n", num_fs);
+
+    fs = calloc(num_fs, sizeof(otfs_t));
+    if ((fs == NULL) || (otfs_init(&group) != 0)) {
+        fprintf(stderr, "%sError: could not init group (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+        return -1;
+    }
+    for (int i=0; i<num_fs; i++) {
+        fs[i].uid.u64 = sub_uid(i);
+        if ((otfs_load_defaults(group, &fs[i], DEF_FS_ALLOC) < 0) || (otfs_new(group, &fs[i]) != 0)) {
+            fprintf(stderr, "%sError: could not add FS (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+            return -1;
+        }
+    }
+    otfs_release(group);
+
+    // Every ID of every FS: the files that open must be the ones in the image
+    sub_isf_map(fs[0].base, map);
+    for (int id=0; id<256; id++) {
+        files += map[id];
+    }
+    for (int i=0; i<num_fs; i++) {
+        uid = sub_uid(i);
+        errors += (otfs_setfs(group, NULL, (ot_u8*)&uid) != 0);
+        errors += sub_isf_check(map);
+    }
+    otfs_release(group);
+    printf("ISF files:             %d\n", files);
+    printf("Lookup errors:         %d\n", errors);
+
+    // Rate of opens of existing files, then of IDs that have no file
+    start = sub_now();
+    for (int i=0; i<num_fs; i++) {
+        uid = sub_uid(i);
+        otfs_setfs(group, NULL, (ot_u8*)&uid);
+        for (int n=0; n<DEF_PASSES; n++) {
+            for (int id=255; id>=0; id--) {
+                if (map[id] != 0) {
+                    vlFILE* fp = ISF_open_su((ot_u8)id);
+                    errors += (fp == NULL);
+                    vl_close(fp);
+                    opens++;
+                }
+            }
+        }
+    }
+    otfs_release(group);
+    elapsed = sub_now() - start;
+    printf("Opens:                 %llu in %.3f s, %.1f ns/open\n",
+            (unsigned long long)opens, elapsed, (opens != 0) ? (1e9 * elapsed / opens) : 0.);
+
+    start = sub_now();
+    for (int i=0; i<num_fs; i++) {
+        uid = sub_uid(i);
+        otfs_setfs(group, NULL, (ot_u8*)&uid);
+        for (int n=0; n<DEF_PASSES; n++) {
+            for (int id=255; id>=0; id--) {
+                if (map[id] == 0) {
+                    errors += (ISF_open_su((ot_u8)id) != NULL);
+                    misses++;
+                }
+            }
+        }
+    }
+    otfs_release(group);
+    elapsed = sub_now() - start;
+    printf("Misses:                %llu in %.3f s, %.1f ns/open\n",
+            (unsigned long long)misses, elapsed, (misses != 0) ? (1e9 * elapsed / misses) : 0.);
+
+#   if (OT_FEATURE(VLNEW) == ENABLED)
+    // The lookup follows file creation and deletion
+    {   vlFILE* fp;
+        ot_u8   id;
+        ot_u8   rc;
+
+        for (id=255; (id > 0) && (map[id] != 0); id--);
+        uid = sub_uid(0);
+        otfs_setfs(group, NULL, (ot_u8*)&uid);
+        rc = vl_new(&fp, VL_ISF_BLOCKID, id, b00110100, 8, NULL);
+        printf("vl_new(0x%02X):         %u\n", id, rc);
+        if (rc == 0) {
+            vl_close(fp);
+            map[id] = 1;
+            errors += sub_isf_check(map);
+            errors += (vl_delete(VL_ISF_BLOCKID, id, NULL) != 0);
+            map[id] = 0;
+            errors += sub_isf_check(map);
+        }
+
+        // Stock files of the default FS are kept from deletion
+        for (id=0; (id < 255) && (map[id] == 0); id++);
+        errors += (vl_delete(VL_ISF_BLOCKID, id, NULL) == 0);
+        errors += sub_isf_check(map);
+        otfs_release(group);
+    }
+#   endif
+
+    otfs_deinit(group, &free);
+    free(fs);
+
+    printf("\nErrors: %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+    return (errors != 0);
+}
@@ -0,0 +1,235 @@
+/* Copyright 2017 JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+/**
+  * @file       /test/multifs_io.c
+  * @author     JP Norair (jpnorair@indigresso.com)
+  * @version    R100
+  * @date       17 October 2026
+  * @brief      Microbenchmark of file data transfers
+  *
+  * Builds an image with ISF files of 16, 256 and 4096 bytes, and measures
+  * vl_store(), vl_load() and vl_append() of the whole of each file on a group
+  * of them.  The data is checked after each kind of transfer, including an
+  * append to a file of odd length.  Build with OT_FEATURE_VLBULK enabled to
+  * copy the data in one step, and without it to compare with the copy of 16
+  * bits at a time.
+  *
+  ******************************************************************************
+  */
+
+
+#include <otfs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+
+// Default parameters
+#define DEF_NUM_FS          16
+#define DEF_REPS            20000
+#define DEF_FILES           3
+#define DEF_HEAP            (16 + 256 + 4096)
+#define DEF_MAXFILE         4096
+
+static const ot_uint file_size[DEF_FILES] = { 16, 256, 4096 };
+
+
+static uint64_t sub_uid(uint64_t i) {
+    return i + 1;
+}
+
+
+static double sub_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+
+/// An image with no GFB or ISS, and one ISF file of each size
+static void* sub_image(size_t* alloc) {
+    vlFSHEADER  fshdr;
+    vl_header_t hdr;
+    uint8_t*    image;
+    size_t      ftab;
+    ot_u16      base;
+
+    ftab    = (sizeof(vlFSHEADER) + (DEF_FILES * sizeof(vl_header_t)) + 3) & ~3;
+    *alloc  = ftab + DEF_HEAP;
+    image   = calloc(1, *alloc);
+    if (image == NULL) {
+        return NULL;
+    }
+
+    memset(&fshdr, 0, sizeof(fshdr));
+    fshdr.ftab_alloc    = (ot_u16)ftab;
+    fshdr.isf.alloc     = DEF_HEAP;
+    fshdr.isf.used      = DEF_HEAP;
+    fshdr.isf.files     = DEF_FILES;
+    memcpy(image, &fshdr, sizeof(fshdr));
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.mirror  = NULL_vaddr;
+    base        = (ot_u16)ftab;
+    for (int i=0; i<DEF_FILES; i++) {
+        hdr.alloc   = file_size[i];
+        hdr.idmod   = (b00110110 << 8) | i;
+        hdr.base    = base;
+        base       += file_size[i];
+        memcpy(image + sizeof(vlFSHEADER) + (i * sizeof(vl_header_t)), &hdr, sizeof(hdr));
+    }
+    return image;
+}
+
+
+static int sub_data_check(vlFILE* fp, const uint8_t* data, ot_uint size) {
+    uint8_t check[DEF_MAXFILE];
+
+    memset(check, 0, sizeof(check));
+    if (vl_load(fp, size, check) != size) {
+        return 1;
+    }
+    return (vl_checklength(fp) != size) || (memcmp(check, data, size) != 0);
+}
+
+
+static void sub_report(const char* name, ot_uint size, double elapsed, uint64_t calls) {
+    printf("%-12s %6u B   %8.1f ns/call   %8.1f MB/s\n", name, size,
+            1e9 * elapsed / calls, ((double)size * calls) / (elapsed * 1e6));
+}
+
+
+
+int main(int argc, char** argv) {
+    void*       group;
+    otfs_t      fs;
+    size_t      alloc;
+    uint8_t     data[DEF_MAXFILE];
+    uint8_t     load[DEF_MAXFILE];
+    uint64_t    uid;
+    int         num_reps;
+    int         errors = 0;
+
+    num_reps = (argc > 1) ? atoi(argv[1]) : DEF_REPS;
+    if (num_reps <= 0) {
+        num_reps = DEF_REPS;
+    }
+
+    printf("MultiFS file data transfer test\n");
+    printf("===============================================================================\n");
+    printf("Name of app in use with libotfs: %s\n", LIBOTFS_APP_NAME);
+    printf("Bulk copy:                       %s\n", (OT_FEATURE(VLBULK) == ENABLED) ? "on" : "off");
+    printf("Filesystems:                     %d\n", DEF_NUM_FS);
+    printf("Transfers per size:              %d\n\n", num_reps);
+
+    if (otfs_init(&group) != 0) {
+        fprintf(stderr, "%sError: could not init group (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+        return -1;
+    }
+    for (int i=0; i<DEF_NUM_FS; i++) {
+        fs.uid.u64  = sub_uid(i);
+        fs.base     = sub_image(&alloc);
+        fs.alloc    = alloc;
+        if ((fs.base == NULL) || (otfs_new(group, &fs) != 0)) {
+            fprintf(stderr, "%sError: could not add FS (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+            return -1;
+        }
+    }
+    otfs_release(group);
+
+    for (int i=0; i<DEF_MAXFILE; i++) {
+        data[i] = (uint8_t)((i * 7) ^ (i >> 8));
+    }
+
+    for (int f=0; f<DEF_FILES; f++) {
+        ot_uint size    = file_size[f];
+        int     reps    = num_reps / DEF_NUM_FS;
+        double  t_store = 0.;
+        double  t_load  = 0.;
+        double  t_append= 0.;
+        double  start;
+
+        for (int i=0; i<DEF_NUM_FS; i++) {
+            vlFILE* fp;
+
+            uid = sub_uid(i);
+            errors += (otfs_setfs(group, NULL, (ot_u8*)&uid) != 0);
+            fp = ISF_open_su((ot_u8)f);
+            if (fp == NULL) {
+                errors++;
+                continue;
+            }
+
+            start = sub_now();
+            for (int n=0; n<reps; n++) {
+                errors += (vl_store(fp, size, data) != 0);
+            }
+            t_store += sub_now() - start;
+            errors  += sub_data_check(fp, data, size);
+
+            start = sub_now();
+            for (int n=0; n<reps; n++) {
+                errors += (vl_load(fp, size, load) != size);
+            }
+            t_load += sub_now() - start;
+            errors += (memcmp(load, data, size) != 0);
+
+            start = sub_now();
+            for (int n=0; n<reps; n++) {
+                fp->length = 0;
+                errors += (vl_append(fp, size, data) != 0);
+            }
+            t_append += sub_now() - start;
+            errors   += sub_data_check(fp, data, size);
+
+            // An append after a byte that is not on a 16 bit boundary
+            errors += (vl_store(fp, 1, data) != 0);
+            errors += (vl_append(fp, size-1, &data[1]) != 0);
+            errors += sub_data_check(fp, data, size);
+            errors += (vl_append(fp, 1, data) != 255);
+
+            vl_close(fp);
+        }
+        otfs_release(group);
+
+        reps *= DEF_NUM_FS;
+        sub_report("vl_store()", size, t_store, reps);
+        sub_report("vl_load()", size, t_load, reps);
+        sub_report("vl_append()", size, t_append, reps);
+    }
+
+    // The data is in the image after the files are closed
+    for (int i=0; i<DEF_NUM_FS; i++) {
+        uid = sub_uid(i);
+        otfs_setfs(group, NULL, (ot_u8*)&uid);
+        for (int f=0; f<DEF_FILES; f++) {
+            vlFILE* fp = ISF_open_su((ot_u8)f);
+            errors += (fp == NULL) || sub_data_check(fp, data, file_size[f]);
+            vl_close(fp);
+        }
+    }
+    otfs_release(group);
+
+    otfs_deinit(group, &free);
+
+    printf("\nErrors: %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+    return (errors != 0);
+}
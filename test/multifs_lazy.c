@@ -0,0 +1,283 @@
+/* Copyright 2017 JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+/**
+  * @file       /test/multifs_lazy.c
+  * @author     JP Norair (jpnorair@indigresso.com)
+  * @version    R100
+  * @date       17 October 2026
+  * @brief      Test of lazy FS images
+  *
+  * Registers a template with a new ISF 0x11, and onboards one group of
+  * filesystems from it with otfs_new_lazy() and one group of full images with
+  * otfs_load_template() and otfs_new(), comparing the time and resident
+  * memory of each.  Then ISF 0x11 is written on a fraction of the lazy
+  * filesystems, and every FS is checked:
+  * - Written FS read back their own data from ISF 0x11
+  * - Unwritten FS read the template data from ISF 0x11
+  * - All FS read the default data from a file that was not written
+  * - Only the written FS have a private image
+  *
+  * The library must be built with OT_FEATURE_VLCOW.
+  *
+  ******************************************************************************
+  */
+
+
+#include <otfs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+#define KYEL  "\x1B[33m"
+
+// Default parameters
+#define DEF_NUM_FS          50000
+#define DEF_WRITE_PERCENT   10
+#define DEF_FS_ALLOC        2048
+#define DEF_TEST_FILE       0x11
+#define DEF_CHECK_FILE      0x01
+
+
+static const uint8_t test_data[8] = { 0xDE, 0xC0, 0xDE, 0x01, 0x02, 0x03, 0x04, 0x05 };
+static size_t image_alloc;
+
+
+static uint64_t sub_uid(uint64_t i) {
+    return i + 1;
+}
+
+
+static double sub_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+
+/// Resident set size in MB, from /proc (0 if it is not available)
+static double sub_rss(void) {
+    FILE* f;
+    long pages = 0;
+
+    f = fopen("/proc/self/statm", "r");
+    if (f != NULL) {
+        if (fscanf(f, "%*ld %ld", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(f);
+    }
+    return ((double)pages * (double)sysconf(_SC_PAGESIZE)) / (1024. * 1024.);
+}
+
+
+static int sub_read(ot_u8 id, uint8_t* data) {
+    vlFILE* fp;
+    fp = ISF_open_su(id);
+    if (fp == NULL) {
+        return -1;
+    }
+    memset(data, 0, 8);
+    vl_load(fp, 8, data);
+    vl_close(fp);
+    return 0;
+}
+
+
+/// Makes a group with a template that has test_data in ISF 0x11
+static int sub_init(void** group) {
+    otfs_t  fs;
+    vlFILE* fp;
+    ot_u8   id;
+    ot_u8   rc;
+
+    if (otfs_init(group) != 0) {
+        return -1;
+    }
+    fs.uid.u64 = ~0ULL;
+    if ((otfs_load_defaults(*group, &fs, DEF_FS_ALLOC) < 0) || (otfs_new(*group, &fs) != 0)) {
+        return -1;
+    }
+    fp = ISF_open_su(DEF_TEST_FILE);
+    if (fp == NULL) {
+        return -1;
+    }
+    vl_store(fp, 8, (ot_u8*)test_data);
+    vl_close(fp);
+
+    image_alloc = fs.alloc;
+    rc = vl_multifs_template_add(*group, fs.base, fs.alloc, &id);
+    otfs_del(*group, &fs, &free);
+    return (rc == 0) ? (int)id : -1;
+}
+
+
+static int sub_onboard(void** group, int num_fs, int lazy) {
+    double  rss0, start, mb;
+    int     tmpl;
+
+    rss0 = sub_rss();
+    tmpl = sub_init(group);
+    if (tmpl <= 0) {
+        return -1;
+    }
+
+    start = sub_now();
+    for (int i=0; i<num_fs; i++) {
+        otfs_t fs;
+        fs.uid.u64 = sub_uid(i);
+        if (lazy) {
+            if (otfs_new_lazy(*group, &fs, tmpl) != 0) {
+                return -1;
+            }
+        }
+        else {
+            if (otfs_load_template(*group, &fs, tmpl, DEF_FS_ALLOC) < 0) {
+                return -1;
+            }
+            if (otfs_new(*group, &fs) != 0) {
+                otfs_free_image(*group, &fs);
+                return -1;
+            }
+        }
+    }
+
+    mb = sub_rss() - rss0;
+    printf("%-14s %-10.3f %-10.1f %.0f\n", lazy ? "otfs_new_lazy" : "otfs_new",
+            sub_now() - start, mb, (mb * 1024. * 1024.) / (double)num_fs);
+    return 0;
+}
+
+
+
+int main(int argc, char** argv) {
+    void*           full;
+    void*           group;
+    otfs_t          fs;
+    otfs_stats_t    stats;
+    uint8_t         def_check[8];
+    uint8_t         data[8];
+    uint64_t        first;
+    size_t          written = 0;
+    int             num_fs;
+    int             errors = 0;
+
+    num_fs = (argc > 1) ? atoi(argv[1]) : DEF_NUM_FS;
+    if (num_fs < 100) {
+        num_fs = DEF_NUM_FS;
+    }
+
+    printf("MultiFS lazy image test\n");
+    printf("===============================================================================\n");
+    printf("Name of app in use with libotfs: %s\n", LIBOTFS_APP_NAME);
+    printf("Filesystems:                     %d\n", num_fs);
+    printf("Filesystems written:             %d%%\n\n", DEF_WRITE_PERCENT);
+
+#   if (OT_FEATURE(VLCOW) != ENABLED)
+    printf("%sNote: libotfs built without OT_FEATURE_VLCOW, nothing to test%s\n", KYEL, KNRM);
+    return 0;
+#   endif
+
+    printf("Images         Time (s)   RSS (MB)   Bytes/FS\n");
+    if (sub_onboard(&group, num_fs, 1) != 0) {
+        fprintf(stderr, "%sError: could not add lazy FS (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+        return -1;
+    }
+    if (sub_onboard(&full, num_fs, 0) != 0) {
+        fprintf(stderr, "%sError: could not add full FS (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+        return -1;
+    }
+
+    // Default data, from a full image
+    first = sub_uid(0);
+    errors += (otfs_setfs(full, NULL, (ot_u8*)&first) != 0);
+    errors += (sub_read(DEF_CHECK_FILE, def_check) != 0);
+    otfs_release(full);
+    otfs_deinit(full, &free);
+
+    // Bad template IDs
+    fs.uid.u64 = sub_uid(num_fs);
+    errors += (otfs_new_lazy(group, &fs, 2) != -1);
+    errors += (otfs_new_lazy(group, &fs, -1) != -1);
+
+    // Write ISF 0x11 of a fraction of the filesystems, with their UID
+    for (int i=0; i<num_fs; i++) {
+        uint64_t uid = sub_uid(i);
+        vlFILE*  fp;
+
+        if ((i % 100) >= DEF_WRITE_PERCENT) {
+            continue;
+        }
+        if (otfs_setfs(group, NULL, (ot_u8*)&uid) != 0) {
+            errors++;
+            continue;
+        }
+        fp = ISF_open_su(DEF_TEST_FILE);
+        if (fp == NULL) {
+            errors++;
+            continue;
+        }
+        errors += (vl_store(fp, 8, (ot_u8*)&uid) != 0);
+        vl_close(fp);
+        written++;
+    }
+
+    // Check every filesystem
+    for (int i=0; i<num_fs; i++) {
+        uint64_t uid = sub_uid(i);
+
+        if (otfs_setfs(group, NULL, (ot_u8*)&uid) != 0) {
+            errors++;
+            continue;
+        }
+        if (sub_read(DEF_TEST_FILE, data) != 0) {
+            errors++;
+        }
+        else if ((i % 100) < DEF_WRITE_PERCENT) {
+            errors += (memcmp(data, &uid, 8) != 0);
+        }
+        else {
+            errors += (memcmp(data, test_data, 8) != 0);
+        }
+        if (sub_read(DEF_CHECK_FILE, data) != 0) {
+            errors++;
+        }
+        else {
+            errors += (memcmp(data, def_check, 8) != 0);
+        }
+    }
+
+    // Only the written FS have a private image
+    if (otfs_stats(group, &stats) == 0) {
+        size_t images = written * image_alloc;
+        errors += (stats.cow_fs != (size_t)num_fs);
+        errors += (stats.cow_bytes < images);
+        errors += (stats.cow_bytes > (images + ((size_t)num_fs * 256)));
+        printf("\nLazy private memory:   %.1f MB, %zu of %d FS written\n",
+                (double)stats.cow_bytes / (1024. * 1024.), written, num_fs);
+    }
+
+    otfs_release(group);
+    otfs_deinit(group, &free);
+
+    printf("\nErrors: %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+    return (errors != 0);
+}
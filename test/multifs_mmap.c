@@ -0,0 +1,284 @@
+/* Copyright 2017 JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+/**
+  * @file       /test/multifs_mmap.c
+  * @author     JP Norair (jpnorair@indigresso.com)
+  * @version    R100
+  * @date       17 October 2026
+  * @brief      Test of file-backed FS images
+  *
+  * Makes a group of FS whose images are files, writes the UID of each FS into
+  * its ISF 0x11 and syncs it, and measures the rate of each.  The group is
+  * freed, and the files are opened again in a new group, as after a restart:
+  * - Every FS must have its UID in ISF 0x11, and the default data elsewhere.
+  * - The image in the file must be the same as the image of the FS.
+  * Then a snapshot file is attached, written and synced, and the write must
+  * be in the file when it is opened again.  Bad inputs are checked.
+  *
+  * The library must be built with OT_FEATURE_VLMMAP.
+  *
+  ******************************************************************************
+  */
+
+
+#include <otfs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+#define KYEL  "\x1B[33m"
+
+// Default parameters
+#define DEF_NUM_FS          2000
+#define DEF_SNAP_FS         100
+#define DEF_TEST_FILE       0x11
+#define DEF_CHECK_FILE      0x01
+
+
+static uint8_t def_check[8];
+
+
+static uint64_t sub_uid(uint64_t i) {
+    return i + 1;
+}
+
+
+static double sub_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+
+static int sub_rw(ot_u8 id, uint8_t* data, int write) {
+    vlFILE* fp;
+    fp = ISF_open_su(id);
+    if (fp == NULL) {
+        return -1;
+    }
+    if (write) {
+        vl_store(fp, 8, data);
+    }
+    else {
+        memset(data, 0, 8);
+        vl_load(fp, 8, data);
+    }
+    vl_close(fp);
+    return 0;
+}
+
+
+static void sub_path(char* path, size_t max, const char* dir, int i) {
+    snprintf(path, max, "%s/fs%d.img", dir, i);
+}
+
+
+/// Compares the image of the selected FS with its file
+static int sub_cmp_file(const char* path, const otfs_t* fs) {
+    FILE*       f;
+    uint8_t*    image;
+    int         rc = -1;
+
+    image   = malloc(fs->alloc);
+    f       = fopen(path, "rb");
+    if ((image != NULL) && (f != NULL) && (fread(image, 1, fs->alloc, f) == fs->alloc)) {
+        rc = memcmp(image, fs->base, fs->alloc);
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+    free(image);
+    return (rc != 0);
+}
+
+
+static void sub_rmdir(const char* dir) {
+    DIR* d;
+    struct dirent* de;
+    char path[256];
+
+    d = opendir(dir);
+    if (d != NULL) {
+        while ((de = readdir(d)) != NULL) {
+            if (de->d_name[0] != '.') {
+                snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+                unlink(path);
+            }
+        }
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+
+
+int main(int argc, char** argv) {
+    void*       group;
+    otfs_t      fs;
+    char        dir[] = "/tmp/otfs_mmap_XXXXXX";
+    char        path[256];
+    uint8_t     data[8];
+    uint64_t    uid;
+    double      start, t_new, t_sync, t_open;
+    int         num_fs;
+    int         errors = 0;
+    int         rc;
+
+    num_fs = (argc > 1) ? atoi(argv[1]) : DEF_NUM_FS;
+    if (num_fs < DEF_SNAP_FS) {
+        num_fs = DEF_NUM_FS;
+    }
+
+    printf("MultiFS file-backed image test\n");
+    printf("===============================================================================\n");
+    printf("Name of app in use with libotfs: %s\n", LIBOTFS_APP_NAME);
+    printf("Filesystems:                     %d\n\n", num_fs);
+
+#   if (OT_FEATURE(VLMMAP) != ENABLED)
+    printf("%sNote: libotfs built without OT_FEATURE_VLMMAP, nothing to test%s\n", KYEL, KNRM);
+    return 0;
+#   endif
+
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "%sError: could not make a temporary directory%s\n", KRED, KNRM);
+        return -1;
+    }
+
+    // A group of file-backed FS
+    errors += (otfs_init(&group) != 0);
+    t_new   = 0.;
+    t_sync  = 0.;
+    for (int i=0; i<num_fs; i++) {
+        uid         = sub_uid(i);
+        fs.uid.u64  = uid;
+        sub_path(path, sizeof(path), dir, i);
+
+        start   = sub_now();
+        rc      = otfs_new_file(group, &fs, 0, path);
+        t_new  += sub_now() - start;
+        if (rc != 0) {
+            fprintf(stderr, "%sError: otfs_new_file() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-3, KNRM);
+            sub_rmdir(dir);
+            return -1;
+        }
+        errors += (sub_rw(DEF_TEST_FILE, (uint8_t*)&uid, 1) != 0);
+
+        start   = sub_now();
+        errors += (otfs_sync(group) != 0);
+        t_sync += sub_now() - start;
+    }
+    errors += (sub_rw(DEF_CHECK_FILE, def_check, 0) != 0);
+
+    // The UID is already in the group, and bad files
+    fs.uid.u64 = sub_uid(0);
+    errors += (otfs_new_file(group, &fs, 0, path) != -2);
+    fs.uid.u64 = sub_uid(num_fs);
+    errors += (otfs_new_file(group, &fs, 0, "/nonexistent/otfs_mmap.img") != -1);
+    snprintf(path, sizeof(path), "%s/short.img", dir);
+    {   FILE* f = fopen(path, "wb");
+        errors += (f == NULL);
+        if (f != NULL) {
+            fwrite(def_check, 1, sizeof(def_check), f);
+            fclose(f);
+        }
+    }
+    errors += (otfs_new_file(group, &fs, 0, path) != -2);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/none.img", dir);
+    errors += (otfs_new_file(group, &fs, 255, path) != -1);
+    unlink(path);
+
+    otfs_release(group);
+    otfs_deinit(group, &free);
+
+    // The same files in a new group, as after a restart
+    errors += (otfs_init(&group) != 0);
+    start = sub_now();
+    for (int i=0; i<num_fs; i++) {
+        fs.uid.u64 = sub_uid(i);
+        sub_path(path, sizeof(path), dir, i);
+        errors += (otfs_new_file(group, &fs, 0, path) != 0);
+    }
+    t_open = sub_now() - start;
+    for (int i=0; i<num_fs; i++) {
+        uid = sub_uid(i);
+        if (otfs_setfs(group, &fs, (ot_u8*)&uid) != 0) {
+            errors++;
+            continue;
+        }
+        errors += (sub_rw(DEF_TEST_FILE, data, 0) != 0) || (memcmp(data, &uid, 8) != 0);
+        errors += (sub_rw(DEF_CHECK_FILE, data, 0) != 0) || (memcmp(data, def_check, 8) != 0);
+        if ((i % 97) == 0) {
+            sub_path(path, sizeof(path), dir, i);
+            errors += sub_cmp_file(path, &fs);
+        }
+    }
+    otfs_release(group);
+    otfs_deinit(group, &free);
+
+    printf("Method                 FS/s\n");
+    printf("%-22s %.0f\n", "otfs_new_file (new)", num_fs / t_new);
+    printf("%-22s %.0f\n", "otfs_new_file (open)", num_fs / t_open);
+    printf("%-22s %.0f\n\n", "write + otfs_sync", num_fs / t_sync);
+
+    // An attached snapshot keeps its writes
+    {   void* snap;
+
+        snprintf(path, sizeof(path), "%s/group.snap", dir);
+        errors += (otfs_init(&group) != 0);
+        for (int i=0; i<DEF_SNAP_FS; i++) {
+            fs.uid.u64 = sub_uid(i);
+            errors += (otfs_load_defaults(group, &fs, 4096) < 0) || (otfs_new(group, &fs) != 0);
+        }
+        otfs_release(group);
+        errors += (otfs_snapshot_save(group, path) != 0);
+        otfs_deinit(group, &free);
+
+        uid = sub_uid(DEF_SNAP_FS / 2);
+        memset(data, 0xA5, 8);
+        rc = otfs_snapshot_attach(&snap, path);
+        errors += (rc != 0);
+        if (rc == 0) {
+            errors += (otfs_setfs(snap, NULL, (ot_u8*)&uid) != 0);
+            errors += (sub_rw(DEF_TEST_FILE, data, 1) != 0);
+            errors += (otfs_sync(snap) != 0);
+            otfs_release(snap);
+            otfs_deinit(snap, &free);
+        }
+        rc = otfs_snapshot_open(&snap, path);
+        errors += (rc != 0);
+        if (rc == 0) {
+            errors += (otfs_setfs(snap, NULL, (ot_u8*)&uid) != 0);
+            errors += (sub_rw(DEF_TEST_FILE, data, 0) != 0) || (data[0] != 0xA5) || (data[7] != 0xA5);
+            otfs_release(snap);
+            otfs_deinit(snap, &free);
+        }
+        errors += (otfs_snapshot_attach(&snap, "/nonexistent/otfs_snapshot") != -1);
+        printf("Attached snapshot:     %d FS, write kept\n", DEF_SNAP_FS);
+    }
+
+    sub_rmdir(dir);
+
+    printf("\nErrors: %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+    return (errors != 0);
+}
@@ -0,0 +1,187 @@
+/* Copyright 2017 JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+/**
+  * @file       /test/multifs_mt.c
+  * @author     JP Norair (jpnorair@indigresso.com)
+  * @version    R101
+  * @date       17 October 2026
+  * @brief      Multithreaded throughput test for MultiFS
+  *
+  * Each thread owns a disjoint set of filesystems.  It checks them out in
+  * turn, writes its own UID into ISF 0x11, and reads it back.  The test is
+  * run with 1, 2, 4 ... N threads, so the scaling can be seen directly.  Any
+  * read-back that doesn't match is an isolation error between threads.
+  *
+  * The library must be built with OT_FEATURE_VLTHREADS for more than one
+  * thread to be used.
+  *
+  ******************************************************************************
+  */
+
+
+#include <otfs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+#define KYEL  "\x1B[33m"
+
+// Default parameters
+#define DEF_MAX_THREADS     8
+#define DEF_FS_PER_THREAD   64
+#define DEF_OPS_PER_THREAD  200000
+#define DEF_FS_ALLOC        2048
+#define DEF_TEST_FILE       0x11
+
+
+typedef struct {
+    void*       group;
+    int         index;
+    int         ops;
+    int         errors;
+} worker_t;
+
+
+
+static uint64_t sub_uid(int thread, int fs) {
+    return ((uint64_t)(thread+1) << 32) | (uint64_t)(fs+1);
+}
+
+
+static double sub_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+
+static void* sub_worker(void* arg) {
+    worker_t* w = arg;
+    int i;
+
+    for (i=0; i<w->ops; i++) {
+        uint64_t uid = sub_uid(w->index, i % DEF_FS_PER_THREAD);
+        uint64_t check;
+        vlFILE*  fp;
+
+        if (otfs_setfs(w->group, NULL, (ot_u8*)&uid) != 0) {
+            w->errors++;
+            continue;
+        }
+
+        fp = ISF_open_su(DEF_TEST_FILE);
+        if (fp == NULL) {
+            w->errors++;
+            continue;
+        }
+        vl_store(fp, 8, (ot_u8*)&uid);
+        check = 0;
+        vl_load(fp, 8, (ot_u8*)&check);
+        vl_close(fp);
+
+        w->errors += (check != uid);
+    }
+
+    return NULL;
+}
+
+
+
+int main(int argc, char** argv) {
+    void*       group;
+    pthread_t   threads[DEF_MAX_THREADS];
+    worker_t    workers[DEF_MAX_THREADS];
+    int         max_threads;
+    int         rc;
+    double      base_rate = 0.;
+
+    max_threads = (argc > 1) ? atoi(argv[1]) : DEF_MAX_THREADS;
+    if ((max_threads < 1) || (max_threads > DEF_MAX_THREADS)) {
+        max_threads = DEF_MAX_THREADS;
+    }
+#   if (OT_FEATURE(VLTHREADS) != ENABLED)
+    printf("%sNote: libotfs built without OT_FEATURE_VLTHREADS, using 1 thread%s\n", KYEL, KNRM);
+    max_threads = 1;
+#   endif
+
+    printf("MultiFS multithreaded throughput test\n");
+    printf("===============================================================================\n");
+    printf("Name of app in use with libotfs: %s\n", LIBOTFS_APP_NAME);
+    printf("Filesystems per thread:          %d\n", DEF_FS_PER_THREAD);
+    printf("Operations per thread:           %d\n\n", DEF_OPS_PER_THREAD);
+
+    rc = otfs_init(&group);
+    if (rc != 0) {
+        fprintf(stderr, "%sError: otfs_init() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-2, KNRM);
+        return -1;
+    }
+
+    // Every thread gets its own set of filesystems
+    for (int t=0; t<max_threads; t++) {
+        for (int i=0; i<DEF_FS_PER_THREAD; i++) {
+            otfs_t fs;
+            fs.uid.u64 = sub_uid(t, i);
+            rc = otfs_load_defaults(group, &fs, DEF_FS_ALLOC);
+            if (rc < 0) {
+                fprintf(stderr, "%sError: otfs_load_defaults() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-2, KNRM);
+                return -1;
+            }
+            rc = otfs_new(group, &fs);
+            if (rc != 0) {
+                fprintf(stderr, "%sError: otfs_new() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-2, KNRM);
+                return -1;
+            }
+        }
+    }
+
+    printf("Threads   Ops/s          Speedup   Errors\n");
+    for (int n=1; n<=max_threads; n*=2) {
+        double start, elapsed, rate;
+        int errors = 0;
+
+        start = sub_now();
+        for (int t=0; t<n; t++) {
+            workers[t].group    = group;
+            workers[t].index    = t;
+            workers[t].ops      = DEF_OPS_PER_THREAD;
+            workers[t].errors   = 0;
+            pthread_create(&threads[t], NULL, &sub_worker, &workers[t]);
+        }
+        for (int t=0; t<n; t++) {
+            pthread_join(threads[t], NULL);
+            errors += workers[t].errors;
+        }
+        elapsed = sub_now() - start;
+
+        rate = ((double)n * DEF_OPS_PER_THREAD) / elapsed;
+        if (n == 1) {
+            base_rate = rate;
+        }
+        printf("%-9d %-14.0f %-9.2f %s%d%s\n", n, rate, rate/base_rate,
+                (errors != 0) ? KRED : KGRN, errors, KNRM);
+    }
+
+    otfs_deinit(group, &free);
+    printf("\nFS group deallocated\n");
+
+    return 0;
+}
@@ -0,0 +1,278 @@
+/* Copyright 2017 JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+/**
+  * @file       /test/multifs_paged.c
+  * @author     JP Norair (jpnorair@indigresso.com)
+  * @version    R100
+  * @date       17 October 2026
+  * @brief      Test of paged FS images
+  *
+  * Provisions a group, saves it to a snapshot file, and opens the snapshot as
+  * a group of paged images, whose memory is bounded by the page cache.  Then:
+  * - A new value is written into ISF 0x11 of every FS, and read back, which
+  *   pages the whole group through the cache.  The resident memory and the
+  *   cache counters are reported.
+  * - A small set of FS is used over and over, which must hit in the cache.
+  * - The group is freed, which writes back the dirty blocks, and every FS of
+  *   the snapshot must have its new value.
+  * - A paged FS made with otfs_new_paged() keeps its writes over a restart.
+  *
+  * The library must be built with OT_FEATURE_VLPAGED and OT_FEATURE_VLCOW.
+  *
+  ******************************************************************************
+  */
+
+
+#include <otfs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+#define KYEL  "\x1B[33m"
+
+// Default parameters
+#define DEF_NUM_FS          20000
+#define DEF_HOT_FS          16
+#define DEF_HOT_OPS         100000
+#define DEF_FS_ALLOC        2048
+#define DEF_TEST_FILE       0x11
+#define DEF_CHECK_FILE      0x01
+#define DEF_MASK            0x5A5A000000000000ULL
+
+
+static uint8_t def_check[8];
+
+
+static uint64_t sub_uid(uint64_t i) {
+    return i + 1;
+}
+
+
+static double sub_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+
+/// Resident set size in MB, from /proc (0 if it is not available)
+static double sub_rss(void) {
+    FILE* f;
+    long pages = 0;
+
+    f = fopen("/proc/self/statm", "r");
+    if (f != NULL) {
+        if (fscanf(f, "%*ld %ld", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(f);
+    }
+    return ((double)pages * (double)sysconf(_SC_PAGESIZE)) / (1024. * 1024.);
+}
+
+
+static int sub_rw(ot_u8 id, uint8_t* data, int write) {
+    vlFILE* fp;
+    fp = ISF_open_su(id);
+    if (fp == NULL) {
+        return -1;
+    }
+    if (write) {
+        vl_store(fp, 8, data);
+    }
+    else {
+        memset(data, 0, 8);
+        vl_load(fp, 8, data);
+    }
+    vl_close(fp);
+    return 0;
+}
+
+
+/// Every FS must have value in ISF 0x11, and the default data elsewhere
+static int sub_verify(void* group, int num_fs, uint64_t mask) {
+    uint8_t data[8];
+    int errors = 0;
+
+    for (int i=0; i<num_fs; i++) {
+        uint64_t uid = sub_uid(i);
+        uint64_t value = uid ^ mask;
+        if (otfs_setfs(group, NULL, (ot_u8*)&uid) != 0) {
+            errors++;
+            continue;
+        }
+        errors += (sub_rw(DEF_TEST_FILE, data, 0) != 0) || (memcmp(data, &value, 8) != 0);
+        errors += (sub_rw(DEF_CHECK_FILE, data, 0) != 0) || (memcmp(data, def_check, 8) != 0);
+    }
+    otfs_release(group);
+    return errors;
+}
+
+
+/// Prints the cache counters of the accesses between s0 and s1
+static void sub_print_stats(const char* name, const otfs_stats_t* s0, const otfs_stats_t* s1) {
+    uint64_t hits   = s1->page_hits - s0->page_hits;
+    uint64_t misses = s1->page_misses - s0->page_misses;
+
+    printf("%-14s %-12llu %-12llu %-12llu %.4f\n", name,
+            (unsigned long long)hits, (unsigned long long)misses,
+            (unsigned long long)(s1->page_writebacks - s0->page_writebacks),
+            ((hits + misses) != 0) ? (double)hits / (double)(hits + misses) : 0.);
+}
+
+
+
+int main(int argc, char** argv) {
+    void*           group;
+    void*           paged;
+    otfs_t          fs;
+    otfs_stats_t    s0, s1;
+    char            path[] = "/tmp/otfs_paged_XXXXXX";
+    char            image[64];
+    uint8_t         data[8];
+    uint64_t        uid;
+    double          rss0, start;
+    int             num_fs;
+    int             errors = 0;
+    int             fd;
+    int             rc;
+
+    num_fs = (argc > 1) ? atoi(argv[1]) : DEF_NUM_FS;
+    if (num_fs < (4*DEF_HOT_FS)) {
+        num_fs = DEF_NUM_FS;
+    }
+
+    printf("MultiFS paged image test\n");
+    printf("===============================================================================\n");
+    printf("Name of app in use with libotfs: %s\n", LIBOTFS_APP_NAME);
+    printf("Filesystems:                     %d\n\n", num_fs);
+
+#   if ((OT_FEATURE(VLPAGED) != ENABLED) || (OT_FEATURE(VLCOW) != ENABLED))
+    printf("%sNote: libotfs built without OT_FEATURE_VLPAGED, nothing to test%s\n", KYEL, KNRM);
+    return 0;
+#   endif
+
+    // A group saved to a snapshot, and freed
+    errors += (otfs_init(&group) != 0);
+    for (int i=0; i<num_fs; i++) {
+        fs.uid.u64 = sub_uid(i);
+        if ((otfs_load_defaults(group, &fs, DEF_FS_ALLOC) < 0) || (otfs_new(group, &fs) != 0)) {
+            fprintf(stderr, "%sError: could not add FS (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+            return -1;
+        }
+    }
+    errors += (sub_rw(DEF_CHECK_FILE, def_check, 0) != 0);
+    otfs_release(group);
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "%sError: could not make a temporary file%s\n", KRED, KNRM);
+        return -1;
+    }
+    close(fd);
+    errors += (otfs_snapshot_save(group, path) != 0);
+    otfs_deinit(group, &free);
+
+    // The snapshot as paged images
+    rss0    = sub_rss();
+    start   = sub_now();
+    rc      = otfs_snapshot_page(&paged, path);
+    if (rc != 0) {
+        fprintf(stderr, "%sError: otfs_snapshot_page() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-2, KNRM);
+        unlink(path);
+        return -1;
+    }
+    printf("Opened:                %.3f s\n", sub_now() - start);
+
+    otfs_stats(paged, &s0);
+    start = sub_now();
+    for (int i=0; i<num_fs; i++) {
+        uint64_t value;
+        uid     = sub_uid(i);
+        value   = uid ^ DEF_MASK;
+        if (otfs_setfs(paged, NULL, (ot_u8*)&uid) != 0) {
+            errors++;
+            continue;
+        }
+        errors += (sub_rw(DEF_TEST_FILE, (uint8_t*)&value, 1) != 0);
+        errors += (sub_rw(DEF_TEST_FILE, data, 0) != 0) || (memcmp(data, &value, 8) != 0);
+    }
+    otfs_release(paged);
+    printf("Written:               %.0f FS/s\n", num_fs / (sub_now() - start));
+    otfs_stats(paged, &s1);
+    printf("RSS:                   %.1f MB (page cache %.1f MB)\n\n", sub_rss() - rss0,
+            (double)s1.page_bytes / (1024. * 1024.));
+    errors += (s1.page_misses <= s0.page_misses);
+    errors += (s1.page_writebacks <= s0.page_writebacks);
+
+    printf("Access         Hits         Misses       Writebacks   Hit rate\n");
+    sub_print_stats("whole group", &s0, &s1);
+
+    // A small hot set hits in the cache
+    otfs_stats(paged, &s0);
+    for (int n=0; n<DEF_HOT_OPS; n++) {
+        uid = sub_uid((uint64_t)(n % DEF_HOT_FS) * (num_fs / DEF_HOT_FS));
+        if ((otfs_setfs(paged, NULL, (ot_u8*)&uid) != 0) || (sub_rw(DEF_TEST_FILE, data, 0) != 0)) {
+            errors++;
+        }
+    }
+    otfs_release(paged);
+    otfs_stats(paged, &s1);
+    sub_print_stats("hot set", &s0, &s1);
+    errors += ((s1.page_misses - s0.page_misses) > (2 * DEF_HOT_FS * (DEF_FS_ALLOC / 256)));
+
+    // The writes are in the file after the group is freed
+    otfs_deinit(paged, &free);
+    errors += (otfs_snapshot_open(&group, path) != 0);
+    errors += sub_verify(group, num_fs, DEF_MASK);
+    otfs_deinit(group, &free);
+
+    // A paged FS from a new file, and again after a restart
+    snprintf(image, sizeof(image), "%s.img", path);
+    unlink(image);
+    errors += (otfs_init(&group) != 0);
+    fs.uid.u64 = sub_uid(0);
+    errors += (otfs_new_paged(group, &fs, 0, image) != 0);
+    uid = fs.uid.u64 ^ DEF_MASK;
+    errors += (sub_rw(DEF_TEST_FILE, (uint8_t*)&uid, 1) != 0);
+    errors += (otfs_sync(group) != 0);
+    errors += (otfs_new_paged(group, &fs, 0, image) != -2);
+    errors += (otfs_new_paged(group, &fs, 255, "/nonexistent/otfs_paged.img") != -1);
+    otfs_release(group);
+    otfs_deinit(group, &free);
+
+    errors += (otfs_init(&group) != 0);
+    errors += (otfs_new_paged(group, &fs, 0, image) != 0);
+    errors += sub_verify(group, 1, DEF_MASK);
+    otfs_deinit(group, &free);
+
+    // Bad snapshot files
+    errors += (otfs_snapshot_page(&paged, "/nonexistent/otfs_snapshot") != -1);
+    errors += (truncate(path, 100) != 0);
+    errors += (otfs_snapshot_page(&paged, path) != -2);
+
+    unlink(image);
+    unlink(path);
+
+    printf("\nErrors: %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+    return (errors != 0);
+}
@@ -0,0 +1,343 @@
+/* Copyright 2017 JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+/**
+  * @file       /test/multifs_scan.c
+  * @author     JP Norair (jpnorair@indigresso.com)
+  * @version    R100
+  * @date       17 October 2026
+  * @brief      Test of MultiFS group scanning
+  *
+  * Builds a group of filesystems, then:
+  * - Scans it with otfs_scan_next(), and checks that every FS is returned
+  *   once and that the active FS did not change.
+  * - Scans it with K threads, one partition each, and checks the same.
+  * - Compares the time of the above to otfs_iterator_start/next().
+  * - Iterates over a range of IDs and over one OUI, with otfs_iterator_range()
+  *   and otfs_iterator_prefix(), and checks that exactly the FS in them are
+  *   returned.
+  * - Scans a group where all the FS have one OUI, in partitions, and checks
+  *   that every FS is returned once.  With Judy, no partition may have more
+  *   than twice its share of the group.
+  *
+  ******************************************************************************
+  */
+
+
+#include <otfs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+
+// Default parameters
+#define DEF_NUM_FS          20000
+#define DEF_PARTS           4
+#define MAX_PARTS           64
+#define DEF_FS_ALLOC        2048
+
+
+typedef struct {
+    void*           group;
+    unsigned int    part;
+    unsigned int    parts;
+    uint8_t*        seen;
+    int             num_fs;
+    int             shift;
+    int             count;
+    int             errors;
+} scanner_t;
+
+
+
+/// The low byte of the UID is scrambled so that the FS are spread over all the
+/// partitions.  The index is in the upper bytes.
+static uint64_t sub_uid(int i) {
+    return ((uint64_t)(i+1) << 16) | (uint64_t)((i * 151) & 0xFF);
+}
+
+static int sub_index(uint64_t uid) {
+    return (int)(uid >> 16) - 1;
+}
+
+/// UIDs of a fleet from one vendor: the first three bytes are the same, and
+/// the index is in the bytes after them.
+#define OUI_SHIFT   24
+
+static uint64_t sub_oui_uid(int i) {
+    return ((uint64_t)(i+1) << OUI_SHIFT) | 0x563412;
+}
+
+
+static double sub_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+
+static void* sub_scanner(void* arg) {
+    scanner_t*  s = arg;
+    otfs_scan_t scan;
+    otfs_t      fs;
+
+    if (otfs_scan_init(s->group, &scan, s->part, s->parts) != 0) {
+        s->errors++;
+        return NULL;
+    }
+    while (otfs_scan_next(&scan, &fs) == 0) {
+        int i = (int)(fs.uid.u64 >> s->shift) - 1;
+        if ((i < 0) || (i >= s->num_fs) || (fs.base == NULL) || (fs.alloc == 0)) {
+            s->errors++;
+            continue;
+        }
+        __sync_fetch_and_add(&s->seen[i], 1);
+        s->count++;
+    }
+    return NULL;
+}
+
+
+/// Iterates from the current position to the end of the range, and checks
+/// each FS against lo and hi.  Returns the number of errors.
+static int sub_iterate_range(void* group, int rc, otfs_t* fs, ot_u8* uid_bytes,
+                            const ot_u8* lo, const ot_u8* hi, int num_fs, int expected) {
+    int errors = 0;
+    int count = 0;
+
+    while (rc == 0) {
+        count++;
+        errors += (memcmp(&fs->uid.u64, lo, 8) < 0) || (memcmp(&fs->uid.u64, hi, 8) > 0);
+        errors += (sub_index(fs->uid.u64) < 0) || (sub_index(fs->uid.u64) >= num_fs);
+        rc = otfs_iterator_next(group, fs, uid_bytes);
+    }
+    return errors + (count != expected);
+}
+
+
+static int sub_check_seen(uint8_t* seen, int num_fs) {
+    int errors = 0;
+    for (int i=0; i<num_fs; i++) {
+        errors += (seen[i] != 1);
+    }
+    memset(seen, 0, num_fs);
+    return errors;
+}
+
+
+
+int main(int argc, char** argv) {
+    void*       group;
+    uint8_t*    seen;
+    pthread_t   threads[MAX_PARTS];
+    scanner_t   scanners[MAX_PARTS];
+    otfs_t      fs;
+    uint64_t    uid;
+    uint64_t    active;
+    int         num_fs;
+    int         parts;
+    int         errors;
+    int         total_errors = 0;
+    int         rc;
+    double      start;
+
+    num_fs  = (argc > 1) ? atoi(argv[1]) : DEF_NUM_FS;
+    parts   = (argc > 2) ? atoi(argv[2]) : DEF_PARTS;
+    if (num_fs < 1) {
+        num_fs = DEF_NUM_FS;
+    }
+    if ((parts < 1) || (parts > MAX_PARTS)) {
+        parts = DEF_PARTS;
+    }
+#   if (OT_FEATURE(VLTHREADS) != ENABLED)
+    parts = 1;
+#   endif
+
+    printf("MultiFS scanning test\n");
+    printf("===============================================================================\n");
+    printf("Name of app in use with libotfs: %s\n", LIBOTFS_APP_NAME);
+    printf("Filesystems:                     %d\n", num_fs);
+    printf("Partitions:                      %d\n\n", parts);
+
+    seen = calloc(num_fs, 1);
+    if (seen == NULL) {
+        fprintf(stderr, "%sError: out of memory%s\n", KRED, KNRM);
+        return -1;
+    }
+
+    rc = otfs_init(&group);
+    if (rc != 0) {
+        fprintf(stderr, "%sError: otfs_init() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-2, KNRM);
+        return -1;
+    }
+    for (int i=0; i<num_fs; i++) {
+        fs.uid.u64 = sub_uid(i);
+        rc = otfs_load_defaults(group, &fs, DEF_FS_ALLOC);
+        if (rc < 0) {
+            fprintf(stderr, "%sError: otfs_load_defaults() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-2, KNRM);
+            return -1;
+        }
+        rc = otfs_new(group, &fs);
+        if (rc != 0) {
+            fprintf(stderr, "%sError: otfs_new() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-2, KNRM);
+            return -1;
+        }
+    }
+
+    // The active FS must not be changed by scanning
+    uid = sub_uid(0);
+    otfs_setfs(group, NULL, (ot_u8*)&uid);
+
+    // 1. Switching iterator, for reference
+    start   = sub_now();
+    errors  = 0;
+    rc      = otfs_iterator_start(group, &fs, (ot_u8*)&uid);
+    while (rc == 0) {
+        errors += ((sub_index(fs.uid.u64) < 0) || (sub_index(fs.uid.u64) >= num_fs));
+        rc = otfs_iterator_next(group, &fs, (ot_u8*)&uid);
+    }
+    printf("otfs_iterator:         %.3f s\n", sub_now() - start);
+    total_errors += errors;
+
+    uid = sub_uid(0);
+    otfs_setfs(group, NULL, (ot_u8*)&uid);
+
+    // 2. Scan in one partition
+    scanners[0].group   = group;
+    scanners[0].part    = 0;
+    scanners[0].parts   = 1;
+    scanners[0].seen    = seen;
+    scanners[0].num_fs  = num_fs;
+    scanners[0].shift   = 16;
+    scanners[0].errors  = 0;
+    start = sub_now();
+    sub_scanner(&scanners[0]);
+    printf("otfs_scan, 1 part:     %.3f s\n", sub_now() - start);
+    errors = scanners[0].errors + sub_check_seen(seen, num_fs);
+    printf("  errors:              %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+    total_errors += errors;
+
+    // 3. Scan in K partitions, by K threads
+    start = sub_now();
+    for (int t=0; t<parts; t++) {
+        scanners[t]         = scanners[0];
+        scanners[t].part    = t;
+        scanners[t].parts   = parts;
+        scanners[t].errors  = 0;
+        pthread_create(&threads[t], NULL, &sub_scanner, &scanners[t]);
+    }
+    errors = 0;
+    for (int t=0; t<parts; t++) {
+        pthread_join(threads[t], NULL);
+        errors += scanners[t].errors;
+    }
+    printf("otfs_scan, %2d parts:   %.3f s\n", parts, sub_now() - start);
+    errors += sub_check_seen(seen, num_fs);
+    printf("  errors:              %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+    total_errors += errors;
+
+    active = 0;
+    otfs_activeuid(group, (ot_u8*)&active);
+    errors = (active != sub_uid(0));
+    printf("Active FS unchanged:   %s%s%s\n", (errors != 0) ? KRED : KGRN, (errors != 0) ? "no" : "yes", KNRM);
+    total_errors += errors;
+
+    // 4. Range of IDs: the ones with the first byte from 0x40 to 0x7F
+    {   ot_u8 lo[8] = { 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+        ot_u8 hi[8] = { 0x7F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+        int expected = 0;
+
+        for (int i=0; i<num_fs; i++) {
+            uid = sub_uid(i);
+            expected += (memcmp(&uid, lo, 8) >= 0) && (memcmp(&uid, hi, 8) <= 0);
+        }
+        start   = sub_now();
+        rc      = otfs_iterator_range(group, &fs, (ot_u8*)&uid, lo, hi);
+        errors  = sub_iterate_range(group, rc, &fs, (ot_u8*)&uid, lo, hi, num_fs, expected);
+        printf("otfs_iterator_range:   %.3f s (%d FS)\n", sub_now() - start, expected);
+        printf("  errors:              %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+        total_errors += errors;
+    }
+
+    // 5. OUI of the FS in the middle of the group
+    {   ot_u8 lo[8], hi[8];
+        int expected = 0;
+
+        uid = sub_uid(num_fs/2);
+        memcpy(lo, &uid, 3);
+        memcpy(hi, &uid, 3);
+        memset(&lo[3], 0x00, 5);
+        memset(&hi[3], 0xFF, 5);
+        for (int i=0; i<num_fs; i++) {
+            uid = sub_uid(i);
+            expected += (memcmp(&uid, lo, 3) == 0);
+        }
+        start   = sub_now();
+        rc      = otfs_iterator_prefix(group, &fs, (ot_u8*)&uid, lo);
+        errors  = sub_iterate_range(group, rc, &fs, (ot_u8*)&uid, lo, hi, num_fs, expected);
+        printf("otfs_iterator_prefix:  %.6f s (%d FS)\n", sub_now() - start, expected);
+        printf("  errors:              %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+        total_errors += errors;
+    }
+
+    otfs_deinit(group, &free);
+    printf("\nFS group deallocated\n");
+
+    // 6. Partitions of a group with one OUI, scanned one after the other
+    rc = otfs_init(&group);
+    for (int i=0; (rc == 0) && (i<num_fs); i++) {
+        fs.uid.u64  = sub_oui_uid(i);
+        rc          = (otfs_load_defaults(group, &fs, DEF_FS_ALLOC) < 0) || (otfs_new(group, &fs) != 0);
+    }
+    if (rc != 0) {
+        fprintf(stderr, "%sError: could not build the OUI group (LINE %d)%s\n", KRED, __LINE__-2, KNRM);
+        return -1;
+    }
+    {   int most = 0;
+
+        errors = 0;
+        for (int t=0; t<DEF_PARTS; t++) {
+            scanners[t]         = scanners[0];
+            scanners[t].group   = group;
+            scanners[t].part    = t;
+            scanners[t].parts   = DEF_PARTS;
+            scanners[t].shift   = OUI_SHIFT;
+            scanners[t].count   = 0;
+            scanners[t].errors  = 0;
+        }
+        for (int t=0; t<DEF_PARTS; t++) {
+            sub_scanner(&scanners[t]);
+            errors += scanners[t].errors;
+            most    = (scanners[t].count > most) ? scanners[t].count : most;
+        }
+        errors += sub_check_seen(seen, num_fs);
+#       if (OT_FEATURE(VLJUDY) == ENABLED)
+        errors += (most > ((2 * num_fs) / DEF_PARTS) + 1);
+#       endif
+        printf("otfs_scan, one OUI:    %d of %d FS in the largest of %d parts\n", most, num_fs, DEF_PARTS);
+        printf("  errors:              %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+        total_errors += errors;
+    }
+    otfs_deinit(group, &free);
+    free(seen);
+
+    return (total_errors != 0);
+}
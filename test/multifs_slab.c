@@ -0,0 +1,193 @@
+/* Copyright 2017 JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+/**
+  * @file       /test/multifs_slab.c
+  * @author     JP Norair (jpnorair@indigresso.com)
+  * @version    R100
+  * @date       17 October 2026
+  * @brief      Benchmark of FS image allocation for large MultiFS groups
+  *
+  * Provisions a large group, then measures:
+  * - Time to load and add all the filesystems
+  * - Resident memory of the process after that
+  * - Rate of random checkouts, each followed by a read of ISF 0x11
+  * - Time to delete half of the filesystems and to add them back
+  * - Time to deinitialize the group
+  *
+  * Build libotfs with and without OT_FEATURE_VLSLAB (and VLHUGEPAGES) to
+  * compare the slab arena with malloc().
+  *
+  ******************************************************************************
+  */
+
+
+#include <otfs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+
+// Default parameters
+#define DEF_NUM_FS          100000
+#define DEF_CHECKOUTS       2000000
+#define DEF_FS_ALLOC        2048
+#define DEF_TEST_FILE       0x11
+
+
+static uint64_t sub_uid(uint64_t i) {
+    return i + 1;
+}
+
+
+static double sub_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+
+static uint32_t sub_rand(uint32_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+
+/// Resident set size in MB, from /proc (0 if it is not available)
+static double sub_rss(void) {
+    FILE* f;
+    long pages = 0;
+
+    f = fopen("/proc/self/statm", "r");
+    if (f != NULL) {
+        if (fscanf(f, "%*ld %ld", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(f);
+    }
+    return ((double)pages * (double)sysconf(_SC_PAGESIZE)) / (1024. * 1024.);
+}
+
+
+static int sub_add(void* group, uint64_t uid) {
+    otfs_t fs;
+    fs.uid.u64 = uid;
+    if (otfs_load_defaults(group, &fs, DEF_FS_ALLOC) < 0) {
+        return -1;
+    }
+    if (otfs_new(group, &fs) != 0) {
+        otfs_free_image(group, &fs);
+        return -1;
+    }
+    return 0;
+}
+
+
+
+int main(int argc, char** argv) {
+    void*           group;
+    otfs_stats_t    stats;
+    int             num_fs;
+    int             errors = 0;
+    int             rc;
+    uint32_t        seed = 0x2545F491;
+    double          rss0, start;
+
+    num_fs = (argc > 1) ? atoi(argv[1]) : DEF_NUM_FS;
+    if (num_fs < 2) {
+        num_fs = DEF_NUM_FS;
+    }
+
+    printf("MultiFS image allocation benchmark\n");
+    printf("===============================================================================\n");
+    printf("Name of app in use with libotfs: %s\n", LIBOTFS_APP_NAME);
+    printf("Image allocator:                 %s\n",
+            (OT_FEATURE(VLSLAB) != ENABLED) ? "malloc" :
+            (OT_FEATURE(VLHUGEPAGES) == ENABLED) ? "slab, huge pages" : "slab");
+    printf("Filesystems:                     %d\n\n", num_fs);
+
+    rss0 = sub_rss();
+    rc = otfs_init(&group);
+    if (rc != 0) {
+        fprintf(stderr, "%sError: otfs_init() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-2, KNRM);
+        return -1;
+    }
+
+    start = sub_now();
+    for (int i=0; i<num_fs; i++) {
+        if (sub_add(group, sub_uid(i)) != 0) {
+            fprintf(stderr, "%sError: could not add FS (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+            return -1;
+        }
+    }
+    printf("Provision:             %.3f s\n", sub_now() - start);
+    printf("Resident memory:       %.1f MB (%.0f bytes/FS)\n", sub_rss() - rss0,
+            ((sub_rss() - rss0) * 1024. * 1024.) / (double)num_fs);
+
+    start = sub_now();
+    for (int i=0; i<DEF_CHECKOUTS; i++) {
+        uint64_t uid = sub_uid(sub_rand(&seed) % num_fs);
+        uint64_t data;
+        vlFILE*  fp;
+
+        if (otfs_setfs(group, NULL, (ot_u8*)&uid) != 0) {
+            errors++;
+            continue;
+        }
+        fp = ISF_open_su(DEF_TEST_FILE);
+        if (fp == NULL) {
+            errors++;
+            continue;
+        }
+        vl_load(fp, 8, (ot_u8*)&data);
+        vl_close(fp);
+    }
+    printf("Checkout + read:       %.0f /s\n", DEF_CHECKOUTS / (sub_now() - start));
+
+    // Churn: delete half, then add them back, which reuses the freed images
+    start = sub_now();
+    for (int i=0; i<num_fs; i+=2) {
+        otfs_t fs;
+        fs.uid.u64 = sub_uid(i);
+        errors += (otfs_del(group, &fs, &free) != 0);
+    }
+    for (int i=0; i<num_fs; i+=2) {
+        errors += (sub_add(group, sub_uid(i)) != 0);
+    }
+    printf("Delete + re-add half:  %.3f s\n", sub_now() - start);
+
+    if (otfs_stats(group, &stats) == 0) {
+        errors += (stats.fs != (size_t)num_fs);
+        if (stats.slab_bytes != 0) {
+            printf("Slab arena:            %.1f MB\n", (double)stats.slab_bytes / (1024. * 1024.));
+        }
+    }
+
+    otfs_release(group);
+    start = sub_now();
+    otfs_deinit(group, &free);
+    printf("Deinit:                %.3f s\n", sub_now() - start);
+
+    printf("\nErrors: %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+    return (errors != 0);
+}
@@ -0,0 +1,283 @@
+/* Copyright 2017 JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+/**
+  * @file       /test/multifs_snapshot.c
+  * @author     JP Norair (jpnorair@indigresso.com)
+  * @version    R100
+  * @date       17 October 2026
+  * @brief      Test of group snapshot files
+  *
+  * Provisions a group and writes the UID of each FS into its ISF 0x11, saves
+  * the group to a snapshot file, and opens the snapshot as a new group.  The
+  * time to open the snapshot is compared to the time to provision the group.
+  * Then:
+  * - Every FS of the new group must have its UID in ISF 0x11, and the default
+  *   data elsewhere.
+  * - An image extracted from the file at its index offset must be the same as
+  *   the image of the FS in the first group.
+  * - Writes to the new group must not change the file.
+  * - Missing and bad snapshot files must be rejected.
+  *
+  ******************************************************************************
+  */
+
+
+#include <otfs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+
+// Default parameters
+#define DEF_NUM_FS          100000
+#define DEF_FS_ALLOC        2048
+#define DEF_TEST_FILE       0x11
+#define DEF_CHECK_FILE      0x01
+
+
+static uint64_t sub_uid(uint64_t i) {
+    return i + 1;
+}
+
+
+static double sub_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+
+static int sub_rw(ot_u8 id, uint8_t* data, int write) {
+    vlFILE* fp;
+    fp = ISF_open_su(id);
+    if (fp == NULL) {
+        return -1;
+    }
+    if (write) {
+        vl_store(fp, 8, data);
+    }
+    else {
+        memset(data, 0, 8);
+        vl_load(fp, 8, data);
+    }
+    vl_close(fp);
+    return 0;
+}
+
+
+static int sub_copy_file(const char* src, const char* dst, long size) {
+    FILE*   in;
+    FILE*   out;
+    char    buf[4096];
+    size_t  n;
+    int     rc = 0;
+
+    in  = fopen(src, "rb");
+    out = fopen(dst, "wb");
+    if ((in == NULL) || (out == NULL)) {
+        rc = -1;
+    }
+    while ((rc == 0) && (size != 0) && ((n = fread(buf, 1, sizeof(buf), in)) != 0)) {
+        if ((size > 0) && ((long)n > size)) {
+            n = (size_t)size;
+        }
+        rc      = (fwrite(buf, 1, n, out) == n) ? 0 : -1;
+        size   -= (size > 0) ? (long)n : 0;
+    }
+    if (in != NULL)     fclose(in);
+    if (out != NULL)    fclose(out);
+    return rc;
+}
+
+
+/// Finds the image of a UID in the snapshot file, by its index
+static int sub_extract(const char* path, uint64_t uid, uint8_t* image, uint32_t max) {
+    otfs_snaphdr_t  hdr;
+    vlFSMAPENT      ent;
+    FILE*           f;
+    int             rc = -1;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        return -1;
+    }
+    if ((fread(&hdr, sizeof(hdr), 1, f) == 1) && (fseek(f, (long)hdr.index_offset, SEEK_SET) == 0)) {
+        for (uint64_t i=0; i<hdr.count; i++) {
+            if (fread(&ent, sizeof(ent), 1, f) != 1) {
+                break;
+            }
+            if (ent.uid == uid) {
+                if ((ent.alloc <= max) && (fseek(f, (long)ent.offset, SEEK_SET) == 0)
+                && (fread(image, 1, ent.alloc, f) == ent.alloc)) {
+                    rc = (int)ent.alloc;
+                }
+                break;
+            }
+        }
+    }
+    fclose(f);
+    return rc;
+}
+
+
+
+int main(int argc, char** argv) {
+    void*       group;
+    void*       snap;
+    otfs_t      fs;
+    char        path[] = "/tmp/otfs_snapshot_XXXXXX";
+    char        bad[64];
+    uint8_t     def_check[8];
+    uint8_t     data[8];
+    uint8_t*    image;
+    uint8_t*    before;
+    uint64_t    uid;
+    int         num_fs;
+    int         errors = 0;
+    int         fd;
+    int         rc;
+    double      start, t_new, t_save, t_open;
+
+    num_fs = (argc > 1) ? atoi(argv[1]) : DEF_NUM_FS;
+    if (num_fs < 100) {
+        num_fs = DEF_NUM_FS;
+    }
+
+    printf("MultiFS snapshot test\n");
+    printf("===============================================================================\n");
+    printf("Name of app in use with libotfs: %s\n", LIBOTFS_APP_NAME);
+    printf("Filesystems:                     %d\n\n", num_fs);
+
+    rc = otfs_init(&group);
+    if (rc != 0) {
+        fprintf(stderr, "%sError: otfs_init() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-2, KNRM);
+        return -1;
+    }
+
+    start = sub_now();
+    for (int i=0; i<num_fs; i++) {
+        uid = sub_uid(i);
+        fs.uid.u64 = uid;
+        if ((otfs_load_defaults(group, &fs, DEF_FS_ALLOC) < 0) || (otfs_new(group, &fs) != 0)) {
+            fprintf(stderr, "%sError: could not add FS (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+            return -1;
+        }
+        sub_rw(DEF_TEST_FILE, (uint8_t*)&uid, 1);
+    }
+    t_new = sub_now() - start;
+    errors += (sub_rw(DEF_CHECK_FILE, def_check, 0) != 0);
+    otfs_release(group);
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "%sError: could not make a temporary file%s\n", KRED, KNRM);
+        return -1;
+    }
+    close(fd);
+
+    start   = sub_now();
+    rc      = otfs_snapshot_save(group, path);
+    t_save  = sub_now() - start;
+    if (rc != 0) {
+        fprintf(stderr, "%sError: otfs_snapshot_save() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-3, KNRM);
+        unlink(path);
+        return -1;
+    }
+
+    start   = sub_now();
+    rc      = otfs_snapshot_open(&snap, path);
+    t_open  = sub_now() - start;
+    if (rc != 0) {
+        fprintf(stderr, "%sError: otfs_snapshot_open() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-3, KNRM);
+        unlink(path);
+        return -1;
+    }
+
+    printf("Method                 Time (ms)\n");
+    printf("%-22s %.3f\n", "otfs_new", t_new * 1000.);
+    printf("%-22s %.3f\n", "otfs_snapshot_save", t_save * 1000.);
+    printf("%-22s %.3f\n\n", "otfs_snapshot_open", t_open * 1000.);
+
+    // Every FS of the snapshot
+    for (int i=0; i<num_fs; i++) {
+        uid = sub_uid(i);
+        if (otfs_setfs(snap, NULL, (ot_u8*)&uid) != 0) {
+            errors++;
+            continue;
+        }
+        errors += (sub_rw(DEF_TEST_FILE, data, 0) != 0) || (memcmp(data, &uid, 8) != 0);
+        errors += (sub_rw(DEF_CHECK_FILE, data, 0) != 0) || (memcmp(data, def_check, 8) != 0);
+    }
+    uid = sub_uid(num_fs);
+    errors += (otfs_setfs(snap, NULL, (ot_u8*)&uid) == 0);
+
+    // An image extracted from the file, by its index
+    image   = malloc(DEF_FS_ALLOC);
+    before  = malloc(DEF_FS_ALLOC);
+    uid     = sub_uid(num_fs / 2);
+    if ((image == NULL) || (before == NULL) || (otfs_setfs(group, &fs, (ot_u8*)&uid) != 0)) {
+        errors++;
+    }
+    else {
+        rc = sub_extract(path, uid, image, DEF_FS_ALLOC);
+        errors += (rc != (int)fs.alloc) || (memcmp(image, fs.base, fs.alloc) != 0);
+    }
+    otfs_release(group);
+    otfs_deinit(group, &free);
+
+    // Writes to the snapshot group are not written to the file
+    uid = sub_uid(0);
+    rc  = sub_extract(path, uid, before, DEF_FS_ALLOC);
+    errors += (rc < 0);
+    errors += (otfs_setfs(snap, NULL, (ot_u8*)&uid) != 0);
+    memset(data, 0xA5, 8);
+    errors += (sub_rw(DEF_TEST_FILE, data, 1) != 0);
+    errors += (sub_rw(DEF_TEST_FILE, data, 0) != 0) || (data[0] != 0xA5);
+    errors += (sub_extract(path, uid, image, DEF_FS_ALLOC) != rc);
+    errors += (rc > 0) && (memcmp(image, before, rc) != 0);
+    otfs_release(snap);
+    otfs_deinit(snap, &free);
+
+    rc = otfs_snapshot_open(&snap, path);
+    errors += (rc != 0);
+    if (rc == 0) {
+        errors += (otfs_setfs(snap, NULL, (ot_u8*)&uid) != 0);
+        errors += (sub_rw(DEF_TEST_FILE, data, 0) != 0) || (memcmp(data, &uid, 8) != 0);
+        otfs_release(snap);
+        otfs_deinit(snap, &free);
+    }
+    free(image);
+    free(before);
+
+    // Bad snapshot files: missing, truncated, and not a snapshot
+    snprintf(bad, sizeof(bad), "%s.bad", path);
+    errors += (otfs_snapshot_open(&snap, "/nonexistent/otfs_snapshot") != -1);
+    errors += (sub_copy_file(path, bad, 4096) != 0);
+    errors += (otfs_snapshot_open(&snap, bad) != -2);
+    errors += (sub_copy_file("/proc/self/exe", bad, 4096) != 0);
+    errors += (otfs_snapshot_open(&snap, bad) != -2);
+    unlink(bad);
+    unlink(path);
+
+    printf("Errors: %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+    return (errors != 0);
+}
@@ -0,0 +1,292 @@
+/* Copyright 2017 JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+/**
+  * @file       /test/multifs_span.c
+  * @author     JP Norair (jpnorair@indigresso.com)
+  * @version    R100
+  * @date       17 October 2026
+  * @brief      Test of reading file data in place with vl_span()
+  *
+  * Builds an image with ISF files of sensor records, and parses every file
+  * of every FS, once from a copy made with vl_load() and once in place from
+  * vl_span().  The results must be the same, and the rate of each is
+  * measured.  Then the bounds of vl_span() are checked, and, with VLNEW, that
+  * vl_defrag() leaves a file with a span where it is until it is closed.
+  *
+  ******************************************************************************
+  */
+
+
+#include <otfs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+
+// Default parameters
+#define DEF_NUM_FS          1000
+#define DEF_PASSES          20
+#define DEF_FILES           4
+#define DEF_RECORDS         16
+#define DEF_RECORD_BYTES    8
+#define DEF_FILE_BYTES      (DEF_RECORDS * DEF_RECORD_BYTES)
+#define DEF_HEAP            (DEF_FILES * DEF_FILE_BYTES)
+
+
+static uint64_t sub_uid(uint64_t i) {
+    return i + 1;
+}
+
+
+static double sub_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+
+static vl_header_t* sub_header(void* image, int i, vl_header_t* hdr) {
+    memcpy(hdr, (uint8_t*)image + sizeof(vlFSHEADER) + (i * sizeof(vl_header_t)), sizeof(*hdr));
+    return hdr;
+}
+
+
+/// An image with no GFB or ISS, and ISF files full of records
+static void* sub_image(uint64_t uid, size_t* alloc) {
+    vlFSHEADER  fshdr;
+    vl_header_t hdr;
+    uint8_t*    image;
+    size_t      ftab;
+
+    ftab    = (sizeof(vlFSHEADER) + (DEF_FILES * sizeof(vl_header_t)) + 3) & ~3;
+    *alloc  = ftab + DEF_HEAP;
+    image   = calloc(1, *alloc);
+    if (image == NULL) {
+        return NULL;
+    }
+
+    memset(&fshdr, 0, sizeof(fshdr));
+    fshdr.ftab_alloc    = (ot_u16)ftab;
+    fshdr.isf.alloc     = DEF_HEAP;
+    fshdr.isf.used      = DEF_HEAP;
+    fshdr.isf.files     = DEF_FILES;
+    memcpy(image, &fshdr, sizeof(fshdr));
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.length  = DEF_FILE_BYTES;
+    hdr.alloc   = DEF_FILE_BYTES;
+    hdr.mirror  = NULL_vaddr;
+    for (int i=0; i<DEF_FILES; i++) {
+        hdr.idmod   = (b00110110 << 8) | i;
+        hdr.base    = (ot_u16)(ftab + (i * DEF_FILE_BYTES));
+        memcpy(image + sizeof(vlFSHEADER) + (i * sizeof(vl_header_t)), &hdr, sizeof(hdr));
+        for (int j=0; j<DEF_FILE_BYTES; j++) {
+            image[hdr.base + j] = (uint8_t)(uid + (i * 31) + j);
+        }
+    }
+    return image;
+}
+
+
+/// A record is a 16 bit sensor ID, a 16 bit value and a 32 bit time
+static uint64_t sub_parse(const uint8_t* data) {
+    uint64_t sum = 0;
+
+    for (int r=0; r<DEF_RECORDS; r++) {
+        uint16_t id, value;
+        uint32_t time;
+        memcpy(&id, data, 2);
+        memcpy(&value, data+2, 2);
+        memcpy(&time, data+4, 4);
+        sum    += ((uint64_t)id * value) ^ time;
+        data   += DEF_RECORD_BYTES;
+    }
+    return sum;
+}
+
+
+static uint64_t sub_parse_load(void* group, int num_fs, int* errors) {
+    uint8_t  data[DEF_FILE_BYTES];
+    uint64_t uid;
+    uint64_t sum = 0;
+
+    for (int i=0; i<num_fs; i++) {
+        uid = sub_uid(i);
+        otfs_setfs(group, NULL, (ot_u8*)&uid);
+        for (int f=0; f<DEF_FILES; f++) {
+            vlFILE* fp = ISF_open_su((ot_u8)f);
+            if (fp == NULL) {
+                (*errors)++;
+                continue;
+            }
+            *errors += (vl_load(fp, DEF_FILE_BYTES, data) != DEF_FILE_BYTES);
+            sum     += sub_parse(data);
+            vl_close(fp);
+        }
+    }
+    return sum;
+}
+
+
+static uint64_t sub_parse_span(void* group, int num_fs, int* errors) {
+    const void* data;
+    uint64_t    uid;
+    uint64_t    sum = 0;
+
+    for (int i=0; i<num_fs; i++) {
+        uid = sub_uid(i);
+        otfs_setfs(group, NULL, (ot_u8*)&uid);
+        for (int f=0; f<DEF_FILES; f++) {
+            vlFILE* fp = ISF_open_su((ot_u8)f);
+            if (fp == NULL) {
+                (*errors)++;
+                continue;
+            }
+            *errors += (vl_span(fp, 0, DEF_FILE_BYTES, &data) != 0);
+            if (data != NULL) {
+                sum += sub_parse(data);
+            }
+            vl_close(fp);
+        }
+    }
+    return sum;
+}
+
+
+
+int main(int argc, char** argv) {
+    void*       group;
+    otfs_t      fs;
+    void*       image0 = NULL;
+    size_t      alloc;
+    uint64_t    uid;
+    uint64_t    sum_load = 0;
+    uint64_t    sum_span = 0;
+    double      t_load = 0.;
+    double      t_span = 0.;
+    double      start;
+    int         num_fs;
+    int         errors = 0;
+
+    num_fs = (argc > 1) ? atoi(argv[1]) : DEF_NUM_FS;
+    if (num_fs <= 0) {
+        num_fs = DEF_NUM_FS;
+    }
+
+    printf("MultiFS in-place read test\n");
+    printf("===============================================================================\n");
+    printf("Name of app in use with libotfs: %s\n", LIBOTFS_APP_NAME);
+    printf("Filesystems:                     %d\n", num_fs);
+    printf("Files, records:                  %d x %d records of %d bytes\n\n",
+            DEF_FILES, DEF_RECORDS, DEF_RECORD_BYTES);
+
+    if (otfs_init(&group) != 0) {
+        fprintf(stderr, "%sError: could not init group (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+        return -1;
+    }
+    for (int i=0; i<num_fs; i++) {
+        fs.uid.u64  = sub_uid(i);
+        fs.base     = sub_image(fs.uid.u64, &alloc);
+        fs.alloc    = alloc;
+        if ((fs.base == NULL) || (otfs_new(group, &fs) != 0)) {
+            fprintf(stderr, "%sError: could not add FS (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+            return -1;
+        }
+        image0 = (i == 0) ? fs.base : image0;
+    }
+    otfs_release(group);
+
+    // Parse every file of every FS, from a copy and in place
+    for (int n=0; n<DEF_PASSES; n++) {
+        start       = sub_now();
+        sum_load   += sub_parse_load(group, num_fs, &errors);
+        t_load     += sub_now() - start;
+        start       = sub_now();
+        sum_span   += sub_parse_span(group, num_fs, &errors);
+        t_span     += sub_now() - start;
+    }
+    otfs_release(group);
+    errors += (sum_load != sum_span);
+    printf("vl_load() and parse:   %.1f ns/file\n", 1e9 * t_load / ((double)DEF_PASSES * num_fs * DEF_FILES));
+    printf("vl_span() and parse:   %.1f ns/file\n", 1e9 * t_span / ((double)DEF_PASSES * num_fs * DEF_FILES));
+    printf("Devices per second:    %.0f from a copy, %.0f in place\n",
+            (double)DEF_PASSES * num_fs / t_load, (double)DEF_PASSES * num_fs / t_span);
+
+    // Bounds, and a write via the file shows through the span
+    uid = sub_uid(0);
+    otfs_setfs(group, NULL, (ot_u8*)&uid);
+    {   vlFILE*     fp = ISF_open_su(0);
+        const void* data = &data;
+        uint8_t     buf[DEF_FILE_BYTES];
+
+        errors += (vl_span(fp, 0, DEF_FILE_BYTES+1, &data) != 255) || (data != NULL);
+        errors += (vl_span(fp, DEF_FILE_BYTES, 1, &data) != 255);
+        errors += (vl_span(fp, 0, 0, &data) != 255);
+        errors += (vl_span(fp, 0, 4, NULL) != 255);
+        errors += (vl_span(NULL, 0, 4, &data) != 255);
+        errors += (vl_span(fp, 3, DEF_FILE_BYTES-3, &data) != 0);
+        vl_load(fp, DEF_FILE_BYTES, buf);
+        errors += (data == NULL) || (memcmp(data, &buf[3], DEF_FILE_BYTES-3) != 0);
+
+        memset(buf, 0x5A, sizeof(buf));
+        vl_store(fp, DEF_FILE_BYTES, buf);
+        errors += (data == NULL) || (memcmp(data, &buf[3], DEF_FILE_BYTES-3) != 0);
+        vl_close(fp);
+    }
+
+#   if (OT_FEATURE(VLNEW) == ENABLED)
+    // A file with a span stays in place in a compaction until it is closed
+    {   vlFILE*     fp;
+        const void* data;
+        vl_header_t h1, h3;
+        uint8_t     buf[DEF_FILE_BYTES];
+        ot_u16      base1, base3;
+
+        base1   = sub_header(image0, 1, &h1)->base;
+        base3   = sub_header(image0, 3, &h3)->base;
+        fp      = ISF_open_su(1);
+        errors += (vl_span(fp, 0, DEF_FILE_BYTES, &data) != 0);
+        vl_load(fp, DEF_FILE_BYTES, buf);
+
+        errors += (vl_delete(VL_ISF_BLOCKID, 0, NULL) != 0);
+        errors += (vl_delete(VL_ISF_BLOCKID, 2, NULL) != 0);
+        errors += (vl_defrag(VL_ISF_BLOCKID, 0) != 0);
+        errors += (sub_header(image0, 1, &h1)->base != base1);
+        errors += (sub_header(image0, 3, &h3)->base != (base1 + DEF_FILE_BYTES));
+        errors += (data == NULL) || (memcmp(data, buf, DEF_FILE_BYTES) != 0);
+        vl_close(fp);
+
+        errors += (vl_defrag(VL_ISF_BLOCKID, 0) != 0);
+        errors += (sub_header(image0, 1, &h1)->base != (base1 - DEF_FILE_BYTES));
+        fp      = ISF_open_su(1);
+        errors += (vl_span(fp, 0, DEF_FILE_BYTES, &data) != 0);
+        errors += (data == NULL) || (memcmp(data, buf, DEF_FILE_BYTES) != 0);
+        vl_close(fp);
+        printf("Compaction with a span: %s\n", (base3 != h3.base) ? "done" : "not done");
+    }
+#   endif
+    otfs_release(group);
+
+    otfs_deinit(group, &free);
+
+    printf("\nErrors: %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+    return (errors != 0);
+}
@@ -0,0 +1,202 @@
+/* Copyright 2017 JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+/**
+  * @file       /test/multifs_stats.c
+  * @author     JP Norair (jpnorair@indigresso.com)
+  * @version    R100
+  * @date       17 October 2026
+  * @brief      Test of group and FS statistics
+  *
+  * Provisions a group, and checks that otfs_stats() reports the number of FS,
+  * the size of their images and the FS switches, which are counted apart in a
+  * second group.  Then otfs_fsstats() is checked against the FS header, and
+  * against a write that changes the length of a file.  Last, the FS are
+  * deleted, which must show in the stats.  The time taken by each call is
+  * measured, since they are meant to be polled on a live group.
+  *
+  ******************************************************************************
+  */
+
+
+#include <otfs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+
+// Default parameters
+#define DEF_NUM_FS          100000
+#define DEF_FS_ALLOC        2048
+#define DEF_TEST_FILE       0x11
+#define DEF_POLLS           100
+
+
+static uint64_t sub_uid(uint64_t i) {
+    return i + 1;
+}
+
+
+static double sub_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+
+static int sub_block_check(const char* name, const vlBLOCKSTATS* b) {
+    printf("%-5s %8u %8u %8u %8u %8u %8u\n", name, b->alloc, b->used, b->length,
+            b->largest_gap, b->headers, b->files);
+    return (b->used > b->alloc) || (b->files > b->headers)
+        || (b->largest_gap > (b->alloc - b->used));
+}
+
+
+
+int main(int argc, char** argv) {
+    void*           group;
+    void*           group2;
+    otfs_t          fs;
+    otfs_stats_t    s0, s1, s2, s3;
+    otfs_fsstats_t  f0, f1;
+    vlFILE*         fp;
+    uint64_t        uid;
+    uint8_t         data[8];
+    ot_uint         length;
+    double          start;
+    int             num_fs;
+    int             errors = 0;
+
+    num_fs = (argc > 1) ? atoi(argv[1]) : DEF_NUM_FS;
+    if (num_fs <= 0) {
+        num_fs = DEF_NUM_FS;
+    }
+
+    printf("MultiFS statistics test\n");
+    printf("===============================================================================\n");
+    printf("Name of app in use with libotfs: %s\n", LIBOTFS_APP_NAME);
+    printf("Filesystems:                     %d\n\n", num_fs);
+
+    if (otfs_init(&group) != 0) {
+        fprintf(stderr, "%sError: could not init group (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+        return -1;
+    }
+    for (int i=0; i<num_fs; i++) {
+        fs.uid.u64 = sub_uid(i);
+        if ((otfs_load_defaults(group, &fs, DEF_FS_ALLOC) < 0) || (otfs_new(group, &fs) != 0)) {
+            fprintf(stderr, "%sError: could not add FS (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+            return -1;
+        }
+    }
+    otfs_release(group);
+
+    // Group statistics
+    start = sub_now();
+    for (int n=0; n<DEF_POLLS; n++) {
+        errors += (otfs_stats(group, &s0) != 0);
+    }
+    printf("otfs_stats():          %.3f ms\n", 1000. * (sub_now() - start) / DEF_POLLS);
+    printf("Images:                %zu bytes\n", s0.image_bytes);
+    printf("Table:                 %zu bytes\n", s0.table_bytes);
+    errors += (s0.fs != (size_t)num_fs);
+    errors += (s0.image_bytes != ((size_t)num_fs * fs.alloc));
+
+    for (int i=0; i<num_fs; i++) {
+        uid = sub_uid(i);
+        errors += (otfs_setfs(group, NULL, (ot_u8*)&uid) != 0);
+    }
+    otfs_release(group);
+    otfs_stats(group, &s1);
+    printf("Switches:              %llu\n\n", (unsigned long long)(s1.switches - s0.switches));
+    errors += ((s1.switches - s0.switches) != (uint64_t)num_fs);
+
+    // Switches in another group don't count in this one
+    if (otfs_init(&group2) != 0) {
+        fprintf(stderr, "%sError: could not init group (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+        return -1;
+    }
+    fs.uid.u64 = sub_uid(0);
+    if ((otfs_load_defaults(group2, &fs, DEF_FS_ALLOC) < 0) || (otfs_new(group2, &fs) != 0)) {
+        fprintf(stderr, "%sError: could not add FS (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+        return -1;
+    }
+    otfs_release(group2);
+    otfs_stats(group2, &s2);
+    uid = sub_uid(0);
+    errors += (otfs_setfs(group2, NULL, (ot_u8*)&uid) != 0);
+    otfs_release(group2);
+    otfs_stats(group2, &s3);
+    otfs_stats(group, &s0);
+    errors += ((s3.switches - s2.switches) != 1);
+    errors += (s0.switches != s1.switches);
+    otfs_deinit(group2, &free);
+
+    // FS statistics
+    fs.uid.u64 = sub_uid(0);
+    start = sub_now();
+    for (int n=0; n<DEF_POLLS; n++) {
+        errors += (otfs_fsstats(group, &fs, &f0) != 0);
+    }
+    printf("otfs_fsstats():        %.3f us\n", 1e6 * (sub_now() - start) / DEF_POLLS);
+    printf("Image:                 %u bytes\n", f0.image_bytes);
+    printf("Header table:          %u bytes\n\n", f0.table_bytes);
+    printf("Block    alloc     used   length  max gap  headers    files\n");
+    errors += sub_block_check("GFB", &f0.gfb);
+    errors += sub_block_check("ISS", &f0.iss);
+    errors += sub_block_check("ISF", &f0.isf);
+    errors += (f0.image_bytes != fs.alloc);
+    errors += ((f0.table_bytes + f0.gfb.alloc + f0.iss.alloc + f0.isf.alloc) != f0.image_bytes);
+    errors += (f0.isf.files == 0);
+
+    // A write that changes the length of a file shows in the ISF block
+    fp = ISF_open_su(DEF_TEST_FILE);
+    if (fp == NULL) {
+        errors++;
+    }
+    else {
+        length = vl_checklength(fp);
+        memset(data, 0xA5, sizeof(data));
+        vl_store(fp, sizeof(data), data);
+        vl_close(fp);
+        errors += (otfs_fsstats(group, NULL, &f1) != 0);
+        errors += (((int)f1.isf.length - (int)f0.isf.length) != ((int)sizeof(data) - (int)length));
+        errors += (f1.isf.used != f0.isf.used);
+    }
+    otfs_release(group);
+
+    // Bad inputs
+    errors += (otfs_fsstats(NULL, &fs, &f0) == 0);
+    errors += (otfs_fsstats(group, &fs, NULL) == 0);
+    fs.uid.u64 = sub_uid(num_fs);
+    errors += (otfs_fsstats(group, &fs, &f0) == 0);
+
+    // The counters of the group follow deletes
+    for (int i=0; i<num_fs; i++) {
+        fs.uid.u64 = sub_uid(i);
+        errors += (otfs_del(group, &fs, &free) != 0);
+    }
+    otfs_stats(group, &s0);
+    errors += (s0.fs != 0) || (s0.image_bytes != 0);
+
+    otfs_deinit(group, &free);
+
+    printf("\nErrors: %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+    return (errors != 0);
+}
@@ -0,0 +1,259 @@
+/* Copyright 2017 JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+/**
+  * @file       /test/multifs_stress.c
+  * @author     JP Norair (jpnorair@indigresso.com)
+  * @version    R100
+  * @date       17 October 2026
+  * @brief      Stress test for concurrent MultiFS group changes
+  *
+  * Each thread does a mix of 95% lookups and 5% add/delete on a shared FS
+  * group.  Lookups are on any FS in the key space.  Add/delete is only on the
+  * FS owned by the thread, so the result of each one is known in advance.
+  *
+  * Images are poisoned before they are freed.  A lookup that returns an image
+  * with a bad header, or with the wrong UID, has seen memory that was freed
+  * too early, and it is counted as an error.
+  *
+  * The library must be built with OT_FEATURE_VLTHREADS for more than one
+  * thread to be used.
+  *
+  ******************************************************************************
+  */
+
+
+#include <otfs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+#define KYEL  "\x1B[33m"
+
+// Default parameters
+#define DEF_MAX_THREADS     8
+#define DEF_FS_PER_THREAD   1024
+#define DEF_OPS_PER_THREAD  500000
+#define DEF_WRITE_PERCENT   5
+#define DEF_FS_ALLOC        2048
+
+
+typedef struct {
+    void*       group;
+    int         index;
+    int         threads;
+    int         ops;
+    uint8_t*    present;
+    uint64_t    lookups;
+    uint64_t    hits;
+    uint64_t    changes;
+    int         errors;
+} worker_t;
+
+
+static size_t fs_alloc;
+
+
+
+static uint64_t sub_uid(int thread, int fs) {
+    return ((uint64_t)(thread+1) << 32) | (uint64_t)(fs+1);
+}
+
+
+static double sub_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+
+static uint32_t sub_rand(uint32_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+
+static void sub_poison_free(void* base) {
+    memset(base, 0xA5, fs_alloc);
+    free(base);
+}
+
+
+static int sub_add(void* group, uint64_t uid) {
+    otfs_t fs;
+    fs.uid.u64 = uid;
+    if (otfs_load_defaults(group, &fs, DEF_FS_ALLOC) < 0) {
+        return -1;
+    }
+    if (otfs_new(group, &fs) != 0) {
+        otfs_free_image(group, &fs);
+        return -1;
+    }
+    return 0;
+}
+
+
+static void* sub_worker(void* arg) {
+    worker_t* w = arg;
+    uint32_t  seed = 0x9E3779B9 ^ (uint32_t)(w->index * 7919 + 1);
+
+    for (int i=0; i<w->ops; i++) {
+        uint32_t r = sub_rand(&seed);
+
+        if ((r % 100) < DEF_WRITE_PERCENT) {
+            // Add or delete one of the FS owned by this thread
+            int      fs_i   = (r >> 8) % DEF_FS_PER_THREAD;
+            uint64_t uid    = sub_uid(w->index, fs_i);
+            otfs_t   fs;
+
+            fs.uid.u64 = uid;
+            if (w->present[fs_i]) {
+                w->errors += (otfs_del(w->group, &fs, &sub_poison_free) != 0);
+                w->present[fs_i] = 0;
+            }
+            else {
+                w->errors += (sub_add(w->group, uid) != 0);
+                w->present[fs_i] = 1;
+            }
+            w->changes++;
+        }
+        else {
+            // Lookup of any FS
+            int      thread = (r >> 8) % w->threads;
+            int      fs_i   = (r >> 16) % DEF_FS_PER_THREAD;
+            uint64_t uid    = sub_uid(thread, fs_i);
+            otfs_t   fs;
+
+            w->lookups++;
+            if (otfs_setfs(w->group, &fs, (ot_u8*)&uid) == 0) {
+                w->hits++;
+                if ((fs.uid.u64 != uid) || (fs.alloc != fs_alloc)) {
+                    w->errors++;
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+
+int main(int argc, char** argv) {
+    void*       group;
+    pthread_t   threads[DEF_MAX_THREADS];
+    worker_t    workers[DEF_MAX_THREADS];
+    uint8_t*    present;
+    otfs_t      fs;
+    int         max_threads;
+    int         rc;
+
+    max_threads = (argc > 1) ? atoi(argv[1]) : DEF_MAX_THREADS;
+    if ((max_threads < 1) || (max_threads > DEF_MAX_THREADS)) {
+        max_threads = DEF_MAX_THREADS;
+    }
+#   if (OT_FEATURE(VLTHREADS) != ENABLED)
+    printf("%sNote: libotfs built without OT_FEATURE_VLTHREADS, using 1 thread%s\n", KYEL, KNRM);
+    max_threads = 1;
+#   endif
+
+    printf("MultiFS concurrent stress test\n");
+    printf("===============================================================================\n");
+    printf("Name of app in use with libotfs: %s\n", LIBOTFS_APP_NAME);
+    printf("Filesystems per thread:          %d\n", DEF_FS_PER_THREAD);
+    printf("Operations per thread:           %d\n", DEF_OPS_PER_THREAD);
+    printf("Add/delete operations:           %d%%\n\n", DEF_WRITE_PERCENT);
+
+    present = calloc(DEF_MAX_THREADS * DEF_FS_PER_THREAD, 1);
+    if (present == NULL) {
+        fprintf(stderr, "%sError: out of memory%s\n", KRED, KNRM);
+        return -1;
+    }
+
+    rc = otfs_init(&group);
+    if (rc != 0) {
+        fprintf(stderr, "%sError: otfs_init() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-2, KNRM);
+        return -1;
+    }
+
+    // Get the image size, which the lookups check against
+    fs.uid.u64 = 0;
+    rc = otfs_load_defaults(group, &fs, DEF_FS_ALLOC);
+    if (rc < 0) {
+        fprintf(stderr, "%sError: otfs_load_defaults() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-2, KNRM);
+        return -1;
+    }
+    fs_alloc = fs.alloc;
+    otfs_free_image(group, &fs);
+
+    // Every thread starts with half of its filesystems present
+    for (int t=0; t<DEF_MAX_THREADS; t++) {
+        for (int i=0; i<DEF_FS_PER_THREAD; i+=2) {
+            if (sub_add(group, sub_uid(t, i)) != 0) {
+                fprintf(stderr, "%sError: could not add FS (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+                return -1;
+            }
+            present[(t*DEF_FS_PER_THREAD) + i] = 1;
+        }
+    }
+
+    // The main thread doesn't use the group during the test
+    otfs_release(group);
+
+    printf("Threads   Ops/s          Hit rate  Errors\n");
+    for (int n=1; n<=max_threads; n*=2) {
+        double   start, elapsed;
+        uint64_t lookups = 0;
+        uint64_t hits = 0;
+        int      errors = 0;
+
+        start = sub_now();
+        for (int t=0; t<n; t++) {
+            memset(&workers[t], 0, sizeof(worker_t));
+            workers[t].group    = group;
+            workers[t].index    = t;
+            workers[t].threads  = DEF_MAX_THREADS;
+            workers[t].ops      = DEF_OPS_PER_THREAD;
+            workers[t].present  = &present[t*DEF_FS_PER_THREAD];
+            pthread_create(&threads[t], NULL, &sub_worker, &workers[t]);
+        }
+        for (int t=0; t<n; t++) {
+            pthread_join(threads[t], NULL);
+            lookups += workers[t].lookups;
+            hits    += workers[t].hits;
+            errors  += workers[t].errors;
+        }
+        elapsed = sub_now() - start;
+
+        printf("%-9d %-14.0f %-9.2f %s%d%s\n", n,
+                ((double)n * DEF_OPS_PER_THREAD) / elapsed,
+                (lookups != 0) ? (double)hits / (double)lookups : 0.,
+                (errors != 0) ? KRED : KGRN, errors, KNRM);
+    }
+
+    otfs_deinit(group, &free);
+    free(present);
+    printf("\nFS group deallocated\n");
+
+    return 0;
+}
@@ -0,0 +1,210 @@
+/* Copyright 2017 JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+/**
+  * @file       /test/multifs_switch.c
+  * @author     JP Norair (jpnorair@indigresso.com)
+  * @version    R100
+  * @date       17 October 2026
+  * @brief      FS context switch benchmark for MultiFS
+  *
+  * Measures how many FS switches per second can be done, three ways:
+  * - Full reinit: otfs_setfs() followed by vl_init() and auth_init(), which
+  *   is what a switch used to cost before each FS kept its runtime state.
+  * - otfs_setfs(): lookup by UID, then swap of the runtime state.
+  * - otfs_select_handle(): swap of the runtime state only.
+  *
+  * It also checks that the runtime state of each FS survives the switches:
+  * a file opened on an FS must still be open when the FS is selected again.
+  * Deleting the same UID from another group, or freeing that group, must not
+  * release the FS that is checked-out.
+  *
+  ******************************************************************************
+  */
+
+
+#include <otfs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+
+// Default parameters
+#define DEF_NUM_FS          256
+#define DEF_SWITCHES        2000000
+#define DEF_FS_ALLOC        2048
+#define DEF_TEST_FILE       0x11
+
+
+static double sub_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+
+static void sub_report(const char* name, int switches, double elapsed, double base_rate) {
+    double rate = (double)switches / elapsed;
+    printf("%-22s %-14.0f %.2f\n", name, rate, (base_rate > 0.) ? rate/base_rate : 1.);
+}
+
+
+
+int main(int argc, char** argv) {
+    void*           group;
+    otfs_handle_t*  handles;
+    vlFILE**        files;
+    int             num_fs;
+    int             switches;
+    int             errors = 0;
+    int             rc;
+    double          start, elapsed, base_rate;
+
+    num_fs      = (argc > 1) ? atoi(argv[1]) : DEF_NUM_FS;
+    switches    = (argc > 2) ? atoi(argv[2]) : DEF_SWITCHES;
+    if (num_fs < 2) {
+        num_fs = DEF_NUM_FS;
+    }
+    if (switches < 1) {
+        switches = DEF_SWITCHES;
+    }
+
+    printf("MultiFS context switch benchmark\n");
+    printf("===============================================================================\n");
+    printf("Name of app in use with libotfs: %s\n", LIBOTFS_APP_NAME);
+    printf("Filesystems:                     %d\n", num_fs);
+    printf("Switches per method:             %d\n\n", switches);
+
+    handles = calloc(num_fs, sizeof(otfs_handle_t));
+    files   = calloc(num_fs, sizeof(vlFILE*));
+    if ((handles == NULL) || (files == NULL)) {
+        fprintf(stderr, "%sError: out of memory%s\n", KRED, KNRM);
+        return -1;
+    }
+
+    rc = otfs_init(&group);
+    if (rc != 0) {
+        fprintf(stderr, "%sError: otfs_init() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-2, KNRM);
+        return -1;
+    }
+
+    for (int i=0; i<num_fs; i++) {
+        otfs_t fs;
+        fs.uid.u64 = (uint64_t)(i+1);
+        rc = otfs_load_defaults(group, &fs, DEF_FS_ALLOC);
+        if (rc < 0) {
+            fprintf(stderr, "%sError: otfs_load_defaults() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-2, KNRM);
+            return -1;
+        }
+        rc = otfs_new(group, &fs);
+        if (rc != 0) {
+            fprintf(stderr, "%sError: otfs_new() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-2, KNRM);
+            return -1;
+        }
+        rc = otfs_open(group, &handles[i], &fs.uid.u8[0]);
+        if (rc != 0) {
+            fprintf(stderr, "%sError: otfs_open() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-2, KNRM);
+            return -1;
+        }
+    }
+
+    // Open a file on each FS, and leave it open through the switching
+    for (int i=0; i<num_fs; i++) {
+        otfs_select_handle(handles[i], NULL);
+        files[i] = ISF_open_su(DEF_TEST_FILE);
+        errors  += (files[i] == NULL);
+    }
+
+    printf("Method                 Switches/s     Speedup\n");
+
+    // Legacy: every switch rebuilds the runtime state.  This also discards
+    // the open files, so the state check is not done for this method.
+    start = sub_now();
+    for (int i=0; i<switches; i++) {
+        uint64_t uid = (uint64_t)((i % num_fs) + 1);
+        otfs_setfs(group, NULL, (ot_u8*)&uid);
+        vl_init(NULL);
+        auth_init();
+    }
+    elapsed     = sub_now() - start;
+    base_rate   = (double)switches / elapsed;
+    sub_report("full reinit", switches, elapsed, 0.);
+
+    // The legacy loop has wiped the file tables, so open the files again
+    for (int i=0; i<num_fs; i++) {
+        otfs_select_handle(handles[i], NULL);
+        files[i] = ISF_open_su(DEF_TEST_FILE);
+        errors  += (files[i] == NULL);
+    }
+
+    start = sub_now();
+    for (int i=0; i<switches; i++) {
+        uint64_t uid = (uint64_t)((i % num_fs) + 1);
+        otfs_setfs(group, NULL, (ot_u8*)&uid);
+    }
+    elapsed = sub_now() - start;
+    sub_report("otfs_setfs", switches, elapsed, base_rate);
+
+    start = sub_now();
+    for (int i=0; i<switches; i++) {
+        otfs_select_handle(handles[i % num_fs], NULL);
+    }
+    elapsed = sub_now() - start;
+    sub_report("otfs_select_handle", switches, elapsed, base_rate);
+
+    // Files opened before the switching must still be open
+    for (int i=0; i<num_fs; i++) {
+        otfs_select_handle(handles[i], NULL);
+        if ((files[i] == NULL) || (vl_get_fd(files[i]) < 0) || (files[i]->read == NULL)) {
+            errors++;
+            continue;
+        }
+        vl_close(files[i]);
+    }
+
+    // The UID of the checked-out FS is deleted from another group
+    {   void*       group2;
+        otfs_t      fs;
+        uint64_t    active = 0;
+
+        fs.uid.u64 = 1;
+        if ((otfs_init(&group2) != 0) || (otfs_load_defaults(group2, &fs, DEF_FS_ALLOC) < 0)
+        ||  (otfs_new(group2, &fs) != 0)) {
+            fprintf(stderr, "%sError: could not add FS to a second group (LINE %d)%s\n", KRED, __LINE__-2, KNRM);
+            return -1;
+        }
+        otfs_select_handle(handles[0], NULL);
+        files[0] = ISF_open_su(DEF_TEST_FILE);
+        errors  += (otfs_del(group2, &fs, &free) != 0);
+        otfs_activeuid(group, (ot_u8*)&active);
+        errors  += (active != 1);
+        otfs_deinit(group2, &free);
+        errors  += (files[0] == NULL) || (vl_get_fd(files[0]) < 0);
+        vl_close(files[0]);
+    }
+    printf("\nRuntime state errors: %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+
+    otfs_deinit(group, &free);
+    free(handles);
+    free(files);
+    printf("FS group deallocated\n");
+
+    return (errors != 0);
+}
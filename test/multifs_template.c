@@ -0,0 +1,236 @@
+/* Copyright 2017 JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+/**
+  * @file       /test/multifs_template.c
+  * @author     JP Norair (jpnorair@indigresso.com)
+  * @version    R100
+  * @date       17 October 2026
+  * @brief      Test of FS image templates
+  *
+  * - Measures the rate of loading default images section by section, with
+  *   vworm_fsdata_defload(), and from the prebuilt default image, with
+  *   otfs_load_defaults(), and checks that the images are the same.
+  * - Writes ISF 0x11 of an FS, saves its image to a file, and registers the
+  *   file as a template.  Filesystems made from the template must have the
+  *   new ISF 0x11 and the default data elsewhere.
+  * - Checks that bad template files are rejected.
+  *
+  ******************************************************************************
+  */
+
+
+#include <otfs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+
+// Default parameters
+#define DEF_NUM_FS          100000
+#define DEF_FS_ALLOC        2048
+#define DEF_TEST_FILE       0x11
+#define DEF_CHECK_FILE      0x01
+
+
+static const uint8_t test_data[8] = { 0xDE, 0xC0, 0xDE, 0x01, 0x02, 0x03, 0x04, 0x05 };
+
+
+static double sub_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+
+static int sub_read(ot_u8 id, uint8_t* data) {
+    vlFILE* fp;
+    fp = ISF_open_su(id);
+    if (fp == NULL) {
+        return -1;
+    }
+    memset(data, 0, 8);
+    vl_load(fp, 8, data);
+    vl_close(fp);
+    return 0;
+}
+
+
+static int sub_write_file(const char* path, const void* data, size_t size) {
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) {
+        return -1;
+    }
+    if (fwrite(data, 1, size, f) != size) {
+        fclose(f);
+        return -1;
+    }
+    return fclose(f);
+}
+
+
+static int sub_bench_load(void* group, int num_fs) {
+    vlFSHEADER  header;
+    otfs_t      fs;
+    void*       ref;
+    int         errors = 0;
+    double      start, t_sections, t_image;
+
+    // Same allocation for both, so only the loading differs
+    start = sub_now();
+    for (int i=0; i<num_fs; i++) {
+        vworm_fsheader_defload(&header);
+        fs.alloc    = vworm_fsalloc(&header);
+        fs.base     = malloc(fs.alloc);
+        if (fs.base == NULL) {
+            return 1;
+        }
+        vworm_fsdata_defload(fs.base, &header);
+        free(fs.base);
+    }
+    t_sections = sub_now() - start;
+
+    start = sub_now();
+    for (int i=0; i<num_fs; i++) {
+        if (otfs_load_defaults(group, &fs, DEF_FS_ALLOC) < 0) {
+            return 1;
+        }
+        otfs_free_image(group, &fs);
+    }
+    t_image = sub_now() - start;
+
+    printf("Method                 Images/s       Speedup\n");
+    printf("%-22s %-14.0f %.2f\n", "vworm_fsdata_defload", num_fs / t_sections, 1.);
+    printf("%-22s %-14.0f %.2f\n\n", "otfs_load_defaults", num_fs / t_image, t_sections / t_image);
+
+    // The two must make the same image
+    ref = calloc(1, fs.alloc);
+    if ((ref == NULL) || (otfs_load_defaults(group, &fs, DEF_FS_ALLOC) < 0)) {
+        return 1;
+    }
+    vworm_fsdata_defload(ref, &header);
+    errors += (memcmp(fs.base, ref, fs.alloc) != 0);
+    otfs_free_image(group, &fs);
+    free(ref);
+
+    return errors;
+}
+
+
+int main(int argc, char** argv) {
+    void*       group;
+    otfs_t      fs;
+    char        path[] = "/tmp/otfs_template_XXXXXX";
+    uint8_t     def_check[8];
+    uint8_t     data[8];
+    vlFILE*     fp;
+    int         num_fs;
+    int         errors = 0;
+    int         tmpl;
+    int         fd;
+    int         rc;
+
+    num_fs = (argc > 1) ? atoi(argv[1]) : DEF_NUM_FS;
+    if (num_fs < 100) {
+        num_fs = DEF_NUM_FS;
+    }
+
+    printf("MultiFS template test\n");
+    printf("===============================================================================\n");
+    printf("Name of app in use with libotfs: %s\n", LIBOTFS_APP_NAME);
+    printf("Filesystems:                     %d\n\n", num_fs);
+
+    rc = otfs_init(&group);
+    if (rc != 0) {
+        fprintf(stderr, "%sError: otfs_init() returned %d (LINE %d)%s\n", KRED, rc, __LINE__-2, KNRM);
+        return -1;
+    }
+
+    errors += sub_bench_load(group, num_fs);
+
+    // Make an FS with a new ISF 0x11, and save its image as a template file
+    fs.uid.u64 = 1;
+    if ((otfs_load_defaults(group, &fs, DEF_FS_ALLOC) < 0) || (otfs_new(group, &fs) != 0)) {
+        fprintf(stderr, "%sError: could not add FS (LINE %d)%s\n", KRED, __LINE__-1, KNRM);
+        return -1;
+    }
+    errors += (sub_read(DEF_CHECK_FILE, def_check) != 0);
+    fp = ISF_open_su(DEF_TEST_FILE);
+    if (fp == NULL) {
+        fprintf(stderr, "%sError: could not open ISF 0x%02X (LINE %d)%s\n", KRED, DEF_TEST_FILE, __LINE__-2, KNRM);
+        return -1;
+    }
+    errors += (vl_store(fp, 8, (ot_u8*)test_data) != 0);
+    vl_close(fp);
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "%sError: could not make a temporary file%s\n", KRED, KNRM);
+        return -1;
+    }
+    close(fd);
+    errors += (sub_write_file(path, fs.base, fs.alloc) != 0);
+
+    tmpl = otfs_template_add(group, path);
+    if (tmpl <= 0) {
+        fprintf(stderr, "%sError: otfs_template_add() returned %d (LINE %d)%s\n", KRED, tmpl, __LINE__-2, KNRM);
+        unlink(path);
+        return -1;
+    }
+
+    // Bad template files: missing, and truncated
+    errors += (otfs_template_add(group, "/nonexistent/otfs_template") != -1);
+    errors += (sub_write_file(path, fs.base, fs.alloc/2) != 0);
+    errors += (otfs_template_add(group, path) != -2);
+    unlink(path);
+
+    // Filesystems from the template
+    for (int i=0; i<num_fs; i++) {
+        otfs_t tfs;
+        tfs.uid.u64 = 100 + i;
+        if (otfs_load_template(group, &tfs, tmpl, DEF_FS_ALLOC) < 0) {
+            errors++;
+            break;
+        }
+        if (otfs_new(group, &tfs) != 0) {
+            otfs_free_image(group, &tfs);
+            errors++;
+            break;
+        }
+    }
+    for (int i=0; i<num_fs; i+=97) {
+        uint64_t uid = 100 + i;
+        if (otfs_setfs(group, NULL, (ot_u8*)&uid) != 0) {
+            errors++;
+            continue;
+        }
+        errors += (sub_read(DEF_TEST_FILE, data) != 0) || (memcmp(data, test_data, 8) != 0);
+        errors += (sub_read(DEF_CHECK_FILE, data) != 0) || (memcmp(data, def_check, 8) != 0);
+    }
+    errors += (otfs_load_template(group, &fs, tmpl+1, DEF_FS_ALLOC) != -1);
+    printf("Template %d:            %d filesystems checked\n", tmpl, (num_fs + 96) / 97);
+
+    otfs_release(group);
+    otfs_deinit(group, &free);
+
+    printf("\nErrors: %s%d%s\n", (errors != 0) ? KRED : KGRN, errors, KNRM);
+    return (errors != 0);
+}